@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+/// Destination of the emulated sound output, implemented by the
+/// frontend, usually an AudioOutput. The core runs without one,
+/// the output is then dropped.
+struct AudioSink {
+    // Output rate of the SPU
+    static constexpr uint32_t SAMPLE_RATE = 44100;
+
+    virtual ~AudioSink() = default;
+
+    // p_frames interleaved left/right pairs of signed 16bit
+    // samples, called from the emulation thread
+    virtual void push_samples(const int16_t *p_samples,
+                              uint32_t p_frames) = 0;
+};
+
+struct NullAudio : AudioSink {
+    void push_samples(const int16_t *p_samples,
+                      uint32_t p_frames) override {}
+};
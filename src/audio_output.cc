@@ -0,0 +1,199 @@
+#include "audio_output.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+/// Canonical 44 byte header of a PCM WAV file, little endian in
+/// its host layout
+struct WavHeader {
+    char riff[4];
+    // Bytes after this field
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits;
+    char data[4];
+    uint32_t data_size;
+};
+
+static_assert(sizeof(WavHeader) == 44);
+
+static WavHeader wav_header(uint64_t p_frames) {
+    uint32_t bytes = uint32_t(p_frames * 4);
+    WavHeader header = {
+        {'R', 'I', 'F', 'F'},
+        36 + bytes,
+        {'W', 'A', 'V', 'E'},
+        {'f', 'm', 't', ' '},
+        16,
+        // PCM
+        1,
+        2,
+        AudioSink::SAMPLE_RATE,
+        AudioSink::SAMPLE_RATE * 4,
+        4,
+        16,
+        {'d', 'a', 't', 'a'},
+        bytes,
+    };
+    return header;
+}
+
+WavDevice::WavDevice(const char *p_path) : frames(0) {
+    this->file = fopen(p_path, "wb");
+    if (this->file == nullptr)
+        throw std::runtime_error(std::string("Can't create ") +
+                                 p_path);
+    // Written from the emulation thread, which mustn't wait on
+    // the disk every frame
+    setvbuf(this->file, nullptr, _IOFBF, 256 * 1024);
+    WavHeader header = wav_header(0);
+    fwrite(&header, sizeof(header), 1, this->file);
+}
+
+WavDevice::~WavDevice() {
+    WavHeader header = wav_header(this->frames);
+    fseek(this->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, this->file);
+    fclose(this->file);
+}
+
+bool WavDevice::write(const int16_t *p_samples,
+                      uint32_t p_frames) {
+    // The sizes are 32bit, stop at 4GB
+    if ((this->frames + p_frames) * 4 > UINT32_MAX - 36)
+        return false;
+    this->frames += p_frames;
+    return fwrite(p_samples, 4, p_frames, this->file) == p_frames;
+}
+
+PipeDevice::PipeDevice(const char *p_command) {
+    this->pipe = popen(p_command, "w");
+    if (this->pipe == nullptr)
+        throw std::runtime_error(std::string("Can't run ") +
+                                 p_command);
+}
+
+PipeDevice::~PipeDevice() { pclose(this->pipe); }
+
+bool PipeDevice::write(const int16_t *p_samples,
+                       uint32_t p_frames) {
+    // Unbuffered, the player should get every chunk right away
+    bool ok =
+        fwrite(p_samples, 4, p_frames, this->pipe) == p_frames;
+    return ok && fflush(this->pipe) == 0;
+}
+
+AudioOutput::AudioOutput(AudioDevice *p_device)
+    : perf(nullptr), device(p_device) {
+    this->realtime = p_device->realtime();
+    this->broken = false;
+    this->level = int32_t(AudioRing::FRAMES / 2) * 16;
+    this->phase = 0;
+    this->last[0] = 0;
+    this->last[1] = 0;
+    this->pushes.store(0, std::memory_order_relaxed);
+    this->stopping.store(false, std::memory_order_relaxed);
+    if (this->realtime)
+        this->thread = std::thread(&AudioOutput::run, this);
+}
+
+AudioOutput::~AudioOutput() {
+    if (!this->realtime)
+        return;
+    this->stopping.store(true, std::memory_order_release);
+    this->pushes.fetch_add(1, std::memory_order_release);
+    this->pushes.notify_one();
+    this->thread.join();
+}
+
+void AudioOutput::push_samples(const int16_t *p_samples,
+                               uint32_t p_frames) {
+    if (!this->realtime) {
+        this->broken = this->broken ||
+                       !this->device->write(p_samples, p_frames);
+        return;
+    }
+
+    // Fuller than half: step through the input faster, making
+    // fewer frames, and the other way round
+    int32_t half = int32_t(AudioRing::FRAMES / 2);
+    this->level +=
+        int32_t(this->ring.size()) - (this->level >> 4);
+    int32_t step =
+        ONE + MAX_DELTA * ((this->level >> 4) - half) / half;
+
+    int16_t out[PIECE * 2 * 2];
+    for (uint32_t i = 0; i < p_frames; i += PIECE) {
+        uint32_t n = std::min(PIECE, p_frames - i);
+        uint32_t made =
+            this->resample(p_samples + i * 2, n, step, out);
+        uint32_t pushed = this->ring.push(out, made);
+        perf_count(this->perf, PerfCounter::AudioDrops,
+                   made - pushed);
+    }
+    this->wake_output();
+}
+
+void AudioOutput::wake_output() {
+    // The output thread only wakes up for a whole chunk
+    this->pushes.fetch_add(1, std::memory_order_release);
+    if (this->ring.size() >= CHUNK)
+        this->pushes.notify_one();
+}
+
+uint32_t AudioOutput::resample(const int16_t *p_samples,
+                               uint32_t p_frames, int32_t p_step,
+                               int16_t *p_out) {
+    // Linear interpolation from `last` to each input frame
+    uint32_t made = 0;
+    for (uint32_t i = 0; i < p_frames; i++) {
+        int32_t left = p_samples[i * 2];
+        int32_t right = p_samples[i * 2 + 1];
+        for (; this->phase < ONE; this->phase += p_step) {
+            p_out[made * 2] = int16_t(
+                this->last[0] +
+                (int64_t(left - this->last[0]) * this->phase >>
+                 16));
+            p_out[made * 2 + 1] = int16_t(
+                this->last[1] +
+                (int64_t(right - this->last[1]) * this->phase >>
+                 16));
+            made++;
+        }
+        this->phase -= ONE;
+        this->last[0] = left;
+        this->last[1] = right;
+    }
+    return made;
+}
+
+void AudioOutput::run() {
+    int16_t chunk[CHUNK * 2];
+    bool ok = true;
+    // Starts once the ring is half full, to have a margin both
+    // ways
+    bool started = false;
+
+    while (true) {
+        uint32_t seen =
+            this->pushes.load(std::memory_order_acquire);
+        bool done =
+            this->stopping.load(std::memory_order_acquire);
+        if (this->ring.size() >= AudioRing::FRAMES / 2)
+            started = true;
+        if (started || done) {
+            while (uint32_t n = this->ring.pop(chunk, CHUNK))
+                ok = ok && this->device->write(chunk, n);
+        }
+        if (done)
+            break;
+        this->pushes.wait(seen, std::memory_order_acquire);
+    }
+}
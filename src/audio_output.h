@@ -0,0 +1,135 @@
+#pragma once
+#include "audio.h"
+#include "audio_ring.h"
+#include "perf.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+/// Where an AudioOutput finally sends the samples. A realtime
+/// device is only called from the output thread, so its write()
+/// may block. A file is written from the emulation thread and
+/// must buffer instead.
+struct AudioDevice {
+    virtual ~AudioDevice() = default;
+
+    // Plays at AudioSink::SAMPLE_RATE by its own clock. The
+    // output then runs rate control and drops what doesn't fit,
+    // files get every sample as is.
+    virtual bool realtime() const = 0;
+    // p_frames interleaved left/right pairs, false once the
+    // device is broken: the rest is then dropped
+    virtual bool write(const int16_t *p_samples,
+                       uint32_t p_frames) = 0;
+};
+
+/// 16bit stereo WAV file. The sizes in the header are filled in
+/// when it is closed. Writes go through a stdio buffer of about
+/// a second and a half of sound.
+struct WavDevice : AudioDevice {
+    // Throws std::runtime_error when p_path can't be created
+    WavDevice(const char *p_path);
+    ~WavDevice() override;
+
+    WavDevice(const WavDevice &) = delete;
+    WavDevice &operator=(const WavDevice &) = delete;
+
+    bool realtime() const override { return false; }
+    bool write(const int16_t *p_samples,
+               uint32_t p_frames) override;
+
+  private:
+    FILE *file;
+    uint64_t frames;
+};
+
+/// Raw 16bit stereo little endian samples on the standard input
+/// of p_command, the host's own player, e.g. "aplay -q -f cd" or
+/// "ffplay -nodisp -f s16le -ar 44100 -ac 2 -". Its writes block
+/// at the sound card's pace.
+struct PipeDevice : AudioDevice {
+    // Throws std::runtime_error when p_command can't be started
+    PipeDevice(const char *p_command);
+    ~PipeDevice() override;
+
+    PipeDevice(const PipeDevice &) = delete;
+    PipeDevice &operator=(const PipeDevice &) = delete;
+
+    bool realtime() const override { return true; }
+    bool write(const int16_t *p_samples,
+               uint32_t p_frames) override;
+
+  private:
+    FILE *pipe;
+};
+
+/// AudioSink feeding an AudioDevice. Either way push_samples()
+/// never waits for another thread. A realtime device is fed from
+/// an output thread of its own, through an AudioRing:
+/// push_samples() only copies into the ring, and what a full ring
+/// has no room for is dropped and counted as
+/// PerfCounter::AudioDrops. A file loses nothing: push_samples()
+/// hands every sample straight to its buffered write(). Without
+/// any audio output the Interconnect has no sink at all and the
+/// samples cost nothing past the SPU.
+///
+/// A realtime device drains the ring at the host's sample clock,
+/// which never quite matches the emulation's. Dynamic rate
+/// control resamples every block by a ratio within MAX_DELTA of
+/// 1, set from how far the ring is from half full, so the ring
+/// hovers there instead of slowly running dry or over.
+struct AudioOutput : AudioSink {
+    // 16.16 fixed point step between input frames
+    static constexpr int32_t ONE = 1 << 16;
+    // 0.5%: enough for 59.94Hz games on a 60Hz display, too
+    // little to hear
+    static constexpr int32_t MAX_DELTA = ONE / 200;
+    // Frames per device write
+    static constexpr uint32_t CHUNK = 256;
+
+    // p_device is owned by the caller and outlives the output
+    AudioOutput(AudioDevice *p_device);
+    // A realtime device plays what is left in the ring first
+    ~AudioOutput() override;
+
+    // Set by the frontend, for the drop counter
+    Perf *perf;
+
+    AudioOutput(const AudioOutput &) = delete;
+    AudioOutput &operator=(const AudioOutput &) = delete;
+
+    void push_samples(const int16_t *p_samples,
+                      uint32_t p_frames) override;
+
+  private:
+    // Input frames per push to the ring, its output fits twice
+    static constexpr uint32_t PIECE = 64;
+
+    AudioDevice *device;
+    bool realtime;
+    // A file write failed, the rest is dropped
+    bool broken;
+    AudioRing ring;
+
+    // Producer side. Ring fill, smoothed: 16 times its moving
+    // average.
+    int32_t level;
+    // Position past `last` of the next output frame, 16.16
+    int32_t phase;
+    int32_t last[2];
+
+    // Bumped by every push and by shutdown, the output thread
+    // sleeps on it
+    std::atomic<uint32_t> pushes;
+    std::atomic<bool> stopping;
+    // Realtime devices only
+    std::thread thread;
+
+    // Resample p_frames (at most PIECE) into p_out, returns the
+    // frames made
+    uint32_t resample(const int16_t *p_samples, uint32_t p_frames,
+                      int32_t p_step, int16_t *p_out);
+    void wake_output();
+    void run();
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/// Lock free single producer, single consumer ring of stereo
+/// frames (interleaved left/right signed 16bit samples), between
+/// the emulation thread and an audio output thread.
+///
+/// `head` and `tail` count frames forever and are each written by
+/// one side only, on their own cache lines. Neither side ever
+/// waits: push() takes what fits and pop() what is there.
+struct AudioRing {
+    // Power of two, about 93ms at 44.1kHz
+    static constexpr uint32_t FRAMES = 4096;
+
+    AudioRing() {
+        this->head.store(0, std::memory_order_relaxed);
+        this->tail.store(0, std::memory_order_relaxed);
+    }
+
+    AudioRing(const AudioRing &) = delete;
+    AudioRing &operator=(const AudioRing &) = delete;
+
+    // Frames queued, a lower bound for the producer and an upper
+    // bound for the consumer
+    uint32_t size() const {
+        return this->tail.load(std::memory_order_acquire) -
+               this->head.load(std::memory_order_acquire);
+    }
+
+    // Producer: queue up to p_frames, returns how many fit
+    uint32_t push(const int16_t *p_samples, uint32_t p_frames) {
+        uint32_t tail =
+            this->tail.load(std::memory_order_relaxed);
+        uint32_t head =
+            this->head.load(std::memory_order_acquire);
+        uint32_t n = FRAMES - (tail - head);
+        if (p_frames < n)
+            n = p_frames;
+        uint32_t at = tail & (FRAMES - 1);
+        uint32_t first = std::min(n, FRAMES - at);
+        memcpy(this->samples + at * 2, p_samples, first * 4);
+        memcpy(this->samples, p_samples + first * 2,
+               (n - first) * 4);
+        this->tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer: take up to p_frames, returns how many there were
+    uint32_t pop(int16_t *p_samples, uint32_t p_frames) {
+        uint32_t head =
+            this->head.load(std::memory_order_relaxed);
+        uint32_t tail =
+            this->tail.load(std::memory_order_acquire);
+        uint32_t n = tail - head;
+        if (p_frames < n)
+            n = p_frames;
+        uint32_t at = head & (FRAMES - 1);
+        uint32_t first = std::min(n, FRAMES - at);
+        memcpy(p_samples, this->samples + at * 2, first * 4);
+        memcpy(p_samples + first * 2, this->samples,
+               (n - first) * 4);
+        this->head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+  private:
+    // Consumer position, then producer position
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) int16_t samples[FRAMES * 2];
+};
@@ -0,0 +1,662 @@
+// psx_bench: fixed, reproducible workloads for catching
+// performance regressions. Links the emulator core only, no
+// window, GL context or UI.
+//
+//   psx_bench [options] bios
+//       Boot the BIOS for --cycles CPU cycles
+//   psx_bench [options] exe FILE
+//       Boot to the shell, side-load a PS-X EXE and run it for
+//       --cycles CPU cycles
+//   psx_bench [options] gp0 FILE
+//       Replay a GPU trace written by --record-gp0
+//
+// Options:
+//   --cycles N        emulated CPU cycles per run (default 200M)
+//   --runs N          repeat the workload, statistics at the end
+//   --bios PATH       BIOS image (default SCPH1001.BIN)
+//   --scanout         convert every frame like frame dumps do
+//   --record-gp0 PATH save the GPU input of the first run
+//   --instances N     independent sessions per run, the rates
+//                     are then aggregated
+//   --threads N       threads running them (default: one per
+//                     hardware thread)
+//   --states N        time N save states and loads of the
+//                     machine at the end of each run
+//   --rewind MB       capture rewind history every frame, then
+//                     step back through all of it
+//   --run-ahead N     emulate N frames ahead of each shown one
+//   --disc PATH       disc image in the drive of every session
+//   --cd-timing MODE  accurate (default), fast or instant drive
+//                     timing, see CdTiming
+//   --no-reverb       skip the SPU reverb
+#include "bios.h"
+#include "disc.h"
+#include "null_renderer.h"
+#include "sector_cache.h"
+#include "system.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Shell entry point, reached once the BIOS is done with the logo
+// and the CD-ROM
+static constexpr uint32_t SHELL_ENTRY = 0x80030000;
+// Side-loading gives up if the BIOS doesn't get there
+static constexpr uint64_t SHELL_TIMEOUT = 2000000000;
+
+static constexpr char TRACE_MAGIC[8] = {'P', 'S', 'X', 'G',
+                                        'P', 'U', 'T', '1'};
+
+/// Retired host instructions of the calling thread, user space
+/// only. Unavailable (e.g. perf_event_paranoid, containers,
+/// non-Linux hosts) unless the kernel hands out the counter.
+struct HostCounter {
+    int fd;
+
+    HostCounter() {
+        this->fd = -1;
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        this->fd = int(
+            syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~HostCounter() {
+#ifdef __linux__
+        if (this->fd >= 0)
+            close(this->fd);
+#endif
+    }
+
+    bool available() const { return this->fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (this->fd < 0)
+            return;
+        ioctl(this->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    uint64_t stop() {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (this->fd < 0)
+            return 0;
+        ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(this->fd, &count, sizeof(count)) !=
+            sizeof(count))
+            count = 0;
+#endif
+        return count;
+    }
+};
+
+struct Options {
+    const char *workload = nullptr;
+    const char *file = nullptr;
+    const char *bios = "SCPH1001.BIN";
+    const char *record = nullptr;
+    uint64_t cycles = 200000000;
+    uint32_t runs = 1;
+    // Sessions run side by side per run, on `threads` threads
+    uint32_t instances = 1;
+    uint32_t threads = 0;
+    // Save/load round trips timed after each run
+    uint32_t states = 0;
+    // Rewind history cap, 0 for none
+    uint32_t rewind_mb = 0;
+    uint32_t run_ahead = 0;
+    const char *disc = nullptr;
+    CdTiming cd_timing = CdTiming::Accurate;
+    bool reverb = true;
+    bool scanout = false;
+};
+
+struct RunResult {
+    double wall_s;
+    // Emulated instructions, GPU words for trace replays
+    uint64_t guest;
+    // 0 when the host counter is unavailable
+    uint64_t host;
+    uint64_t frames;
+    // Median save and load times, with --states
+    double save_ms;
+    double load_ms;
+    // With --rewind: average capture time over the last frames,
+    // history held at the end and steps back through it
+    double capture_ms;
+    double history_mb;
+    uint64_t steps;
+};
+
+static std::vector<uint8_t> read_file(const char *p_path) {
+    FILE *f = fopen(p_path, "rb");
+    if (!f)
+        throw std::runtime_error(std::string("Couldn't open ") +
+                                 p_path);
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+static uint32_t read_u32(const std::vector<uint8_t> &p_data,
+                         size_t p_offset) {
+    uint32_t v;
+    memcpy(&v, p_data.data() + p_offset, 4);
+    return v;
+}
+
+static void set_reg(CPU &p_cpu, uint32_t p_index,
+                    uint32_t p_val) {
+    p_cpu.regs[p_index] = p_val;
+    p_cpu.out_regs[p_index] = p_val;
+}
+
+// Boot to the shell and replace it with the EXE
+static void side_load(System &p_system,
+                      const std::vector<uint8_t> &p_exe) {
+    // PS-X EXE: 2KB header, then the text section
+    if (p_exe.size() < 0x800 ||
+        memcmp(p_exe.data(), "PS-X EXE", 8) != 0)
+        throw std::runtime_error("Not a PS-X EXE");
+    uint32_t pc = read_u32(p_exe, 0x10);
+    uint32_t gp = read_u32(p_exe, 0x14);
+    uint32_t dst = read_u32(p_exe, 0x18) & (RAM::SIZE - 1);
+    uint32_t size = read_u32(p_exe, 0x1c);
+    uint32_t sp = read_u32(p_exe, 0x30) + read_u32(p_exe, 0x34);
+    if (size > p_exe.size() - 0x800 || dst + size > RAM::SIZE)
+        throw std::runtime_error("Truncated or oversized EXE");
+
+    Interconnect &inter = p_system.inter;
+    Watchpoint shell = {SHELL_ENTRY & 0x1fffffff, 4,
+                        (uint8_t)WatchAccess::Exec, true};
+    inter.add_watchpoint(shell);
+    p_system.run_until(SHELL_TIMEOUT);
+    if (!inter.watch.halted)
+        throw std::runtime_error("The BIOS never reached the "
+                                 "shell");
+    inter.clear_watchpoints();
+
+    RAM &ram = p_system.ram;
+    memcpy(ram.data + dst, p_exe.data() + 0x800, size);
+    if (size > 0)
+        ram.dirty.mark_range(dst >> RAM::PAGE_SHIFT,
+                             (dst + size - 1) >> RAM::PAGE_SHIFT);
+
+    CPU &cpu = p_system.cpu;
+    set_reg(cpu, 28, gp);
+    if (sp != 0) {
+        set_reg(cpu, 29, sp);
+        set_reg(cpu, 30, sp);
+    }
+    cpu.program_counter = pc;
+    cpu.next_program_counter = pc + 4;
+    inter.resume();
+}
+
+static double seconds_since(
+    std::chrono::steady_clock::time_point p_start) {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - p_start)
+        .count();
+}
+
+static double median(std::vector<double> p_values) {
+    std::sort(p_values.begin(), p_values.end());
+    return p_values[p_values.size() / 2];
+}
+
+// Time p_count saves and loads of the current machine state,
+// checking that a loaded state saves back identically
+static void time_states(System &p_system, uint32_t p_count,
+                        RunResult &p_result) {
+    SaveState state, check;
+    std::vector<double> save, load;
+    for (uint32_t i = 0; i < p_count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        p_system.save_state(state);
+        save.push_back(seconds_since(start) * 1e3);
+    }
+    for (uint32_t i = 0; i < p_count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        p_system.load_state(state);
+        load.push_back(seconds_since(start) * 1e3);
+    }
+
+    p_system.save_state(check);
+    if (check.data != state.data)
+        throw std::runtime_error("Save state round trip differs");
+    p_result.save_ms = median(save);
+    p_result.load_ms = median(load);
+}
+
+// Step back through the whole rewind history, then check that
+// the machine still runs
+static uint64_t unwind(System &p_system, Rewind &p_rewind) {
+    uint64_t steps = 0;
+    while (p_rewind.step_back(p_system))
+        steps += 1;
+    p_system.run_frame();
+    return steps;
+}
+
+// One session on a System of its own. p_disc and p_counter are
+// optional.
+static RunResult run_cpu(const Options &p_options, Bios *p_bios,
+                         const Disc *p_disc,
+                         const std::vector<uint8_t> &p_exe,
+                         HostCounter *p_counter,
+                         std::vector<uint32_t> *p_trace) {
+    NullRenderer renderer;
+    System *system = new System(p_bios, &renderer);
+    system->gpu.scanout_always = p_options.scanout;
+    system->gpu.trace = p_trace;
+    system->cdrom.timing = p_options.cd_timing;
+    system->spu.reverb.enabled = p_options.reverb;
+
+    // The image is mapped once, every session reads ahead of its
+    // own drive
+    SectorCache *disc_cache = nullptr;
+    if (p_disc) {
+        disc_cache = new SectorCache(p_disc);
+        system->cdrom.insert(disc_cache);
+    }
+
+    Rewind *rewind = nullptr;
+    Perf *perf = nullptr;
+    if (p_options.rewind_mb != 0) {
+        size_t cap = size_t(p_options.rewind_mb) << 20;
+        rewind = new Rewind(cap, 60);
+        perf = new Perf();
+        system->set_perf(perf);
+    }
+
+    // The boot to the shell isn't part of the measurement
+    if (!p_exe.empty())
+        side_load(*system, p_exe);
+    uint64_t start_cycle = system->inter.scheduler.now;
+    uint64_t start_count = system->cpu.opcode_count;
+    uint64_t start_frames = system->frames;
+    // Not from the boot, side-loading would be rewound too
+    system->rewind = rewind;
+    system->run_ahead = p_options.run_ahead;
+
+    auto start = std::chrono::steady_clock::now();
+    if (p_counter)
+        p_counter->start();
+    system->run_until(start_cycle + p_options.cycles);
+
+    RunResult r;
+    r.host = p_counter ? p_counter->stop() : 0;
+    r.wall_s = seconds_since(start);
+    r.guest = system->cpu.opcode_count - start_count;
+    r.frames = system->frames - start_frames;
+    r.save_ms = r.load_ms = 0.0;
+    if (p_options.states != 0)
+        time_states(*system, p_options.states, r);
+
+    r.capture_ms = r.history_mb = 0.0;
+    r.steps = 0;
+    if (rewind) {
+        uint64_t last = perf->frames();
+        uint64_t first =
+            last > Perf::HISTORY ? last - Perf::HISTORY : 0;
+        uint32_t section = (uint32_t)PerfSection::State;
+        for (uint64_t i = first; i < last; i++)
+            r.capture_ms += perf->frame(i).section_ms[section];
+        if (last != first)
+            r.capture_ms /= double(last - first);
+        r.history_mb = double(rewind->memory()) / (1 << 20);
+        r.steps = unwind(*system, *rewind);
+    }
+
+    delete system;
+    delete disc_cache;
+    delete rewind;
+    delete perf;
+    return r;
+}
+
+// p_options.instances sessions spread over the thread pool, as
+// one aggregated result
+static RunResult run_parallel(const Options &p_options,
+                              Bios *p_bios, const Disc *p_disc,
+                              const std::vector<uint8_t> &p_exe,
+                              ThreadPool &p_pool) {
+    std::vector<RunResult> sessions(p_options.instances);
+    std::vector<std::string> errors(p_options.instances);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < p_options.instances; i++) {
+        p_pool.submit([&, i] {
+            try {
+                sessions[i] = run_cpu(p_options, p_bios, p_disc,
+                                      p_exe, nullptr, nullptr);
+            } catch (const std::runtime_error &e) {
+                errors[i] = e.what();
+            }
+        });
+    }
+    p_pool.wait();
+
+    for (const std::string &e : errors)
+        if (!e.empty())
+            throw std::runtime_error(e);
+
+    RunResult r = {seconds_since(start), 0, 0, 0, 0.0, 0.0,
+                   0.0, 0.0, 0};
+    for (const RunResult &s : sessions) {
+        r.guest += s.guest;
+        r.frames += s.frames;
+    }
+    return r;
+}
+
+static RunResult replay_gpu(const Options &p_options,
+                            const std::vector<uint32_t> &p_trace,
+                            HostCounter &p_counter) {
+    NullRenderer renderer;
+    CommmandBuffer commands;
+    GPU *gpu = new GPU(&commands, &renderer);
+    gpu->scanout_always = p_options.scanout;
+
+    RunResult r = {0.0, 0, 0, 0, 0.0, 0.0, 0.0, 0.0, 0};
+    auto start = std::chrono::steady_clock::now();
+    p_counter.start();
+    for (size_t i = 0; i + 1 < p_trace.size(); i += 2) {
+        uint32_t val = p_trace[i + 1];
+        switch ((GpuTracePort)p_trace[i]) {
+        case GpuTracePort::Gp0:
+            gpu->gp0(val);
+            break;
+        case GpuTracePort::Gp1:
+            gpu->gp1(val);
+            break;
+        case GpuTracePort::VBlank:
+            gpu->present();
+            r.frames += 1;
+            continue;
+        }
+        r.guest += 1;
+    }
+    r.host = p_counter.stop();
+    r.wall_s = seconds_since(start);
+
+    delete gpu;
+    return r;
+}
+
+static std::vector<uint32_t> load_trace(const char *p_path) {
+    std::vector<uint8_t> data = read_file(p_path);
+    if (data.size() < sizeof(TRACE_MAGIC) ||
+        memcmp(data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)))
+        throw std::runtime_error(std::string(p_path) +
+                                 " isn't a GPU trace");
+    size_t words = (data.size() - sizeof(TRACE_MAGIC)) / 4;
+    std::vector<uint32_t> trace(words & ~size_t(1));
+    memcpy(trace.data(), data.data() + sizeof(TRACE_MAGIC),
+           trace.size() * 4);
+    return trace;
+}
+
+static void save_trace(const char *p_path,
+                       const std::vector<uint32_t> &p_trace) {
+    FILE *f = fopen(p_path, "wb");
+    if (!f ||
+        fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, f) != 1 ||
+        fwrite(p_trace.data(), 4, p_trace.size(), f) !=
+            p_trace.size())
+        throw std::runtime_error(std::string("Couldn't write ") +
+                                 p_path);
+    fclose(f);
+}
+
+struct Stats {
+    double min, median, mean, stddev;
+
+    static Stats of(std::vector<double> p_values) {
+        std::sort(p_values.begin(), p_values.end());
+        size_t n = p_values.size();
+        Stats s;
+        s.min = p_values[0];
+        s.median = p_values[n / 2];
+        if (n % 2 == 0)
+            s.median = (p_values[n / 2 - 1] + s.median) / 2.0;
+        s.mean = 0.0;
+        for (double v : p_values)
+            s.mean += v;
+        s.mean /= double(n);
+        double var = 0.0;
+        for (double v : p_values)
+            var += (v - s.mean) * (v - s.mean);
+        s.stddev = n > 1 ? std::sqrt(var / double(n - 1)) : 0.0;
+        return s;
+    }
+
+    void print(const char *p_name) const {
+        printf("%-12s min %10.3f  median %10.3f  mean %10.3f  "
+               "stddev %8.3f\n",
+               p_name, this->min, this->median, this->mean,
+               this->stddev);
+    }
+};
+
+// Peak resident set of the process, in MB
+static double peak_rss_mb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return double(usage.ru_maxrss) / (1024.0 * 1024.0);
+#else
+    return double(usage.ru_maxrss) / 1024.0;
+#endif
+}
+
+static void usage() {
+    printf("usage: psx_bench [--cycles N] [--runs N] "
+           "[--bios PATH] [--scanout]\n"
+           "                 [--instances N] [--threads N] "
+           "[--states N]\n"
+           "                 [--rewind MB] [--run-ahead N] "
+           "[--record-gp0 PATH]\n"
+           "                 [--disc PATH] [--cd-timing MODE] "
+           "[--no-reverb]\n"
+           "                 bios | exe FILE | gp0 FILE\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            options.cycles = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            options.runs = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bios") == 0 && i + 1 < argc)
+            options.bios = argv[++i];
+        else if (strcmp(argv[i], "--instances") == 0 &&
+                 i + 1 < argc)
+            options.instances = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 &&
+                 i + 1 < argc)
+            options.threads = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--states") == 0 &&
+                 i + 1 < argc)
+            options.states = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc)
+            options.rewind_mb = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--run-ahead") == 0 &&
+                 i + 1 < argc)
+            options.run_ahead = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--disc") == 0 && i + 1 < argc)
+            options.disc = argv[++i];
+        else if (strcmp(argv[i], "--cd-timing") == 0 &&
+                 i + 1 < argc) {
+            if (!cd_timing_from_name(argv[++i],
+                                     options.cd_timing))
+                usage();
+        }
+        else if (strcmp(argv[i], "--no-reverb") == 0)
+            options.reverb = false;
+        else if (strcmp(argv[i], "--scanout") == 0)
+            options.scanout = true;
+        else if (strcmp(argv[i], "--record-gp0") == 0 &&
+                 i + 1 < argc)
+            options.record = argv[++i];
+        else if (!options.workload)
+            options.workload = argv[i];
+        else if (!options.file)
+            options.file = argv[i];
+        else
+            usage();
+    }
+    if (!options.workload || options.runs == 0 ||
+        options.instances == 0)
+        usage();
+
+    bool replay = strcmp(options.workload, "gp0") == 0;
+    bool exe = strcmp(options.workload, "exe") == 0;
+    if (!replay && !exe && strcmp(options.workload, "bios") != 0)
+        usage();
+    if ((replay || exe) && !options.file)
+        usage();
+    // Traces come from, and replay into, a single session
+    bool parallel = options.instances > 1;
+    if (parallel && (replay || options.record))
+        usage();
+    // Timed on the single session only
+    if ((options.states != 0 || options.rewind_mb != 0) &&
+        (parallel || replay))
+        usage();
+
+    std::vector<RunResult> results;
+    try {
+        std::vector<uint8_t> program;
+        std::vector<uint32_t> trace;
+        if (exe)
+            program = read_file(options.file);
+        if (replay)
+            trace = load_trace(options.file);
+        // Loaded once, every session shares them
+        Bios *bios = replay ? nullptr : new Bios(options.bios);
+        Disc *disc = nullptr;
+        if (options.disc && !replay)
+            disc = new Disc(options.disc);
+        ThreadPool *pool = nullptr;
+        if (parallel) {
+            pool = new ThreadPool(options.threads);
+            options.threads = pool->size();
+        }
+
+        // Only counts the main thread, so not in parallel runs
+        HostCounter counter;
+        if (!counter.available() && !parallel)
+            printf("Host instruction counter unavailable\n");
+
+        std::vector<uint32_t> recorded;
+        for (uint32_t run = 0; run < options.runs; run++) {
+            std::vector<uint32_t> *record = nullptr;
+            if (options.record && run == 0)
+                record = &recorded;
+
+            RunResult r;
+            if (replay)
+                r = replay_gpu(options, trace, counter);
+            else if (parallel)
+                r = run_parallel(options, bios, disc, program,
+                                 *pool);
+            else
+                r = run_cpu(options, bios, disc, program,
+                            &counter, record);
+            results.push_back(r);
+
+            printf("run %u: %.3f s, %llu %s, %llu frames",
+                   run + 1, r.wall_s, (unsigned long long)r.guest,
+                   replay ? "GPU words" : "instructions",
+                   (unsigned long long)r.frames);
+            if (r.host != 0 && r.guest != 0)
+                printf(", %.1f host/guest",
+                       double(r.host) / double(r.guest));
+            if (options.states != 0)
+                printf(", state save %.3f ms, load %.3f ms",
+                       r.save_ms, r.load_ms);
+            if (options.rewind_mb != 0)
+                printf(", rewind %.3f ms/frame, %.1f MB, %llu "
+                       "steps back",
+                       r.capture_ms, r.history_mb,
+                       (unsigned long long)r.steps);
+            printf("\n");
+        }
+
+        if (options.record && !replay) {
+            save_trace(options.record, recorded);
+            printf("Recorded %zu GPU words to %s\n",
+                   recorded.size() / 2, options.record);
+        }
+        delete pool;
+        delete disc;
+        delete bios;
+    } catch (const std::runtime_error &e) {
+        printf("%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    std::vector<double> wall, rate, ratio, save, load, capture;
+    for (const RunResult &r : results) {
+        wall.push_back(r.wall_s);
+        capture.push_back(r.capture_ms);
+        save.push_back(r.save_ms);
+        load.push_back(r.load_ms);
+        rate.push_back(r.wall_s > 0.0
+                           ? double(r.guest) / r.wall_s / 1e6
+                           : 0.0);
+        if (r.host != 0 && r.guest != 0)
+            ratio.push_back(double(r.host) / double(r.guest));
+    }
+
+    printf("\n%s, %u run(s)", options.workload, options.runs);
+    if (parallel)
+        printf(" of %u sessions on %u threads", options.instances,
+               options.threads);
+    printf("\n");
+    Stats::of(wall).print("wall s");
+    Stats::of(rate).print(replay ? "M words/s" : "MIPS");
+    if (!ratio.empty())
+        Stats::of(ratio).print("host/guest");
+    if (options.states != 0) {
+        Stats::of(save).print("save ms");
+        Stats::of(load).print("load ms");
+    }
+    if (options.rewind_mb != 0)
+        Stats::of(capture).print("rewind ms");
+    printf("%-12s %.1f MB\n", "peak RSS", peak_rss_mb());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,595 @@
+#include "cdrom.h"
+#include <cstdio>
+#include <cstring>
+
+// Status byte
+static constexpr uint8_t STAT_ERROR = 0x01;
+static constexpr uint8_t STAT_MOTOR = 0x02;
+static constexpr uint8_t STAT_SHELL_OPEN = 0x10;
+static constexpr uint8_t STAT_READ = 0x20;
+static constexpr uint8_t STAT_SEEK = 0x40;
+
+// Setmode
+static constexpr uint8_t MODE_WHOLE_SECTOR = 0x20;
+static constexpr uint8_t MODE_DOUBLE_SPEED = 0x80;
+
+// Second byte of INT5 answers
+static constexpr uint8_t ERROR_BAD_PARAM = 0x10;
+static constexpr uint8_t ERROR_BAD_COMMAND = 0x40;
+static constexpr uint8_t ERROR_NOT_READY = 0x80;
+
+// Delays in CPU cycles
+static constexpr uint64_t ACK_DELAY = 50401;
+static constexpr uint64_t INIT_ACK_DELAY = 81102;
+static constexpr uint64_t GETID_DELAY = 33868;
+static constexpr uint64_t PAUSE_DELAY = 7154;
+static constexpr uint64_t MOTOR_DELAY = Cdrom::CPU_HZ / 10;
+static constexpr uint64_t TOC_DELAY = Cdrom::CPU_HZ / 2;
+static constexpr uint64_t SEEK_DELAY = Cdrom::CPU_HZ / 30;
+// Retry of a sector the cache doesn't have yet
+static constexpr uint64_t MISS_DELAY = Cdrom::CPU_HZ / 2000;
+// CdTiming::Fast drive speed, times the single speed
+static constexpr uint64_t FAST_SPEED = 8;
+// CdTiming::Instant sector and mechanics delays, still long
+// enough for an interrupt handler to run in between
+static constexpr uint64_t INSTANT_DELAY = Cdrom::CPU_HZ / 4000;
+
+enum class CdCommand : uint8_t {
+    Getstat = 0x01,
+    Setloc = 0x02,
+    ReadN = 0x06,
+    MotorOn = 0x07,
+    Stop = 0x08,
+    Pause = 0x09,
+    Init = 0x0a,
+    Mute = 0x0b,
+    Demute = 0x0c,
+    Setfilter = 0x0d,
+    Setmode = 0x0e,
+    Getparam = 0x0f,
+    GetlocL = 0x10,
+    GetlocP = 0x11,
+    GetTN = 0x13,
+    GetTD = 0x14,
+    SeekL = 0x15,
+    SeekP = 0x16,
+    Test = 0x19,
+    GetID = 0x1a,
+    ReadS = 0x1b,
+    ReadTOC = 0x1e,
+};
+
+bool cd_timing_from_name(const char *p_name, CdTiming &p_timing) {
+    if (strcmp(p_name, "accurate") == 0)
+        p_timing = CdTiming::Accurate;
+    else if (strcmp(p_name, "fast") == 0)
+        p_timing = CdTiming::Fast;
+    else if (strcmp(p_name, "instant") == 0)
+        p_timing = CdTiming::Instant;
+    else
+        return false;
+    return true;
+}
+
+Cdrom::Cdrom() {
+    this->scheduler = nullptr;
+    this->disc = nullptr;
+    this->timing = CdTiming::Accurate;
+    this->index = 0;
+    memset(this->params, 0, sizeof(this->params));
+    this->param_len = 0;
+    memset(this->response, 0, sizeof(this->response));
+    this->response_len = 0;
+    this->response_pos = 0;
+    this->int_enable = 0;
+    this->int_flag = 0;
+    memset(this->queue, 0, sizeof(this->queue));
+    this->queue_len = 0;
+    this->command = 0;
+    this->busy = false;
+    memset(&this->async, 0, sizeof(this->async));
+    this->stat = STAT_SHELL_OPEN;
+    this->mode = 0;
+    this->filter_file = 0;
+    this->filter_channel = 0;
+    this->drive = Drive::Idle;
+    this->target = 0;
+    this->target_pending = false;
+    this->position = 0;
+    memset(this->sector, 0, sizeof(this->sector));
+    memset(this->data, 0, sizeof(this->data));
+    this->data_len = 0;
+    this->data_pos = 0;
+}
+
+void Cdrom::insert(SectorCache *p_disc) {
+    this->disc = p_disc;
+    this->drive = Drive::Idle;
+    this->stat = p_disc != nullptr ? STAT_MOTOR : STAT_SHELL_OPEN;
+    if (p_disc != nullptr)
+        p_disc->prefetch(0);
+}
+
+uint8_t Cdrom::load(uint32_t p_offset) {
+    switch (p_offset) {
+    case 0: {
+        uint8_t status = this->index;
+        if (this->param_len == 0)
+            status |= 1 << 3;
+        if (this->param_len < FIFO_SIZE)
+            status |= 1 << 4;
+        if (this->response_pos < this->response_len)
+            status |= 1 << 5;
+        if (this->data_pos < this->data_len)
+            status |= 1 << 6;
+        if (this->busy)
+            status |= 1 << 7;
+        return status;
+    }
+    case 1:
+        if (this->response_pos < this->response_len)
+            return this->response[this->response_pos++];
+        return 0;
+    case 2:
+        if (this->data_pos < this->data_len)
+            return this->data[this->data_pos++];
+        return 0;
+    default:
+        if (this->index & 1)
+            return 0xe0 | this->int_flag;
+        return 0xe0 | this->int_enable;
+    }
+}
+
+void Cdrom::store(uint32_t p_offset, uint8_t p_val) {
+    // Banks 2 and 3 and the rest of bank 1 set the CD audio
+    // volume and XA decoder, not emulated
+    switch (p_offset << 2 | this->index) {
+    case 0 << 2 | 0:
+    case 0 << 2 | 1:
+    case 0 << 2 | 2:
+    case 0 << 2 | 3:
+        this->index = p_val & 3;
+        break;
+    case 1 << 2 | 0:
+        this->command = p_val;
+        this->busy = true;
+        this->scheduler->schedule(
+            Event::CdRom, p_val == uint8_t(CdCommand::Init)
+                              ? INIT_ACK_DELAY
+                              : ACK_DELAY);
+        break;
+    case 2 << 2 | 0:
+        if (this->param_len < FIFO_SIZE)
+            this->params[this->param_len++] = p_val;
+        break;
+    case 2 << 2 | 1:
+        this->int_enable = p_val & 0x1f;
+        break;
+    case 3 << 2 | 0:
+        // Request register: BFRD loads the data FIFO
+        if (p_val & 0x80) {
+            this->load_data();
+        } else {
+            this->data_len = 0;
+            this->data_pos = 0;
+        }
+        break;
+    case 3 << 2 | 1:
+        this->int_flag &= ~(p_val & 0x1f);
+        if (p_val & 0x40)
+            this->param_len = 0;
+        this->show_next();
+        break;
+    default:
+        break;
+    }
+}
+
+uint32_t Cdrom::dma_read() {
+    uint32_t word = 0;
+    for (uint32_t i = 0; i < 4; i++)
+        word |= uint32_t(this->load(2)) << (i * 8);
+    return word;
+}
+
+void Cdrom::run_command() {
+    this->busy = false;
+    const uint8_t *p = this->params;
+    bool loaded = this->disc != nullptr;
+
+    switch (CdCommand(this->command)) {
+    case CdCommand::Getstat:
+        this->reply_stat(CdInt::Acknowledge);
+        // Reading the status acknowledges a closed shell
+        if (loaded)
+            this->stat &= ~STAT_SHELL_OPEN;
+        break;
+    case CdCommand::Setloc: {
+        if (this->param_len < 3) {
+            this->error(ERROR_BAD_PARAM);
+            break;
+        }
+        uint32_t msf =
+            (from_bcd(p[0]) * 60 + from_bcd(p[1])) * 75 +
+            from_bcd(p[2]);
+        this->target =
+            msf >= Disc::LEAD_IN ? msf - Disc::LEAD_IN : 0;
+        this->target_pending = true;
+        // Get the I/O thread going while the CPU sets up the read
+        if (loaded)
+            this->disc->prefetch(this->target);
+        this->reply_stat(CdInt::Acknowledge);
+        break;
+    }
+    case CdCommand::ReadN:
+    case CdCommand::ReadS:
+        if (!loaded) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        this->reply_stat(CdInt::Acknowledge);
+        this->start_read();
+        break;
+    case CdCommand::MotorOn:
+        this->reply_stat(CdInt::Acknowledge);
+        if (loaded)
+            this->stat |= STAT_MOTOR;
+        this->reply_later(CdInt::Complete, &this->stat, 1,
+                          this->mechanics_cycles(MOTOR_DELAY));
+        break;
+    case CdCommand::Stop:
+        this->reply_stat(CdInt::Acknowledge);
+        this->stop_drive();
+        this->stat &= ~STAT_MOTOR;
+        this->reply_later(CdInt::Complete, &this->stat, 1,
+                          this->mechanics_cycles(MOTOR_DELAY));
+        break;
+    case CdCommand::Pause: {
+        this->reply_stat(CdInt::Acknowledge);
+        // Pausing a read waits for the sector under the head
+        uint64_t delay = this->drive != Drive::Idle
+                             ? this->sector_cycles()
+                             : PAUSE_DELAY;
+        this->stop_drive();
+        this->reply_later(CdInt::Complete, &this->stat, 1, delay);
+        break;
+    }
+    case CdCommand::Init:
+        this->reply_stat(CdInt::Acknowledge);
+        this->mode = 0;
+        this->stop_drive();
+        if (loaded)
+            this->stat |= STAT_MOTOR;
+        this->reply_later(CdInt::Complete, &this->stat, 1,
+                          ACK_DELAY);
+        break;
+    case CdCommand::Mute:
+    case CdCommand::Demute:
+        this->reply_stat(CdInt::Acknowledge);
+        break;
+    case CdCommand::Setfilter:
+        this->filter_file = p[0];
+        this->filter_channel = p[1];
+        this->reply_stat(CdInt::Acknowledge);
+        break;
+    case CdCommand::Setmode:
+        this->mode = p[0];
+        this->reply_stat(CdInt::Acknowledge);
+        break;
+    case CdCommand::Getparam: {
+        uint8_t bytes[] = {this->stat, this->mode, 0,
+                           this->filter_file,
+                           this->filter_channel};
+        this->reply(CdInt::Acknowledge, bytes, sizeof(bytes));
+        break;
+    }
+    case CdCommand::GetlocL:
+        // Header and subheader of the last sector
+        this->reply(CdInt::Acknowledge, this->sector + 12, 8);
+        break;
+    case CdCommand::GetlocP: {
+        const DiscTrack *track =
+            loaded ? this->disc->image().track_at(this->position)
+                   : nullptr;
+        if (track == nullptr) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        // Relative time counts down to the start in the pregap
+        uint32_t lba = this->position;
+        bool pregap = lba < track->start;
+        uint32_t rel = pregap ? track->start - lba
+                              : lba - track->start;
+        uint32_t msf = lba + Disc::LEAD_IN;
+        uint8_t bytes[] = {
+            to_bcd(track->number),
+            uint8_t(pregap ? 0x00 : 0x01),
+            to_bcd(rel / (60 * 75)),
+            to_bcd(rel / 75 % 60),
+            to_bcd(rel % 75),
+            to_bcd(msf / (60 * 75)),
+            to_bcd(msf / 75 % 60),
+            to_bcd(msf % 75),
+        };
+        this->reply(CdInt::Acknowledge, bytes, sizeof(bytes));
+        break;
+    }
+    case CdCommand::GetTN: {
+        if (!loaded) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        const std::vector<DiscTrack> &tracks =
+            this->disc->image().tracks;
+        uint8_t bytes[] = {this->stat,
+                           to_bcd(tracks.front().number),
+                           to_bcd(tracks.back().number)};
+        this->reply(CdInt::Acknowledge, bytes, sizeof(bytes));
+        break;
+    }
+    case CdCommand::GetTD: {
+        if (!loaded) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        // Track 0 is the end of the disc
+        uint32_t number = from_bcd(p[0]);
+        uint32_t lba = this->disc->sectors();
+        bool found = number == 0;
+        for (const DiscTrack &t : this->disc->image().tracks) {
+            if (t.number == number) {
+                lba = t.start;
+                found = true;
+            }
+        }
+        if (!found) {
+            this->error(ERROR_BAD_PARAM);
+            break;
+        }
+        uint32_t msf = lba + Disc::LEAD_IN;
+        uint8_t bytes[] = {this->stat, to_bcd(msf / (60 * 75)),
+                           to_bcd(msf / 75 % 60)};
+        this->reply(CdInt::Acknowledge, bytes, sizeof(bytes));
+        break;
+    }
+    case CdCommand::SeekL:
+    case CdCommand::SeekP:
+        if (!loaded) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        this->reply_stat(CdInt::Acknowledge);
+        this->seek(Drive::Seeking);
+        break;
+    case CdCommand::Test:
+        switch (p[0]) {
+        case 0x04:
+            this->reply_stat(CdInt::Acknowledge);
+            break;
+        case 0x05: {
+            uint8_t bytes[] = {0, 0};
+            this->reply(CdInt::Acknowledge, bytes, sizeof(bytes));
+            break;
+        }
+        case 0x20: {
+            // Controller firmware date and version
+            uint8_t bytes[] = {0x94, 0x09, 0x19, 0xc0};
+            this->reply(CdInt::Acknowledge, bytes, sizeof(bytes));
+            break;
+        }
+        default:
+            printf("Unhandled CD-ROM test 0x%02x\n", p[0]);
+            this->error(ERROR_BAD_PARAM);
+            break;
+        }
+        break;
+    case CdCommand::GetID: {
+        if (!loaded) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        this->reply_stat(CdInt::Acknowledge);
+        // Licensed Mode 2 disc, region SCEA
+        uint8_t bytes[] = {0x02, 0x00, 0x20, 0x00,
+                           'S',  'C',  'E',  'A'};
+        this->reply_later(CdInt::Complete, bytes, sizeof(bytes),
+                          GETID_DELAY);
+        break;
+    }
+    case CdCommand::ReadTOC:
+        if (!loaded) {
+            this->error(ERROR_NOT_READY);
+            break;
+        }
+        this->reply_stat(CdInt::Acknowledge);
+        this->reply_later(CdInt::Complete, &this->stat, 1,
+                          this->mechanics_cycles(TOC_DELAY));
+        break;
+    default:
+        printf("Unhandled CD-ROM command 0x%02x\n",
+               this->command);
+        this->error(ERROR_BAD_COMMAND);
+        break;
+    }
+
+    this->param_len = 0;
+}
+
+void Cdrom::run_async() {
+    this->reply(this->async.irq, this->async.bytes,
+                this->async.len);
+}
+
+void Cdrom::step_drive() {
+    // A state may be loaded with another disc, or none
+    if (this->disc == nullptr) {
+        this->stop_drive();
+        return;
+    }
+
+    switch (this->drive) {
+    case Drive::Idle:
+        break;
+    case Drive::Seeking:
+        this->drive = Drive::Idle;
+        this->stat &= ~STAT_SEEK;
+        this->reply_stat(CdInt::Complete);
+        break;
+    case Drive::SeekingToRead:
+        this->drive = Drive::Reading;
+        this->stat = (this->stat & ~STAT_SEEK) | STAT_READ;
+        this->scheduler->schedule(Event::CdRomDrive,
+                                  this->sector_cycles());
+        break;
+    case Drive::Reading:
+        if (this->position >= this->disc->sectors()) {
+            this->stop_drive();
+            this->reply_stat(CdInt::DataEnd);
+            break;
+        }
+        // Faster than the real drive, the CPU could still be busy
+        // with the last sector or a command: wait for it rather
+        // than have it miss a sector or see one before the answer
+        if (this->timing != CdTiming::Accurate &&
+            (this->busy || this->int_flag != 0 ||
+             this->queue_len != 0)) {
+            this->scheduler->schedule(Event::CdRomDrive,
+                                      this->sector_cycles());
+            break;
+        }
+        if (!this->disc->fetch(this->position, this->sector)) {
+            this->scheduler->schedule(Event::CdRomDrive,
+                                      MISS_DELAY);
+            break;
+        }
+        this->position += 1;
+        this->disc->prefetch(this->position);
+        this->reply_stat(CdInt::DataReady);
+        this->scheduler->schedule(Event::CdRomDrive,
+                                  this->sector_cycles());
+        break;
+    }
+}
+
+void Cdrom::reply(CdInt p_irq, const uint8_t *p_bytes,
+                  uint8_t p_len) {
+    Reply r;
+    r.irq = p_irq;
+    r.len = p_len;
+    memcpy(r.bytes, p_bytes, p_len);
+
+    if (this->int_flag == 0 && this->queue_len == 0) {
+        this->show(r);
+        return;
+    }
+    // A CPU too slow to keep up loses the newest answers, like
+    // sectors overrunning the drive buffers
+    if (this->queue_len < QUEUE_SIZE)
+        this->queue[this->queue_len++] = r;
+}
+
+void Cdrom::reply_stat(CdInt p_irq) {
+    this->reply(p_irq, &this->stat, 1);
+}
+
+void Cdrom::error(uint8_t p_code) {
+    uint8_t bytes[] = {uint8_t(this->stat | STAT_ERROR), p_code};
+    this->reply(CdInt::Error, bytes, sizeof(bytes));
+}
+
+void Cdrom::reply_later(CdInt p_irq, const uint8_t *p_bytes,
+                        uint8_t p_len, uint64_t p_delay) {
+    this->async.irq = p_irq;
+    this->async.len = p_len;
+    memcpy(this->async.bytes, p_bytes, p_len);
+    this->scheduler->schedule(Event::CdRomAsync, p_delay);
+}
+
+void Cdrom::show(const Reply &p_reply) {
+    memcpy(this->response, p_reply.bytes, p_reply.len);
+    this->response_len = p_reply.len;
+    this->response_pos = 0;
+    this->int_flag = uint8_t(p_reply.irq);
+}
+
+void Cdrom::show_next() {
+    if (this->int_flag != 0 || this->queue_len == 0)
+        return;
+    this->show(this->queue[0]);
+    this->queue_len -= 1;
+    memmove(this->queue, this->queue + 1,
+            this->queue_len * sizeof(Reply));
+}
+
+void Cdrom::seek(Drive p_next) {
+    if (this->target_pending) {
+        this->position = this->target;
+        this->target_pending = false;
+    }
+    this->drive = p_next;
+    this->stat &= ~STAT_READ;
+    this->stat |= STAT_SEEK | STAT_MOTOR;
+    this->disc->prefetch(this->position);
+    this->scheduler->schedule(Event::CdRomDrive,
+                              this->mechanics_cycles(SEEK_DELAY));
+}
+
+void Cdrom::start_read() {
+    if (this->target_pending) {
+        this->seek(Drive::SeekingToRead);
+        return;
+    }
+    this->drive = Drive::Reading;
+    this->stat &= ~STAT_SEEK;
+    this->stat |= STAT_READ | STAT_MOTOR;
+    this->disc->prefetch(this->position);
+    this->scheduler->schedule(Event::CdRomDrive,
+                              this->sector_cycles());
+}
+
+void Cdrom::stop_drive() {
+    this->drive = Drive::Idle;
+    this->stat &= ~(STAT_READ | STAT_SEEK);
+    this->scheduler->cancel(Event::CdRomDrive);
+}
+
+uint64_t Cdrom::sector_cycles() const {
+    switch (this->timing) {
+    case CdTiming::Accurate:
+        break;
+    case CdTiming::Fast:
+        return CPU_HZ / (75 * FAST_SPEED);
+    case CdTiming::Instant:
+        return INSTANT_DELAY;
+    }
+    if (this->mode & MODE_DOUBLE_SPEED)
+        return CPU_HZ / 150;
+    return CPU_HZ / 75;
+}
+
+uint64_t Cdrom::mechanics_cycles(uint64_t p_accurate) const {
+    switch (this->timing) {
+    case CdTiming::Accurate:
+        break;
+    case CdTiming::Fast:
+        return p_accurate / FAST_SPEED;
+    case CdTiming::Instant:
+        return INSTANT_DELAY;
+    }
+    return p_accurate;
+}
+
+void Cdrom::load_data() {
+    if (this->mode & MODE_WHOLE_SECTOR) {
+        // Everything after the sync pattern
+        this->data_len = 0x924;
+        memcpy(this->data, this->sector + 12, this->data_len);
+    } else {
+        // User data after the header, and the subheader in Mode 2
+        uint32_t offset = this->sector[15] == 1 ? 16 : 24;
+        this->data_len = 0x800;
+        memcpy(this->data, this->sector + offset, this->data_len);
+    }
+    this->data_pos = 0;
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include "disc.h"
+#include "scheduler.h"
+#include "sector_cache.h"
+#include <cstdint>
+
+/// Controller answers, numbered as in the interrupt flags
+enum class CdInt : uint8_t {
+    None = 0,
+    // Sector ready for the data FIFO
+    DataReady = 1,
+    // Second response of a slow command
+    Complete = 2,
+    // First response of every command
+    Acknowledge = 3,
+    DataEnd = 4,
+    Error = 5,
+};
+
+/// Drive timing model, see Cdrom::timing
+enum class CdTiming : uint8_t {
+    // Read speeds, seek and spin-up times of the real drive
+    Accurate,
+    // 8x reads, seeks and spin-up 8 times shorter
+    Fast,
+    // Every drive delay next to nothing
+    Instant,
+};
+
+// "accurate", "fast" or "instant", false for anything else
+bool cd_timing_from_name(const char *p_name, CdTiming &p_timing);
+
+/// CD-ROM controller: the four byte registers at 0x1f801800
+/// banked by an index, its parameter, response and data FIFOs,
+/// and the drive.
+///
+/// Commands answer after a delay through Event::CdRom, slow ones
+/// a second time through Event::CdRomAsync, and the drive seeks
+/// and reads sectors through Event::CdRomDrive. Answers wait in
+/// a queue until the CPU acknowledges the one it was shown.
+/// Sectors come from the SectorCache (nullptr when the tray is
+/// empty), a sector it doesn't have yet just delays the read.
+///
+/// Audio (CD-DA play, XA-ADPCM) is not emulated: ReadS hands XA
+/// sectors to the CPU like data sectors.
+///
+/// The faster timing models only shorten the drive: commands
+/// are acknowledged after the usual delays, and a sector isn't
+/// delivered while a command waits for its answer or the CPU
+/// hasn't acknowledged every earlier one, so interrupts keep
+/// their order and no sector is lost however fast the drive gets.
+struct Cdrom {
+    static constexpr uint64_t CPU_HZ = 33868800;
+    static constexpr uint32_t FIFO_SIZE = 16;
+    // Answers waiting behind the one shown
+    static constexpr uint32_t QUEUE_SIZE = 4;
+
+    struct Reply {
+        CdInt irq;
+        uint8_t len;
+        uint8_t bytes[FIFO_SIZE];
+    };
+
+    enum class Drive : uint8_t {
+        Idle,
+        // SeekL/SeekP, answering when done
+        Seeking,
+        // ReadN/ReadS going to the Setloc target first
+        SeekingToRead,
+        Reading,
+    };
+
+    // Set by the Interconnect
+    Scheduler *scheduler;
+    // Inserted disc, owned by the frontend
+    SectorCache *disc;
+    // Set by the frontend, not part of save states
+    CdTiming timing;
+
+    // Register bank selected through 0x1f801800
+    uint8_t index;
+    uint8_t params[FIFO_SIZE];
+    uint8_t param_len;
+    // Shown answer, read through the response FIFO
+    uint8_t response[FIFO_SIZE];
+    uint8_t response_len;
+    uint8_t response_pos;
+    uint8_t int_enable;
+    // Type of the shown answer until acknowledged
+    uint8_t int_flag;
+    Reply queue[QUEUE_SIZE];
+    uint8_t queue_len;
+
+    // Command waiting for its first answer
+    uint8_t command;
+    bool busy;
+    // Second answer waiting for Event::CdRomAsync
+    Reply async;
+
+    uint8_t stat;
+    uint8_t mode;
+    uint8_t filter_file;
+    uint8_t filter_channel;
+
+    Drive drive;
+    // Setloc target, used by the next seek or read
+    uint32_t target;
+    bool target_pending;
+    // Next sector under the head
+    uint32_t position;
+
+    // Last sector read
+    uint8_t sector[Disc::SECTOR_SIZE];
+    // Data FIFO, loaded from the sector on request
+    uint8_t data[Disc::SECTOR_SIZE];
+    uint32_t data_len;
+    uint32_t data_pos;
+
+    Cdrom();
+    ~Cdrom() = default;
+
+    // Change the disc, nullptr opens the tray
+    void insert(SectorCache *p_disc);
+
+    uint8_t load(uint32_t p_offset);
+    void store(uint32_t p_offset, uint8_t p_val);
+    // DMA channel 3: the next word of the data FIFO
+    uint32_t dma_read();
+
+    // Interrupt line to the interrupt controller
+    bool irq_line() const {
+        return (this->int_flag & this->int_enable & 0x1f) != 0;
+    }
+
+    // Event::CdRom: run the command, first answer
+    void run_command();
+    // Event::CdRomAsync: second answer
+    void run_async();
+    // Event::CdRomDrive: seek done or next sector
+    void step_drive();
+
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("CDRM");
+        p_v.value(this->index);
+        p_v.value(this->params);
+        p_v.value(this->param_len);
+        p_v.value(this->response);
+        p_v.value(this->response_len);
+        p_v.value(this->response_pos);
+        p_v.value(this->int_enable);
+        p_v.value(this->int_flag);
+        p_v.value(this->queue);
+        p_v.value(this->queue_len);
+        p_v.value(this->command);
+        p_v.value(this->busy);
+        p_v.value(this->async);
+        p_v.value(this->stat);
+        p_v.value(this->mode);
+        p_v.value(this->filter_file);
+        p_v.value(this->filter_channel);
+        p_v.value(this->drive);
+        p_v.value(this->target);
+        p_v.value(this->target_pending);
+        p_v.value(this->position);
+        p_v.value(this->sector);
+        p_v.value(this->data);
+        p_v.value(this->data_len);
+        p_v.value(this->data_pos);
+        if constexpr (V::LOADING) {
+            if (this->disc != nullptr)
+                this->disc->prefetch(
+                    this->target_pending ? this->target
+                                         : this->position);
+        }
+    }
+
+  private:
+    // Answer now, or once the shown answer is acknowledged
+    void reply(CdInt p_irq, const uint8_t *p_bytes,
+               uint8_t p_len);
+    void reply_stat(CdInt p_irq);
+    // INT5 with the status and p_code
+    void error(uint8_t p_code);
+    // Second answer p_delay cycles from now
+    void reply_later(CdInt p_irq, const uint8_t *p_bytes,
+                     uint8_t p_len, uint64_t p_delay);
+    void show(const Reply &p_reply);
+    // Show the next queued answer if the last one was
+    // acknowledged
+    void show_next();
+
+    // Move the head to the Setloc target, then p_next
+    void seek(Drive p_next);
+    // Read from the Setloc target if one is pending, else on from
+    // the current position
+    void start_read();
+    void stop_drive();
+    uint64_t sector_cycles() const;
+    // Seek, spin-up or TOC read taking p_accurate cycles on the
+    // real drive, under the timing model
+    uint64_t mechanics_cycles(uint64_t p_accurate) const;
+    // The sector part the data FIFO gets, per Setmode
+    void load_data();
+};
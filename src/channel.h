@@ -77,6 +77,22 @@ struct Channel {
     // list mode
     std::optional<uint32_t> transfer_size();
 
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.value(this->enable);
+        p_v.value(this->direction);
+        p_v.value(this->step);
+        p_v.value(this->sync);
+        p_v.value(this->trigger);
+        p_v.value(this->chop);
+        p_v.value(this->chop_dma_sz);
+        p_v.value(this->chop_cpu_sz);
+        p_v.value(this->dummy);
+        p_v.value(this->base);
+        p_v.value(this->block_size);
+        p_v.value(this->block_count);
+    }
+
     Channel();
     ~Channel() = default;
 };
@@ -12,4 +12,11 @@ struct CommmandBuffer {
     void clear();
     void push_word(uint32_t p_word);
     uint32_t& operator[](uint32_t p_index);
+
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("GP0 ");
+        p_v.value(this->buffer);
+        p_v.value(this->length);
+    }
 };
@@ -3,13 +3,12 @@
 #include "interconnect.h"
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 // #include "r3000d.h"
 #include <cstdio>
 #include <iterator>
 #include <stdexcept>
 
-char buf[1024];
-
 template void CPU::store<uint8_t>(uint32_t p_addr, uint8_t);
 template void CPU::store<uint16_t>(uint32_t p_addr, uint16_t);
 template void CPU::store<uint32_t>(uint32_t p_addr, uint32_t);
@@ -18,11 +17,89 @@ template uint8_t CPU::load<uint8_t>(uint32_t);
 template uint16_t CPU::load<uint16_t>(uint32_t);
 template uint32_t CPU::load<uint32_t>(uint32_t);
 
+// Instruction handlers, built at compile time and shared by every
+// CPU instance
+static constexpr CPU::Dispatch build_dispatch() {
+    CPU::Dispatch d = {};
+
+    d.rtype[0b000000] = &CPU::op_sll;
+    d.rtype[0b100101] = &CPU::op_or;
+    d.rtype[0b101011] = &CPU::op_stlu;
+    d.rtype[0b100001] = &CPU::op_addu;
+    d.rtype[0b001000] = &CPU::op_jr;
+    d.rtype[0b001001] = &CPU::op_jalr;
+    d.rtype[0b100100] = &CPU::op_and;
+    d.rtype[0b001100] = &CPU::op_syscall;
+    d.rtype[0b100000] = &CPU::op_add;
+    d.rtype[0b100010] = &CPU::op_sub;
+    d.rtype[0b100011] = &CPU::op_subu;
+    d.rtype[0b000011] = &CPU::op_sra;
+    d.rtype[0b011010] = &CPU::op_div;
+    d.rtype[0b011011] = &CPU::op_divu;
+    d.rtype[0b010010] = &CPU::op_mflo;
+    d.rtype[0b000010] = &CPU::op_srl;
+    d.rtype[0b010000] = &CPU::op_mfhi;
+    d.rtype[0b101010] = &CPU::op_slt;
+    d.rtype[0b010011] = &CPU::op_mtlo;
+    d.rtype[0b010001] = &CPU::op_mthi;
+    d.rtype[0b000100] = &CPU::op_sllv;
+    d.rtype[0b100111] = &CPU::op_nor;
+    d.rtype[0b000111] = &CPU::op_srav;
+    d.rtype[0b100110] = &CPU::op_xor;
+    d.rtype[0b000110] = &CPU::op_srlv;
+    d.rtype[0b110000] = &CPU::op_mult;
+    d.rtype[0b011001] = &CPU::op_multu;
+    d.rtype[0b001101] = &CPU::op_break;
+
+    d.main[0b001111] = &CPU::op_lui;
+    d.main[0b001101] = &CPU::op_ori;
+    d.main[0b101011] = &CPU::op_sw;
+    d.main[0b001001] = &CPU::op_addiu;
+    d.main[0b000010] = &CPU::op_jmp;
+    d.main[0b010000] = &CPU::op_cop0;
+    d.main[0b000101] = &CPU::op_bne;
+    d.main[0b001000] = &CPU::op_addi;
+    d.main[0b100011] = &CPU::op_lw;
+    d.main[0b101001] = &CPU::op_sh;
+    d.main[0b000011] = &CPU::op_jal;
+    d.main[0b001100] = &CPU::op_andi;
+    d.main[0b101000] = &CPU::op_sb;
+    d.main[0b100000] = &CPU::op_lb;
+    d.main[0b000100] = &CPU::op_beq;
+    d.main[0b000111] = &CPU::op_bgtz;
+    d.main[0b000110] = &CPU::op_blez;
+    d.main[0b100100] = &CPU::op_lbu;
+    d.main[0b000001] = &CPU::op_bxx;
+    d.main[0b001010] = &CPU::op_slti;
+    d.main[0b001011] = &CPU::op_sltiu;
+    d.main[0b100101] = &CPU::op_lhu;
+    d.main[0b100001] = &CPU::op_lh;
+    d.main[0b001110] = &CPU::op_xori;
+    d.main[0b100010] = &CPU::op_lwl;
+    d.main[0b100110] = &CPU::op_lwr;
+    d.main[0b101010] = &CPU::op_swl;
+    d.main[0b101110] = &CPU::op_swr;
+    d.main[0b110000] = &CPU::op_lwc0;
+    d.main[0b110001] = &CPU::op_lwc1;
+    d.main[0b110010] = &CPU::op_lwc2;
+    d.main[0b110011] = &CPU::op_lwc3;
+    d.main[0b111000] = &CPU::op_swc0;
+    d.main[0b111001] = &CPU::op_swc1;
+    d.main[0b111010] = &CPU::op_swc2;
+    d.main[0b111011] = &CPU::op_swc3;
+
+    return d;
+}
+static constexpr CPU::Dispatch CPU_DISPATCH = build_dispatch();
+
 CPU::CPU(Interconnect *p_inter) {
     this->program_counter = 0xbfc00000;
     this->next_program_counter = this->program_counter + 4;
     this->inter = p_inter;
+    this->inter->watch.pc = &this->current_program_counter;
     this->status_register = 0;
+    this->cause_register = 0;
+    this->epc_register = 0;
     this->opcode_count = 0;
     this->branch_occured = this->delay_slot = false;
     this->hi = this->lo = 0xdeadbeef;
@@ -30,89 +107,50 @@ CPU::CPU(Interconnect *p_inter) {
     memset(this->regs, 0, sizeof(this->regs));
     memset(this->out_regs, 0, sizeof(this->out_regs));
 
-    rtype_dispatch[0b000000] = &CPU::op_sll;
-    rtype_dispatch[0b100101] = &CPU::op_or;
-    rtype_dispatch[0b101011] = &CPU::op_stlu;
-    rtype_dispatch[0b100001] = &CPU::op_addu;
-    rtype_dispatch[0b001000] = &CPU::op_jr;
-    rtype_dispatch[0b001001] = &CPU::op_jalr;
-    rtype_dispatch[0b100100] = &CPU::op_and;
-    rtype_dispatch[0b001100] = &CPU::op_syscall;
-    rtype_dispatch[0b100000] = &CPU::op_add;
-    rtype_dispatch[0b100010] = &CPU::op_sub;
-    rtype_dispatch[0b100011] = &CPU::op_subu;
-    rtype_dispatch[0b000011] = &CPU::op_sra;
-    rtype_dispatch[0b011010] = &CPU::op_div;
-    rtype_dispatch[0b011011] = &CPU::op_divu;
-    rtype_dispatch[0b010010] = &CPU::op_mflo;
-    rtype_dispatch[0b000010] = &CPU::op_srl;
-    rtype_dispatch[0b010000] = &CPU::op_mfhi;
-    rtype_dispatch[0b101010] = &CPU::op_slt;
-    rtype_dispatch[0b010011] = &CPU::op_mtlo;
-    rtype_dispatch[0b010001] = &CPU::op_mthi;
-    rtype_dispatch[0b000100] = &CPU::op_sllv;
-    rtype_dispatch[0b100111] = &CPU::op_nor;
-    rtype_dispatch[0b000111] = &CPU::op_srav;
-    rtype_dispatch[0b100110] = &CPU::op_xor;
-    rtype_dispatch[0b000110] = &CPU::op_srlv;
-    rtype_dispatch[0b110000] = &CPU::op_mult;
-    rtype_dispatch[0b011001] = &CPU::op_multu;
-    rtype_dispatch[0b001101] = &CPU::op_break;
-
-    main_dispatch[0b001111] = &CPU::op_lui;
-    main_dispatch[0b001101] = &CPU::op_ori;
-    main_dispatch[0b101011] = &CPU::op_sw;
-    main_dispatch[0b001001] = &CPU::op_addiu;
-    main_dispatch[0b000010] = &CPU::op_jmp;
-    main_dispatch[0b010000] = &CPU::op_cop0;
-    main_dispatch[0b000101] = &CPU::op_bne;
-    main_dispatch[0b001000] = &CPU::op_addi;
-    main_dispatch[0b100011] = &CPU::op_lw;
-    main_dispatch[0b101001] = &CPU::op_sh;
-    main_dispatch[0b000011] = &CPU::op_jal;
-    main_dispatch[0b001100] = &CPU::op_andi;
-    main_dispatch[0b101000] = &CPU::op_sb;
-    main_dispatch[0b100000] = &CPU::op_lb;
-    main_dispatch[0b000100] = &CPU::op_beq;
-    main_dispatch[0b000111] = &CPU::op_bgtz;
-    main_dispatch[0b000110] = &CPU::op_blez;
-    main_dispatch[0b100100] = &CPU::op_lbu;
-    main_dispatch[0b000001] = &CPU::op_bxx;
-    main_dispatch[0b001010] = &CPU::op_slti;
-    main_dispatch[0b001011] = &CPU::op_sltiu;
-    main_dispatch[0b100101] = &CPU::op_lhu;
-    main_dispatch[0b100001] = &CPU::op_lh;
-    main_dispatch[0b001110] = &CPU::op_xori;
-    main_dispatch[0b100010] = &CPU::op_lwl;
-    main_dispatch[0b100110] = &CPU::op_lwr;
-    main_dispatch[0b101010] = &CPU::op_swl;
-    main_dispatch[0b101110] = &CPU::op_swr;
-    main_dispatch[0b110000] = &CPU::op_lwc0;
-    main_dispatch[0b110001] = &CPU::op_lwc1;
-    main_dispatch[0b110010] = &CPU::op_lwc2;
-    main_dispatch[0b110011] = &CPU::op_lwc3;
-    main_dispatch[0b111000] = &CPU::op_swc0;
-    main_dispatch[0b111001] = &CPU::op_swc1;
-    main_dispatch[0b111010] = &CPU::op_swc2;
-    main_dispatch[0b111011] = &CPU::op_swc3;
-
     this->load_reg = 0;
     this->load_val = 0;
 
     // $0 always zero
     this->set_reg(0, 0);
+
+    this->update_irq_enable();
 }
 
 void CPU::run_next_instruction() {
     uint32_t pc = this->program_counter;
 
+    // Interrupts are taken between instructions, before the
+    // next one is even fetched: a breakpoint on it only stops it
+    // once the handler returns. The flag is only recomputed when
+    // I_STAT, I_MASK or SR change.
+    if (this->inter->irq.pending) {
+        // Retire the pending load before leaving
+        this->set_reg(this->load_reg, this->load_val);
+        this->load_reg = 0;
+        this->load_val = 0;
+        std::copy(std::begin(this->out_regs),
+                  std::end(this->out_regs),
+                  std::begin(this->regs));
+
+        this->current_program_counter = pc;
+        this->delay_slot = this->branch_occured;
+        this->branch_occured = false;
+        this->exception(Exception::Interrupt);
+        return;
+    }
+
     if (pc % 4 != 0) {
         this->exception(Exception::LoadAddressError);
         return;
     }
 
-    Instruction instruction =
-        Instruction(this->load<uint32_t>(pc));
+    uint32_t word;
+    if (!this->inter->fetch(pc, word)) {
+        // Halted by a watchpoint, we'll resume from this
+        // instruction
+        return;
+    }
+    Instruction instruction = Instruction(word);
 
     // delay slot
     this->delay_slot = this->branch_occured;
@@ -222,7 +260,7 @@ void CPU::op_swl(Instruction p_instruction) {
 
     uint32_t v = this->get_reg(t);
 
-    uint32_t aligned_addr = addr & !3;
+    uint32_t aligned_addr = addr & ~3;
     uint32_t cur_mem = this->load<uint32_t>(aligned_addr);
 
     uint32_t mem = (uint32_t)NULL;
@@ -257,7 +295,7 @@ void CPU::op_swr(Instruction p_instruction) {
 
     uint32_t v = this->get_reg(t);
 
-    uint32_t aligned_addr = addr & !3;
+    uint32_t aligned_addr = addr & ~3;
     uint32_t cur_mem = this->load<uint32_t>(aligned_addr);
 
     uint32_t mem = (uint32_t)NULL;
@@ -349,7 +387,7 @@ void CPU::op_lwl(Instruction p_instruction) {
 
     uint32_t cur_v = this->out_regs[t];
 
-    uint32_t aligned_addr = addr & !3;
+    uint32_t aligned_addr = addr & ~3;
     uint32_t aligned_word = this->load<uint32_t>(aligned_addr);
 
     uint32_t v = (uint32_t)NULL;
@@ -388,22 +426,22 @@ void CPU::op_lwr(Instruction p_instruction) {
 
     uint32_t cur_v = this->out_regs[t];
 
-    uint32_t aligned_addr = addr & !3;
+    uint32_t aligned_addr = addr & ~3;
     uint32_t aligned_word = this->load<uint32_t>(aligned_addr);
 
     uint32_t v = (uint32_t)NULL;
 
     switch (addr & 3) {
     case 3: {
-        v = (cur_v & 0xffffff00) | (aligned_word << 24);
+        v = (cur_v & 0xffffff00) | (aligned_word >> 24);
         break;
     }
     case 2: {
-        v = (cur_v & 0xffff0000) | (aligned_word << 16);
+        v = (cur_v & 0xffff0000) | (aligned_word >> 16);
         break;
     }
     case 1: {
-        v = (cur_v & 0xff000000) | (aligned_word << 8);
+        v = (cur_v & 0xff000000) | (aligned_word >> 8);
         break;
     }
     case 0: {
@@ -699,6 +737,7 @@ void CPU::op_mtc0(Instruction p_instruction) {
         break;
     case 12:
         this->status_register = v;
+        this->update_irq_enable();
         break;
     case 13:
         // Cause register
@@ -727,8 +766,9 @@ void CPU::op_rfe(Instruction p_instruction) {
     // Enable/User Mode stack back to its original position.
 
     uint32_t mode = this->status_register & 0x3f;
-    this->status_register &= !0x3f;
+    this->status_register &= ~0x3f;
     this->status_register |= mode >> 2;
+    this->update_irq_enable();
 }
 
 void CPU::op_mfc0(Instruction p_instruction) {
@@ -742,8 +782,10 @@ void CPU::op_mfc0(Instruction p_instruction) {
         v = this->status_register;
         break;
     case 13:
-        // Cause register
+        // Cause register, IP2 mirrors the interrupt controller
         v = this->cause_register;
+        if (this->inter->irq.active())
+            v |= 1 << 10;
         break;
     case 14:
         v = this->epc_register;
@@ -1060,12 +1102,22 @@ void CPU::exception(Exception cause) {
     this->epc_register = this->current_program_counter;
 
     if (this->delay_slot) {
-        this->epc_register = this->epc_register + 4;
+        // EPC points at the branch so that it's re-executed
+        this->epc_register = this->epc_register - 4;
         this->cause_register |= 1 << 31;
     }
 
     this->program_counter = handler;
     this->next_program_counter = this->program_counter + 4;
+
+    this->update_irq_enable();
+}
+
+void CPU::update_irq_enable() {
+    // IEc (bit 0) and the IM2 hardware line mask (bit 10)
+    bool enabled = (this->status_register & 1) != 0 &&
+                   (this->status_register & (1 << 10)) != 0;
+    this->inter->irq.set_cpu_enabled(enabled);
 }
 
 void CPU::op_syscall(Instruction) {
@@ -1087,7 +1139,7 @@ void CPU::execute_instruction(Instruction p_instruction) {
     uint32_t subfunction = p_instruction.subfunction();
 
     if (function == 0x0) {
-        op_handler h = rtype_dispatch[subfunction];
+        op_handler h = CPU_DISPATCH.rtype[subfunction];
         if (h)
             (this->*h)(p_instruction);
         else
@@ -1095,10 +1147,21 @@ void CPU::execute_instruction(Instruction p_instruction) {
 
         return;
     }
-    op_handler h = main_dispatch[function];
+    op_handler h = CPU_DISPATCH.main[function];
     if (h)
         (this->*h)(p_instruction);
     else
         this->op_illegal(p_instruction);
 }
-void CPU::run() { this->run_next_instruction(); }
+void CPU::run() {
+    Scheduler &scheduler = this->inter->scheduler;
+
+    if (this->inter->watch.halted)
+        return;
+
+    while (scheduler.now < scheduler.slice_end) {
+        this->run_next_instruction();
+        scheduler.now += CYCLES_PER_INSTRUCTION;
+    }
+    this->inter->run_events();
+}
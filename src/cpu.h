@@ -20,6 +20,10 @@ KSEG2      LENGTH   Description
 
 
 struct CPU {
+    // Average cost of an instruction, the emulator doesn't model
+    // per-instruction timings
+    static constexpr uint64_t CYCLES_PER_INSTRUCTION = 2;
+
     uint32_t program_counter;
     uint32_t next_program_counter;
     uint32_t current_program_counter;
@@ -48,6 +52,8 @@ struct CPU {
     ~CPU() = default;
 
     enum Exception : uint32_t {
+        // External interrupt (I_STAT & I_MASK)
+        Interrupt = 0x0,
         SysCall = 0x8,
         ArithmeticOverflow = 0xc,
         /// Address error on load
@@ -65,12 +71,16 @@ struct CPU {
     void op_cop2(Instruction);
     void op_cop3(Instruction);
 
+    // Run until the next device event is due, then handle it
     void run();
     void print();
     void run_next_instruction();
     void execute_instruction(Instruction);
 
     void exception(Exception);
+    // Push the SR interrupt enable state to the interrupt
+    // controller. Must follow every status_register change.
+    void update_irq_enable();
 
     void branch(uint32_t p_offset);
 
@@ -84,10 +94,35 @@ struct CPU {
     uint32_t get_reg(uint32_t idx);
     void set_reg(uint32_t idx, uint32_t val);
 
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("CPU ");
+        p_v.value(this->program_counter);
+        p_v.value(this->next_program_counter);
+        p_v.value(this->current_program_counter);
+        p_v.value(this->regs);
+        p_v.value(this->out_regs);
+        p_v.value(this->load_reg);
+        p_v.value(this->load_val);
+        p_v.value(this->status_register);
+        p_v.value(this->cause_register);
+        p_v.value(this->epc_register);
+        p_v.value(this->hi);
+        p_v.value(this->lo);
+        p_v.value(this->opcode_count);
+        p_v.value(this->branch_occured);
+        p_v.value(this->delay_slot);
+    }
+
     typedef void (CPU::*op_handler)(Instruction);
 
-    op_handler rtype_dispatch[63] = {nullptr };
-    op_handler main_dispatch[63] = { nullptr };
+    // Handlers indexed by the primary opcode, and by the function
+    // field for opcode 0. One table for every instance, see
+    // CPU_DISPATCH.
+    struct Dispatch {
+        op_handler rtype[64];
+        op_handler main[64];
+    };
 
     void op_lui(Instruction);
     void op_ori(Instruction);
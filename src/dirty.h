@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+/// Write tracking over N fixed-size blocks (RAM pages, VRAM
+/// tiles).
+///
+/// Several independent consumers (snapshots, texture cache,
+/// renderer uploads...) need their own "changed since I last
+/// looked" view, so every block holds one bit per client. A store
+/// marks the block dirty for all clients at once with a single
+/// byte write; each client then tests and clears its own bit.
+template <uint32_t N> struct DirtyMap {
+    static constexpr uint32_t MAX_CLIENTS = 8;
+
+    uint8_t blocks[N];
+    uint32_t clients;
+
+    DirtyMap() {
+        // Everything starts dirty so the first scan of any
+        // client picks up the initial contents
+        memset(this->blocks, 0xff, sizeof(this->blocks));
+        this->clients = 0;
+    }
+
+    // Reserve a client bit
+    uint8_t acquire_client() {
+        if (this->clients >= MAX_CLIENTS) {
+            printf("DirtyMap: out of client slots\n");
+            std::terminate();
+        }
+        return uint8_t(this->clients++);
+    }
+
+    void mark(uint32_t p_block) { this->blocks[p_block] = 0xff; }
+
+    // Mark blocks [p_first, p_last]
+    void mark_range(uint32_t p_first, uint32_t p_last) {
+        memset(this->blocks + p_first, 0xff,
+               p_last - p_first + 1);
+    }
+
+    void mark_all() {
+        memset(this->blocks, 0xff, sizeof(this->blocks));
+    }
+
+    // Same, for p_client only
+    void mark_all(uint8_t p_client) {
+        for (uint32_t i = 0; i < N; i++)
+            this->blocks[i] |= 1 << p_client;
+    }
+
+    bool is_dirty(uint32_t p_block, uint8_t p_client) const {
+        return (this->blocks[p_block] >> p_client) & 1;
+    }
+
+    void clear(uint32_t p_block, uint8_t p_client) {
+        this->blocks[p_block] &= ~(1 << p_client);
+    }
+
+    void clear_all(uint8_t p_client) {
+        for (uint32_t i = 0; i < N; i++)
+            this->blocks[i] &= ~(1 << p_client);
+    }
+
+    bool any(uint8_t p_client) const {
+        for (uint32_t i = 0; i < N; i++)
+            if (this->is_dirty(i, p_client))
+                return true;
+        return false;
+    }
+
+    // Call p_fn(block) for every block dirty for p_client
+    template <class F>
+    void for_each_dirty(uint8_t p_client, F &&p_fn) const {
+        for (uint32_t i = 0; i < N; i++)
+            if (this->is_dirty(i, p_client))
+                p_fn(i);
+    }
+};
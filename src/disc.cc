@@ -0,0 +1,347 @@
+#include "disc.h"
+#include "hunk_image.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool has_extension(const char *p_path, const char *p_ext) {
+    size_t len = strlen(p_path);
+    size_t ext_len = strlen(p_ext);
+    if (len < ext_len)
+        return false;
+    const char *ext = p_path + len - ext_len;
+    for (size_t i = 0; i < ext_len; i++) {
+        if (tolower(ext[i]) != p_ext[i])
+            return false;
+    }
+    return true;
+}
+
+// Sync pattern and header of sector p_lba
+static void build_header(uint8_t *p_dst, uint32_t p_lba,
+                         uint8_t p_mode) {
+    p_dst[0] = 0;
+    memset(p_dst + 1, 0xff, 10);
+    p_dst[11] = 0;
+    uint32_t msf = p_lba + Disc::LEAD_IN;
+    p_dst[12] = to_bcd(msf / (60 * 75));
+    p_dst[13] = to_bcd(msf / 75 % 60);
+    p_dst[14] = to_bcd(msf % 75);
+    p_dst[15] = p_mode;
+}
+
+Disc::Disc(const char *p_path) {
+    try {
+        if (has_extension(p_path, ".cue")) {
+            this->load_cue(p_path);
+        } else if (has_extension(p_path, ".cdz")) {
+            this->load_hunks(p_path);
+        } else {
+            std::span<const uint8_t> image =
+                this->map_file(p_path);
+            DiscTrack track = {};
+            track.number = 1;
+            track.type = TrackType::Mode2;
+            bool iso = has_extension(p_path, ".iso");
+            track.stride = iso ? 2048 : SECTOR_SIZE;
+            track.end = uint32_t(image.size() / track.stride);
+            track.data = image.data();
+            if (track.end == 0)
+                throw std::runtime_error(
+                    std::string("Empty disc image: ") + p_path);
+            this->tracks.push_back(track);
+        }
+    } catch (...) {
+        delete this->hunks;
+        for (const Mapping &m : this->files)
+            munmap(m.addr, m.size);
+        throw;
+    }
+}
+
+Disc::~Disc() {
+    delete this->hunks;
+    for (const Mapping &m : this->files)
+        munmap(m.addr, m.size);
+}
+
+std::span<const uint8_t>
+Disc::map_file(const std::string &p_path) {
+    int fd = open(p_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Can't open disc image: " +
+                                 p_path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Empty disc image: " + p_path);
+    }
+    size_t size = size_t(st.st_size);
+    void *addr =
+        mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error("Can't map disc image: " +
+                                 p_path);
+
+    // Reads mostly stream forward: read ahead eagerly, drop
+    // behind
+    madvise(addr, size, MADV_SEQUENTIAL);
+    this->files.push_back({addr, size});
+    return {(const uint8_t *)addr, size};
+}
+
+// Next word of a CUE line, quotes removed. Empty at the end.
+static std::string next_word(const char *&p_line) {
+    while (*p_line == ' ' || *p_line == '\t')
+        p_line++;
+    std::string word;
+    if (*p_line == '"') {
+        p_line++;
+        while (*p_line != '\0' && *p_line != '"')
+            word += *p_line++;
+        if (*p_line == '"')
+            p_line++;
+        return word;
+    }
+    while (*p_line != '\0' && !isspace((unsigned char)*p_line))
+        word += *p_line++;
+    return word;
+}
+
+// mm:ss:ff to sectors
+static bool parse_msf(const std::string &p_word,
+                      uint32_t &p_val) {
+    unsigned m, s, f;
+    if (sscanf(p_word.c_str(), "%u:%u:%u", &m, &s, &f) != 3 ||
+        s >= 60 || f >= 75)
+        return false;
+    p_val = (m * 60 + s) * 75 + f;
+    return true;
+}
+
+void Disc::load_cue(const char *p_path) {
+    FILE *file = fopen(p_path, "r");
+    if (!file)
+        throw std::runtime_error(
+            std::string("Can't open CUE sheet: ") + p_path);
+
+    // BIN paths are relative to the sheet
+    std::string dir = p_path;
+    size_t slash = dir.find_last_of('/');
+    dir = slash == std::string::npos ? ""
+                                     : dir.substr(0, slash + 1);
+
+    struct CueTrack {
+        DiscTrack track;
+        // File holding it and positions in there, in sectors
+        std::span<const uint8_t> image;
+        uint32_t index0;
+        uint32_t index1;
+        bool has_index0;
+        bool has_index1;
+        // PREGAP: silence not stored in the file
+        uint32_t gap;
+    };
+    std::vector<CueTrack> cue;
+    std::span<const uint8_t> image;
+    bool has_image = false;
+    std::string error;
+
+    char buf[512];
+    while (error.empty() && fgets(buf, sizeof(buf), file)) {
+        const char *line = buf;
+        std::string command = next_word(line);
+        if (command == "FILE") {
+            std::string name = next_word(line);
+            bool absolute = !name.empty() && name[0] == '/';
+            std::string path = absolute ? name : dir + name;
+            try {
+                image = this->map_file(path);
+                has_image = true;
+            } catch (const std::runtime_error &e) {
+                error = e.what();
+            }
+        } else if (command == "TRACK") {
+            std::string number = next_word(line);
+            std::string type = next_word(line);
+            CueTrack t = {};
+            t.track.number = uint8_t(atoi(number.c_str()));
+            t.image = image;
+            if (type == "AUDIO") {
+                t.track.type = TrackType::Audio;
+                t.track.stride = SECTOR_SIZE;
+            } else if (type.rfind("MODE1/", 0) == 0) {
+                t.track.type = TrackType::Mode1;
+                t.track.stride = atoi(type.c_str() + 6);
+            } else if (type.rfind("MODE2/", 0) == 0) {
+                t.track.type = TrackType::Mode2;
+                t.track.stride = atoi(type.c_str() + 6);
+            }
+            uint32_t stride = t.track.stride;
+            if (!has_image || t.track.number == 0 ||
+                (stride != SECTOR_SIZE && stride != 2336 &&
+                 stride != 2048))
+                error = "Unsupported CUE track " + number + " " +
+                        type;
+            cue.push_back(t);
+        } else if (command == "INDEX" && !cue.empty()) {
+            uint32_t index = atoi(next_word(line).c_str());
+            uint32_t pos = 0;
+            if (!parse_msf(next_word(line), pos))
+                error = "Bad CUE index time";
+            if (index == 0) {
+                cue.back().index0 = pos;
+                cue.back().has_index0 = true;
+            } else if (index == 1) {
+                cue.back().index1 = pos;
+                cue.back().has_index1 = true;
+            }
+        } else if (command == "PREGAP" && !cue.empty()) {
+            if (!parse_msf(next_word(line), cue.back().gap))
+                error = "Bad CUE pregap time";
+        }
+    }
+    fclose(file);
+    if (error.empty() && cue.empty())
+        error = "No track in CUE sheet";
+    if (!error.empty())
+        throw std::runtime_error(error + ": " + p_path);
+
+    // Lay the tracks out one after the other. The sectors of a
+    // file are assumed to all have the size of its tracks.
+    uint32_t lba = 0;
+    for (size_t i = 0; i < cue.size(); i++) {
+        CueTrack &t = cue[i];
+        uint32_t stride = t.track.stride;
+        uint32_t first = t.has_index0 ? t.index0 : t.index1;
+        uint32_t end = uint32_t(t.image.size() / stride);
+        if (i + 1 < cue.size() &&
+            cue[i + 1].image.data() == t.image.data())
+            end = cue[i + 1].has_index0 ? cue[i + 1].index0
+                                        : cue[i + 1].index1;
+        bool fits = size_t(end) * stride <= t.image.size();
+        if (!t.has_index1 || first > t.index1 ||
+            t.index1 >= end || !fits)
+            throw std::runtime_error(
+                "Bad CUE track " +
+                std::to_string(t.track.number) + ": " + p_path);
+
+        t.track.pregap = lba;
+        lba += t.gap;
+        t.track.stored = lba;
+        lba += t.index1 - first;
+        t.track.start = lba;
+        lba += end - t.index1;
+        t.track.end = lba;
+        t.track.data = t.image.data() + size_t(first) * stride;
+        this->tracks.push_back(t.track);
+    }
+}
+
+void Disc::load_hunks(const char *p_path) {
+    std::span<const uint8_t> file = this->map_file(p_path);
+    try {
+        this->hunks = new HunkImage(file);
+    } catch (const std::runtime_error &e) {
+        throw std::runtime_error(std::string(e.what()) + ": " +
+                                 p_path);
+    }
+
+    for (const HunkTrack &h : this->hunks->track_list()) {
+        DiscTrack t = {};
+        t.number = h.number;
+        t.type = TrackType(h.type);
+        t.pregap = h.pregap;
+        t.stored = h.pregap;
+        t.start = h.start;
+        t.end = h.end;
+        t.stride = SECTOR_SIZE;
+        this->tracks.push_back(t);
+    }
+}
+
+const DiscTrack *Disc::track_at(uint32_t p_lba) const {
+    auto it = std::upper_bound(
+        this->tracks.begin(), this->tracks.end(), p_lba,
+        [](uint32_t p_lba, const DiscTrack &p_track) {
+            return p_lba < p_track.end;
+        });
+    return it == this->tracks.end() ? nullptr : &*it;
+}
+
+std::span<const uint8_t> Disc::sector(uint32_t p_lba,
+                                      uint8_t *p_scratch) const {
+    const DiscTrack *track = this->track_at(p_lba);
+    if (track == nullptr)
+        return {};
+    if (this->hunks != nullptr) {
+        this->hunks->read(p_lba, p_scratch);
+        return {p_scratch, SECTOR_SIZE};
+    }
+    uint8_t mode = track->type == TrackType::Mode1 ? 1 : 2;
+
+    if (p_lba < track->stored) {
+        // Pregap missing from the image: silence or empty data
+        memset(p_scratch, 0, SECTOR_SIZE);
+        if (track->type != TrackType::Audio)
+            build_header(p_scratch, p_lba, mode);
+        return {p_scratch, SECTOR_SIZE};
+    }
+
+    size_t offset = size_t(p_lba - track->stored) * track->stride;
+    const uint8_t *src = track->data + offset;
+    switch (track->stride) {
+    case SECTOR_SIZE:
+        return {src, SECTOR_SIZE};
+    case 2336:
+        build_header(p_scratch, p_lba, 2);
+        memcpy(p_scratch + 16, src, 2336);
+        break;
+    default:
+        // User data only: EDC/ECC left blank, Mode 2 sectors get
+        // a Form 1 data subheader
+        memset(p_scratch, 0, SECTOR_SIZE);
+        build_header(p_scratch, p_lba, mode);
+        if (mode == 1) {
+            memcpy(p_scratch + 16, src, 2048);
+        } else {
+            p_scratch[18] = p_scratch[22] = 0x08;
+            memcpy(p_scratch + 24, src, 2048);
+        }
+        break;
+    }
+    return {p_scratch, SECTOR_SIZE};
+}
+
+void Disc::will_need(uint32_t p_lba, uint32_t p_count) const {
+    if (this->hunks != nullptr) {
+        this->hunks->prefetch(p_lba, p_count);
+        return;
+    }
+    const DiscTrack *track = this->track_at(p_lba);
+    if (track == nullptr)
+        return;
+    uint32_t first = std::max(p_lba, track->stored);
+    uint32_t last = std::min(p_lba + p_count, track->end);
+    if (first >= last)
+        return;
+
+    static const uintptr_t PAGE =
+        uintptr_t(sysconf(_SC_PAGESIZE));
+    const uint8_t *data = track->data;
+    uintptr_t begin = uintptr_t(
+        data + size_t(first - track->stored) * track->stride);
+    uintptr_t end = uintptr_t(
+        data + size_t(last - track->stored) * track->stride);
+    begin &= ~(PAGE - 1);
+    madvise((void *)begin, end - begin, MADV_WILLNEED);
+}
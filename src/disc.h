@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+struct HunkImage;
+
+// Disc addresses (minutes, seconds, sectors) are BCD coded
+inline uint8_t to_bcd(uint32_t p_val) {
+    return uint8_t((p_val / 10) << 4 | p_val % 10);
+}
+
+inline uint32_t from_bcd(uint8_t p_val) {
+    return (p_val >> 4) * 10 + (p_val & 15);
+}
+
+enum class TrackType : uint8_t {
+    Audio,
+    Mode1,
+    Mode2,
+};
+
+/// One track of a disc, in disc sectors (LBA 0 is the first
+/// sector of track 1, absolute time 00:02:00)
+struct DiscTrack {
+    uint8_t number;
+    TrackType type;
+    // Pregap (index 0), track proper (index 1) and end, exclusive
+    uint32_t pregap;
+    uint32_t start;
+    uint32_t end;
+    // Bytes per sector in the image: 2352 (raw), 2336 (Mode 2
+    // without sync and header) or 2048 (user data only)
+    uint32_t stride;
+    // First sector stored in the image, the pregap before it
+    // isn't (CUE PREGAP) and reads as zeros
+    uint32_t stored;
+    const uint8_t *data;
+};
+
+/// A disc image, memory mapped read only: a CUE sheet and its
+/// BIN files (any number of tracks and files), a lone .bin (one
+/// Mode 2 track of raw sectors) or .iso (one Mode 2 track of Form
+/// 1 user data), or a compressed .cdz (see HunkImage).
+///
+/// Reading a sector is a view into the mapping, no copy and no
+/// system call: sessions using the same image share the page
+/// cache, and a Disc can be shared by threads. Touching a page
+/// the kernel hasn't read yet blocks though, only the SectorCache
+/// thread reads sectors. Compressed sectors are decompressed into
+/// the scratch sector, from hunks will_need() got decompressed
+/// in the background.
+struct Disc {
+    static constexpr uint32_t SECTOR_SIZE = 2352;
+    // Absolute times count the 2 second lead-in before LBA 0
+    static constexpr uint32_t LEAD_IN = 150;
+
+    // Throws std::runtime_error when the image can't be opened or
+    // the CUE sheet is invalid
+    Disc(const char *p_path);
+    ~Disc();
+
+    Disc(const Disc &) = delete;
+    Disc &operator=(const Disc &) = delete;
+
+    // End of the last track
+    uint32_t sectors() const { return this->tracks.back().end; }
+
+    // The track holding p_lba, nullptr past the end
+    const DiscTrack *track_at(uint32_t p_lba) const;
+
+    // Raw sector p_lba (SECTOR_SIZE bytes): a view into the image
+    // when it stores raw sectors, otherwise rebuilt in p_scratch
+    // (SECTOR_SIZE bytes). Empty past the end.
+    std::span<const uint8_t> sector(uint32_t p_lba,
+                                    uint8_t *p_scratch) const;
+
+    // Have the kernel start reading p_count sectors from p_lba
+    // on, or decompressing them
+    void will_need(uint32_t p_lba, uint32_t p_count) const;
+
+    std::vector<DiscTrack> tracks;
+
+  private:
+    struct Mapping {
+        void *addr;
+        size_t size;
+    };
+
+    std::vector<Mapping> files;
+    // Set for .cdz images, the tracks don't point into the file
+    HunkImage *hunks = nullptr;
+
+    // Map p_path, returns its contents
+    std::span<const uint8_t> map_file(const std::string &p_path);
+    void load_cue(const char *p_path);
+    void load_hunks(const char *p_path);
+};
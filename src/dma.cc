@@ -1,6 +1,13 @@
 #include "dma.h"
 
-Dma::Dma() { this->control = 0x07654321; }
+Dma::Dma() {
+    this->control = 0x07654321;
+    this->irq_en = false;
+    this->channel_irq_en = 0;
+    this->channel_irq_flags = 0;
+    this->force_irq = false;
+    this->irq_dummy = 0;
+}
 
 uint32_t Dma::get_control() { return this->control; }
 void Dma::set_control(uint32_t p_val) { this->control = p_val; }
@@ -34,6 +41,17 @@ void Dma::set_interrupt(uint32_t p_val) {
     this->channel_irq_flags &= ~ack;
 }
 
+bool Dma::flag_channel_irq(Port p_port) {
+    uint8_t bit = 1 << (uint32_t)p_port;
+
+    if ((this->channel_irq_en & bit) == 0)
+        return false;
+
+    bool irq_before = this->get_irq();
+    this->channel_irq_flags |= bit;
+    return !irq_before && this->get_irq();
+}
+
 const Channel& Dma::get_channel(Port p_port) {
     const Channel& ref = this->channels[p_port];
     return ref;
@@ -49,4 +49,20 @@ struct Dma {
     uint32_t interrupt();
     void set_interrupt(uint32_t p_val);
     void set_control(uint32_t p_val);
+    // Flag the end of a transfer on `p_port`. Returns true when
+    // this raises the master IRQ flag (edge triggering IRQ3)
+    bool flag_channel_irq(Port p_port);
+
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("DMA ");
+        p_v.value(this->control);
+        p_v.value(this->irq_en);
+        p_v.value(this->channel_irq_en);
+        p_v.value(this->channel_irq_flags);
+        p_v.value(this->force_irq);
+        p_v.value(this->irq_dummy);
+        for (Channel &channel : this->channels)
+            channel.serialize(p_v);
+    }
 };
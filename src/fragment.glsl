@@ -1,8 +1,43 @@
 #version 410 core
 
 in vec3 color;
+in vec2 uv;
+flat in uint flags;
+flat in uint page;
+
+// Decoded texture pages (1555 texels), one layer per texture
+// cache slot
+uniform usampler2DArray pages;
+
 out vec4 fragColor;
 
+// VertexFlag bits
+const uint TEXTURED = 1u;
+const uint RAW_TEXTURE = 2u;
+
 void main() {
-    fragColor = vec4(color, 1.0);
+    if ((flags & TEXTURED) == 0u) {
+        // Alpha holds the VRAM mask bit, left clear
+        fragColor = vec4(color, 0.0);
+        return;
+    }
+
+    ivec2 texel_pos = ivec2(floor(uv)) & 0xff;
+    uint texel = texelFetch(pages, ivec3(texel_pos, page), 0).r;
+
+    // Texel 0x0000 is fully transparent
+    if (texel == 0u)
+        discard;
+
+    vec3 texel_color = vec3(float(texel & 0x1fu),
+                            float((texel >> 5) & 0x1fu),
+                            float((texel >> 10) & 0x1fu)) / 31.0;
+
+    // Modulation by the vertex color, 0x80 leaves the texel as is
+    if ((flags & RAW_TEXTURE) == 0u)
+        texel_color = min(texel_color * color * (255.0 / 128.0),
+                          vec3(1.0));
+
+    // The texel mask bit goes through to VRAM
+    fragColor = vec4(texel_color, float(texel >> 15));
 }
@@ -1,56 +1,115 @@
 // gl_buffer.cc
 #include "gl_buffer.h"
 #include "structs.h"
-#include <cstring>
-#include <algorithm>
+#include <cstdio>
 
-template <typename T> Buffer<T>::Buffer() {
-    this->dirty = false;
-    this->dirty_start = VERTEX_BUFFER_LEN;
-    this->dirty_end = 0;
+template <typename T> StreamBuffer<T>::StreamBuffer() {
+    this->window = nullptr;
+    this->window_base = 0;
+    this->segment = 0;
+    this->start = 0;
+    this->end = 0;
+    for (uint32_t i = 0; i < SEGMENTS; i++)
+        this->fences[i] = nullptr;
 
     glGenBuffers(1, &object);
     glBindBuffer(GL_ARRAY_BUFFER, object);
 
-    shadow_copy.resize(VERTEX_BUFFER_LEN, T());
+    GLsizeiptr size = sizeof(T) * LEN;
 
-    glBufferData(GL_ARRAY_BUFFER, sizeof(T) * VERTEX_BUFFER_LEN,
-                 shadow_copy.data(), GL_DYNAMIC_DRAW);
+    this->persistent = GLAD_GL_VERSION_4_4 != 0;
+    if (this->persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT |
+                           GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+        this->window = (T *)glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                             size, flags);
+        this->window_base = 0;
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr,
+                     GL_STREAM_DRAW);
+    }
 }
 
-template <typename T> Buffer<T>::~Buffer() {
+template <typename T> StreamBuffer<T>::~StreamBuffer() {
+    if (this->window != nullptr) {
+        glBindBuffer(GL_ARRAY_BUFFER, object);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    for (uint32_t i = 0; i < SEGMENTS; i++) {
+        if (this->fences[i] != nullptr)
+            glDeleteSync(this->fences[i]);
+    }
     glDeleteBuffers(1, &object);
 }
 
+template <typename T> void StreamBuffer<T>::map_window() {
+    // The fence guarantees the GPU is done with this segment, no
+    // need for GL to synchronize
+    GLbitfield flags = GL_MAP_WRITE_BIT |
+                       GL_MAP_UNSYNCHRONIZED_BIT |
+                       GL_MAP_INVALIDATE_RANGE_BIT;
+
+    uint32_t base = this->segment * SEGMENT_LEN + this->end;
+    uint32_t len = SEGMENT_LEN - this->end;
+
+    glBindBuffer(GL_ARRAY_BUFFER, object);
+    this->window = (T *)glMapBufferRange(
+        GL_ARRAY_BUFFER, base * sizeof(T), len * sizeof(T), flags);
+    this->window_base = base;
+}
+
 template <typename T>
-void Buffer<T>::set(uint32_t index, const T &value) {
-    if (index >= VERTEX_BUFFER_LEN) {
-        throw std::out_of_range("Buffer index out of range");
-    }
+bool StreamBuffer<T>::flush(GLint &p_first, GLsizei &p_count) {
+    if (this->end == this->start)
+        return false;
 
-    shadow_copy[index] = value;
+    // GL can't source vertices from a buffer mapped without
+    // GL_MAP_PERSISTENT_BIT
+    if (!this->persistent && this->window != nullptr) {
+        glBindBuffer(GL_ARRAY_BUFFER, object);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        this->window = nullptr;
+    }
 
-    dirty_start = std::min(dirty_start, index);
-    dirty_end = std::max(dirty_end, index + 1);
-    dirty = true;
+    p_first = GLint(this->segment * SEGMENT_LEN + this->start);
+    p_count = GLsizei(this->end - this->start);
+    this->start = this->end;
+    return true;
 }
 
-template <typename T> void Buffer<T>::flush() {
-    if (!dirty)
-        return;
+template <typename T> void StreamBuffer<T>::next_segment() {
+    if (!this->persistent && this->window != nullptr) {
+        glBindBuffer(GL_ARRAY_BUFFER, object);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        this->window = nullptr;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, object);
+    this->fences[this->segment] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
-    GLintptr offset = dirty_start * sizeof(T);
-    GLsizeiptr size = (dirty_end - dirty_start) * sizeof(T);
+    this->segment = (this->segment + 1) % SEGMENTS;
+    this->start = 0;
+    this->end = 0;
 
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size,
-                    shadow_copy.data() + dirty_start);
+    GLsync fence = this->fences[this->segment];
+    if (fence == nullptr)
+        return;
 
-    dirty = false;
-    dirty_start = VERTEX_BUFFER_LEN;
-    dirty_end = 0;
+    for (;;) {
+        GLenum r = glClientWaitSync(
+            fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        if (r == GL_ALREADY_SIGNALED ||
+            r == GL_CONDITION_SATISFIED)
+            break;
+        if (r == GL_WAIT_FAILED) {
+            printf("glClientWaitSync failed\n");
+            break;
+        }
+    }
+    glDeleteSync(fence);
+    this->fences[this->segment] = nullptr;
 }
 
-template class Buffer<Color>;
-template class Buffer<Position>;
+template struct StreamBuffer<Vertex>;
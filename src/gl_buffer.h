@@ -2,25 +2,66 @@
 #pragma once
 #include "glad.h"
 #include <cstddef>
-#include <vector>
+#include <cstdint>
+
+/// Streaming vertex buffer split into SEGMENTS fenced segments.
+/// Vertices are written straight into GL mapped memory: the whole
+/// buffer is persistently mapped when GL 4.4 buffer storage is
+/// available, otherwise the unused part of the current segment is
+/// mapped unsynchronized between draws. A segment is only reused
+/// once the GPU signalled the fence placed when we left it, which
+/// gives frame level triple buffering without any copy.
+template <typename T> struct StreamBuffer {
+    static constexpr uint32_t SEGMENTS = 3;
+    static constexpr uint32_t SEGMENT_LEN = 64 * 1024;
+    static constexpr uint32_t LEN = SEGMENTS * SEGMENT_LEN;
 
-template <typename T> struct Buffer {
     GLuint object;
-    std::vector<T> shadow_copy;
-    bool dirty;
-    uint32_t dirty_start;
-    uint32_t dirty_end;
+    // GL_MAP_PERSISTENT_BIT mapping of the whole buffer
+    bool persistent;
+    // Mapped memory and the buffer index of its first element
+    T *window;
+    uint32_t window_base;
+
+    GLsync fences[SEGMENTS];
+    // Segment being filled
+    uint32_t segment;
+    // [start, end) holds vertices written but not drawn yet,
+    // relative to the segment
+    uint32_t start;
+    uint32_t end;
+
+    StreamBuffer();
+    ~StreamBuffer();
 
-    static const uint32_t VERTEX_BUFFER_LEN = 64 * 1024;
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
 
-    Buffer();
-    ~Buffer();
+    // Room for p_count elements in the current segment, nullptr
+    // if it's full: draw the pending range and call
+    // next_segment() first
+    T *reserve(uint32_t p_count) {
+        if (this->end + p_count > SEGMENT_LEN)
+            return nullptr;
+        if (this->window == nullptr)
+            this->map_window();
 
-    Buffer(const Buffer &) = delete;
-    Buffer &operator=(const Buffer &) = delete;
+        uint32_t index = this->segment * SEGMENT_LEN + this->end;
+        this->end += p_count;
+        return this->window + (index - this->window_base);
+    }
+
+    // Make the pending range visible to GL. Returns false if
+    // there's nothing to draw, otherwise the range in p_first and
+    // p_count.
+    bool flush(GLint &p_first, GLsizei &p_count);
+    // Fence the current segment and move to the next one,
+    // waiting for the GPU to be done with it if needed
+    void next_segment();
 
-    void set(uint32_t index, const T &value);
-    void flush(); // Flush changes to GPU
     GLuint id() const { return object; };
     void bind() const { glBindBuffer(GL_ARRAY_BUFFER, object); };
+
+  private:
+    void map_window();
 };
@@ -0,0 +1,916 @@
+#include "gl_renderer.h"
+#include "GLFW/glfw3.h"
+#include "imgui.h"
+#include "imgui_impl_glfw.h"
+#include "imgui_impl_opengl3.h"
+#include "shader.h"
+#include "structs.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// GLFW and EGL displays are process wide: the first renderer
+// brings them up, the last one shuts them down, so renderers can
+// come and go while others keep running
+static std::mutex platform_mutex;
+static uint32_t glfw_users = 0;
+static uint32_t egl_users = 0;
+
+// No entry point switches contexts, each thread only has the one
+// its renderer made current
+static thread_local GlRenderer *thread_renderer = nullptr;
+// GLFW windows and events belong to the main thread, the one
+// running static initialisation
+static const std::thread::id main_thread =
+    std::this_thread::get_id();
+
+GlRenderer::GlRenderer(bool p_headless) {
+    if (thread_renderer != nullptr)
+        throw std::runtime_error(
+            "Only one GL renderer per thread");
+    if (!p_headless && std::this_thread::get_id() != main_thread)
+        throw std::runtime_error(
+            "A GL window needs the main thread");
+    this->headless = p_headless;
+    this->window = nullptr;
+    this->egl_display = nullptr;
+    this->egl_context = nullptr;
+    this->egl_surface = nullptr;
+    this->imgui = nullptr;
+    this->program = nullptr;
+    this->vertices = nullptr;
+
+    if (this->headless)
+        this->create_headless_context();
+    else
+        this->create_window();
+
+    // The destructor won't run if the rest throws
+    try {
+        this->create_objects();
+    } catch (...) {
+        delete this->program;
+        delete this->vertices;
+        this->close_context();
+        throw;
+    }
+    thread_renderer = this;
+}
+
+void GlRenderer::create_objects() {
+    this->vendor = (const char *)glGetString(GL_VENDOR);
+    this->renderer = (const char *)glGetString(GL_RENDERER);
+
+    this->program = new Shader("vertex.glsl", "fragment.glsl");
+    this->vertices = new StreamBuffer<Vertex>();
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    // Single interleaved stream
+    const GLsizei stride = sizeof(Vertex);
+    this->vertices->bind();
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 2, GL_SHORT, stride,
+                           (void *)offsetof(Vertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 3, GL_UNSIGNED_BYTE, stride,
+                           (void *)offsetof(Vertex, color));
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 2, GL_UNSIGNED_BYTE, stride,
+                           (void *)offsetof(Vertex, u));
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, stride,
+                           (void *)offsetof(Vertex, texpage));
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_SHORT, stride,
+                           (void *)offsetof(Vertex, clut));
+    glEnableVertexAttribArray(5);
+    glVertexAttribIPointer(5, 1, GL_UNSIGNED_BYTE, stride,
+                           (void *)offsetof(Vertex, flags));
+    glEnableVertexAttribArray(6);
+    glVertexAttribIPointer(6, 1, GL_UNSIGNED_SHORT, stride,
+                           (void *)offsetof(Vertex, page));
+    glBindVertexArray(0);
+
+    // Texture pages stay bound to unit 1 for good, unit 0 is used
+    // for the transfer surfaces
+    const GLsizei page_size = TextureCache::PAGE_SIZE;
+    glGenTextures(1, &this->page_texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, this->page_texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16UI, page_size,
+                 page_size, TextureCache::SLOTS, 0,
+                 GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER,
+                    GL_NEAREST);
+    glActiveTexture(GL_TEXTURE0);
+    this->program->use();
+    this->program->set_int("pages", 1);
+    this->pending_pages = 0;
+
+    this->display = DisplayArea{0, 0, 640, 480, false};
+
+    this->scale = 1;
+    this->requested_scale = 1;
+    this->area_left = 0;
+    this->area_top = 0;
+    this->area_right = 0;
+    this->area_bottom = 0;
+    this->offset_x = 0;
+    this->offset_y = 0;
+    this->scratch_texture = 0;
+    this->scratch_fbo = 0;
+    this->scratch_width = 0;
+    this->scratch_height = 0;
+    this->frame_texture = 0;
+    this->frame_fbo = 0;
+    this->frame_width = 0;
+    this->frame_height = 0;
+
+    // Staging texture at the native resolution, CPU pixels are
+    // uploaded as is (1555 matches the VRAM layout) and then
+    // blitted to the scaled VRAM texture
+    glGenTextures(1, &this->upload_texture);
+    glBindTexture(GL_TEXTURE_2D, this->upload_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, VRam::WIDTH,
+                 VRam::HEIGHT, 0, GL_RGBA,
+                 GL_UNSIGNED_SHORT_1_5_5_5_REV, nullptr);
+    glGenFramebuffers(1, &this->upload_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->upload_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, this->upload_texture,
+                           0);
+
+    this->create_vram_target();
+    this->bind_vram_target();
+}
+
+void GlRenderer::create_window() {
+    {
+        std::lock_guard<std::mutex> lock(platform_mutex);
+        if (glfw_users == 0 && !glfwInit())
+            throw std::runtime_error("GLFW did not initialize");
+        glfw_users += 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_PROFILE,
+                   GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
+    glfwWindowHint(GLFW_DECORATED, GLFW_TRUE);
+
+    this->window =
+        glfwCreateWindow(800, 600, "main", NULL, NULL);
+    if (this->window == nullptr) {
+        this->close_context();
+        throw std::runtime_error("GLFW: window creation failed");
+    }
+
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+
+    // GLAD initialization
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        this->close_context();
+        throw std::runtime_error("GLFW: failed to load GL");
+    }
+
+    // ImGui initialization
+    // Every window has its own UI context
+    IMGUI_CHECKVERSION();
+    this->imgui = ImGui::CreateContext();
+    ImGui::SetCurrentContext(this->imgui);
+    ImGuiIO &io = ImGui::GetIO();
+    io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
+    ImGui::StyleColorsDark();
+
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init("#version 410 core");
+
+    this->previousSecond = glfwGetTime();
+}
+
+void GlRenderer::create_headless_context() {
+#ifdef HAVE_EGL
+    // Prefer Mesa's surfaceless platform, it works without any
+    // display server or GPU (llvmpipe)
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (get_platform_display)
+        display = get_platform_display(
+            EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY,
+            nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY)
+        throw std::runtime_error("EGL: no display available");
+    {
+        std::lock_guard<std::mutex> lock(platform_mutex);
+        if (!eglInitialize(display, nullptr, nullptr))
+            throw std::runtime_error("EGL: no display available");
+        egl_users += 1;
+    }
+    // Holds a display reference from here on, fail() drops it
+    // along with the context and surface made so far
+    this->egl_display = display;
+    auto fail = [this](const char *p_message) {
+        this->close_context();
+        throw std::runtime_error(p_message);
+    };
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+        fail("EGL: desktop GL unsupported");
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1,
+                         &count) ||
+        count == 0)
+        fail("EGL: no usable config");
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,
+        4,
+        EGL_CONTEXT_MINOR_VERSION,
+        1,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    EGLContext context = eglCreateContext(
+        display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT)
+        fail("EGL: GL 4.1 context failed");
+    this->egl_context = context;
+
+    // Everything is drawn into the VRAM framebuffer object, a
+    // dummy pbuffer is only needed without surfaceless support
+    EGLSurface surface = EGL_NO_SURFACE;
+    const char *extensions =
+        eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions ||
+        !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+        const EGLint pbuffer_attribs[] = {
+            EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
+        };
+        surface = eglCreatePbufferSurface(display, config,
+                                          pbuffer_attribs);
+        this->egl_surface = surface;
+    }
+    if (!eglMakeCurrent(display, surface, surface, context))
+        fail("EGL: eglMakeCurrent failed");
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+        fail("EGL: failed to load GL");
+#else
+    throw std::runtime_error(
+        "Headless rendering needs a build with EGL");
+#endif
+}
+
+void GlRenderer::create_vram_target() {
+    glGenTextures(1, &this->vram_texture);
+    glBindTexture(GL_TEXTURE_2D, this->vram_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+                 VRam::WIDTH * this->scale,
+                 VRam::HEIGHT * this->scale, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                    GL_LINEAR);
+
+    glGenFramebuffers(1, &this->vram_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->vram_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, this->vram_texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+        GL_FRAMEBUFFER_COMPLETE) {
+        printf("Renderer: incomplete VRAM framebuffer (%ux)\n",
+               this->scale);
+        std::terminate();
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void GlRenderer::bind_vram_target() {
+    glBindFramebuffer(GL_FRAMEBUFFER, this->vram_fbo);
+    glViewport(0, 0, VRam::WIDTH * this->scale,
+               VRam::HEIGHT * this->scale);
+
+    // VRAM line 0 is the first texture row, so the scissor box
+    // uses VRAM coordinates directly
+    GLint s = GLint(this->scale);
+    GLint width = 0;
+    GLint height = 0;
+    if (this->area_right >= this->area_left)
+        width = this->area_right - this->area_left + 1;
+    if (this->area_bottom >= this->area_top)
+        height = this->area_bottom - this->area_top + 1;
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(this->area_left * s, this->area_top * s, width * s,
+              height * s);
+}
+
+void GlRenderer::set_draw_area(uint16_t p_left, uint16_t p_top,
+                             uint16_t p_right,
+                             uint16_t p_bottom) {
+    // Primitives already batched use the previous area
+    this->draw();
+    this->area_left = p_left;
+    this->area_top = p_top;
+    this->area_right = p_right;
+    this->area_bottom = p_bottom;
+    this->bind_vram_target();
+}
+
+void GlRenderer::set_draw_offset(int16_t p_x, int16_t p_y) {
+    if (p_x == this->offset_x && p_y == this->offset_y)
+        return;
+    this->draw();
+    this->offset_x = p_x;
+    this->offset_y = p_y;
+}
+
+void GlRenderer::set_scale(uint32_t p_scale) {
+    GLint max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+    if (p_scale < 1)
+        p_scale = 1;
+    if (p_scale > MAX_SCALE)
+        p_scale = MAX_SCALE;
+    while (p_scale > 1 &&
+           VRam::WIDTH * p_scale > GLuint(max_size))
+        p_scale -= 1;
+
+    this->requested_scale = p_scale;
+    if (p_scale == this->scale)
+        return;
+
+    this->draw();
+
+    GLuint old_texture = this->vram_texture;
+    GLuint old_fbo = this->vram_fbo;
+    GLint old_scale = GLint(this->scale);
+
+    this->scale = p_scale;
+    this->create_vram_target();
+
+    // Keep the current contents, resampled to the new size
+    GLint s = GLint(this->scale);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, old_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->vram_fbo);
+    glBlitFramebuffer(0, 0, VRam::WIDTH * old_scale,
+                      VRam::HEIGHT * old_scale, 0, 0,
+                      VRam::WIDTH * s, VRam::HEIGHT * s,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glDeleteFramebuffers(1, &old_fbo);
+    glDeleteTextures(1, &old_texture);
+
+    this->bind_vram_target();
+}
+
+void GlRenderer::fill_vram(uint16_t p_x, uint16_t p_y,
+                           uint16_t p_width, uint16_t p_height,
+                           Color p_color) {
+    PerfScope scope(this->perf, PerfSection::Raster);
+    this->draw();
+
+    glClearColor(p_color.r / 255.0f, p_color.g / 255.0f,
+                 p_color.b / 255.0f, 0.0f);
+
+    GLint s = GLint(this->scale);
+    VRam::split_rect(
+        p_x, p_y, p_width, p_height,
+        [&](GLint x, GLint y, GLint width, GLint height) {
+            glScissor(x * s, y * s, width * s, height * s);
+            glClear(GL_COLOR_BUFFER_BIT);
+        });
+
+    // Back to the drawing area
+    this->bind_vram_target();
+}
+
+void GlRenderer::upload_vram(const VRam &p_vram, uint32_t p_x,
+                           uint32_t p_y, uint32_t p_width,
+                           uint32_t p_height) {
+    PerfScope scope(this->perf, PerfSection::Raster);
+    // Primitives batched before the transfer must land first
+    this->draw();
+
+    GLint s = GLint(this->scale);
+    glDisable(GL_SCISSOR_TEST);
+    glBindTexture(GL_TEXTURE_2D, this->upload_texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, VRam::WIDTH);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->upload_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->vram_fbo);
+
+    VRam::split_rect(
+        p_x, p_y, p_width, p_height,
+        [&](GLint x, GLint y, GLint width, GLint height) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width,
+                            height, GL_RGBA,
+                            GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                            p_vram.data + VRam::index(x, y));
+            glBlitFramebuffer(x, y, x + width, y + height, x * s,
+                              y * s, (x + width) * s,
+                              (y + height) * s,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        });
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    this->bind_vram_target();
+}
+
+Vertex *GlRenderer::reserve(uint32_t p_count) {
+    Vertex *v = this->vertices->reserve(p_count);
+    if (v == nullptr) {
+        // Current segment is full
+        this->draw();
+        this->vertices->next_segment();
+        v = this->vertices->reserve(p_count);
+    }
+    return v;
+}
+
+void GlRenderer::upload_texture_page(uint32_t p_slot,
+                                     const uint16_t *p_texels) {
+    PerfScope scope(this->perf, PerfSection::Raster);
+    // Batched primitives still sample the old texels
+    if ((this->pending_pages >> p_slot) & 1)
+        this->draw();
+
+    glActiveTexture(GL_TEXTURE1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, p_slot,
+                    TextureCache::PAGE_SIZE,
+                    TextureCache::PAGE_SIZE, 1, GL_RED_INTEGER,
+                    GL_UNSIGNED_SHORT, p_texels);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void GlRenderer::push_triangle(const Vertex p_vertices[3]) {
+    if (p_vertices[0].flags & VertexFlag::Textured)
+        this->pending_pages |= uint64_t(1) << p_vertices[0].page;
+    Vertex *v = this->reserve(3);
+    memcpy(v, p_vertices, 3 * sizeof(Vertex));
+}
+
+void GlRenderer::push_quad(const Vertex p_vertices[4]) {
+    if (p_vertices[0].flags & VertexFlag::Textured)
+        this->pending_pages |= uint64_t(1) << p_vertices[0].page;
+    // Split in two triangles sharing the 1-2 edge
+    Vertex *v = this->reserve(6);
+    memcpy(v, p_vertices, 3 * sizeof(Vertex));
+    memcpy(v + 3, p_vertices + 1, 3 * sizeof(Vertex));
+}
+
+void GlRenderer::push_line(const Vertex p_vertices[2]) {
+    // Drawn as a one pixel thick quad along the minor axis,
+    // stretched by one pixel on the major axis so that the end
+    // point is covered too
+    Vertex quad[4] = {p_vertices[0], p_vertices[1], p_vertices[0],
+                      p_vertices[1]};
+
+    int dx = p_vertices[1].position.x - p_vertices[0].position.x;
+    int dy = p_vertices[1].position.y - p_vertices[0].position.y;
+    if (abs(dx) >= abs(dy)) {
+        quad[2].position.y += 1;
+        quad[3].position.y += 1;
+        int end = dx >= 0 ? 1 : 0;
+        quad[end].position.x += 1;
+        quad[end + 2].position.x += 1;
+    } else {
+        quad[2].position.x += 1;
+        quad[3].position.x += 1;
+        int end = dy >= 0 ? 1 : 0;
+        quad[end].position.y += 1;
+        quad[end + 2].position.y += 1;
+    }
+
+    this->push_quad(quad);
+}
+
+GlRenderer::~GlRenderer() {
+    thread_renderer = nullptr;
+    delete this->program;
+    delete this->vertices;
+
+    glDeleteFramebuffers(1, &this->vram_fbo);
+    glDeleteTextures(1, &this->vram_texture);
+    glDeleteFramebuffers(1, &this->upload_fbo);
+    glDeleteTextures(1, &this->upload_texture);
+    glDeleteTextures(1, &this->page_texture);
+    if (this->scratch_fbo != 0) {
+        glDeleteFramebuffers(1, &this->scratch_fbo);
+        glDeleteTextures(1, &this->scratch_texture);
+    }
+    if (this->frame_fbo != 0) {
+        glDeleteFramebuffers(1, &this->frame_fbo);
+        glDeleteTextures(1, &this->frame_texture);
+    }
+    this->close_context();
+}
+
+void GlRenderer::close_context() {
+    if (this->headless) {
+#ifdef HAVE_EGL
+        if (this->egl_context != EGL_NO_CONTEXT) {
+            eglMakeCurrent(this->egl_display, EGL_NO_SURFACE,
+                           EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(this->egl_display,
+                              this->egl_context);
+        }
+        if (this->egl_surface != EGL_NO_SURFACE)
+            eglDestroySurface(this->egl_display,
+                              this->egl_surface);
+#endif
+        this->release_platform();
+        return;
+    }
+
+    if (this->imgui) {
+        ImGui::SetCurrentContext(this->imgui);
+        ImGui_ImplGlfw_Shutdown();
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui::DestroyContext(this->imgui);
+    }
+    if (this->window)
+        glfwDestroyWindow(this->window);
+    this->release_platform();
+}
+
+void GlRenderer::release_platform() {
+    std::lock_guard<std::mutex> lock(platform_mutex);
+    if (this->headless) {
+#ifdef HAVE_EGL
+        if (this->egl_display && --egl_users == 0)
+            eglTerminate(this->egl_display);
+#endif
+        return;
+    }
+    if (--glfw_users == 0)
+        glfwTerminate();
+}
+
+void GlRenderer::draw() {
+    PerfScope scope(this->perf, PerfSection::Raster);
+    GLint first;
+    GLsizei count;
+    if (!this->vertices->flush(first, count))
+        return;
+    this->pending_pages = 0;
+
+    this->program->use();
+    this->program->set_ivec2("draw_offset", this->offset_x,
+                             this->offset_y);
+    glBindVertexArray(this->vao);
+    glDrawArrays(GL_TRIANGLES, first, count);
+}
+void GlRenderer::present(const DisplayArea &p_area,
+                         const Scanout *p_frame) {
+    this->draw();
+    // Fence this frame's vertices, the next frame writes to
+    // another segment
+    this->vertices->next_segment();
+    this->display = p_area;
+
+    if (this->headless) {
+        // Nothing to show, VRAM stays in the framebuffer object
+        glFlush();
+        return;
+    }
+
+    this->update();
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+
+    // The frontend stops at the end of the frame
+    if (this->should_close())
+        return;
+
+    // VRAM only holds 24bit pictures as packed bytes, show the
+    // CPU conversion instead
+    if (!p_area.depth24)
+        p_frame = nullptr;
+    this->blit_display(p_area, p_frame);
+    this->draw_debug_ui(p_area);
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+
+    // VRAM keeps its contents across frames, only restore the
+    // draw target the blit and the UI switched away from
+    if (this->requested_scale != this->scale)
+        this->set_scale(this->requested_scale);
+    this->bind_vram_target();
+}
+
+void GlRenderer::draw_debug_ui(const DisplayArea &p_area) {
+    ImGui::SetCurrentContext(this->imgui);
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+
+    int scale = int(this->requested_scale);
+    // Room for the performance graphs
+    ImGui::SetNextWindowSize(ImVec2(380, 480),
+                             ImGuiCond_FirstUseEver);
+    ImGui::Begin("Debug Menu");
+    ImGui::Text("Renderer: %s", this->renderer);
+    ImGui::Text("Vendor: %s", this->vendor);
+    ImGui::Text("FPS: %d", this->fps);
+    ImGui::Text("Frame time: %f",
+                ((float)1 / this->fps) * 1000.0f);
+    ImGui::Text("Display: %dx%d", p_area.width, p_area.height);
+    // Applied once the frame is on screen
+    if (ImGui::SliderInt("Internal resolution", &scale, 1,
+                         MAX_SCALE, "%dx"))
+        this->requested_scale = uint32_t(scale);
+    if (this->perf && this->perf->frames() > 0 &&
+        ImGui::CollapsingHeader("Performance",
+                                ImGuiTreeNodeFlags_DefaultOpen))
+        this->draw_perf_ui();
+    ImGui::End();
+    ImGui::Render();
+
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+}
+
+void GlRenderer::draw_perf_ui() {
+    const Perf &perf = *this->perf;
+    uint64_t n = perf.frames();
+    // The oldest history slot is being rewritten, see Perf
+    uint32_t count =
+        uint32_t(std::min<uint64_t>(n, Perf::HISTORY - 1));
+
+    float frame_ms[Perf::HISTORY];
+    float mips[Perf::HISTORY];
+    PerfFrame sum = {};
+    for (uint32_t i = 0; i < count; i++) {
+        const PerfFrame &f = perf.frame(n - count + i);
+        frame_ms[i] = float(f.frame_ms);
+        mips[i] = float(f.mips());
+
+        sum.frame_ms += f.frame_ms;
+        for (uint32_t k = 0; k < PERF_SECTIONS; k++)
+            sum.section_ms[k] += f.section_ms[k];
+        for (uint32_t k = 0; k < PERF_COUNTERS; k++)
+            sum.counters[k] += f.counters[k];
+    }
+
+    // Averages over the plotted frames, single frames are too
+    // noisy to read
+    ImGui::Text("MIPS: %.2f", sum.mips());
+    for (uint32_t k = 0; k < PERF_SECTIONS; k++)
+        ImGui::Text("%-8s %6.2f ms", Perf::SECTION_NAMES[k],
+                    sum.section_ms[k] / count);
+    for (uint32_t k = 0; k < PERF_COUNTERS; k++)
+        ImGui::Text("%-13s %.0f", Perf::COUNTER_NAMES[k],
+                    double(sum.counters[k]) / count);
+
+    ImGui::PlotLines("Frame ms", frame_ms, int(count), 0,
+                     nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+    ImGui::PlotLines("MIPS", mips, int(count), 0, nullptr, 0.0f,
+                     FLT_MAX, ImVec2(0, 60));
+}
+
+void GlRenderer::read_vram(VRam &p_vram, uint32_t p_x,
+                           uint32_t p_y, uint32_t p_width,
+                           uint32_t p_height) {
+    PerfScope scope(this->perf, PerfSection::Raster);
+    this->draw();
+
+    // Scale back down through the native staging surface, which
+    // also converts to the 1555 VRAM layout
+    GLint s = GLint(this->scale);
+    glDisable(GL_SCISSOR_TEST);
+    glPixelStorei(GL_PACK_ROW_LENGTH, VRam::WIDTH);
+
+    GLuint vram_fbo = this->vram_fbo;
+    GLuint upload_fbo = this->upload_fbo;
+    VRam::split_rect(
+        p_x, p_y, p_width, p_height,
+        [&](GLint x, GLint y, GLint width, GLint height) {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, vram_fbo);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, upload_fbo);
+            glBlitFramebuffer(x * s, y * s, (x + width) * s,
+                              (y + height) * s, x, y, x + width,
+                              y + height, GL_COLOR_BUFFER_BIT,
+                              GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, upload_fbo);
+            glReadPixels(x, y, width, height, GL_RGBA,
+                         GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                         p_vram.data + VRam::index(x, y));
+        });
+
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    this->bind_vram_target();
+}
+
+bool GlRenderer::copy_vram(uint32_t p_src_x, uint32_t p_src_y,
+                           uint32_t p_dst_x, uint32_t p_dst_y,
+                           uint32_t p_width, uint32_t p_height) {
+    PerfScope scope(this->perf, PerfSection::Raster);
+    // Wrapping copies are rare, let the GPU go through VRam
+    if (p_src_x + p_width > VRam::WIDTH ||
+        p_dst_x + p_width > VRam::WIDTH ||
+        p_src_y + p_height > VRam::HEIGHT ||
+        p_dst_y + p_height > VRam::HEIGHT)
+        return false;
+
+    this->draw();
+
+    // Mask bits are only honoured by the CPU side copy
+    GLint s = GLint(this->scale);
+    GLint sx = p_src_x * s, sy = p_src_y * s;
+    GLint dx = p_dst_x * s, dy = p_dst_y * s;
+    GLint w = p_width * s, h = p_height * s;
+
+    glDisable(GL_SCISSOR_TEST);
+
+    bool overlap = p_src_x < p_dst_x + p_width &&
+                   p_dst_x < p_src_x + p_width &&
+                   p_src_y < p_dst_y + p_height &&
+                   p_dst_y < p_src_y + p_height;
+    if (!overlap) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->vram_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->vram_fbo);
+        glBlitFramebuffer(sx, sy, sx + w, sy + h, dx, dy, dx + w,
+                          dy + h, GL_COLOR_BUFFER_BIT,
+                          GL_NEAREST);
+        this->bind_vram_target();
+        return true;
+    }
+
+    // Blitting between overlapping regions of the same buffer is
+    // undefined, bounce through the scratch surface
+    if (w > this->scratch_width || h > this->scratch_height) {
+        if (this->scratch_fbo != 0) {
+            glDeleteFramebuffers(1, &this->scratch_fbo);
+            glDeleteTextures(1, &this->scratch_texture);
+        }
+        this->scratch_width = std::max(w, this->scratch_width);
+        this->scratch_height = std::max(h, this->scratch_height);
+
+        glGenTextures(1, &this->scratch_texture);
+        glBindTexture(GL_TEXTURE_2D, this->scratch_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+                     this->scratch_width, this->scratch_height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glGenFramebuffers(1, &this->scratch_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->scratch_fbo);
+        glFramebufferTexture2D(
+            GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+            this->scratch_texture, 0);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->vram_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->scratch_fbo);
+    glBlitFramebuffer(sx, sy, sx + w, sy + h, 0, 0, w, h,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->scratch_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->vram_fbo);
+    glBlitFramebuffer(0, 0, w, h, dx, dy, dx + w, dy + h,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    this->bind_vram_target();
+    return true;
+}
+
+void GlRenderer::upload_frame(const Scanout &p_frame) {
+    GLint w = GLint(p_frame.width);
+    GLint h = GLint(p_frame.height);
+
+    glBindTexture(GL_TEXTURE_2D, this->frame_texture);
+    if (w != this->frame_width || h != this->frame_height) {
+        if (this->frame_fbo == 0) {
+            glGenTextures(1, &this->frame_texture);
+            glGenFramebuffers(1, &this->frame_fbo);
+            glBindTexture(GL_TEXTURE_2D, this->frame_texture);
+        }
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, nullptr);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->frame_fbo);
+        glFramebufferTexture2D(
+            GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+            this->frame_texture, 0);
+        this->frame_width = w;
+        this->frame_height = h;
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA,
+                    GL_UNSIGNED_BYTE, p_frame.pixels.data());
+}
+
+void GlRenderer::blit_display(const DisplayArea &p_area,
+                              const Scanout *p_frame) {
+    if (p_frame && (p_frame->width == 0 || p_frame->height == 0))
+        p_frame = nullptr;
+    // Before switching to the window framebuffer, the upload may
+    // create the frame FBO
+    if (p_frame)
+        this->upload_frame(*p_frame);
+
+    int fb_w, fb_h;
+    glfwGetFramebufferSize(this->window, &fb_w, &fb_h);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_SCISSOR_TEST);
+    glViewport(0, 0, fb_w, fb_h);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Largest 4:3 rectangle fitting in the window
+    GLint w = fb_w;
+    GLint h = fb_w * 3 / 4;
+    if (h > fb_h) {
+        h = fb_h;
+        w = fb_h * 4 / 3;
+    }
+    GLint x = (fb_w - w) / 2;
+    GLint y = (fb_h - h) / 2;
+
+    GLuint src_fbo = this->vram_fbo;
+    GLint src_x0, src_y0, src_x1, src_y1;
+    if (p_frame) {
+        src_fbo = this->frame_fbo;
+        src_x0 = 0;
+        src_y0 = 0;
+        src_x1 = GLint(p_frame->width);
+        src_y1 = GLint(p_frame->height);
+    } else {
+        // Clamp the source to VRAM, the blit doesn't wrap around
+        GLint s = GLint(this->scale);
+        src_x0 = p_area.x;
+        src_y0 = p_area.y;
+        src_x1 = src_x0 + p_area.width;
+        src_y1 = src_y0 + p_area.height;
+        if (src_x1 > GLint(VRam::WIDTH))
+            src_x1 = VRam::WIDTH;
+        if (src_y1 > GLint(VRam::HEIGHT))
+            src_y1 = VRam::HEIGHT;
+        src_x0 *= s;
+        src_y0 *= s;
+        src_x1 *= s;
+        src_y1 *= s;
+    }
+
+    // Line 0 is at the bottom of the texture, flip it
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src_fbo);
+    glBlitFramebuffer(src_x0, src_y0, src_x1, src_y1, x, y + h,
+                      x + w, y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+bool GlRenderer::key_down(int p_key) const {
+    return this->window != nullptr &&
+           glfwGetKey(this->window, p_key) == GLFW_PRESS;
+}
+
+bool GlRenderer::should_close() const {
+    return this->window != nullptr &&
+           glfwWindowShouldClose(this->window);
+}
+
+void GlRenderer::update() {
+    float currentFrame = glfwGetTime();
+    this->deltaTime = currentFrame - this->lastFrame;
+    this->lastFrame = currentFrame;
+
+    float elapsed_seconds = currentFrame - previousSecond;
+    if (elapsed_seconds > 1.0f) {
+        previousSecond = currentFrame;
+        this->fps = (int)(frameCount / elapsed_seconds);
+
+        frameCount = 0;
+    }
+    frameCount++;
+}
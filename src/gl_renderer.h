@@ -0,0 +1,165 @@
+#pragma once
+#include "gl_buffer.h"
+#include "GLFW/glfw3.h"
+#include "glad.h"
+#include "imgui.h"
+#include "renderer.h"
+#include "shader.h"
+#include "structs.h"
+#include "texture_cache.h"
+#include "vram.h"
+
+/// OpenGL renderer drawing into a scaled copy of VRAM. The context
+/// either comes from a GLFW window with the debug UI on top, or,
+/// in headless mode, from an offscreen EGL context (surfaceless
+/// when supported, e.g. Mesa llvmpipe) with nothing to show.
+///
+/// The context is made current on the constructing thread, which
+/// must be the one using the renderer: no entry point switches
+/// contexts. Several headless renderers can live in one process,
+/// each on its own thread. A window only works on the main
+/// thread (GLFW requires it, and the debug UI uses ImGui's
+/// global current context), so there is at most one. The
+/// constructor throws std::runtime_error for a window on another
+/// thread and for a second renderer on the same thread.
+struct GlRenderer : Renderer {
+    // Throws std::runtime_error when no context can be created
+    GlRenderer(bool p_headless);
+    ~GlRenderer() override;
+
+    // Draw what's left of the frame and show it
+    void present(const DisplayArea &p_area,
+                 const Scanout *p_frame) override;
+    void update();
+    // A GLFW key is held down in the window, never true headless
+    bool key_down(int p_key) const;
+    // The window was closed (or Escape pressed), never true
+    // headless
+    bool should_close() const;
+
+    // Offscreen context: no window, no UI, no event polling
+    bool headless;
+
+    GLuint vao;
+
+    StreamBuffer<Vertex> *vertices;
+
+    void push_triangle(const Vertex p_vertices[3]) override;
+    void push_quad(const Vertex p_vertices[4]) override;
+    void push_line(const Vertex p_vertices[2]) override;
+    // Space for p_count vertices, drawing the pending ones if the
+    // stream segment is full
+    Vertex *reserve(uint32_t p_count);
+    // Flush the batched primitives without presenting
+    void draw();
+
+    // Largest supported internal resolution multiplier
+    static constexpr uint32_t MAX_SCALE = 8;
+    // Internal resolution multiplier: emulated VRAM is rendered
+    // at (1024 * scale) x (512 * scale)
+    uint32_t scale;
+    // Scale requested from the debug UI, applied after the frame
+    uint32_t requested_scale;
+    // Emulated VRAM, target of every draw
+    GLuint vram_texture;
+    GLuint vram_fbo;
+    // Native resolution staging surface for CPU to VRAM uploads
+    GLuint upload_texture;
+    GLuint upload_fbo;
+
+    // GP0(E3)/GP0(E4) drawing area, inclusive
+    uint16_t area_left;
+    uint16_t area_top;
+    uint16_t area_right;
+    uint16_t area_bottom;
+    // GP0(E5) offset added to every vertex
+    int16_t offset_x;
+    int16_t offset_y;
+
+    void set_draw_area(uint16_t p_left, uint16_t p_top,
+                       uint16_t p_right,
+                       uint16_t p_bottom) override;
+    void set_draw_offset(int16_t p_x, int16_t p_y) override;
+    // Resample VRAM to a new internal resolution
+    void set_scale(uint32_t p_scale);
+    void fill_vram(uint16_t p_x, uint16_t p_y, uint16_t p_width,
+                   uint16_t p_height, Color p_color) override;
+    void upload_vram(const VRam &p_vram, uint32_t p_x,
+                     uint32_t p_y, uint32_t p_width,
+                     uint32_t p_height) override;
+    void read_vram(VRam &p_vram, uint32_t p_x, uint32_t p_y,
+                   uint32_t p_width, uint32_t p_height) override;
+    bool copy_vram(uint32_t p_src_x, uint32_t p_src_y,
+                   uint32_t p_dst_x, uint32_t p_dst_y,
+                   uint32_t p_width, uint32_t p_height) override;
+
+    void upload_texture_page(uint32_t p_slot,
+                             const uint16_t *p_texels) override;
+
+    // Decoded texture pages, one array layer per TextureCache
+    // slot, sampled as integers by the fragment shader
+    GLuint page_texture;
+    // Slots sampled by the batched primitives, one bit each
+    uint64_t pending_pages;
+    static_assert(TextureCache::SLOTS <= 64,
+                  "pending_pages has one bit per slot");
+
+    // Bounce surface for overlapping VRAM copies, grown on demand
+    GLuint scratch_texture;
+    GLuint scratch_fbo;
+    GLint scratch_width;
+    GLint scratch_height;
+
+    // CPU scanout of 24bit frames, shown instead of VRAM
+    GLuint frame_texture;
+    GLuint frame_fbo;
+    GLint frame_width;
+    GLint frame_height;
+
+    // VRAM region shown by the last presented frame
+    DisplayArea display;
+
+    // Only set when running in a window
+    GLFWwindow *window;
+    // Debug UI state of the window
+    ImGuiContext *imgui;
+    // EGLDisplay, EGLContext and EGLSurface of the headless
+    // context
+    void *egl_display;
+    void *egl_context;
+    void *egl_surface;
+
+    Shader *program;
+
+    const char *vendor;
+    const char *renderer;
+
+    float deltaTime = 0.0f;
+    float lastFrame = 0.0f;
+    float previousSecond = 0.0f;
+    int frameCount = 0;
+    int fps = 0;
+
+  private:
+    void create_window();
+    // Throws std::runtime_error when no EGL context is available
+    void create_headless_context();
+    // Drop this renderer's reference to GLFW or the EGL display
+    void release_platform();
+    // Destroy the window (and its UI) or the headless context,
+    // whatever of them exists, then release the platform
+    void close_context();
+    // Shaders, buffers and targets, once a context is current
+    void create_objects();
+    void create_vram_target();
+    // Bind VRAM as the draw target with its viewport and scissor
+    void bind_vram_target();
+    // Scale the displayed VRAM region, or p_frame when given, to
+    // the window
+    void blit_display(const DisplayArea &p_area,
+                      const Scanout *p_frame);
+    void upload_frame(const Scanout &p_frame);
+    void draw_debug_ui(const DisplayArea &p_area);
+    // Section timings, counters and graphs of the recent frames
+    void draw_perf_ui();
+};
@@ -1,12 +1,98 @@
 #include "gpu.h"
 #include "commandbuffer.h"
 #include "renderer.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <utility>
+
+// CPU cycles per scanline: 3413 (NTSC) or 3406 (PAL) GPU cycles
+// with the GPU clocked at 11/7 of the CPU
+static constexpr uint64_t NTSC_LINE_CYCLES = 2153;
+static constexpr uint64_t PAL_LINE_CYCLES = 2168;
+// Scanlines per frame, including blanking
+static constexpr uint32_t NTSC_LINES = 263;
+static constexpr uint32_t PAL_LINES = 314;
+
+template <uint8_t Op> static constexpr Gp0Command gp0_describe() {
+    void (GPU::*handler)(void) = &GPU::gp0_nop;
+    void (GPU::*next)(void) = nullptr;
+
+    if constexpr (Gp0Command::is_polygon(Op)) {
+        handler = &GPU::gp0_polygon<Op>;
+    } else if constexpr (Gp0Command::is_line(Op)) {
+        if constexpr (Gp0Command::attributes_of(Op) &
+                      Gp0Command::MULTI) {
+            handler = &GPU::gp0_polyline<Op>;
+            next = &GPU::gp0_polyline_next<Op>;
+        } else
+            handler = &GPU::gp0_line<Op>;
+    } else if constexpr (Gp0Command::is_rect(Op)) {
+        handler = &GPU::gp0_rect<Op>;
+    } else if constexpr (Op == 0x01) {
+        handler = &GPU::gp0_clear_cache;
+    } else if constexpr (Op == 0x02) {
+        handler = &GPU::gp0_fill_rect;
+    } else if constexpr (Op == 0x1f) {
+        handler = &GPU::gp0_irq;
+    } else if constexpr (Op >= 0x80 && Op < 0xa0) {
+        handler = &GPU::gp0_vram_copy;
+    } else if constexpr (Op >= 0xa0 && Op < 0xc0) {
+        handler = &GPU::gp0_image_load;
+    } else if constexpr (Op >= 0xc0 && Op < 0xe0) {
+        handler = &GPU::gp0_image_store;
+    } else if constexpr (Op == 0xe1) {
+        handler = &GPU::gp0_draw_mode;
+    } else if constexpr (Op == 0xe2) {
+        handler = &GPU::gp0_texture_window;
+    } else if constexpr (Op == 0xe3) {
+        handler = &GPU::gp0_drawing_area_top_left;
+    } else if constexpr (Op == 0xe4) {
+        handler = &GPU::gp0_drawing_area_bottom_right;
+    } else if constexpr (Op == 0xe5) {
+        handler = &GPU::gp0_drawing_offset;
+    } else if constexpr (Op == 0xe6) {
+        handler = &GPU::gp0_mask_bit_setting;
+    }
+    // Everything else (0x00, 0x03-0x1e, 0xe0, 0xe7-0xff) is a NOP
+
+    return Gp0Command{Gp0Command::length_of(Op),
+                      Gp0Command::is_variable(Op),
+                      Gp0Command::attributes_of(Op), handler,
+                      next};
+}
+
+template <size_t... Ops>
+static constexpr std::array<Gp0Command, 256>
+gp0_table(std::index_sequence<Ops...>) {
+    return {{gp0_describe<uint8_t(Ops)>()...}};
+}
+
+// Every GP0 opcode, indexed by the command word's top byte
+static constexpr std::array<Gp0Command, 256> GP0_COMMANDS =
+    gp0_table(std::make_index_sequence<256>());
+
+static_assert(GP0_COMMANDS[0x28].len == 5 &&
+                  GP0_COMMANDS[0x2c].len == 9 &&
+                  GP0_COMMANDS[0x30].len == 6 &&
+                  GP0_COMMANDS[0x38].len == 8 &&
+                  GP0_COMMANDS[0x3e].len == 12 &&
+                  GP0_COMMANDS[0x64].len == 4 &&
+                  GP0_COMMANDS[0x7d].len == 3,
+              "GP0 command lengths don't match the hardware");
+
+// Polyline vertices stop at the first 0x5xxx5xxx word
+static bool is_polyline_end(uint32_t p_val) {
+    return (p_val & 0xf000f000) == 0x50005000;
+}
 
-GPU::GPU(CommmandBuffer *p_commandbuffer) {
+GPU::GPU(CommmandBuffer *p_commandbuffer, Renderer *p_renderer)
+    : textures(&this->vram) {
     this->page_base_x = 0;
     this->page_base_y = 0;
     this->semi_transparency = 0;
@@ -17,6 +103,8 @@ GPU::GPU(CommmandBuffer *p_commandbuffer) {
     this->preserve_masked_pixels = false;
     this->field = Field::Top;
     this->texture_disable = false;
+    this->rectangle_texture_x_flip = false;
+    this->rectangle_texture_y_flip = false;
     this->hres = HorizontalRes::from_fields(0, 0);
     this->vres = VerticalRes::Y240Lines;
 
@@ -46,10 +134,23 @@ GPU::GPU(CommmandBuffer *p_commandbuffer) {
     this->display_line_end = 0x100;
 
     this->gp0_command_remaining = 0;
+    this->gp0_opcode = 0;
     this->gp0_command_ptr = nullptr;
     this->gp0_command = p_commandbuffer;
+    this->renderer = p_renderer;
+    this->perf = nullptr;
+    this->scanout_always = false;
+    this->trace = nullptr;
 
     this->gp0_mode = Gp0Mode::Command;
+    this->image_load = ImageTransfer{0, 0, 0, 0, 0, 0};
+    this->polyline_last = Vertex::from_gp0(0, 0);
+    this->image_store = ImageTransfer{0, 0, 0, 0, 0, 0};
+    this->image_store_remaining = 0;
+    this->gpuread = 0;
+
+    this->in_vblank = false;
+    this->frame_done = false;
 }
 
 uint32_t GPU::status() {
@@ -100,94 +201,61 @@ uint32_t GPU::status() {
     return r;
 }
 
-void GPU::gp0(uint32_t p_val) {
-    if (this->gp0_command_remaining == 0) {
-        uint32_t opcode = (p_val >> 24) & 0xff;
-
-        uint32_t len = 0;
-        void (GPU::*method)(void) = nullptr;
-
-        switch (opcode) {
-        case 0x2c:
-            len = 9;
-            method = &GPU::gp0_quad_texture_blend_opaque;
-            break;
-        case 0x30:
-            len = 6;
-            method = &GPU::gp0_triangle_shaded_opaque;
-            break;
-        case 0x38:
-            len = 8;
-            method = &GPU::gp0_quad_shaded_opaque;
-            break;
-        case 0xc0:
-            method = &GPU::gp0_image_store;
-            len = 3;
-            break;
-        case 0xa0:
-            len = 3;
-            method = &GPU::gp0_image_load;
-            break;
-        case 0x01:
-            len = 1;
-            method = &GPU::gp0_clear_cache;
-            break;
-        case 0x28:
-            len = 5;
-            method = &GPU::gp0_quad_mono_opaque;
-            break;
-        // NOP
-        case 0x0:
-            len = 1;
-            method = &GPU::gp0_nop;
-            break;
-        case 0xe1:
-            len = 1;
-            method = &GPU::gp0_draw_mode;
-            break;
-        case 0xe2:
-            len = 1;
-            method = &GPU::gp0_texture_window;
-            break;
-        case 0xe3:
-            len = 1;
-            method = &GPU::gp0_drawing_area_top_left;
-            break;
-        case 0xe4:
-            len = 1;
-            method = &GPU::gp0_drawing_area_bottom_right;
-            break;
-        case 0xe5:
-            len = 1;
-            method = &GPU::gp0_drawing_offset;
-            break;
-        case 0xe6:
-            len = 1;
-            method = &GPU::gp0_mask_bit_setting;
-            break;
-        default:
-            printf("Unhandled GP0 command: 0x%x\n", p_val);
-            std::exit(1);
-        }
-        this->gp0_command_remaining = len;
-        this->gp0_command_ptr = method;
-        this->gp0_command->clear();
+void GPU::record(GpuTracePort p_port, const uint8_t *p_words,
+                 uint32_t p_count) {
+    for (uint32_t i = 0; i < p_count; i++) {
+        uint32_t word;
+        memcpy(&word, p_words + i * 4, 4);
+        this->trace->push_back((uint32_t)p_port);
+        this->trace->push_back(word);
     }
+}
 
-    this->gp0_command_remaining -= 1;
+void GPU::gp0(uint32_t p_val) {
+    if (this->trace)
+        this->record(GpuTracePort::Gp0, (const uint8_t *)&p_val,
+                     1);
 
     switch (this->gp0_mode) {
     case Gp0Mode::Command:
+        if (this->gp0_command_remaining == 0) {
+            this->gp0_opcode = uint8_t(p_val >> 24);
+            const Gp0Command &command =
+                GP0_COMMANDS[this->gp0_opcode];
+            this->gp0_command_remaining = command.len;
+            this->gp0_command_ptr = command.handler;
+            this->gp0_command->clear();
+        }
         this->gp0_command->push_word(p_val);
+        this->gp0_command_remaining -= 1;
         if (this->gp0_command_remaining == 0)
             (this->*gp0_command_ptr)();
         break;
     case Gp0Mode::ImageLoad:
-        if (this->gp0_command_remaining == 0)
+        this->image_load_words((const uint8_t *)&p_val, 1);
+        break;
+    case Gp0Mode::PolyLine:
+        // The terminator takes the place of the next vertex's
+        // first word
+        if (this->gp0_command->length == 0 &&
+            is_polyline_end(p_val)) {
+            this->gp0_command_remaining = 0;
             this->gp0_mode = Gp0Mode::Command;
+            break;
+        }
+        this->gp0_command->push_word(p_val);
+        this->gp0_command_remaining -= 1;
+        if (this->gp0_command_remaining == 0)
+            (this->*gp0_command_ptr)();
+        break;
     }
 }
+
 void GPU::gp1(uint32_t p_val) {
+    if (this->trace)
+        this->record(GpuTracePort::Gp1, (const uint8_t *)&p_val,
+                     1);
+
     uint32_t opcode = (p_val >> 24) & 0xff;
     switch (opcode) {
     case 0x02:
@@ -223,15 +291,26 @@ void GPU::gp1(uint32_t p_val) {
     }
 }
 
-void GPU::gp0_image_load() {
-    // Parameters 2 contaains the image resolution
-    uint32_t res = (*this->gp0_command)[2];
+ImageTransfer GPU::transfer_rect(uint32_t p_pos,
+                                 uint32_t p_size) {
+    uint16_t x = p_pos & 0x3ff;
+    uint16_t y = (p_pos >> 16) & 0x1ff;
+
+    // A size of 0 means the full 1024x512 range
+    uint16_t width = (((p_size & 0xffff) - 1) & 0x3ff) + 1;
+    uint16_t height = (((p_size >> 16) - 1) & 0x1ff) + 1;
+
+    return ImageTransfer{x, y, width, height, 0, 0};
+}
 
-    uint16_t width = res & 0xffff;
-    uint16_t height = res >> 16;
+void GPU::gp0_image_load() {
+    // Parameter 1 contains the destination in VRAM, parameter 2
+    // the image resolution
+    CommmandBuffer &cmd = *this->gp0_command;
+    ImageTransfer t = this->transfer_rect(cmd[1], cmd[2]);
 
     // Size of the image in 16bit pixels
-    uint16_t imgsize = width * height;
+    uint32_t imgsize = uint32_t(t.width) * t.height;
 
     // If we hae an odd number of pixels we must round up
     // since we transfer 32bits at a time. There'll be 16bits
@@ -241,16 +320,80 @@ void GPU::gp0_image_load() {
     // Store number of words expected for this image
     this->gp0_command_remaining = imgsize / 2;
 
+    this->image_load = t;
+    this->vram.mark_rect(t.x, t.y, t.width, t.height);
+
     // Put the GP0 state machine in ImageLoad mode
     this->gp0_mode = Gp0Mode::ImageLoad;
 }
 
+void GPU::image_load_words(const uint8_t *p_src,
+                           uint32_t p_count) {
+    ImageTransfer &t = this->image_load;
+    uint16_t set_mask = this->force_set_mask_bit ? 0x8000 : 0;
+
+    // Padding halfword at the end of an odd sized image is
+    // dropped by the done() check
+    uint32_t pixels = p_count * 2;
+    while (pixels > 0 && !t.done()) {
+        uint32_t n = t.run(pixels);
+        this->vram.write_span(t.x + t.cur_x, t.y + t.cur_y, p_src,
+                              n, set_mask,
+                              this->preserve_masked_pixels);
+        p_src += n * sizeof(uint16_t);
+        pixels -= n;
+        t.advance(n);
+    }
+
+    this->gp0_command_remaining -= p_count;
+    if (this->gp0_command_remaining == 0) {
+        this->renderer->upload_vram(this->vram, t.x, t.y, t.width,
+                                    t.height);
+        this->gp0_mode = Gp0Mode::Command;
+    }
+}
+
 void GPU::gp0_image_store() {
-    uint32_t res = (*this->gp0_command)[2];
+    CommmandBuffer &cmd = *this->gp0_command;
+    ImageTransfer t = this->transfer_rect(cmd[1], cmd[2]);
+
+    // Drawn pixels only live in the renderer, bring them back
+    this->sync_vram(VRam::tiles_of(t.x, t.y, t.width, t.height));
 
-    uint16_t width = res & 0xffff;
-    uint16_t height = res >> 16;
-    printf("Unhandled image store: %dx%d\n", width, height);
+    this->image_store = t;
+    this->image_store_remaining =
+        (uint32_t(t.width) * t.height + 1) / 2;
+}
+
+void GPU::image_store_words(uint8_t *p_dst, uint32_t p_count) {
+    ImageTransfer &t = this->image_store;
+
+    if (p_count > this->image_store_remaining) {
+        // Reading past the end returns the latched value
+        uint32_t i = this->image_store_remaining;
+        for (; i < p_count; i++)
+            memcpy(p_dst + i * 4, &this->gpuread, 4);
+        p_count = this->image_store_remaining;
+    }
+    if (p_count == 0)
+        return;
+
+    uint8_t *dst = p_dst;
+    uint32_t pixels = p_count * 2;
+    while (pixels > 0 && !t.done()) {
+        uint32_t n = t.run(pixels);
+        this->vram.read_span(t.x + t.cur_x, t.y + t.cur_y, dst,
+                             n);
+        dst += n * sizeof(uint16_t);
+        pixels -= n;
+        t.advance(n);
+    }
+    // Padding of an odd sized image
+    if (pixels > 0)
+        memset(dst, 0, pixels * sizeof(uint16_t));
+
+    this->image_store_remaining -= p_count;
+    memcpy(&this->gpuread, p_dst + (p_count - 1) * 4, 4);
 }
 
 void GPU::gp0_texture_window() {
@@ -267,22 +410,32 @@ void GPU::gp0_drawing_area_top_left() {
     uint32_t p_val = (*this->gp0_command)[0];
     this->drawing_area_top = uint16_t((p_val >> 10) & 0x3ff);
     this->drawing_area_left = uint16_t(p_val & 0x3ff);
+    this->update_drawing_area();
 }
 
 void GPU::gp0_drawing_area_bottom_right() {
     uint32_t p_val = (*this->gp0_command)[0];
     this->drawing_area_bottom = uint16_t((p_val >> 10) & 0x3ff);
     this->drawing_area_right = uint16_t(p_val & 0x3ff);
+    this->update_drawing_area();
+}
+
+void GPU::update_drawing_area() {
+    this->renderer->set_draw_area(
+        this->drawing_area_left, this->drawing_area_top,
+        this->drawing_area_right, this->drawing_area_bottom);
 }
 
 void GPU::gp0_drawing_offset() {
-    this->renderer.render_loop();
     uint32_t p_val = (*this->gp0_command)[0];
     uint16_t x = uint16_t(p_val & 0x7ff);
     uint16_t y = uint16_t((p_val >> 11) & 0x7ff);
 
     this->drawing_x_offset = (int16_t(x << 5)) >> 5;
     this->drawing_y_offset = (int16_t(y << 5)) >> 5;
+
+    this->renderer->set_draw_offset(this->drawing_x_offset,
+                                   this->drawing_y_offset);
 }
 
 void GPU::gp0_mask_bit_setting() {
@@ -295,98 +448,336 @@ void GPU::gp0_clear_cache() { printf("GP0: Clear cache\n"); }
 
 void GPU::gp0_nop() { return; }
 
-void GPU::gp0_triangle_shaded_opaque() {
-    Position positions[3] = {
-        Position::from_gp0((*this->gp0_command)[1]),
-        Position::from_gp0((*this->gp0_command)[3]),
-        Position::from_gp0((*this->gp0_command)[5]),
-    };
-    Color colors[3] = {
-        Color::from_gp0((*this->gp0_command)[0]),
-        Color::from_gp0((*this->gp0_command)[2]),
-        Color::from_gp0((*this->gp0_command)[4]),
-    };
+void GPU::gp0_irq() { this->interrupt = true; }
+
+void GPU::gp0_fill_rect() {
+    CommmandBuffer &cmd = *this->gp0_command;
 
-    this->renderer.push_triangle(positions, colors);
+    // The position is in 16 pixel steps and the width rounded up
+    // to a multiple of 16. Fills ignore the drawing area, the
+    // drawing offset and the mask settings.
+    uint16_t x = uint16_t(cmd[1] & 0x3f0);
+    uint16_t y = uint16_t((cmd[1] >> 16) & 0x1ff);
+    uint16_t width = uint16_t(((cmd[2] & 0x3ff) + 0xf) & ~0xf);
+    uint16_t height = uint16_t((cmd[2] >> 16) & 0x1ff);
+
+    this->renderer->fill_vram(x, y, width, height,
+                              Color::from_gp0(cmd[0]));
+    this->vram.mark_drawn(x, y, width, height);
 }
 
-void GPU::gp0_quad_mono_opaque() {
-    Position positions[4] = {
-        Position::from_gp0((*this->gp0_command)[1]),
-        Position::from_gp0((*this->gp0_command)[2]),
-        Position::from_gp0((*this->gp0_command)[3]),
-        Position::from_gp0((*this->gp0_command)[4]),
-    };
+void GPU::gp0_vram_copy() {
+    CommmandBuffer &cmd = *this->gp0_command;
 
-    Color colors[4] = {
-        Color::from_gp0((*this->gp0_command)[0]),
-        Color::from_gp0((*this->gp0_command)[0]),
-        Color::from_gp0((*this->gp0_command)[0]),
-        Color::from_gp0((*this->gp0_command)[0]),
-    };
+    ImageTransfer src = this->transfer_rect(cmd[1], cmd[3]);
+    ImageTransfer dst = this->transfer_rect(cmd[2], cmd[3]);
+    uint16_t set_mask = this->force_set_mask_bit ? 0x8000 : 0;
+
+    VRam::TileSet src_tiles =
+        VRam::tiles_of(src.x, src.y, src.width, src.height);
+
+    // The renderer copies its own (possibly upscaled) pixels, the
+    // CPU copy keeps VRam in step for later transfers
+    bool done = this->renderer->copy_vram(
+        src.x, src.y, dst.x, dst.y, src.width, src.height);
+    if (!done)
+        this->sync_vram(src_tiles);
 
-    this->renderer.push_quad(positions, colors);
+    this->vram.copy_rect(src.x, src.y, dst.x, dst.y, src.width,
+                         src.height, set_mask,
+                         this->preserve_masked_pixels);
+
+    // Copying stale pixels leaves the destination stale too
+    if (done && (src_tiles & this->vram.stale).any())
+        this->vram.mark_drawn(dst.x, dst.y, dst.width,
+                              dst.height);
+
+    if (!done)
+        this->renderer->upload_vram(this->vram, dst.x, dst.y,
+                                    dst.width, dst.height);
 }
 
-void GPU::gp0_quad_shaded_opaque() {
-    Position positions[4] = {
-        Position::from_gp0((*this->gp0_command)[1]),
-        Position::from_gp0((*this->gp0_command)[3]),
-        Position::from_gp0((*this->gp0_command)[5]),
-        Position::from_gp0((*this->gp0_command)[7]),
-    };
+template <uint8_t Op> void GPU::gp0_polygon() {
+    constexpr uint8_t attr = Gp0Command::attributes_of(Op);
+    constexpr bool shaded = attr & Gp0Command::SHADED;
+    constexpr bool textured = attr & Gp0Command::TEXTURED;
+    constexpr uint32_t count = (attr & Gp0Command::MULTI) ? 4 : 3;
 
-    Color colors[4] = {
-        Color::from_gp0((*this->gp0_command)[0]),
-        Color::from_gp0((*this->gp0_command)[2]),
-        Color::from_gp0((*this->gp0_command)[4]),
-        Color::from_gp0((*this->gp0_command)[6]),
-    };
+    CommmandBuffer &cmd = *this->gp0_command;
+    Vertex vertices[count];
+
+    uint32_t word = 1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t color = cmd[0];
+        if (shaded && i > 0)
+            color = cmd[word++];
+
+        vertices[i] = Vertex::from_gp0(cmd[word++], color);
+        if constexpr (textured)
+            vertices[i].set_uv(cmd[word++]);
+    }
+
+    uint8_t flags = 0;
+    if constexpr (attr & Gp0Command::SEMI_TRANSPARENT)
+        flags |= VertexFlag::SemiTransparent;
+
+    if constexpr (textured) {
+        // CLUT and texture page ride in the top half of the
+        // first two UV words
+        uint16_t clut = uint16_t(cmd[2] >> 16);
+        uint16_t texpage = uint16_t(cmd[shaded ? 5 : 4] >> 16);
+        this->set_texpage(texpage);
+
+        flags |= VertexFlag::Textured;
+        if constexpr (attr & Gp0Command::RAW_TEXTURE)
+            flags |= VertexFlag::RawTexture;
+
+        uint16_t page = this->texture_page(texpage, clut);
+        for (Vertex &v : vertices) {
+            v.clut = clut;
+            v.texpage = texpage;
+            v.page = page;
+        }
+    }
+
+    for (Vertex &v : vertices)
+        v.flags = flags;
 
-    this->renderer.push_quad(positions, colors);
+    if constexpr (count == 4)
+        this->renderer->push_quad(vertices);
+    else
+        this->renderer->push_triangle(vertices);
+    this->mark_drawn(vertices, count, false);
+    perf_count(this->perf, PerfCounter::Primitives, 1);
 }
 
-void GPU::gp0_quad_texture_blend_opaque() {
-    Position positions[4] = {
-        Position::from_gp0((*this->gp0_command)[1]),
-        Position::from_gp0((*this->gp0_command)[3]),
-        Position::from_gp0((*this->gp0_command)[5]),
-        Position::from_gp0((*this->gp0_command)[7]),
+template <uint8_t Op> void GPU::gp0_line() {
+    constexpr uint8_t attr = Gp0Command::attributes_of(Op);
+    constexpr bool shaded = attr & Gp0Command::SHADED;
+
+    CommmandBuffer &cmd = *this->gp0_command;
+
+    uint8_t flags = 0;
+    if constexpr (attr & Gp0Command::SEMI_TRANSPARENT)
+        flags |= VertexFlag::SemiTransparent;
+
+    uint32_t end_color = shaded ? cmd[2] : cmd[0];
+    Vertex vertices[2] = {
+        Vertex::from_gp0(cmd[1], cmd[0]),
+        Vertex::from_gp0(cmd[shaded ? 3 : 2], end_color),
     };
+    vertices[0].flags = flags;
+    vertices[1].flags = flags;
+
+    this->renderer->push_line(vertices);
+    this->mark_drawn(vertices, 2, true);
+    perf_count(this->perf, PerfCounter::Primitives, 1);
+    this->polyline_last = vertices[1];
+}
 
-    Color color{0x80, 0x00, 0x00};
+template <uint8_t Op> void GPU::gp0_polyline() {
+    constexpr bool shaded =
+        Gp0Command::attributes_of(Op) & Gp0Command::SHADED;
 
-    Color colors[4];
-    std::fill(std::begin(colors), std::end(colors), color);
+    // First segment, then one vertex at a time
+    this->gp0_line<Op>();
 
-    this->renderer.push_quad(positions, colors);
+    this->gp0_mode = Gp0Mode::PolyLine;
+    this->gp0_command->clear();
+    this->gp0_command_remaining = shaded ? 2 : 1;
+    this->gp0_command_ptr = &GPU::gp0_polyline_next<Op>;
 }
 
-void GPU::gp0_draw_mode() {
-    uint32_t p_val = (*this->gp0_command)[0];
-    this->page_base_x = uint8_t(p_val & 0xf);
-    this->page_base_y = uint8_t((p_val >> 4) & 1);
-    this->semi_transparency = uint8_t((p_val >> 5) & 3);
+template <uint8_t Op> void GPU::gp0_polyline_next() {
+    constexpr bool shaded =
+        Gp0Command::attributes_of(Op) & Gp0Command::SHADED;
 
-    switch ((p_val >> 7) & 3) {
-    case 0:
-        this->texture_depth = TextureDepth::T4Bit;
-        break;
-    case 1:
-        this->texture_depth = TextureDepth::T8Bit;
-        break;
-    case 2:
-        this->texture_depth = TextureDepth::T15Bit;
-        break;
-    default:
-        printf("Unhandled textured depth: %d\n",
-               ((p_val >> 7) & 3));
-        std::terminate();
+    CommmandBuffer &cmd = *this->gp0_command;
+
+    Vertex vertices[2] = {this->polyline_last,
+                          this->polyline_last};
+    if constexpr (shaded) {
+        vertices[1].position = Position::from_gp0(cmd[1]);
+        vertices[1].color = Color::from_gp0(cmd[0]);
+    } else {
+        vertices[1].position = Position::from_gp0(cmd[0]);
     }
 
+    this->renderer->push_line(vertices);
+    this->mark_drawn(vertices, 2, true);
+    perf_count(this->perf, PerfCounter::Primitives, 1);
+    this->polyline_last = vertices[1];
+
+    this->gp0_command->clear();
+    this->gp0_command_remaining = shaded ? 2 : 1;
+}
+
+template <uint8_t Op> void GPU::gp0_rect() {
+    constexpr uint8_t attr = Gp0Command::attributes_of(Op);
+    constexpr bool textured = attr & Gp0Command::TEXTURED;
+    // 0: variable size, 1: 1x1, 2: 8x8, 3: 16x16
+    constexpr uint32_t size = (Op >> 3) & 3;
+
+    CommmandBuffer &cmd = *this->gp0_command;
+
+    int16_t width = size == 1 ? 1 : size == 2 ? 8 : 16;
+    int16_t height = width;
+    if constexpr (size == 0) {
+        uint32_t val = cmd[textured ? 3 : 2];
+        width = int16_t(val & 0x3ff);
+        height = int16_t((val >> 16) & 0x1ff);
+    }
+    if (width == 0 || height == 0)
+        return;
+
+    Vertex v = Vertex::from_gp0(cmd[1], cmd[0]);
+    if constexpr (attr & Gp0Command::SEMI_TRANSPARENT)
+        v.flags |= VertexFlag::SemiTransparent;
+
+    // Corners in push_quad order: top-left, top-right,
+    // bottom-left, bottom-right
+    Vertex vertices[4] = {v, v, v, v};
+    vertices[1].position.x += width;
+    vertices[2].position.y += height;
+    vertices[3].position.x += width;
+    vertices[3].position.y += height;
+
+    if constexpr (textured) {
+        // Rectangles use the current draw mode texture page
+        uint16_t texpage = this->texpage();
+        uint16_t clut = uint16_t(cmd[2] >> 16);
+        uint16_t page = this->texture_page(texpage, clut);
+
+        int16_t du =
+            this->rectangle_texture_x_flip ? -width : width;
+        int16_t dv =
+            this->rectangle_texture_y_flip ? -height : height;
+        for (uint32_t i = 0; i < 4; i++) {
+            Vertex &c = vertices[i];
+            c.set_uv(cmd[2]);
+            c.u = uint8_t(c.u + ((i & 1) ? du : 0));
+            c.v = uint8_t(c.v + ((i & 2) ? dv : 0));
+            c.clut = clut;
+            c.texpage = texpage;
+            c.page = page;
+            c.flags |= VertexFlag::Textured;
+            if constexpr (attr & Gp0Command::RAW_TEXTURE)
+                c.flags |= VertexFlag::RawTexture;
+        }
+    }
+
+    this->renderer->push_quad(vertices);
+    this->mark_drawn(vertices, 4, false);
+    perf_count(this->perf, PerfCounter::Primitives, 1);
+}
+
+uint16_t GPU::texture_page(uint16_t p_texpage, uint16_t p_clut) {
+    bool miss = false;
+    uint32_t slot =
+        this->textures.lookup(p_texpage, p_clut, miss);
+    if (miss) {
+        PerfScope scope(this->perf, PerfSection::Raster);
+        const TextureCache::Entry &e = this->textures.entry(slot);
+        // Render to texture: pixels drawn under the page have to
+        // come back from the renderer first
+        this->sync_vram(e.tiles);
+        this->textures.decode(slot);
+        this->renderer->upload_texture_page(slot, e.texels);
+    }
+    return uint16_t(slot);
+}
+
+// Pixel rectangle covering a non-empty tile set
+static void bounding_box(const VRam::TileSet &p_tiles,
+                         uint32_t &p_x, uint32_t &p_y,
+                         uint32_t &p_width, uint32_t &p_height) {
+    uint32_t tx0 = VRam::TILES_X, ty0 = VRam::TILES_Y;
+    uint32_t tx1 = 0, ty1 = 0;
+    for (uint32_t i = 0; i < VRam::TILE_COUNT; i++) {
+        if (!p_tiles[i])
+            continue;
+        uint32_t tx = i % VRam::TILES_X;
+        uint32_t ty = i / VRam::TILES_X;
+        tx0 = std::min(tx0, tx);
+        ty0 = std::min(ty0, ty);
+        tx1 = std::max(tx1, tx);
+        ty1 = std::max(ty1, ty);
+    }
+
+    p_x = tx0 << VRam::TILE_SHIFT_X;
+    p_y = ty0 << VRam::TILE_SHIFT_Y;
+    p_width = (tx1 - tx0 + 1) << VRam::TILE_SHIFT_X;
+    p_height = (ty1 - ty0 + 1) << VRam::TILE_SHIFT_Y;
+}
+
+void GPU::sync_vram(const VRam::TileSet &p_tiles) {
+    VRam::TileSet tiles = p_tiles & this->vram.stale;
+    if (tiles.none())
+        return;
+
+    // Each readback waits for the renderer, so fetch the
+    // bounding box of the stale tiles in one go
+    uint32_t x, y, width, height;
+    bounding_box(tiles, x, y, width, height);
+    this->renderer->read_vram(this->vram, x, y, width, height);
+    this->vram.stale &= ~VRam::tiles_of(x, y, width, height);
+}
+
+void GPU::mark_drawn(const Vertex *p_vertices, uint32_t p_count,
+                     bool p_line) {
+    int32_t x0 = INT32_MAX, y0 = INT32_MAX;
+    int32_t x1 = INT32_MIN, y1 = INT32_MIN;
+    for (uint32_t i = 0; i < p_count; i++) {
+        const Position &p = p_vertices[i].position;
+        int32_t x = p.x + this->drawing_x_offset;
+        int32_t y = p.y + this->drawing_y_offset;
+        x0 = std::min(x0, x);
+        y0 = std::min(y0, y);
+        x1 = std::max(x1, x);
+        y1 = std::max(y1, y);
+    }
+
+    if (!p_line) {
+        x1 -= 1;
+        y1 -= 1;
+    }
+
+    x0 = std::max(x0, int32_t(this->drawing_area_left));
+    y0 = std::max(y0, int32_t(this->drawing_area_top));
+    x1 = std::min(x1, int32_t(this->drawing_area_right));
+    y1 = std::min(y1, int32_t(this->drawing_area_bottom));
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    this->vram.mark_drawn(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+void GPU::set_texpage(uint16_t p_texpage) {
+    this->page_base_x = uint8_t(p_texpage & 0xf);
+    this->page_base_y = uint8_t((p_texpage >> 4) & 1);
+    this->semi_transparency = uint8_t((p_texpage >> 5) & 3);
+    // Depth 3 is reserved and behaves like 15 bits
+    uint32_t depth = (p_texpage >> 7) & 3;
+    this->texture_depth =
+        depth >= 2 ? TextureDepth::T15Bit : TextureDepth(depth);
+    this->texture_disable = ((p_texpage >> 11) & 1) != 0;
+}
+
+uint16_t GPU::texpage() const {
+    return uint16_t(this->page_base_x) |
+           uint16_t(this->page_base_y) << 4 |
+           uint16_t(this->semi_transparency) << 5 |
+           uint16_t(this->texture_depth) << 7 |
+           uint16_t(this->texture_disable) << 11;
+}
+
+void GPU::gp0_draw_mode() {
+    uint32_t p_val = (*this->gp0_command)[0];
+    // Same texpage bits as a textured polygon's
+    this->set_texpage(uint16_t(p_val));
+
     this->dithering = ((p_val >> 9) & 1) != 0;
     this->draw_to_display = ((p_val >> 10) & 1) != 0;
-    this->texture_disable = ((p_val >> 11) & 1) != 0;
     this->rectangle_texture_x_flip = ((p_val >> 12) & 1) != 0;
     this->rectangle_texture_y_flip = ((p_val >> 13) & 1) != 0;
 }
@@ -431,6 +822,9 @@ void GPU::gp1_reset(uint32_t p_val) {
     this->display_horiz_end = 0xc00;
     this->display_line_start = 0x10;
     this->display_line_end = 0x100;
+
+    this->update_drawing_area();
+    this->renderer->set_draw_offset(0, 0);
 }
 
 void GPU::gp1_reset_command_buffer() {
@@ -446,14 +840,14 @@ void GPU::gp1_display_mode(uint32_t p_val) {
     this->hres = HorizontalRes::from_fields(hr1, hr2);
 
     if ((p_val & 0x4) != 0)
-        this->vres = VerticalRes::Y240Lines;
-    else
         this->vres = VerticalRes::Y480Lines;
+    else
+        this->vres = VerticalRes::Y240Lines;
 
     if ((p_val & 0x8) != 0)
-        this->vmode = VMode::Ntsc;
-    else
         this->vmode = VMode::Pal;
+    else
+        this->vmode = VMode::Ntsc;
 
     if ((p_val & 0x10) != 0)
         this->display_depth = DisplayDepth::D24Bits;
@@ -499,4 +893,152 @@ void GPU::gp1_display_vertical_range(uint32_t p_val) {
     this->display_line_end = uint16_t((p_val >> 10) & 0x3ff);
 }
 
-uint32_t GPU::read() { return 0; }
+uint32_t GPU::read() {
+    uint32_t word = this->gpuread;
+    if (this->image_store_remaining > 0)
+        this->image_store_words((uint8_t *)&word, 1);
+    return word;
+}
+
+uint32_t GPU::frame_lines() {
+    return this->vmode == VMode::Ntsc ? NTSC_LINES : PAL_LINES;
+}
+
+uint32_t GPU::active_lines() {
+    uint32_t total = this->frame_lines();
+    uint32_t start = this->display_line_start;
+    uint32_t end = this->display_line_end;
+
+    if (end > total)
+        end = total;
+    // Nonsensical range, fall back to the standard picture
+    if (end <= start)
+        return this->vmode == VMode::Ntsc ? 240 : 288;
+
+    return end - start;
+}
+
+uint64_t GPU::line_cycles() {
+    return this->vmode == VMode::Ntsc ? NTSC_LINE_CYCLES
+                                      : PAL_LINE_CYCLES;
+}
+
+bool GPU::step_timing(uint64_t &p_delay) {
+    uint32_t total = this->frame_lines();
+    uint32_t active = this->active_lines();
+
+    this->in_vblank = !this->in_vblank;
+
+    if (!this->in_vblank) {
+        p_delay = active * this->line_cycles();
+        return false;
+    }
+
+    p_delay = (total - active) * this->line_cycles();
+
+    if (this->interlaced) {
+        this->field =
+            this->field == Field::Top ? Field::Bottom : Field::Top;
+    }
+    this->frame_done = true;
+    if (this->trace) {
+        uint32_t unused = 0;
+        this->record(GpuTracePort::VBlank,
+                     (const uint8_t *)&unused, 1);
+    }
+    return true;
+}
+
+DisplayArea GPU::display_area() {
+    // Dotclock divider for each horizontal resolution
+    static constexpr uint16_t dividers[] = {10, 8, 5, 4};
+
+    uint16_t divider = (this->hres.value & 1)
+                           ? 7
+                           : dividers[(this->hres.value >> 1) & 3];
+
+    uint32_t cycles = 2560;
+    if (this->display_horiz_end > this->display_horiz_start)
+        cycles = this->display_horiz_end - this->display_horiz_start;
+
+    // Widths are rounded to a multiple of 4 pixels
+    uint16_t width = uint16_t(((cycles / divider) + 2) & ~3);
+
+    uint16_t height = uint16_t(this->active_lines());
+    if (this->vres == VerticalRes::Y480Lines && this->interlaced)
+        height *= 2;
+
+    return DisplayArea{this->display_vram_x_start,
+                       this->display_vram_y_start, width, height,
+                       this->display_depth == DisplayDepth::D24Bits};
+}
+
+void GPU::present() {
+    PerfScope scope(this->perf, PerfSection::Present);
+    DisplayArea area = this->display_area();
+
+    const Scanout *frame = nullptr;
+    if (area.depth24 || this->scanout_always) {
+        // 24bit rows span 1.5 VRAM pixels per output pixel
+        uint32_t span =
+            area.depth24 ? (area.width * 3 + 1) / 2 : area.width;
+        this->sync_vram(
+            VRam::tiles_of(area.x, area.y, span, area.height));
+        this->scanout.convert(this->vram, area);
+        frame = &this->scanout;
+    }
+
+    this->renderer->present(area, frame);
+}
+
+void GPU::load_vram(const uint8_t *p_data) {
+    constexpr uint32_t TILE_WIDTH = 1 << VRam::TILE_SHIFT_X;
+    constexpr uint32_t TILE_HEIGHT = 1 << VRam::TILE_SHIFT_Y;
+
+    // The renderer's copy differs from the CPU side one on the
+    // tiles drawn since the last readback, and from the saved
+    // one wherever the CPU side differs too
+    VRam::TileSet changed = this->vram.stale;
+    for (uint32_t tile = 0; tile < VRam::TILE_COUNT; tile++) {
+        if (changed[tile])
+            continue;
+        uint32_t x = (tile % VRam::TILES_X) * TILE_WIDTH;
+        uint32_t y = (tile / VRam::TILES_X) * TILE_HEIGHT;
+        for (uint32_t row = y; row < y + TILE_HEIGHT; row++) {
+            uint32_t i = VRam::index(x, row);
+            if (memcmp(&this->vram.data[i], p_data + i * 2,
+                       TILE_WIDTH * 2) != 0) {
+                changed.set(tile);
+                break;
+            }
+        }
+    }
+
+    memcpy(this->vram.data, p_data, sizeof(this->vram.data));
+    this->vram.stale.reset();
+    this->refresh_renderer(changed);
+}
+
+void GPU::refresh_renderer(const VRam::TileSet &p_tiles) {
+    if (p_tiles.none())
+        return;
+
+    for (uint32_t tile = 0; tile < VRam::TILE_COUNT; tile++)
+        if (p_tiles[tile])
+            this->vram.dirty.mark(tile);
+    uint32_t x, y, width, height;
+    bounding_box(p_tiles, x, y, width, height);
+    this->renderer->upload_vram(this->vram, x, y, width, height);
+    this->vram.stale &= ~VRam::tiles_of(x, y, width, height);
+}
+
+void GPU::reload() {
+    const Gp0Command &command = GP0_COMMANDS[this->gp0_opcode];
+    this->gp0_command_ptr = this->gp0_mode == Gp0Mode::PolyLine
+                                ? command.next
+                                : command.handler;
+
+    this->update_drawing_area();
+    this->renderer->set_draw_offset(this->drawing_x_offset,
+                                    this->drawing_y_offset);
+}
@@ -1,7 +1,12 @@
 #pragma once
 #include "commandbuffer.h"
 #include <cstdint>
+#include "perf.h"
 #include "renderer.h"
+#include "scanout.h"
+#include "texture_cache.h"
+#include "vram.h"
+#include <vector>
 
 /// Depth of the pixel values in a texture page
 enum TextureDepth : uint32_t {
@@ -71,11 +76,137 @@ enum Gp0Mode {
     Command,
     // Loading an image into VRAM
     ImageLoad,
+    // Receiving polyline vertices until the terminator word
+    PolyLine,
 };
 
-struct Poisition {
-    GLshort x;
-    GLshort y;
+// Rectangle targeted by a CPU to VRAM image load or a VRAM to
+// CPU image store
+struct ImageTransfer {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    // Next pixel to be transferred, relative to (x, y)
+    uint16_t cur_x;
+    uint16_t cur_y;
+
+    bool done() const { return this->cur_y >= this->height; }
+
+    // Length of the next contiguous run of at most p_max pixels:
+    // it stops at the end of the rectangle row and at the right
+    // edge of VRAM
+    uint32_t run(uint32_t p_max) const {
+        uint32_t n = this->width - this->cur_x;
+        uint32_t edge =
+            VRam::WIDTH - (this->x + this->cur_x) % VRam::WIDTH;
+        if (n > edge)
+            n = edge;
+        return n < p_max ? n : p_max;
+    }
+
+    void advance(uint32_t p_count) {
+        this->cur_x += p_count;
+        if (this->cur_x == this->width) {
+            this->cur_x = 0;
+            this->cur_y += 1;
+        }
+    }
+};
+
+/// Entries of a recorded GPU trace
+enum class GpuTracePort : uint32_t {
+    Gp0 = 0,
+    Gp1 = 1,
+    // Start of vertical blanking, the value is unused
+    VBlank = 2,
+};
+
+struct GPU;
+
+/// Static description of a GP0 opcode, see GP0_COMMANDS in gpu.cc
+struct Gp0Command {
+    // Attribute bits, decoded from the opcode
+    static constexpr uint8_t SHADED = 1 << 0;
+    static constexpr uint8_t TEXTURED = 1 << 1;
+    static constexpr uint8_t SEMI_TRANSPARENT = 1 << 2;
+    // Texels aren't modulated by the vertex color
+    static constexpr uint8_t RAW_TEXTURE = 1 << 3;
+    // Quad for polygons, polyline for lines
+    static constexpr uint8_t MULTI = 1 << 4;
+
+    // Words making up the command, opcode included. For variable
+    // length commands (polylines, image loads) only the fixed
+    // part.
+    uint8_t len;
+    bool variable;
+    uint8_t attributes;
+    // Called once the len words are in the command buffer
+    void (GPU::*handler)(void);
+    // Polylines: called for each vertex after the first segment
+    void (GPU::*next)(void);
+
+    static constexpr bool is_polygon(uint8_t p_op) {
+        return p_op >= 0x20 && p_op < 0x40;
+    }
+    static constexpr bool is_line(uint8_t p_op) {
+        return p_op >= 0x40 && p_op < 0x60;
+    }
+    static constexpr bool is_rect(uint8_t p_op) {
+        return p_op >= 0x60 && p_op < 0x80;
+    }
+
+    static constexpr uint8_t attributes_of(uint8_t p_op) {
+        if (!is_polygon(p_op) && !is_line(p_op) && !is_rect(p_op))
+            return 0;
+
+        uint8_t attr = 0;
+        // Lines are never textured, rectangles never shaded
+        if ((p_op & 0x10) && !is_rect(p_op))
+            attr |= SHADED;
+        if ((p_op & 0x08) && !is_rect(p_op))
+            attr |= MULTI;
+        if ((p_op & 0x04) && !is_line(p_op))
+            attr |= TEXTURED;
+        if (p_op & 0x02)
+            attr |= SEMI_TRANSPARENT;
+        if ((p_op & 0x01) && (attr & TEXTURED))
+            attr |= RAW_TEXTURE;
+        return attr;
+    }
+
+    static constexpr uint8_t length_of(uint8_t p_op) {
+        uint8_t attr = attributes_of(p_op);
+        bool shaded = attr & SHADED;
+        bool textured = attr & TEXTURED;
+
+        if (is_polygon(p_op)) {
+            uint8_t n = (attr & MULTI) ? 4 : 3;
+            // Color and first vertex, then for every vertex its
+            // position, UV word and (but the first) color
+            return 1 + n * (1 + textured) + (shaded ? n - 1 : 0);
+        }
+        if (is_line(p_op))
+            // First segment for polylines
+            return 3 + shaded;
+        if (is_rect(p_op)) {
+            bool sized = ((p_op >> 3) & 3) == 0;
+            return 2 + textured + sized;
+        }
+        if (p_op == 0x02)
+            return 3;
+        if (p_op >= 0x80 && p_op < 0xa0)
+            return 4;
+        if (p_op >= 0xa0 && p_op < 0xe0)
+            return 3;
+        return 1;
+    }
+
+    static constexpr bool is_variable(uint8_t p_op) {
+        return (is_line(p_op) &&
+                (attributes_of(p_op) & MULTI)) ||
+               (p_op >= 0xa0 && p_op < 0xc0);
+    }
 };
 
 struct GPU {
@@ -133,37 +264,112 @@ struct GPU {
     uint16_t display_line_start;
     uint16_t display_line_end;
 
-    Renderer renderer;
-
-    GPU(CommmandBuffer *);
+    // Video output is in vertical blanking
+    bool in_vblank;
+    // Raised at the start of every vertical blanking, the
+    // frontend presents the frame and clears it
+    bool frame_done;
+
+    // Backend the primitives are forwarded to, owned by the
+    // frontend
+    Renderer *renderer;
+    // Timing and counters, optional and owned by the frontend
+    Perf *perf;
+
+    VRam vram;
+    // Decoded texture pages, sampled by the renderer through the
+    // slot stored in Vertex::page
+    TextureCache textures;
+    // Destination of the image load in progress
+    ImageTransfer image_load;
+    // Source of the image store being read through GPUREAD
+    ImageTransfer image_store;
+    // Words left to read from the image store
+    uint32_t image_store_remaining;
+    // GPUREAD latch, returned again once the store is over
+    uint32_t gpuread;
+    // Video output converted to RGBA8 for CPU consumers
+    Scanout scanout;
+    // Convert every frame (frame dumps, hashes), not only the
+    // 24bit ones
+    bool scanout_always;
+    // Last vertex of the polyline being received
+    Vertex polyline_last;
+    // When set, every word written to GP0 or GP1 is appended as a
+    // (port, value) pair, see GpuTracePort. Used to record
+    // benchmark workloads.
+    std::vector<uint32_t> *trace;
+
+    GPU(CommmandBuffer *, Renderer *);
     ~GPU() = default;
 
     // Buffer containing the current GP0 command
     CommmandBuffer *gp0_command;
     // Remaining words for the current GP0 command
     uint32_t gp0_command_remaining;
+    // Opcode of the current GP0 command, gp0_command_ptr is
+    // derived from it when a state is loaded
+    uint8_t gp0_opcode;
     // Pointer to the method implementing the current GPX commnad
     void (GPU::*gp0_command_ptr)(void);
 
     uint32_t status();
     void gp0(uint32_t p_val);
     void gp1(uint32_t p_val);
+    // Append p_count words written to p_port to the trace
+    void record(GpuTracePort p_port, const uint8_t *p_words,
+                uint32_t p_count);
 
     void gp0_draw_mode();
     void gp0_drawing_area_top_left();
     void gp0_drawing_area_bottom_right();
     void gp0_drawing_offset();
+    // Forward the drawing area registers to the renderer
+    void update_drawing_area();
     void gp0_texture_window();
     void gp0_mask_bit_setting();
     void gp0_nop();
     void gp0_clear_cache();
+    void gp0_irq();
+    void gp0_fill_rect();
+    void gp0_vram_copy();
     void gp0_image_load();
     void gp0_image_store();
-
-    void gp0_quad_mono_opaque();
-    void gp0_quad_shaded_opaque();
-    void gp0_triangle_shaded_opaque();
-    void gp0_quad_texture_blend_opaque();
+    // Feed p_count words of image load data (at most
+    // gp0_command_remaining), written to VRAM row by row. Used by
+    // gp0() and directly by GPU DMA.
+    void image_load_words(const uint8_t *p_src, uint32_t p_count);
+    // Read p_count GPUREAD words of the image store in progress
+    void image_store_words(uint8_t *p_dst, uint32_t p_count);
+    // Parse the position and size words of a transfer command
+    ImageTransfer transfer_rect(uint32_t p_pos, uint32_t p_size);
+
+    // Drawing commands, specialised on the opcode so that the
+    // attribute tests and word offsets are resolved at compile
+    // time
+    template <uint8_t Op> void gp0_polygon();
+    template <uint8_t Op> void gp0_line();
+    template <uint8_t Op> void gp0_polyline();
+    template <uint8_t Op> void gp0_polyline_next();
+    template <uint8_t Op> void gp0_rect();
+
+    // Texture page attribute of a textured polygon or bits 0-11
+    // of GP0(E1), also updates the draw mode
+    void set_texpage(uint16_t p_texpage);
+    // Texture cache slot for a page and CLUT, handing freshly
+    // decoded pages to the renderer
+    uint16_t texture_page(uint16_t p_texpage, uint16_t p_clut);
+    // Read back the stale tiles among p_tiles so that the CPU
+    // side VRam can be used there
+    void sync_vram(const VRam::TileSet &p_tiles);
+    // Flag the area covered by a primitive, drawing offset
+    // applied and clipped to the drawing area. Lines cover their
+    // end points, polygons and rectangles stop short of their
+    // right and bottom edges.
+    void mark_drawn(const Vertex *p_vertices, uint32_t p_count,
+                    bool p_line);
+    // Current draw mode in the texture page attribute encoding
+    uint16_t texpage() const;
 
     void gp1_reset(uint32_t p_val);
     void gp1_acknowledge_irq();
@@ -175,5 +381,89 @@ struct GPU {
     void gp1_display_vertical_range(uint32_t p_val);
     void gp1_reset_command_buffer();
 
+    // GPUREAD
     uint32_t read();
+
+    // Move to the next video timing phase (start or end of
+    // vertical blanking). Returns true when blanking starts and
+    // sets p_delay to the CPU cycles until the following phase.
+    bool step_timing(uint64_t &p_delay);
+    uint32_t frame_lines();
+    uint32_t active_lines();
+    uint64_t line_cycles();
+
+    DisplayArea display_area();
+    // Show the frame accumulated since the last vertical
+    // blanking
+    void present();
+
+    // Save state fields, see SaveState. VRAM is saved from the
+    // CPU side copy, call sync_vram(vram.stale) first.
+    template <class V> void serialize(V &p_v) {
+        p_v.section("GPU ");
+        p_v.value(this->page_base_x);
+        p_v.value(this->page_base_y);
+        p_v.value(this->semi_transparency);
+        p_v.value(this->texture_depth);
+        p_v.value(this->dithering);
+        p_v.value(this->draw_to_display);
+        p_v.value(this->force_set_mask_bit);
+        p_v.value(this->texture_disable);
+        p_v.value(this->preserve_masked_pixels);
+        p_v.value(this->rectangle_texture_x_flip);
+        p_v.value(this->rectangle_texture_y_flip);
+        p_v.value(this->field);
+        p_v.value(this->vres);
+        p_v.value(this->hres);
+        p_v.value(this->vmode);
+        p_v.value(this->gp0_mode);
+        p_v.value(this->display_depth);
+        p_v.value(this->interlaced);
+        p_v.value(this->display_disabled);
+        p_v.value(this->interrupt);
+        p_v.value(this->dma_direction);
+        p_v.value(this->texture_window_x_mask);
+        p_v.value(this->texture_window_y_mask);
+        p_v.value(this->texture_window_x_offset);
+        p_v.value(this->texture_window_y_offset);
+        p_v.value(this->drawing_area_left);
+        p_v.value(this->drawing_area_top);
+        p_v.value(this->drawing_area_right);
+        p_v.value(this->drawing_area_bottom);
+        p_v.value(this->drawing_x_offset);
+        p_v.value(this->drawing_y_offset);
+        p_v.value(this->display_vram_x_start);
+        p_v.value(this->display_vram_y_start);
+        p_v.value(this->display_horiz_start);
+        p_v.value(this->display_horiz_end);
+        p_v.value(this->display_line_start);
+        p_v.value(this->display_line_end);
+        p_v.value(this->in_vblank);
+        p_v.value(this->frame_done);
+        p_v.value(this->image_load);
+        p_v.value(this->image_store);
+        p_v.value(this->image_store_remaining);
+        p_v.value(this->gpuread);
+        p_v.value(this->polyline_last);
+        p_v.value(this->gp0_command_remaining);
+        p_v.value(this->gp0_opcode);
+
+        p_v.section("VRAM");
+        if constexpr (V::LOADING) {
+            this->load_vram(p_v.take(sizeof(this->vram.data)));
+            this->reload();
+        } else {
+            p_v.bytes(this->vram.data, sizeof(this->vram.data));
+        }
+    }
+    // Replace VRAM with a saved copy. Only the tiles that differ
+    // from the renderer's are uploaded and dropped from the
+    // texture cache, so states taken every frame stay cheap.
+    void load_vram(const uint8_t *p_data);
+    // Hand the CPU side pixels of p_tiles to the renderer,
+    // dropping the texture pages decoded from them
+    void refresh_renderer(const VRam::TileSet &p_tiles);
+    // Bring the command handler and the renderer's drawing
+    // registers in line with freshly loaded fields
+    void reload();
 };
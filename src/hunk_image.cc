@@ -0,0 +1,274 @@
+#include "hunk_image.h"
+#include "disc.h"
+#include "lz.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static constexpr uint32_t NO_HUNK = UINT32_MAX;
+
+HunkImage::HunkImage(std::span<const uint8_t> p_file)
+    : file(p_file), pool(WORKERS) {
+    if (p_file.size() < sizeof(HunkHeader))
+        throw std::runtime_error("Truncated compressed disc");
+    memcpy(&this->head, p_file.data(), sizeof(HunkHeader));
+    if (memcmp(this->head.magic, HunkHeader::MAGIC,
+               sizeof(this->head.magic)) != 0)
+        throw std::runtime_error("Not a compressed disc");
+    if (this->head.version != HUNK_VERSION)
+        throw std::runtime_error(
+            "Unsupported compressed disc version " +
+            std::to_string(this->head.version));
+    uint32_t hunk_sectors = this->head.hunk_sectors;
+    if (hunk_sectors == 0 || hunk_sectors > 64 ||
+        this->head.sectors == 0 || this->head.tracks == 0 ||
+        this->head.tracks > 99)
+        throw std::runtime_error("Bad compressed disc header");
+
+    this->hunks =
+        (this->head.sectors + hunk_sectors - 1) / hunk_sectors;
+    size_t tracks_at = sizeof(HunkHeader);
+    size_t index_at =
+        tracks_at + this->head.tracks * sizeof(HunkTrack);
+    size_t data_at =
+        index_at + (size_t(this->hunks) + 1) * sizeof(uint64_t);
+    if (p_file.size() < data_at)
+        throw std::runtime_error("Truncated compressed disc");
+    this->track_table = {
+        (const HunkTrack *)(p_file.data() + tracks_at),
+        this->head.tracks};
+    this->offsets = (const uint64_t *)(p_file.data() + index_at);
+
+    // Checked once here, reads trust the index
+    for (uint32_t i = 0; i < this->hunks; i++) {
+        uint64_t first = this->offsets[i];
+        uint64_t last = this->offsets[i + 1];
+        if (first < data_at || first > last ||
+            last > p_file.size() ||
+            last - first > lz_bound(this->hunk_bytes(i)))
+            throw std::runtime_error("Bad compressed disc index");
+    }
+    uint32_t end = 0;
+    for (const HunkTrack &t : this->track_table) {
+        if (t.pregap != end || t.start < t.pregap ||
+            t.end <= t.start ||
+            t.type > uint8_t(TrackType::Mode2))
+            throw std::runtime_error("Bad compressed disc track");
+        end = t.end;
+    }
+    if (end != this->head.sectors)
+        throw std::runtime_error("Bad compressed disc track");
+
+    for (Entry &e : this->entries) {
+        e.hunk = NO_HUNK;
+        e.state = HunkState::Empty;
+        e.used = 0;
+        e.data.resize(size_t(hunk_sectors) * Disc::SECTOR_SIZE);
+    }
+    this->clock = 0;
+}
+
+uint32_t HunkImage::hunk_bytes(uint32_t p_hunk) const {
+    uint32_t first = p_hunk * this->head.hunk_sectors;
+    uint32_t count = this->head.sectors - first;
+    if (count > this->head.hunk_sectors)
+        count = this->head.hunk_sectors;
+    return count * Disc::SECTOR_SIZE;
+}
+
+void HunkImage::decompress(uint32_t p_hunk,
+                           uint8_t *p_dst) const {
+    uint64_t at = this->offsets[p_hunk];
+    const uint8_t *src = this->file.data() + at;
+    size_t size = this->offsets[p_hunk + 1] - at;
+    size_t bytes = this->hunk_bytes(p_hunk);
+    if (size == bytes) {
+        memcpy(p_dst, src, bytes);
+    } else if (!lz_decompress(src, size, p_dst, bytes)) {
+        // Corrupt hunk: unreadable sectors rather than garbage
+        memset(p_dst, 0, bytes);
+    }
+}
+
+HunkImage::Entry *HunkImage::find(uint32_t p_hunk) {
+    for (Entry &e : this->entries) {
+        if (e.hunk == p_hunk)
+            return &e;
+    }
+    return nullptr;
+}
+
+HunkImage::Entry *HunkImage::victim() {
+    Entry *oldest = nullptr;
+    for (Entry &e : this->entries) {
+        if (e.state == HunkState::Pending)
+            continue;
+        if (oldest == nullptr || e.used < oldest->used)
+            oldest = &e;
+    }
+    return oldest;
+}
+
+void HunkImage::read(uint32_t p_lba, uint8_t *p_dst) {
+    uint32_t per = this->head.hunk_sectors;
+    uint32_t hunk = p_lba / per;
+    size_t offset = size_t(p_lba % per) * Disc::SECTOR_SIZE;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    Entry *e = this->find(hunk);
+    if (e != nullptr && e->state == HunkState::Pending) {
+        // Queued or being decompressed: a worker is on it
+        this->done.wait(lock, [e, hunk] {
+            return e->hunk != hunk ||
+                   e->state != HunkState::Pending;
+        });
+        if (e->hunk != hunk)
+            e = nullptr;
+    }
+
+    if (e == nullptr) {
+        // Nobody saw this one coming (a seek), decompress it here
+        e = this->victim();
+        if (e == nullptr) {
+            std::vector<uint8_t> data(this->hunk_bytes(hunk));
+            lock.unlock();
+            this->decompress(hunk, data.data());
+            memcpy(p_dst, data.data() + offset,
+                   Disc::SECTOR_SIZE);
+            return;
+        }
+        e->hunk = hunk;
+        e->state = HunkState::Pending;
+        lock.unlock();
+        this->decompress(hunk, e->data.data());
+        lock.lock();
+        e->state = HunkState::Ready;
+        this->done.notify_all();
+    }
+
+    e->used = ++this->clock;
+    memcpy(p_dst, e->data.data() + offset, Disc::SECTOR_SIZE);
+}
+
+void HunkImage::prefetch(uint32_t p_lba, uint32_t p_count) {
+    if (p_lba >= this->head.sectors || p_count == 0)
+        return;
+    uint32_t per = this->head.hunk_sectors;
+    uint32_t first = p_lba / per;
+    uint32_t last = (p_lba + p_count - 1) / per;
+    if (last >= this->hunks)
+        last = this->hunks - 1;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (uint32_t hunk = first; hunk <= last; hunk++) {
+        Entry *e = this->find(hunk);
+        if (e == nullptr) {
+            e = this->victim();
+            if (e == nullptr)
+                return;
+            e->hunk = hunk;
+            e->state = HunkState::Pending;
+            this->pool.submit([this, e, hunk] {
+                this->decompress(hunk, e->data.data());
+                std::lock_guard<std::mutex> lock(this->mutex);
+                e->state = HunkState::Ready;
+                this->done.notify_all();
+            });
+        }
+        // Counts as a use, so the window isn't evicted before
+        // it's read
+        e->used = ++this->clock;
+    }
+}
+
+void write_hunk_image(const Disc &p_disc, const char *p_path,
+                      ThreadPool &p_pool) {
+    HunkHeader head;
+    memcpy(head.magic, HunkHeader::MAGIC, sizeof(head.magic));
+    head.version = HUNK_VERSION;
+    head.hunk_sectors = HunkImage::HUNK_SECTORS;
+    head.sectors = p_disc.sectors();
+    head.tracks = uint32_t(p_disc.tracks.size());
+    uint32_t per = head.hunk_sectors;
+    uint32_t hunks = (head.sectors + per - 1) / per;
+
+    std::vector<HunkTrack> tracks;
+    for (const DiscTrack &t : p_disc.tracks) {
+        HunkTrack h = {};
+        h.number = t.number;
+        h.type = uint8_t(t.type);
+        h.pregap = t.pregap;
+        h.start = t.start;
+        h.end = t.end;
+        tracks.push_back(h);
+    }
+    std::vector<uint64_t> offsets(hunks + 1);
+    size_t index_at =
+        sizeof(head) + tracks.size() * sizeof(HunkTrack);
+    offsets[0] = index_at + offsets.size() * sizeof(uint64_t);
+
+    FILE *f = fopen(p_path, "wb");
+    if (!f)
+        throw std::runtime_error(std::string("Couldn't write ") +
+                                 p_path);
+    // The index goes in last, once the hunk sizes are known
+    bool ok = fwrite(&head, sizeof(head), 1, f) == 1 &&
+              fwrite(tracks.data(), sizeof(HunkTrack),
+                     tracks.size(), f) == tracks.size() &&
+              fwrite(offsets.data(), sizeof(uint64_t),
+                     offsets.size(), f) == offsets.size();
+
+    // Batches of hunks compressed in parallel, written in order
+    static constexpr uint32_t BATCH = 256;
+    size_t hunk_size = size_t(per) * Disc::SECTOR_SIZE;
+    std::vector<std::vector<uint8_t>> out(BATCH);
+    for (uint32_t base = 0; ok && base < hunks; base += BATCH) {
+        uint32_t count = std::min(BATCH, hunks - base);
+        for (uint32_t i = 0; i < count; i++) {
+            p_pool.submit([&, i] {
+                uint32_t hunk = base + i;
+                uint32_t first = hunk * per;
+                uint32_t last =
+                    std::min(first + per, head.sectors);
+                std::vector<uint8_t> raw(hunk_size);
+                uint8_t scratch[Disc::SECTOR_SIZE];
+                for (uint32_t lba = first; lba < last; lba++) {
+                    std::span<const uint8_t> sector =
+                        p_disc.sector(lba, scratch);
+                    memcpy(raw.data() + size_t(lba - first) *
+                                            Disc::SECTOR_SIZE,
+                           sector.data(), Disc::SECTOR_SIZE);
+                }
+                raw.resize(size_t(last - first) *
+                           Disc::SECTOR_SIZE);
+
+                std::vector<uint8_t> &dst = out[i];
+                dst.resize(lz_bound(raw.size()));
+                size_t size = lz_compress(raw.data(), raw.size(),
+                                          dst.data());
+                // Stored as is when compression doesn't pay off
+                if (size >= raw.size())
+                    dst = std::move(raw);
+                else
+                    dst.resize(size);
+            });
+        }
+        p_pool.wait();
+
+        for (uint32_t i = 0; ok && i < count; i++) {
+            ok = fwrite(out[i].data(), 1, out[i].size(), f) ==
+                 out[i].size();
+            offsets[base + i + 1] =
+                offsets[base + i] + out[i].size();
+        }
+    }
+
+    ok = ok && fseek(f, long(index_at), SEEK_SET) == 0 &&
+         fwrite(offsets.data(), sizeof(uint64_t), offsets.size(),
+                f) == offsets.size();
+    if (fclose(f) != 0 || !ok)
+        throw std::runtime_error(std::string("Couldn't write ") +
+                                 p_path);
+}
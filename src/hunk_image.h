@@ -0,0 +1,126 @@
+#pragma once
+#include "thread_pool.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+struct Disc;
+
+constexpr uint32_t HUNK_VERSION = 1;
+
+/// Start of a compressed disc image (.cdz). Followed by `tracks`
+/// HunkTrack entries, then the hunk index: hunks + 1 file offsets
+/// (uint64_t), hunk i being the bytes from offsets[i] to
+/// offsets[i + 1].
+///
+/// The disc is stored as raw sectors from LBA 0 to the end of the
+/// last track, pregaps included, in hunks of `hunk_sectors`
+/// sectors (the last one can be shorter). Every hunk is
+/// compressed on its own with lz_compress(), or stored as is when
+/// that doesn't make it smaller, so any sector is one index
+/// lookup and one hunk decompression away.
+///
+/// Fields are little endian, in their host layout.
+struct HunkHeader {
+    static constexpr char MAGIC[8] = {'P', 'S', 'X', 'D',
+                                      'I', 'S', 'C', 'Z'};
+
+    char magic[8];
+    uint32_t version;
+    uint32_t hunk_sectors;
+    uint32_t sectors;
+    uint32_t tracks;
+};
+
+struct HunkTrack {
+    uint8_t number;
+    // TrackType
+    uint8_t type;
+    uint8_t pad[2];
+    uint32_t pregap;
+    uint32_t start;
+    uint32_t end;
+};
+
+static_assert(sizeof(HunkHeader) == 24);
+static_assert(sizeof(HunkTrack) == 16);
+
+/// Reads a mapped .cdz file. Hunks are decompressed by a small
+/// worker pool ahead of the reader (see prefetch()) into an LRU
+/// cache of HunkImage::CACHED hunks, read() only decompresses
+/// itself on a miss nobody asked for in advance.
+///
+/// Thread safe: a Disc and so its HunkImage can be shared by
+/// several SectorCache threads.
+struct HunkImage {
+    // 8 sectors, 18KB: small enough that a seek doesn't cost
+    // much, big enough for the compressor to find repeats
+    static constexpr uint32_t HUNK_SECTORS = 8;
+    static constexpr uint32_t CACHED = 32;
+    static constexpr uint32_t WORKERS = 2;
+
+    // Throws std::runtime_error when p_file isn't a valid image
+    HunkImage(std::span<const uint8_t> p_file);
+
+    HunkImage(const HunkImage &) = delete;
+    HunkImage &operator=(const HunkImage &) = delete;
+
+    const HunkHeader &header() const { return this->head; }
+    std::span<const HunkTrack> track_list() const {
+        return this->track_table;
+    }
+
+    // Raw sector p_lba (2352 bytes) to p_dst, p_lba must be
+    // before header().sectors
+    void read(uint32_t p_lba, uint8_t *p_dst);
+    // Start decompressing the hunks of p_count sectors from p_lba
+    // on in the background
+    void prefetch(uint32_t p_lba, uint32_t p_count);
+
+  private:
+    enum class HunkState : uint8_t {
+        Empty,
+        // Queued or being decompressed
+        Pending,
+        Ready,
+    };
+
+    struct Entry {
+        uint32_t hunk;
+        HunkState state;
+        // Last use, the smallest is evicted
+        uint64_t used;
+        std::vector<uint8_t> data;
+    };
+
+    std::span<const uint8_t> file;
+    HunkHeader head;
+    std::span<const HunkTrack> track_table;
+    const uint64_t *offsets;
+    uint32_t hunks;
+
+    std::mutex mutex;
+    // An entry became Ready
+    std::condition_variable done;
+    Entry entries[CACHED];
+    uint64_t clock;
+    // Last member: destroyed first, finishing the queued jobs
+    ThreadPool pool;
+
+    // Cache entry of p_hunk, nullptr if absent. Holding mutex.
+    Entry *find(uint32_t p_hunk);
+    // Least recently used entry that isn't Pending, nullptr if
+    // all are. Holding mutex.
+    Entry *victim();
+    // Decompress p_hunk into p_dst, sized for it
+    void decompress(uint32_t p_hunk, uint8_t *p_dst) const;
+    uint32_t hunk_bytes(uint32_t p_hunk) const;
+};
+
+// Compress p_disc into a .cdz file at p_path, hunks spread over
+// p_pool. Throws std::runtime_error on I/O errors.
+void write_hunk_image(const Disc &p_disc, const char *p_path,
+                      ThreadPool &p_pool);
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+/// Digital pad buttons. Pads report them active low, sources use
+/// a set bit for a held button.
+enum class PadButton : uint16_t {
+    Select = 1 << 0,
+    L3 = 1 << 1,
+    R3 = 1 << 2,
+    Start = 1 << 3,
+    Up = 1 << 4,
+    Right = 1 << 5,
+    Down = 1 << 6,
+    Left = 1 << 7,
+    L2 = 1 << 8,
+    R2 = 1 << 9,
+    L1 = 1 << 10,
+    R1 = 1 << 11,
+    Triangle = 1 << 12,
+    Circle = 1 << 13,
+    Cross = 1 << 14,
+    Square = 1 << 15,
+};
+
+/// Controller state provided by the frontend (keyboard, gamepad,
+/// recorded input for replays). The core runs without one, the
+/// pads then have nothing pressed.
+struct InputSource {
+    // Controller ports
+    static constexpr uint32_t PORTS = 2;
+
+    virtual ~InputSource() = default;
+
+    // PadButton bits held on the pad plugged in p_port, polled
+    // whenever the emulated game reads it
+    virtual uint16_t buttons(uint32_t p_port) = 0;
+};
+
+struct NullInput : InputSource {
+    uint16_t buttons(uint32_t p_port) override { return 0; }
+};
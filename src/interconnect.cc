@@ -2,33 +2,238 @@
 #include "bios.h"
 #include "dma.h"
 #include "map.h"
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <exception>
 #include <optional>
 
-template void Interconnect::store<uint8_t>(uint32_t p_addr,
-                                           uint8_t);
-template void Interconnect::store<uint16_t>(uint32_t p_addr,
-                                            uint16_t);
-template void Interconnect::store<uint32_t>(uint32_t p_addr,
-                                            uint32_t);
+template void Interconnect::store_slow<uint8_t>(uint32_t p_addr,
+                                                uint8_t);
+template void Interconnect::store_slow<uint16_t>(uint32_t p_addr,
+                                                 uint16_t);
+template void Interconnect::store_slow<uint32_t>(uint32_t p_addr,
+                                                 uint32_t);
 
-template uint8_t Interconnect::load<uint8_t>(uint32_t);
-template uint16_t Interconnect::load<uint16_t>(uint32_t);
-template uint32_t Interconnect::load<uint32_t>(uint32_t);
+template uint8_t Interconnect::load_slow<uint8_t>(uint32_t);
+template uint16_t Interconnect::load_slow<uint16_t>(uint32_t);
+template uint32_t Interconnect::load_slow<uint32_t>(uint32_t);
 
 Interconnect::Interconnect(Bios *p_bios, RAM *p_ram, Dma *p_dma,
-                           GPU *p_gpu)
-    : bios(p_bios), ram(p_ram), dma(p_dma), gpu(p_gpu) {}
+                           GPU *p_gpu, Cdrom *p_cdrom, SPU *p_spu)
+    : bios(p_bios), ram(p_ram), dma(p_dma), gpu(p_gpu),
+      cdrom(p_cdrom), spu(p_spu) {
+    this->cdrom->scheduler = &this->scheduler;
+    this->spu->scheduler = &this->scheduler;
+    this->perf = nullptr;
+    this->audio = nullptr;
+    this->input = nullptr;
+    this->map_pages();
+
+    // Video output starts at the top of the active picture
+    uint64_t active =
+        this->gpu->active_lines() * this->gpu->line_cycles();
+    this->scheduler.schedule(Event::Gpu, active);
+    this->scheduler.schedule(Event::Spu,
+                             SPU::BATCH * SPU::SAMPLE_CYCLES);
+}
+
+void Interconnect::run_events() {
+    Event event;
+
+    while (this->scheduler.pop_due(event)) {
+        switch (event) {
+        case Event::Gpu: {
+            uint64_t delay;
+            if (this->gpu->step_timing(delay))
+                this->irq.assert_irq(Interrupt::VBlank);
+            this->scheduler.schedule(Event::Gpu, delay);
+            break;
+        }
+        case Event::CdRom:
+        case Event::CdRomAsync:
+        case Event::CdRomDrive:
+            this->cdrom_event(event);
+            break;
+        case Event::Spu:
+            this->spu_event();
+            break;
+        default:
+            printf("Unhandled event: %d\n", (uint32_t)event);
+            std::terminate();
+        }
+    }
+}
+
+void Interconnect::gpu_gp0(uint32_t p_val) {
+    PerfScope scope(this->perf, PerfSection::Gp0);
+    perf_count(this->perf, PerfCounter::Gp0Words, 1);
+    bool was_set = this->gpu->interrupt;
+    this->gpu->gp0(p_val);
+    // GP0(1F) requested an interrupt
+    if (!was_set && this->gpu->interrupt)
+        this->irq.assert_irq(Interrupt::Gpu);
+}
+
+void Interconnect::cdrom_store(uint32_t p_offset, uint8_t p_val) {
+    bool was_set = this->cdrom->irq_line();
+    this->cdrom->store(p_offset, p_val);
+    // An acknowledge can show the next queued answer
+    if (!was_set && this->cdrom->irq_line())
+        this->irq.assert_irq(Interrupt::CdRom);
+}
+
+void Interconnect::cdrom_event(Event p_event) {
+    bool was_set = this->cdrom->irq_line();
+    if (p_event == Event::CdRom)
+        this->cdrom->run_command();
+    else if (p_event == Event::CdRomAsync)
+        this->cdrom->run_async();
+    else
+        this->cdrom->step_drive();
+    if (!was_set && this->cdrom->irq_line())
+        this->irq.assert_irq(Interrupt::CdRom);
+}
+
+void Interconnect::spu_sync() {
+    PerfScope scope(this->perf, PerfSection::Spu);
+    bool was_set = this->spu->irq_line();
+    this->spu->sync();
+    // Voices and capture buffers can hit the IRQ address
+    if (!was_set && this->spu->irq_line())
+        this->irq.assert_irq(Interrupt::Spu);
+}
+
+uint16_t Interconnect::spu_load(uint32_t p_offset) {
+    this->spu_sync();
+    return this->spu->load(p_offset);
+}
+
+void Interconnect::spu_store(uint32_t p_offset, uint16_t p_val) {
+    this->spu_sync();
+    bool was_set = this->spu->irq_line();
+    this->spu->store(p_offset, p_val);
+    // A key on or a FIFO write can hit the IRQ address
+    if (!was_set && this->spu->irq_line())
+        this->irq.assert_irq(Interrupt::Spu);
+}
+
+void Interconnect::spu_event() {
+    this->spu_sync();
+    if (this->audio != nullptr && this->spu->out_frames > 0)
+        this->audio->push_samples(this->spu->out,
+                                  this->spu->out_frames);
+    this->spu->out_frames = 0;
+    this->scheduler.schedule(Event::Spu,
+                             SPU::BATCH * SPU::SAMPLE_CYCLES);
+}
+
+void Interconnect::map_pages() {
+    memset(this->read_pages, 0, sizeof(this->read_pages));
+    memset(this->write_pages, 0, sizeof(this->write_pages));
+    memset(this->exec_pages, 0, sizeof(this->exec_pages));
+
+    this->map_range(map::RAM.start, map::RAM.length,
+                    this->ram->data, true);
+    // Read only: stores keep going through store_io
+    this->map_range(map::BIOS.start, map::BIOS.length,
+                    this->bios->data.data(), false);
+
+    // A halted CPU must fail every fetch
+    if (this->watch.halted)
+        memset(this->exec_pages, 0, sizeof(this->exec_pages));
+}
+
+void Interconnect::map_range(uint32_t p_start, uint32_t p_length,
+                             uint8_t *p_host, bool p_writable) {
+    for (uint32_t off = 0; off < p_length; off += PAGE_SIZE) {
+        uint32_t addr = p_start + off;
+        uint32_t page = addr >> PAGE_SHIFT;
+        uint8_t *host = p_host + off;
+        const Watchpoints &w = this->watch;
+
+        if (!w.covers(WatchAccess::Read, addr, PAGE_SIZE))
+            this->read_pages[page] = host;
+        if (p_writable && !w.covers(WatchAccess::Write, addr,
+                                    PAGE_SIZE))
+            this->write_pages[page] = host;
+        if (!w.covers(WatchAccess::Exec, addr, PAGE_SIZE))
+            this->exec_pages[page] = host;
+    }
+}
+
+void Interconnect::add_watchpoint(const Watchpoint &p_watch) {
+    this->watch.points.push_back(p_watch);
+    this->map_pages();
+}
+
+void Interconnect::clear_watchpoints() {
+    this->watch.points.clear();
+    this->map_pages();
+}
+
+void Interconnect::halt() {
+    this->watch.halted = true;
+    memset(this->exec_pages, 0, sizeof(this->exec_pages));
+    this->scheduler.end_slice();
+}
+
+void Interconnect::resume() {
+    this->watch.halted = false;
+    this->watch.resume_addr = this->watch.halt_addr;
+    this->watch.halt_addr = Watchpoints::NO_ADDR;
+    this->map_pages();
+}
+
+template <class T> T Interconnect::load_slow(uint32_t p_addr) {
+    T v = this->load_io<T>(p_addr);
+
+    if (this->watch.armed() &&
+        this->watch.check(WatchAccess::Read,
+                          this->mask_region(p_addr), v, sizeof(T)))
+        this->halt();
+
+    return v;
+}
+
+template <class T>
+void Interconnect::store_slow(uint32_t p_addr, T p_val) {
+    this->store_io<T>(p_addr, p_val);
+
+    if (this->watch.armed() &&
+        this->watch.check(WatchAccess::Write,
+                          this->mask_region(p_addr), p_val,
+                          sizeof(T)))
+        this->halt();
+}
+
+bool Interconnect::fetch_slow(uint32_t p_addr,
+                              uint32_t &p_word) {
+    uint32_t addr = this->mask_region(p_addr);
+
+    if (this->watch.halted)
+        return false;
+
+    p_word = this->load_io<uint32_t>(p_addr);
 
-uint32_t Interconnect::mask_region(uint32_t p_addr) {
-    uint8_t index = p_addr >> 29;
-    uint32_t masked = p_addr & REGION_MASK[index];
-    return masked;
+    if (addr == this->watch.resume_addr) {
+        // Stepping past the breakpoint we stopped on
+        this->watch.resume_addr = Watchpoints::NO_ADDR;
+        return true;
+    }
+
+    if (this->watch.armed() &&
+        this->watch.check(WatchAccess::Exec, addr, p_word, 4)) {
+        this->watch.halt_addr = addr;
+        this->halt();
+        return false;
+    }
+    return true;
 }
 
 void Interconnect::do_dma(Port p_port) {
+    PerfScope scope(this->perf, PerfSection::Dma);
     if (this->dma->get_mut_channel(p_port).get_sync() ==
         Sync::LinkedList) {
         this->do_dma_linked_list(p_port);
@@ -59,15 +264,50 @@ void Interconnect::do_dma_linked_list(Port p_port) {
         while (remsz > 0) {
             addr = (addr + 4) & 0x1ffffc;
             uint32_t command = this->ram->load<uint32_t>(addr);
-            this->gpu->gp0(command);
+            this->gpu_gp0(command);
             remsz -= 1;
         }
+        // Header and payload
+        perf_count(this->perf, PerfCounter::DmaBytes,
+                   (1 + (header >> 24)) * 4);
         if ((header & 0x800000) != 0) {
             break;
         }
         addr = header & 0x1ffffc;
     }
     channel.done();
+
+    if (this->dma->flag_channel_irq(p_port))
+        this->irq.assert_irq(Interrupt::Dma);
+}
+
+uint32_t Interconnect::gpu_dma_span(Direction p_direction,
+                                    uint32_t p_addr,
+                                    uint32_t p_max) {
+    // Don't run past the end of RAM, the caller wraps around
+    uint32_t n = std::min(p_max, (RAM::SIZE - p_addr) / 4);
+    uint8_t *data = this->ram->data + p_addr;
+
+    if (p_direction == Direction::FromRam) {
+        if (this->gpu->gp0_mode != Gp0Mode::ImageLoad)
+            return 0;
+        n = std::min(n, this->gpu->gp0_command_remaining);
+        PerfScope scope(this->perf, PerfSection::Gp0);
+        perf_count(this->perf, PerfCounter::Gp0Words, n);
+        if (this->gpu->trace)
+            this->gpu->record(GpuTracePort::Gp0, data, n);
+        this->gpu->image_load_words(data, n);
+        return n;
+    }
+
+    n = std::min(n, this->gpu->image_store_remaining);
+    if (n == 0)
+        return 0;
+    this->gpu->image_store_words(data, n);
+    this->ram->dirty.mark_range(
+        p_addr >> RAM::PAGE_SHIFT,
+        (p_addr + n * 4 - 1) >> RAM::PAGE_SHIFT);
+    return n;
 }
 
 void Interconnect::do_dma_block(Port p_port) {
@@ -94,17 +334,38 @@ void Interconnect::do_dma_block(Port p_port) {
         printf("Couldn't figure out DMA block transfer size");
         std::terminate();
     }
+    perf_count(this->perf, PerfCounter::DmaBytes, remsz * 4);
+
+    // Sound RAM transfers land at the SPU's current position
+    bool spu_was_set = false;
+    if (p_port == Port::Spu) {
+        this->spu_sync();
+        spu_was_set = this->spu->irq_line();
+    }
 
     while (remsz > 0) {
         // Address wrapping logic, hardware may ignore LSBs
         uint32_t cur_addr = addr & 0x1FFFFC;
 
+        // Image data moves between RAM and VRAM a span at a time
+        if (p_port == Port::Gpu && increment == 4) {
+            uint32_t n = this->gpu_dma_span(
+                channel.get_direction(), cur_addr, remsz);
+            if (n > 0) {
+                addr += n * 4;
+                remsz -= n;
+                continue;
+            }
+        }
+
         switch (channel.get_direction()) {
         case Direction::FromRam: {
             uint32_t src_word =
                 this->ram->load<uint32_t>(cur_addr);
             if (p_port == Port::Gpu) {
-                this->gpu->gp0(src_word);
+                this->gpu_gp0(src_word);
+            } else if (p_port == Port::Spu) {
+                this->spu->dma_write(src_word);
             } else {
                 printf("Unhandled DMA destination port: %d\n",
                        p_port);
@@ -125,6 +386,15 @@ void Interconnect::do_dma_block(Port p_port) {
                     // Otherwise: pointer to previous entry
                     src_word = (addr - 4) & 0x1FFFFF;
                 break;
+            case Port::Gpu:
+                src_word = this->gpu->read();
+                break;
+            case Port::CdRom:
+                src_word = this->cdrom->dma_read();
+                break;
+            case Port::Spu:
+                src_word = this->spu->dma_read();
+                break;
             default:
                 printf("ERROR: Unhandled DMA source port %d\n",
                        (uint8_t)p_port);
@@ -143,6 +413,13 @@ void Interconnect::do_dma_block(Port p_port) {
         remsz--;
     }
     channel.done();
+
+    if (p_port == Port::Spu && !spu_was_set &&
+        this->spu->irq_line())
+        this->irq.assert_irq(Interrupt::Spu);
+
+    if (this->dma->flag_channel_irq(p_port))
+        this->irq.assert_irq(Interrupt::Dma);
 }
 
 uint32_t Interconnect::dma_reg(uint32_t p_offset) {
@@ -215,7 +492,12 @@ void Interconnect::set_dma_reg(uint32_t p_offset,
             break;
         }
         if (minor == 4) {
+            bool irq_before = this->dma->get_irq();
             this->dma->set_interrupt(p_val);
+            // Forcing the IRQ or enabling a flagged channel
+            // raises the master flag too
+            if (!irq_before && this->dma->get_irq())
+                this->irq.assert_irq(Interrupt::Dma);
             break;
         }
     }
@@ -230,8 +512,37 @@ void Interconnect::set_dma_reg(uint32_t p_offset,
     }
 }
 
+uint32_t Interconnect::irq_reg(uint32_t p_offset) {
+    switch (p_offset) {
+    case 0: // I_STAT - interrupt status
+        return this->irq.status;
+    case 4: // I_MASK - interrupt mask
+        return this->irq.mask;
+    default:
+        printf("Unhandled IRQ read at offset: 0x%x\n", p_offset);
+        return 0;
+    }
+}
+
+void Interconnect::set_irq_reg(uint32_t p_offset,
+                               uint32_t p_val) {
+    switch (p_offset) {
+    case 0: // I_STAT - write 0 to acknowledge
+        this->irq.acknowledge(p_val);
+        break;
+    case 4: // I_MASK - set interrupt mask
+        this->irq.set_mask(p_val);
+        break;
+    default:
+        printf("Unhandled IRQ write at offset: 0x%x, "
+               "val: 0x%08x\n",
+               p_offset, p_val);
+        break;
+    }
+}
+
 template <class T>
-void Interconnect::store(uint32_t p_addr, T p_val) {
+void Interconnect::store_io(uint32_t p_addr, T p_val) {
     uint32_t addr = mask_region(p_addr);
     if constexpr (sizeof(T) == 4) {
         if (addr == 0x1f801060)
@@ -241,32 +552,15 @@ void Interconnect::store(uint32_t p_addr, T p_val) {
             return;
         }
         // INTERRUPT CONTROL REG
-        if (auto offset = map::IRQ_CONTROL.contains(p_addr);
+        if (auto offset = map::IRQ_CONTROL.contains(addr);
             offset.has_value()) {
-            switch (*offset) {
-            case 0: // I_STAT - write 1 to clear bits
-                irq_status &=
-                    ~p_val; // Clear the bits that are set to 1
-                printf("I_STAT write: 0x%08x (new status: "
-                       "0x%08x)\n",
-                       p_val, irq_status);
-                return;
-            case 4: // I_MASK - set interrupt mask
-                irq_mask = p_val;
-                printf("I_MASK write: 0x%08x\n", p_val);
-                return;
-            default:
-                printf("Unhandled IRQ write at offset: 0x%x, "
-                       "val: 0x%08x\n",
-                       *offset, p_val);
-                return;
-            }
+            this->set_irq_reg(*offset, p_val);
             return;
         }
         // GPU
         if (auto offset = map::GPU_GP0.contains(p_addr);
             offset.has_value()) {
-            this->gpu->gp0(p_val);
+            this->gpu_gp0(p_val);
             return;
         }
         if (auto offset = map::GPU_GP1.contains(p_addr);
@@ -290,6 +584,13 @@ void Interconnect::store(uint32_t p_addr, T p_val) {
             printf("TIMER0 write: 0x%x\n", p_val);
             return;
         }
+        // SPU: two 16bit registers
+        if (auto offset = map::SPU.contains(addr);
+            offset.has_value()) {
+            this->spu_store(*offset, uint16_t(p_val));
+            this->spu_store(*offset + 2, uint16_t(p_val >> 16));
+            return;
+        }
         // DMA
         if (auto offset = map::DMA.contains(p_addr);
             offset.has_value()) {
@@ -340,16 +641,14 @@ void Interconnect::store(uint32_t p_addr, T p_val) {
         // IQR
         if (auto offset = map::IRQ_CONTROL.contains(addr);
             offset.has_value()) {
-            printf("Unhandled store16 to IQR register: 0x%x\n",
-                   addr);
+            this->set_irq_reg(*offset, p_val);
             return;
         }
 
         // SPU Registers
         if (auto offset = map::SPU.contains(addr);
             offset.has_value()) {
-            printf("Unhandled store16 to SPU register: 0x%x\n",
-                   *offset);
+            this->spu_store(*offset, p_val);
             return;
         }
 
@@ -380,9 +679,7 @@ void Interconnect::store(uint32_t p_addr, T p_val) {
         // CDROM
         if (auto offset = map::CDROM.contains(addr);
             offset.has_value()) {
-            printf("Unhandled store8 to CDROM register: "
-                   "0x%x\n",
-                   *offset);
+            this->cdrom_store(*offset, p_val);
             return;
         }
 
@@ -391,7 +688,7 @@ void Interconnect::store(uint32_t p_addr, T p_val) {
     }
 }
 
-template <typename T> T Interconnect::load(uint32_t p_addr) {
+template <typename T> T Interconnect::load_io(uint32_t p_addr) {
     fflush(stdout);
     uint32_t addr = mask_region(p_addr);
 
@@ -408,13 +705,20 @@ template <typename T> T Interconnect::load(uint32_t p_addr) {
         }
         if (auto offset = map::GPU_GP0.contains(p_addr);
             offset.has_value()) {
-            this->gpu->read();
+            return this->gpu->read();
         }
         // DMA
         if (auto offset = map::DMA.contains(p_addr);
             offset.has_value()) {
             return this->dma_reg(*offset);
         }
+        // SPU: two 16bit registers
+        if (auto offset = map::SPU.contains(addr);
+            offset.has_value()) {
+            uint32_t low = this->spu_load(*offset);
+            uint32_t high = this->spu_load(*offset + 2);
+            return low | high << 16;
+        }
         // EXPANSION 1
         if (auto offset = map::EXPANSION_1.contains(p_addr);
             offset.has_value()) {
@@ -424,18 +728,7 @@ template <typename T> T Interconnect::load(uint32_t p_addr) {
         // IRQ
         if (auto offset = map::IRQ_CONTROL.contains(addr);
             offset.has_value()) {
-            switch (*offset) {
-            case 0: // I_STAT - interrupt status
-                printf("I_STAT read: 0x%08x\n", irq_status);
-                return irq_status;
-            case 4: // I_MASK - interrupt mask
-                printf("I_MASK read: 0x%08x\n", irq_mask);
-                return irq_mask;
-            default:
-                printf("Unhandled IRQ read at offset: 0x%x\n",
-                       *offset);
-                return 0;
-            }
+            return this->irq_reg(*offset);
         }
         // BIOS
         if (auto offset = map::BIOS.contains(addr);
@@ -457,16 +750,12 @@ template <typename T> T Interconnect::load(uint32_t p_addr) {
         // SPU
         if (auto offset = map::SPU.contains(addr);
             offset.has_value()) {
-            printf("Unhandled load16 to SPU register: 0x%x\n",
-                   addr);
-            return 0;
+            return this->spu_load(*offset);
         }
         // IQR
         if (auto offset = map::IRQ_CONTROL.contains(addr);
             offset.has_value()) {
-            printf("Unhandled load16 to IQR register: 0x%x\n",
-                   addr);
-            return 0;
+            return (uint16_t)this->irq_reg(*offset);
         }
         // RAM
         if (auto offset = map::RAM.contains(addr);
@@ -493,9 +782,7 @@ template <typename T> T Interconnect::load(uint32_t p_addr) {
         // CDROM
         if (auto offset = map::CDROM.contains(addr);
             offset.has_value()) {
-            printf("Unhandled load8 to CDROM register: 0x%x\n",
-                   *offset);
-            return 0xd8;
+            return this->cdrom->load(*offset);
         }
         printf("WARNING: Unhandled load8 to address: 0x%x\n",
                addr);
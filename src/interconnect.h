@@ -1,8 +1,21 @@
 #pragma once
+#include "audio.h"
 #include "bios.h"
+#include "cdrom.h"
 #include "ram.h"
 #include "dma.h"
 #include "gpu.h"
+#include "input.h"
+#include "irq.h"
+#include "perf.h"
+#include "scheduler.h"
+#include "spu.h"
+#include "watchpoint.h"
+#include <bit>
+#include <cstring>
+
+static_assert(std::endian::native == std::endian::little,
+              "Fast memory paths assume a little endian host");
 
 struct Interconnect {
     static constexpr uint32_t REGION_MASK[] = {
@@ -20,26 +33,155 @@ struct Interconnect {
         0xffffffff,
     };
 
+    // Page dispatch tables covering the 512MB physical address
+    // space in 64KB pages. A non-null entry points straight at
+    // host memory backing the page (RAM, BIOS), anything else
+    // goes through the slow, device-decoding path. Pages with an
+    // armed watchpoint are removed from the relevant table so
+    // only they pay for the checks.
+    static constexpr uint32_t PAGE_SHIFT = 16;
+    static constexpr uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+    static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;
+    static constexpr uint32_t PAGED_LIMIT = 0x20000000;
+    static constexpr uint32_t PAGE_COUNT =
+        PAGED_LIMIT >> PAGE_SHIFT;
+
     Bios *bios;
     RAM *ram;
     Dma *dma;
     GPU *gpu;
+    Cdrom *cdrom;
+    SPU *spu;
+    // Timing and counters, optional and owned by the frontend
+    Perf *perf;
+    // Sound output and controller state, optional and owned by
+    // the frontend like the GPU's renderer
+    AudioSink *audio;
+    InputSource *input;
 
-    uint32_t irq_status = 0x0;
-    uint32_t irq_mask = 0x0;
+    InterruptController irq;
+    Scheduler scheduler;
+    Watchpoints watch;
 
-    Interconnect(Bios *, RAM *, Dma *, GPU *);
+    uint8_t *read_pages[PAGE_COUNT];
+    // Only ever maps main RAM, see `store`
+    uint8_t *write_pages[PAGE_COUNT];
+    uint8_t *exec_pages[PAGE_COUNT];
+
+    Interconnect(Bios *, RAM *, Dma *, GPU *, Cdrom *, SPU *);
     ~Interconnect() = default;
 
-    template <class T> T load(uint32_t p_addr);
-    template <class V> void store(uint32_t p_addr, V);
+    template <class T> T load(uint32_t p_addr) {
+        uint32_t addr = this->mask_region(p_addr);
+        if (addr < PAGED_LIMIT) {
+            const uint8_t *page =
+                this->read_pages[addr >> PAGE_SHIFT];
+            if (page != nullptr) {
+                T v;
+                memcpy(&v, page + (addr & PAGE_MASK), sizeof(T));
+                return v;
+            }
+        }
+        return this->load_slow<T>(p_addr);
+    }
+
+    template <class T> void store(uint32_t p_addr, T p_val) {
+        uint32_t addr = this->mask_region(p_addr);
+        if (addr < PAGED_LIMIT) {
+            uint8_t *page = this->write_pages[addr >> PAGE_SHIFT];
+            if (page != nullptr) {
+                memcpy(page + (addr & PAGE_MASK), &p_val,
+                       sizeof(T));
+                // RAM sits at physical address 0
+                this->ram->dirty.mark(addr >> RAM::PAGE_SHIFT);
+                return;
+            }
+        }
+        this->store_slow<T>(p_addr, p_val);
+    }
+
+    // Instruction fetch. Returns false when the CPU must not
+    // execute p_addr because a watchpoint halted it.
+    bool fetch(uint32_t p_addr, uint32_t &p_word) {
+        uint32_t addr = this->mask_region(p_addr);
+        if (addr < PAGED_LIMIT) {
+            const uint8_t *page =
+                this->exec_pages[addr >> PAGE_SHIFT];
+            if (page != nullptr) {
+                memcpy(&p_word, page + (addr & PAGE_MASK), 4);
+                return true;
+            }
+        }
+        return this->fetch_slow(p_addr, p_word);
+    }
+
+    template <class T> T load_slow(uint32_t p_addr);
+    template <class V> void store_slow(uint32_t p_addr, V);
+    bool fetch_slow(uint32_t p_addr, uint32_t &p_word);
+
+    // Device decoding for everything not served by the page
+    // tables
+    template <class T> T load_io(uint32_t p_addr);
+    template <class V> void store_io(uint32_t p_addr, V);
+
+    uint32_t mask_region(uint32_t p_addr) {
+        uint8_t index = p_addr >> 29;
+        return p_addr & REGION_MASK[index];
+    }
 
-    uint32_t mask_region(uint32_t p_addr);
+    // (Re)build the page tables from the memory map and the
+    // armed watchpoints
+    void map_pages();
+    void map_range(uint32_t p_start, uint32_t p_length,
+                   uint8_t *p_host, bool p_writable);
+
+    void add_watchpoint(const Watchpoint &p_watch);
+    void clear_watchpoints();
+    // Stop the CPU before its next instruction
+    void halt();
+    // Let a halted CPU run again
+    void resume();
 
     uint32_t dma_reg(uint32_t p_offset);
     void set_dma_reg(uint32_t p_offset, uint32_t p_val);
 
+    uint32_t irq_reg(uint32_t p_offset);
+    void set_irq_reg(uint32_t p_offset, uint32_t p_val);
+
+    // Handle every device event whose deadline has passed
+    void run_events();
+
+    // GP0 write from the CPU or DMA, raising the GPU interrupt
+    // when the command requests it
+    void gpu_gp0(uint32_t p_val);
+
+    // CD-ROM register write or event, raising the CD-ROM
+    // interrupt when an answer shows up
+    void cdrom_store(uint32_t p_offset, uint8_t p_val);
+    void cdrom_event(Event p_event);
+
+    // SPU register access, raising the SPU interrupt when its
+    // IRQ address is hit. The SPU is caught up first.
+    uint16_t spu_load(uint32_t p_offset);
+    void spu_store(uint32_t p_offset, uint16_t p_val);
+    // Run the SPU up to the current cycle
+    void spu_sync();
+    // Event::Spu: pass the new samples on to the AudioSink
+    void spu_event();
+
     void do_dma(Port);
     void do_dma_block(Port);
+    // Bulk GPU image transfer of up to p_max words at p_addr in
+    // RAM. Returns the number of words moved, 0 when no image
+    // load/store is in progress.
+    uint32_t gpu_dma_span(Direction p_direction, uint32_t p_addr,
+                          uint32_t p_max);
     void do_dma_linked_list(Port);
+
+    // Save state fields, see SaveState. The memory map and the
+    // watchpoints are frontend configuration, not machine state.
+    template <class V> void serialize(V &p_v) {
+        this->irq.serialize(p_v);
+        this->scheduler.serialize(p_v);
+    }
 };
@@ -0,0 +1,35 @@
+#include "irq.h"
+
+// Only the low 11 bits of I_STAT and I_MASK are implemented
+static constexpr uint32_t IRQ_LINES_MASK = 0x7ff;
+
+InterruptController::InterruptController() {
+    this->status = 0;
+    this->mask = 0;
+    this->cpu_enabled = false;
+    this->pending = false;
+}
+
+void InterruptController::assert_irq(Interrupt p_irq) {
+    this->status |= 1u << (uint32_t)p_irq;
+    this->update();
+}
+
+void InterruptController::acknowledge(uint32_t p_val) {
+    this->status &= p_val & IRQ_LINES_MASK;
+    this->update();
+}
+
+void InterruptController::set_mask(uint32_t p_val) {
+    this->mask = p_val & IRQ_LINES_MASK;
+    this->update();
+}
+
+void InterruptController::set_cpu_enabled(bool p_enabled) {
+    this->cpu_enabled = p_enabled;
+    this->update();
+}
+
+void InterruptController::update() {
+    this->pending = this->cpu_enabled && this->active();
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+
+/// Interrupt lines, bit index in I_STAT and I_MASK
+enum class Interrupt : uint32_t {
+    /// Display entered the vertical blanking period
+    VBlank = 0,
+    /// GPU interrupt requested through GP0(0x1f)
+    Gpu = 1,
+    /// CD-ROM controller
+    CdRom = 2,
+    /// DMA transfer complete
+    Dma = 3,
+    /// Root counters
+    Timer0 = 4,
+    Timer1 = 5,
+    Timer2 = 6,
+    /// Controller and memory card byte received
+    PadMemCard = 7,
+    /// Serial port
+    Sio = 8,
+    /// Sound Processing Unit
+    Spu = 9,
+    /// Lightpen / PIO
+    Lightpen = 10,
+};
+
+struct InterruptController {
+    // I_STAT: one bit per asserted interrupt line
+    uint32_t status;
+    // I_MASK: lines allowed to reach the CPU
+    uint32_t mask;
+    // Set when COP0 SR has both IEc and IM2 set, i.e. the CPU
+    // currently accepts the external interrupt line
+    bool cpu_enabled;
+    // Pre-computed on every I_STAT, I_MASK or SR change so that
+    // the CPU only has to test this flag between instructions
+    bool pending;
+
+    InterruptController();
+    ~InterruptController() = default;
+
+    // Raise a device interrupt line
+    void assert_irq(Interrupt p_irq);
+    // I_STAT write: bits written as 0 are acknowledged
+    void acknowledge(uint32_t p_val);
+    // I_MASK write
+    void set_mask(uint32_t p_val);
+    // Called by the CPU whenever COP0 SR changes
+    void set_cpu_enabled(bool p_enabled);
+
+    // Level of the CPU external interrupt pin, mirrored in COP0
+    // CAUSE bit 10
+    bool active() const {
+        return (this->status & this->mask) != 0;
+    }
+
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("IRQ ");
+        p_v.value(this->status);
+        p_v.value(this->mask);
+        p_v.value(this->cpu_enabled);
+        p_v.value(this->pending);
+    }
+
+  private:
+    void update();
+};
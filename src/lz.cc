@@ -0,0 +1,165 @@
+#include "lz.h"
+#include <cstring>
+
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t MAX_OFFSET = 65535;
+static constexpr uint32_t HASH_BITS = 14;
+
+static uint32_t read32(const uint8_t *p_src) {
+    uint32_t v;
+    memcpy(&v, p_src, 4);
+    return v;
+}
+
+static uint64_t read64(const uint8_t *p_src) {
+    uint64_t v;
+    memcpy(&v, p_src, 8);
+    return v;
+}
+
+static uint32_t hash(uint32_t p_val) {
+    return (p_val * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes in common at p_a and p_b, p_b < p_a, stopping at p_end
+static size_t common(const uint8_t *p_a, const uint8_t *p_b,
+                     const uint8_t *p_end) {
+    const uint8_t *start = p_a;
+    while (p_a + 8 <= p_end) {
+        uint64_t diff = read64(p_a) ^ read64(p_b);
+        if (diff != 0)
+            return p_a - start + (__builtin_ctzll(diff) >> 3);
+        p_a += 8;
+        p_b += 8;
+    }
+    while (p_a < p_end && *p_a == *p_b) {
+        p_a++;
+        p_b++;
+    }
+    return p_a - start;
+}
+
+static uint8_t *put_length(uint8_t *p_dst, size_t p_len) {
+    while (p_len >= 255) {
+        *p_dst++ = 255;
+        p_len -= 255;
+    }
+    *p_dst++ = uint8_t(p_len);
+    return p_dst;
+}
+
+static uint8_t *put_literals(uint8_t *p_dst, const uint8_t *p_src,
+                             size_t p_count, size_t p_match) {
+    uint8_t lit = p_count < 15 ? uint8_t(p_count) : 15;
+    uint8_t len = p_match < 15 ? uint8_t(p_match) : 15;
+    *p_dst++ = uint8_t(lit << 4 | len);
+    if (p_count >= 15)
+        p_dst = put_length(p_dst, p_count - 15);
+    memcpy(p_dst, p_src, p_count);
+    return p_dst + p_count;
+}
+
+size_t lz_compress(const uint8_t *p_src, size_t p_size,
+                   uint8_t *p_dst) {
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t *end = p_src + p_size;
+    const uint8_t *anchor = p_src;
+    const uint8_t *ip = p_src;
+    uint8_t *op = p_dst;
+
+    while (ip + MIN_MATCH <= end) {
+        uint32_t h = hash(read32(ip));
+        const uint8_t *candidate = p_src + table[h];
+        table[h] = uint32_t(ip - p_src);
+
+        if (candidate >= ip ||
+            size_t(ip - candidate) > MAX_OFFSET ||
+            read32(candidate) != read32(ip)) {
+            // Step faster through data that doesn't compress
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        size_t len =
+            MIN_MATCH +
+            common(ip + MIN_MATCH, candidate + MIN_MATCH, end);
+        size_t match = len - MIN_MATCH;
+        op = put_literals(op, anchor, ip - anchor, match);
+        uint16_t offset = uint16_t(ip - candidate);
+        *op++ = uint8_t(offset);
+        *op++ = uint8_t(offset >> 8);
+        if (match >= 15)
+            op = put_length(op, match - 15);
+
+        ip += len;
+        anchor = ip;
+    }
+
+    if (anchor < end)
+        op = put_literals(op, anchor, end - anchor, 0);
+    return op - p_dst;
+}
+
+// Extra length bytes following a 15 in the token
+static bool get_length(const uint8_t *&p_src,
+                       const uint8_t *p_end, size_t &p_len) {
+    uint8_t b;
+    do {
+        if (p_src >= p_end)
+            return false;
+        b = *p_src++;
+        p_len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *p_src, size_t p_size,
+                   uint8_t *p_dst, size_t p_dst_size) {
+    const uint8_t *ip = p_src;
+    const uint8_t *end = p_src + p_size;
+    uint8_t *op = p_dst;
+    uint8_t *op_end = p_dst + p_dst_size;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(ip, end, lit))
+            return false;
+        if (lit > size_t(end - ip) || lit > size_t(op_end - op))
+            return false;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !get_length(ip, end, len))
+            return false;
+        len += MIN_MATCH;
+        if (offset == 0 || offset > size_t(op - p_dst) ||
+            len > size_t(op_end - op))
+            return false;
+
+        // Overlapping matches repeat the last offset bytes: copy
+        // from the same source with a growing span, it stays a
+        // multiple of the period
+        const uint8_t *from = op - offset;
+        while (len != 0) {
+            size_t n = size_t(op - from);
+            if (n > len)
+                n = len;
+            memcpy(op, from, n);
+            op += n;
+            len -= n;
+        }
+    }
+    return op == op_end;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Small LZ77 block codec in the LZ4 mould: byte aligned
+// sequences of literals followed by a match, 64KB window. Built
+// for speed on data that is mostly repeats or zeros (state
+// deltas, disc sectors), not for ratio.
+//
+// Sequence: token (literal count << 4 | match length - 4, 15
+// meaning "more in extra bytes"), extra literal count bytes,
+// literals, 16bit little endian match offset, extra match length
+// bytes. Extra bytes add up, 255 meaning "another follows". The
+// last sequence has literals only.
+
+// Worst case compressed size of p_size bytes
+inline size_t lz_bound(size_t p_size) {
+    return p_size + p_size / 255 + 16;
+}
+
+// Compress p_size bytes into p_dst, which must hold
+// lz_bound(p_size). Returns the compressed size.
+size_t lz_compress(const uint8_t *p_src, size_t p_size,
+                   uint8_t *p_dst);
+
+// Decompress a whole block into exactly p_dst_size bytes. Returns
+// false on malformed input, without writing out of bounds.
+bool lz_decompress(const uint8_t *p_src, size_t p_size,
+                   uint8_t *p_dst, size_t p_dst_size);
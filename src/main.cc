@@ -1,26 +1,245 @@
+#include "audio_output.h"
 #include "bios.h"
-#include "commandbuffer.h"
-#include "cpu.h"
-#include "dma.h"
-#include "gpu.h"
-#include "interconnect.h"
-#include "ram.h"
+#include "disc.h"
+#include "gl_renderer.h"
+#include "null_renderer.h"
+#include "perf.h"
+#include "sector_cache.h"
+#include "system.h"
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+int main(int argc, char **argv) {
+  // Internal resolution multiplier, e.g. --scale 4
+  uint32_t scale = 1;
+  // --renderer window (default), headless (offscreen GL, no
+  // window or UI) or null (no rendering at all)
+  const char *backend = "window";
+  // Stop after this many frames, 0 runs forever
+  uint64_t max_frames = 0;
+  // Write every frame as a PPM into this directory
+  const char *dump_dir = nullptr;
+  // Print a hash of every frame, to compare runs
+  bool hash_frames = false;
+  // Write the timings and counters of the run as JSON here
+  const char *perf_json = nullptr;
+  // Start from this save state, write one at the end of a
+  // --frames run
+  const char *load_state = nullptr;
+  const char *save_state = nullptr;
+  // Keep this many MB of rewind history, 0 disables it. Hold
+  // Backspace in the window to go back in time.
+  uint32_t rewind_mb = 0;
+  // Show the frame this many frames ahead, see System::run_ahead
+  uint32_t run_ahead = 0;
+  // Disc image in the drive (.cue, .bin raw sectors, .iso or
+  // .cdz), the tray stays open without one
+  const char *disc_path = nullptr;
+  // Drive speed: accurate, fast or instant, see CdTiming
+  CdTiming cd_timing = CdTiming::Accurate;
+  // Skip the SPU reverb, see Reverb::enabled
+  bool reverb = true;
+  // Sound output: a WAV file, or raw samples piped to a player
+  // command, see PipeDevice. No sound without either.
+  const char *audio_wav = nullptr;
+  const char *audio_pipe = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+      scale = (uint32_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--renderer") == 0 && i + 1 < argc)
+      backend = argv[++i];
+    else if (strcmp(argv[i], "--headless") == 0)
+      backend = "headless";
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+      max_frames = strtoull(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--dump-frames") == 0 &&
+             i + 1 < argc)
+      dump_dir = argv[++i];
+    else if (strcmp(argv[i], "--hash-frames") == 0)
+      hash_frames = true;
+    else if (strcmp(argv[i], "--perf-json") == 0 && i + 1 < argc)
+      perf_json = argv[++i];
+    else if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc)
+      load_state = argv[++i];
+    else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc)
+      save_state = argv[++i];
+    else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc)
+      rewind_mb = (uint32_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+      run_ahead = (uint32_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--disc") == 0 && i + 1 < argc)
+      disc_path = argv[++i];
+    else if (strcmp(argv[i], "--cd-timing") == 0 &&
+             i + 1 < argc) {
+      if (!cd_timing_from_name(argv[++i], cd_timing)) {
+        printf("Unknown CD timing %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--no-reverb") == 0)
+      reverb = false;
+    else if (strcmp(argv[i], "--audio-wav") == 0 && i + 1 < argc)
+      audio_wav = argv[++i];
+    else if (strcmp(argv[i], "--audio-pipe") == 0 &&
+             i + 1 < argc)
+      audio_pipe = argv[++i];
+  }
+
+  Renderer *renderer = nullptr;
+  // Only set when running in a window
+  GlRenderer *window = nullptr;
+  if (strcmp(backend, "null") == 0) {
+    renderer = new NullRenderer();
+  } else if (strcmp(backend, "headless") == 0) {
+    // Batch machines may not even have a software GL, keep
+    // running without output in that case
+    try {
+      GlRenderer *gl = new GlRenderer(true);
+      gl->set_scale(scale);
+      renderer = gl;
+    } catch (const std::runtime_error &e) {
+      printf("%s, falling back to the null renderer\n", e.what());
+      renderer = new NullRenderer();
+    }
+  } else {
+    try {
+      window = new GlRenderer(false);
+    } catch (const std::runtime_error &e) {
+      printf("%s\n", e.what());
+      return EXIT_FAILURE;
+    }
+    window->set_scale(scale);
+    renderer = window;
+  }
 
-int main(void) {
   Bios *bios = new Bios("SCPH1001.BIN");
-  RAM *ram = new RAM();
-  Dma *dma = new Dma();
-  CommmandBuffer *cb = new CommmandBuffer();
-  GPU *gpu = new GPU(cb);
-  Interconnect *inter = new Interconnect(bios, ram, dma, gpu);
-  CPU *cpu = new CPU(inter);
+  System *system = new System(bios, renderer);
+  GPU &gpu = system->gpu;
+
+  Disc *disc = nullptr;
+  SectorCache *disc_cache = nullptr;
+  if (disc_path) {
+    try {
+      disc = new Disc(disc_path);
+    } catch (const std::runtime_error &e) {
+      printf("%s\n", e.what());
+      return EXIT_FAILURE;
+    }
+    disc_cache = new SectorCache(disc);
+    system->cdrom.insert(disc_cache);
+  }
+  system->cdrom.timing = cd_timing;
+  system->spu.reverb.enabled = reverb;
+
+  AudioDevice *audio_device = nullptr;
+  AudioOutput *audio = nullptr;
+  try {
+    if (audio_wav) {
+      audio_device = new WavDevice(audio_wav);
+    } else if (audio_pipe) {
+      // A player that quit makes writes fail instead
+      signal(SIGPIPE, SIG_IGN);
+      audio_device = new PipeDevice(audio_pipe);
+    }
+  } catch (const std::runtime_error &e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  if (audio_device) {
+    audio = new AudioOutput(audio_device);
+    system->inter.audio = audio;
+  }
+
+  Perf *perf = new Perf();
+  system->set_perf(perf);
+  if (audio)
+    audio->perf = perf;
+  system->run_ahead = run_ahead;
+
+  // The GPU only scans out 24bit frames for the renderer unless
+  // asked to
+  gpu.scanout_always = dump_dir != nullptr || hash_frames;
+
+  SaveState state;
+  if (load_state) {
+    try {
+      state.read_file(load_state);
+      system->load_state(state);
+    } catch (const std::runtime_error &e) {
+      printf("%s\n", e.what());
+      return EXIT_FAILURE;
+    }
+  }
+
+  // A keyframe every second
+  Rewind *rewind = nullptr;
+  if (rewind_mb != 0) {
+    rewind = new Rewind(size_t(rewind_mb) << 20, 60);
+    system->rewind = rewind;
+  }
+
+  while (max_frames == 0 || system->frames < max_frames) {
+    // Closing the window ends the run like --frames does
+    if (window && window->should_close())
+      break;
+
+    // One state back per frame while the key is held, shown
+    // without emulating
+    if (rewind && window &&
+        window->key_down(GLFW_KEY_BACKSPACE)) {
+      rewind->step_back(*system);
+      gpu.present();
+      continue;
+    }
+
+    // One presentation per emulated frame
+    if (!system->run_frame())
+      continue;
+
+    uint64_t frames = system->frames;
+    const Scanout &frame = gpu.scanout;
+    if (dump_dir) {
+      char path[1024];
+      snprintf(path, sizeof(path), "%s/frame%06llu.ppm", dump_dir,
+               (unsigned long long)frames);
+      if (!frame.write_ppm(path))
+        printf("Couldn't write %s\n", path);
+    }
+    if (hash_frames)
+      printf("frame %llu %016llx\n", (unsigned long long)frames,
+             (unsigned long long)frame.hash());
+  }
+
+  if (save_state) {
+    try {
+      system->save_state(state);
+      state.write_file(save_state);
+    } catch (const std::runtime_error &e) {
+      printf("%s\n", e.what());
+    }
+  }
 
-  while(1) {
-    cpu->run();
+  if (perf_json) {
+    FILE *f = fopen(perf_json, "w");
+    if (f) {
+      perf->write_json(f);
+      fclose(f);
+    } else {
+      printf("Couldn't write %s\n", perf_json);
+    }
   }
 
-  delete bios, ram, dma, cb, gpu, inter, cpu;
+  delete system;
+  delete audio;
+  delete audio_device;
+  delete disc_cache;
+  delete disc;
+  delete rewind;
+  delete bios;
+  delete perf;
+  delete renderer;
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,34 @@
+#pragma once
+#include "renderer.h"
+
+/// Renderer dropping everything, for runs that only care about
+/// the emulated machine state (CI, batch jobs without any GL
+/// implementation). VRAM transfers still land in the GPU's VRam.
+struct NullRenderer : Renderer {
+    void push_triangle(const Vertex p_vertices[3]) override {}
+    void push_quad(const Vertex p_vertices[4]) override {}
+    void push_line(const Vertex p_vertices[2]) override {}
+
+    void set_draw_area(uint16_t p_left, uint16_t p_top,
+                       uint16_t p_right,
+                       uint16_t p_bottom) override {}
+    void set_draw_offset(int16_t p_x, int16_t p_y) override {}
+
+    void fill_vram(uint16_t p_x, uint16_t p_y, uint16_t p_width,
+                   uint16_t p_height, Color p_color) override {}
+    void upload_vram(const VRam &p_vram, uint32_t p_x,
+                     uint32_t p_y, uint32_t p_width,
+                     uint32_t p_height) override {}
+    void read_vram(VRam &p_vram, uint32_t p_x, uint32_t p_y,
+                   uint32_t p_width, uint32_t p_height) override {}
+    bool copy_vram(uint32_t p_src_x, uint32_t p_src_y,
+                   uint32_t p_dst_x, uint32_t p_dst_y,
+                   uint32_t p_width, uint32_t p_height) override {
+        return true;
+    }
+    void upload_texture_page(uint32_t p_slot,
+                             const uint16_t *p_texels) override {}
+
+    void present(const DisplayArea &p_area,
+                 const Scanout *p_frame) override {}
+};
@@ -0,0 +1,100 @@
+// psx_pack: converts a disc image (.cue, .bin or .iso) to the
+// compressed .cdz format, see hunk_image.h
+//
+//   psx_pack [--threads N] IN OUT.cdz
+//
+// The output is then read back sector by sector and checked
+// against the input. That pass runs on one thread with no
+// read-ahead, so its rate is a floor for what the CD-ROM drive
+// gets out of the image.
+#include "disc.h"
+#include "hunk_image.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+
+// Sectors per second of a drive at double speed
+static constexpr double DOUBLE_SPEED = 150.0;
+
+static double seconds_since(
+    std::chrono::steady_clock::time_point p_start) {
+    std::chrono::duration<double> d =
+        std::chrono::steady_clock::now() - p_start;
+    return d.count();
+}
+
+static double file_mb(const char *p_path) {
+    struct stat st;
+    if (stat(p_path, &st) != 0)
+        return 0.0;
+    return double(st.st_size) / (1 << 20);
+}
+
+static void usage() {
+    printf("usage: psx_pack [--threads N] IN OUT.cdz\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    uint32_t threads = 0;
+    const char *in = nullptr;
+    const char *out = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = (uint32_t)atoi(argv[++i]);
+        else if (!in)
+            in = argv[i];
+        else if (!out)
+            out = argv[i];
+        else
+            usage();
+    }
+    if (!in || !out)
+        usage();
+
+    try {
+        Disc disc(in);
+        ThreadPool pool(threads);
+        auto start = std::chrono::steady_clock::now();
+        write_hunk_image(disc, out, pool);
+        double raw_mb = double(disc.sectors()) *
+                        Disc::SECTOR_SIZE / (1 << 20);
+        double packed_mb = file_mb(out);
+        printf("%u sectors, %.1f MB to %.1f MB (%.1f%%) in %.2f "
+               "s on %u threads\n",
+               disc.sectors(), raw_mb, packed_mb,
+               100.0 * packed_mb / raw_mb, seconds_since(start),
+               pool.size());
+
+        Disc packed(out);
+        uint8_t scratch[Disc::SECTOR_SIZE];
+        uint8_t packed_scratch[Disc::SECTOR_SIZE];
+        double busy = 0.0;
+        for (uint32_t lba = 0; lba < disc.sectors(); lba++) {
+            std::span<const uint8_t> a =
+                disc.sector(lba, scratch);
+            start = std::chrono::steady_clock::now();
+            std::span<const uint8_t> b =
+                packed.sector(lba, packed_scratch);
+            busy += seconds_since(start);
+            if (b.size() != a.size() ||
+                memcmp(a.data(), b.data(), a.size()) != 0)
+                throw std::runtime_error(
+                    "Sector " + std::to_string(lba) +
+                    " differs after compression");
+        }
+        double rate = busy > 0.0 ? disc.sectors() / busy : 0.0;
+        printf("verified, %.0f sectors/s on one thread, %.0fx "
+               "double speed\n",
+               rate, rate / DOUBLE_SPEED);
+    } catch (const std::runtime_error &e) {
+        printf("%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include "perf.h"
+#include <chrono>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+const char *const Perf::SECTION_NAMES[PERF_SECTIONS] = {
+    "cpu", "gp0", "dma", "raster", "present", "state", "spu",
+};
+
+const char *const Perf::COUNTER_NAMES[PERF_COUNTERS] = {
+    "instructions", "gp0_words",  "primitives",
+    "dma_bytes",    "audio_drops",
+};
+
+static int64_t wall_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+               steady_clock::now().time_since_epoch())
+        .count();
+}
+
+uint64_t Perf::now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(wall_ns());
+#endif
+}
+
+Perf::Perf() : published(0) {
+    memset(this->ticks, 0, sizeof(this->ticks));
+    memset(this->counts, 0, sizeof(this->counts));
+    memset(this->history, 0, sizeof(this->history));
+    memset(&this->total, 0, sizeof(this->total));
+    this->current = PerfSection::Cpu;
+    this->mark = now();
+    this->frame_ticks = this->mark;
+    this->frame_ns = wall_ns();
+}
+
+PerfSection Perf::enter(PerfSection p_section) {
+    uint64_t t = now();
+    this->ticks[(uint32_t)this->current] += t - this->mark;
+    this->mark = t;
+
+    PerfSection previous = this->current;
+    this->current = p_section;
+    return previous;
+}
+
+void Perf::end_frame() {
+    this->enter(this->current);
+    int64_t ns = wall_ns();
+
+    // The timestamp rate isn't known up front, measure it
+    // against the wall clock over the frame
+    double frame_ms = double(ns - this->frame_ns) / 1e6;
+    uint64_t frame_ticks = this->mark - this->frame_ticks;
+    double ms_per_tick =
+        frame_ticks != 0 ? frame_ms / double(frame_ticks) : 0.0;
+
+    uint64_t index =
+        this->published.load(std::memory_order_relaxed);
+    PerfFrame &f = this->history[index % HISTORY];
+    f.frame_ms = frame_ms;
+    this->total.frame_ms += frame_ms;
+    for (uint32_t i = 0; i < PERF_SECTIONS; i++) {
+        f.section_ms[i] = double(this->ticks[i]) * ms_per_tick;
+        this->total.section_ms[i] += f.section_ms[i];
+    }
+    for (uint32_t i = 0; i < PERF_COUNTERS; i++) {
+        f.counters[i] = this->counts[i];
+        this->total.counters[i] += this->counts[i];
+    }
+    this->published.store(index + 1, std::memory_order_release);
+
+    memset(this->ticks, 0, sizeof(this->ticks));
+    memset(this->counts, 0, sizeof(this->counts));
+    this->frame_ticks = this->mark;
+    this->frame_ns = ns;
+}
+
+// One frame as a JSON object, counters divided by p_frames
+static void write_frame(FILE *p_file, const PerfFrame &p_frame,
+                        double p_frames) {
+    fprintf(p_file, "{\"frame_ms\": %.4f, \"mips\": %.3f, ",
+            p_frame.frame_ms / p_frames, p_frame.mips());
+
+    fprintf(p_file, "\"sections_ms\": {");
+    for (uint32_t i = 0; i < PERF_SECTIONS; i++)
+        fprintf(p_file, "%s\"%s\": %.4f", i ? ", " : "",
+                Perf::SECTION_NAMES[i],
+                p_frame.section_ms[i] / p_frames);
+
+    fprintf(p_file, "}, \"counters\": {");
+    for (uint32_t i = 0; i < PERF_COUNTERS; i++)
+        fprintf(p_file, "%s\"%s\": %.1f", i ? ", " : "",
+                Perf::COUNTER_NAMES[i],
+                p_frame.counters[i] / p_frames);
+    fprintf(p_file, "}}");
+}
+
+void Perf::write_json(FILE *p_file) const {
+    uint64_t n = this->frames();
+    uint64_t first = n > HISTORY ? n - HISTORY : 0;
+
+    fprintf(p_file, "{\n  \"frames\": %llu,\n  \"average\": ",
+            (unsigned long long)n);
+    write_frame(p_file, this->total, n ? double(n) : 1.0);
+
+    fprintf(p_file, ",\n  \"recent\": [");
+    for (uint64_t i = first; i < n; i++) {
+        fprintf(p_file, "%s\n    ", i != first ? "," : "");
+        write_frame(p_file, this->frame(i), 1.0);
+    }
+    fprintf(p_file, "\n  ]\n}\n");
+}
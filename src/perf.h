@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// Where emulation time goes. Sections nest: time is charged to
+// the innermost one, so a GP0 command sent by DMA counts as GP0
+// and not as DMA. Time outside any other section is CPU time.
+enum class PerfSection : uint32_t {
+    Cpu,
+    Gp0,
+    Dma,
+    // Renderer work: draw calls, VRAM transfers and readbacks,
+    // texture decoding
+    Raster,
+    // Scanout, presentation and buffer swaps
+    Present,
+    // Save states taken and loaded every frame: rewind
+    // captures, run-ahead
+    State,
+    // Sound generation, caught up at register accesses and
+    // Event::Spu
+    Spu,
+    Count,
+};
+
+enum class PerfCounter : uint32_t {
+    Instructions,
+    Gp0Words,
+    Primitives,
+    DmaBytes,
+    // Sound frames a realtime AudioOutput had no room for
+    AudioDrops,
+    Count,
+};
+
+constexpr uint32_t PERF_SECTIONS = (uint32_t)PerfSection::Count;
+constexpr uint32_t PERF_COUNTERS = (uint32_t)PerfCounter::Count;
+
+// Totals for one emulated frame
+struct PerfFrame {
+    double section_ms[PERF_SECTIONS];
+    uint64_t counters[PERF_COUNTERS];
+    // Wall time since the previous frame
+    double frame_ms;
+
+    // Emulated millions of instructions per second
+    double mips() const {
+        if (this->frame_ms <= 0.0)
+            return 0.0;
+        uint64_t n =
+            this->counters[(uint32_t)PerfCounter::Instructions];
+        return n / this->frame_ms / 1000.0;
+    }
+};
+
+/// Always-on timing and counters, cheap enough to stay in release
+/// builds: a timestamp read on section changes and plain integer
+/// increments.
+///
+/// Only the emulation thread writes. Each closed frame is copied
+/// to a history ring and published with a release store, so the
+/// UI (or any other thread) reads the last frames without locks.
+struct Perf {
+    static constexpr uint32_t HISTORY = 128;
+    static const char *const SECTION_NAMES[PERF_SECTIONS];
+    static const char *const COUNTER_NAMES[PERF_COUNTERS];
+
+    Perf();
+    ~Perf() = default;
+
+    // Emulation thread side
+    void count(PerfCounter p_counter, uint64_t p_n) {
+        this->counts[(uint32_t)p_counter] += p_n;
+    }
+    // Charge the time since the last switch to the current
+    // section and make p_section current. Returns the previous
+    // section.
+    PerfSection enter(PerfSection p_section);
+    void end_frame();
+
+    // Reader side. Frames [frames() - HISTORY + 1, frames()) are
+    // stable, the oldest slot is the next one to be written.
+    uint64_t frames() const {
+        return this->published.load(std::memory_order_acquire);
+    }
+    const PerfFrame &frame(uint64_t p_index) const {
+        return this->history[p_index % HISTORY];
+    }
+
+    // Averages over the run and the recent frames
+    void write_json(FILE *p_file) const;
+
+    // Raw timestamp: TSC where available, nanoseconds otherwise
+    static uint64_t now();
+
+  private:
+    uint64_t ticks[PERF_SECTIONS];
+    uint64_t counts[PERF_COUNTERS];
+    PerfSection current;
+    // Timestamp of the last section switch
+    uint64_t mark;
+
+    // Start of the frame being measured
+    uint64_t frame_ticks;
+    int64_t frame_ns;
+
+    PerfFrame history[HISTORY];
+    std::atomic<uint64_t> published;
+    // Sum of every published frame
+    PerfFrame total;
+};
+
+/// Charges the enclosing scope to a section. A null Perf makes it
+/// a no-op, for subsystems used without a frontend.
+struct PerfScope {
+    PerfScope(Perf *p_perf, PerfSection p_section) {
+        this->perf = p_perf;
+        // Unused without a Perf
+        this->saved = PerfSection::Cpu;
+        if (p_perf)
+            this->saved = p_perf->enter(p_section);
+    }
+    ~PerfScope() {
+        if (this->perf)
+            this->perf->enter(this->saved);
+    }
+
+    Perf *perf;
+    PerfSection saved;
+};
+
+// Counter increment for subsystems holding an optional Perf
+inline void perf_count(Perf *p_perf, PerfCounter p_counter,
+                       uint64_t p_n) {
+    if (p_perf)
+        p_perf->count(p_counter, p_n);
+}
@@ -40,6 +40,9 @@ template <typename T> T RAM::load(uint32_t p_offset) {
 
 template <typename T>
 void RAM::store(uint32_t p_offset, T p_value) {
+    // Stores are naturally aligned so they never straddle pages
+    this->dirty.mark(p_offset >> PAGE_SHIFT);
+
     switch (sizeof(T)) {
     case 1:
         this->data[p_offset] = p_value;
@@ -1,9 +1,18 @@
 #pragma once
+#include "dirty.h"
 #include <cstdint>
 
 struct RAM {
+  static constexpr uint32_t SIZE = 2 * 1024 * 1024;
+  // Write tracking granularity: 4KB pages
+  static constexpr uint32_t PAGE_SHIFT = 12;
+  static constexpr uint32_t PAGE_COUNT = SIZE >> PAGE_SHIFT;
+
   // RAM BUFFER
-  uint8_t data[2*1024*1024];
+  uint8_t data[SIZE];
+
+  // Pages written since each client last cleared them
+  DirtyMap<PAGE_COUNT> dirty;
 
   RAM();
   ~RAM() = default;
@@ -13,6 +22,14 @@ struct RAM {
 
   template <class T>
   void store(uint32_t offset, T value);
-};
 
+  // Save state fields, see SaveState. A loaded state counts as
+  // written everywhere.
+  template <class V> void serialize(V &p_v) {
+    p_v.section("RAM ");
+    p_v.bytes(this->data, SIZE);
+    if constexpr (V::LOADING)
+      this->dirty.mark_all();
+  }
+};
 
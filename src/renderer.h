@@ -1,37 +1,63 @@
 #pragma once
-#include "gl_buffer.h"
-#include "GLFW/glfw3.h"
-#include "glad.h"
-#include "shader.h"
+#include "perf.h"
+#include "scanout.h"
 #include "structs.h"
+#include "vram.h"
+#include <cstdint>
 
+/// Backend turning the primitives and VRAM transfers decoded by the
+/// GPU into pixels. Picked at startup: GlRenderer in a window or
+/// headless, or NullRenderer when nothing has to be drawn.
 struct Renderer {
-    Renderer();
-    ~Renderer();
-    void render_loop();
-    void update();
-
-    static const uint32_t VERTEX_BUFFER_LEN = 64 * 1024;
-
-    GLuint vao;
-    uint32_t nvertices;
-
-    Buffer<Color> *color_buf;
-    Buffer<Position> *pos_buf;
-
-    void push_triangle(Position positions[3], Color color[3]);
-    void push_quad(Position position[4], Color color[4]);
-    void draw();
-
-    GLFWwindow *window;
-    Shader *program;
-    
-    const char *vendor;
-    const char *renderer;
-
-    float deltaTime = 0.0f;
-    float lastFrame = 0.0f;
-    float previousSecond = glfwGetTime();
-    int frameCount = 0;
-    int fps = 0;
+    virtual ~Renderer() = default;
+
+    // Timing and counters, optional and owned by the frontend
+    Perf *perf = nullptr;
+
+    virtual void push_triangle(const Vertex p_vertices[3]) = 0;
+    virtual void push_quad(const Vertex p_vertices[4]) = 0;
+    // Line including both end points
+    virtual void push_line(const Vertex p_vertices[2]) = 0;
+
+    // GP0(E3)/GP0(E4) drawing area, inclusive
+    virtual void set_draw_area(uint16_t p_left, uint16_t p_top,
+                               uint16_t p_right,
+                               uint16_t p_bottom) = 0;
+    // GP0(E5) offset added to every vertex
+    virtual void set_draw_offset(int16_t p_x, int16_t p_y) = 0;
+
+    // GP0(02) fill, ignoring the drawing area and offset
+    virtual void fill_vram(uint16_t p_x, uint16_t p_y,
+                           uint16_t p_width, uint16_t p_height,
+                           Color p_color) = 0;
+    // Copy a (wrapping) rectangle written by the CPU into VRAM
+    virtual void upload_vram(const VRam &p_vram, uint32_t p_x,
+                             uint32_t p_y, uint32_t p_width,
+                             uint32_t p_height) = 0;
+
+    // Bring back a (wrapping) rectangle drawn by the renderer
+    // into the CPU side VRam, before the CPU reads it
+    virtual void read_vram(VRam &p_vram, uint32_t p_x,
+                           uint32_t p_y, uint32_t p_width,
+                           uint32_t p_height) = 0;
+    // GP0(80) copy on the renderer side. Returns false if the
+    // backend can't do it itself, the GPU then reads the source
+    // back and uploads the destination.
+    virtual bool copy_vram(uint32_t p_src_x, uint32_t p_src_y,
+                           uint32_t p_dst_x, uint32_t p_dst_y,
+                           uint32_t p_width, uint32_t p_height) = 0;
+
+    // (Re)load texture cache slot p_slot with 256x256 decoded
+    // texels. Primitives already pushed keep the previous ones.
+    virtual void
+    upload_texture_page(uint32_t p_slot,
+                        const uint16_t *p_texels) = 0;
+
+    // Called at the start of every vertical blanking with the
+    // VRAM region selected by the display registers. p_frame is
+    // the CPU converted picture when the GPU made one, always the
+    // case for 24bit output which the renderer can't show from
+    // VRAM itself.
+    virtual void present(const DisplayArea &p_area,
+                         const Scanout *p_frame) = 0;
 };
@@ -0,0 +1,283 @@
+#include "reverb.h"
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Register offsets from 0x1f801c00
+static constexpr uint32_t REVERB_VOLUME = 0x184;
+static constexpr uint32_t CONTROL = 0x1aa;
+static constexpr uint32_t APF_OFFSET = 0x1c0;
+static constexpr uint32_t IIR_VOLUME = 0x1c4;
+static constexpr uint32_t COMB_VOLUME = 0x1c6;
+static constexpr uint32_t WALL_VOLUME = 0x1ce;
+static constexpr uint32_t APF_VOLUME = 0x1d0;
+// Left and right pairs from here on
+static constexpr uint32_t SAME = 0x1d4;
+static constexpr uint32_t COMB_12 = 0x1d8;
+static constexpr uint32_t SAME_SOURCE = 0x1e0;
+static constexpr uint32_t DIFF = 0x1e4;
+static constexpr uint32_t COMB_34 = 0x1e8;
+static constexpr uint32_t DIFF_SOURCE = 0x1f0;
+static constexpr uint32_t APF = 0x1f4;
+static constexpr uint32_t INPUT_VOLUME = 0x1fc;
+
+// SPUCNT: the network writes to the work area
+static constexpr uint16_t CONTROL_REVERB = 0x0080;
+
+// The half-band FIR, 39 taps from 44.1kHz to 22.05kHz. Padded
+// with zeros to whole vectors.
+alignas(32) static const int16_t DOWN_TAPS[48] = {
+       -1,     0,     2,     0,   -10,     0,    35,     0,
+     -103,     0,   266,     0,  -616,     0,  1332,     0,
+    -2960,     0, 10246, 16384, 10246,     0, -2960,     0,
+     1332,     0,  -616,     0,   266,     0,  -103,     0,
+       35,     0,   -10,     0,     2,     0,    -1,
+};
+static constexpr uint32_t DOWN_WINDOW = 39;
+
+// Its odd taps, the only non-zero ones when going back to
+// 44.1kHz: the even ones meet the zeros between the 22.05kHz
+// samples, but for the center one
+alignas(32) static const int16_t UP_TAPS[32] = {
+       -1,     2,   -10,    35,  -103,   266,  -616,  1332,
+    -2960, 10246, 10246, -2960,  1332,  -616,   266,  -103,
+       35,   -10,     2,    -1,
+};
+static constexpr uint32_t UP_WINDOW = 20;
+
+static inline int32_t clamp16(int32_t p_val) {
+    return std::clamp(p_val, -0x8000, 0x7fff);
+}
+
+// The IIR's feedback factor, where a volume of -0x8000 wraps
+static inline int32_t iir_feedback(int32_t p_volume,
+                                   int32_t p_sample) {
+    if (p_volume == -0x8000)
+        return p_sample == -0x8000 ? 0 : p_sample * -0x10000;
+    return p_sample * (0x8000 - p_volume);
+}
+
+// Halved sum, saturated: most steps of the network
+static inline int32_t average(int32_t p_a, int32_t p_b) {
+    return clamp16((p_a + p_b) >> 1);
+}
+
+static inline int32_t negate(int32_t p_val) {
+    return p_val == -0x8000 ? 0x7fff : -p_val;
+}
+
+#ifdef __AVX2__
+static inline int32_t sum_lanes(__m256i p_val) {
+    __m128i high = _mm256_extracti128_si256(p_val, 1);
+    __m128i sum =
+        _mm_add_epi32(_mm256_castsi256_si128(p_val), high);
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// Dot product of 16 p_a and p_b
+static inline __m256i dot_16(const int16_t *p_a,
+                             const int16_t *p_b) {
+    return _mm256_madd_epi16(
+        _mm256_loadu_si256((const __m256i *)p_a),
+        _mm256_load_si256((const __m256i *)p_b));
+}
+#endif
+
+Reverb::Reverb() {
+    memset(this->down, 0, sizeof(this->down));
+    memset(this->up, 0, sizeof(this->up));
+    this->position = 0;
+    this->base = 0;
+    this->current = 0;
+    this->enabled = true;
+}
+
+void Reverb::set_base(uint16_t p_val) {
+    this->base = (uint32_t(p_val) << 2) & ReverbArea::MASK;
+    this->current = this->base;
+}
+
+void Reverb::load_params(const uint16_t *p_regs,
+                         Params &p_params) {
+    auto reg = [p_regs](uint32_t p_offset) {
+        return p_regs[p_offset / 2];
+    };
+    // Addresses count 8 bytes, 4 halfwords
+    auto offset = [](uint32_t p_val) {
+        return (p_val << 2) & ReverbArea::MASK;
+    };
+
+    p_params.write = reg(CONTROL) & CONTROL_REVERB;
+    p_params.v_iir = int16_t(reg(IIR_VOLUME));
+    p_params.v_wall = int16_t(reg(WALL_VOLUME));
+    for (uint32_t i = 0; i < 2; i++)
+        p_params.v_apf[i] = int16_t(reg(APF_VOLUME + i * 2));
+    for (uint32_t i = 0; i < 4; i++)
+        p_params.v_comb[i] = int16_t(reg(COMB_VOLUME + i * 2));
+
+    for (uint32_t lr = 0; lr < 2; lr++) {
+        uint32_t side = lr * 2;
+        p_params.v_in[lr] = int16_t(reg(INPUT_VOLUME + side));
+        p_params.v_out[lr] = int16_t(reg(REVERB_VOLUME + side));
+
+        uint16_t same = reg(SAME + side);
+        uint16_t diff = reg(DIFF + side);
+        p_params.same[lr] = offset(same);
+        // The previous sample, wrapping below 0
+        p_params.same_prev[lr] =
+            (offset(same) - 1) & ReverbArea::MASK;
+        p_params.diff[lr] = offset(diff);
+        p_params.diff_prev[lr] =
+            (offset(diff) - 1) & ReverbArea::MASK;
+        p_params.same_src[lr] = offset(reg(SAME_SOURCE + side));
+        // From the other side
+        p_params.diff_src[lr] =
+            offset(reg(DIFF_SOURCE + (side ^ 2)));
+
+        p_params.comb[0][lr] = offset(reg(COMB_12 + side));
+        p_params.comb[1][lr] = offset(reg(COMB_12 + 4 + side));
+        p_params.comb[2][lr] = offset(reg(COMB_34 + side));
+        p_params.comb[3][lr] = offset(reg(COMB_34 + 4 + side));
+
+        for (uint32_t a = 0; a < 2; a++) {
+            uint16_t apf = reg(APF + a * 4 + side);
+            uint16_t back = reg(APF_OFFSET + a * 2);
+            p_params.apf[a][lr] = offset(apf);
+            p_params.apf_src[a][lr] = offset(apf - back);
+        }
+    }
+}
+
+int32_t Reverb::downsample(uint32_t p_channel,
+                           uint32_t p_position) {
+    const int16_t *window =
+        this->down[p_channel] +
+        ((p_position - (DOWN_WINDOW - 1)) & (DOWN_RING - 1));
+    int32_t sum = 0;
+#ifdef __AVX2__
+    __m256i acc = _mm256_add_epi32(
+        _mm256_add_epi32(dot_16(window, DOWN_TAPS),
+                         dot_16(window + 16, DOWN_TAPS + 16)),
+        dot_16(window + 32, DOWN_TAPS + 32));
+    sum = sum_lanes(acc);
+#else
+    for (uint32_t i = 0; i < DOWN_WINDOW; i++)
+        sum += DOWN_TAPS[i] * window[i];
+#endif
+    return clamp16(sum >> 15);
+}
+
+int32_t Reverb::upsample(uint32_t p_channel,
+                         uint32_t p_position) {
+    uint32_t tick = p_position >> 1;
+    const int16_t *window =
+        this->up[p_channel] +
+        ((tick - (UP_WINDOW - 1)) & (UP_RING - 1));
+    // Between two ticks only the center tap meets a sample
+    if (!(p_position & 1))
+        return window[UP_WINDOW / 2 - 1];
+
+    int32_t sum = 0;
+#ifdef __AVX2__
+    __m256i acc =
+        _mm256_add_epi32(dot_16(window, UP_TAPS),
+                         dot_16(window + 16, UP_TAPS + 16));
+    sum = sum_lanes(acc);
+#else
+    for (uint32_t i = 0; i < UP_WINDOW; i++)
+        sum += UP_TAPS[i] * window[i];
+#endif
+    return clamp16(sum >> 14);
+}
+
+void Reverb::tick(ReverbArea &p_area, const Params &p_params,
+                  const int32_t p_in[2], uint32_t p_tick) {
+    const Params &p = p_params;
+    for (uint32_t lr = 0; lr < 2; lr++) {
+        // Reflections, same side and crossing over
+        if (p.write) {
+            int32_t in = p_in[lr] * p.v_in[lr] >> 14;
+            int32_t same_in = average(
+                p_area.read(p.same_src[lr]) * p.v_wall >> 14, in);
+            int32_t diff_in = average(
+                p_area.read(p.diff_src[lr]) * p.v_wall >> 14, in);
+            int32_t same_fb = iir_feedback(
+                p.v_iir, p_area.read(p.same_prev[lr]));
+            int32_t diff_fb = iir_feedback(
+                p.v_iir, p_area.read(p.diff_prev[lr]));
+            int32_t same =
+                average(same_in * p.v_iir >> 14, same_fb >> 14);
+            int32_t diff =
+                average(diff_in * p.v_iir >> 14, diff_fb >> 14);
+            p_area.write(p.same[lr], int16_t(same));
+            p_area.write(p.diff[lr], int16_t(diff));
+        }
+
+        // Echoes
+        int32_t acc = 0;
+        for (uint32_t c = 0; c < 4; c++)
+            acc += p_area.read(p.comb[c][lr]) * p.v_comb[c] >> 14;
+
+        // Two all-pass filters in a row
+        int32_t fb_a = p_area.read(p.apf_src[0][lr]);
+        int32_t fb_b = p_area.read(p.apf_src[1][lr]);
+        int32_t mda =
+            average(acc, fb_a * negate(p.v_apf[0]) >> 14);
+        int32_t apf_mix =
+            (mda * p.v_apf[0] >> 14) - (fb_b * p.v_apf[1] >> 14);
+        int32_t mdb = clamp16(fb_a + (apf_mix >> 1));
+        int32_t out = clamp16(fb_b + (mdb * p.v_apf[1] >> 15));
+        if (p.write) {
+            p_area.write(p.apf[0][lr], int16_t(mda));
+            p_area.write(p.apf[1][lr], int16_t(mdb));
+        }
+
+        uint32_t at = p_tick & (UP_RING - 1);
+        this->up[lr][at] = int16_t(out);
+        this->up[lr][at + UP_RING] = int16_t(out);
+    }
+
+    // Wraps back to the start of the area at the end of RAM
+    uint32_t next = (p_area.current + 1) & ReverbArea::MASK;
+    p_area.current = next != 0 ? next : this->base;
+}
+
+void Reverb::run(uint8_t *p_ram, const uint16_t *p_regs,
+                 const int16_t *p_in, int32_t *p_out,
+                 uint32_t p_frames) {
+    Params params;
+    this->load_params(p_regs, params);
+    ReverbArea area = {p_ram, this->base, this->current};
+
+    // The whole block goes in first: the windows only look back
+    for (uint32_t i = 0; i < p_frames; i++) {
+        uint32_t at = (this->position + i) & (DOWN_RING - 1);
+        for (uint32_t lr = 0; lr < 2; lr++) {
+            this->down[lr][at] = p_in[i * 2 + lr];
+            this->down[lr][at + DOWN_RING] = p_in[i * 2 + lr];
+        }
+    }
+
+    for (uint32_t i = 0; i < p_frames; i++) {
+        uint32_t position = this->position + i;
+        if (position & 1) {
+            int32_t in[2] = {this->downsample(0, position),
+                             this->downsample(1, position)};
+            this->tick(area, params, in, position >> 1);
+        }
+    }
+    this->current = area.current;
+
+    for (uint32_t i = 0; i < p_frames; i++) {
+        uint32_t position = this->position + i;
+        for (uint32_t lr = 0; lr < 2; lr++)
+            p_out[i * 2 + lr] = this->upsample(lr, position) *
+                                    params.v_out[lr] >>
+                                15;
+    }
+    this->position =
+        (this->position + p_frames) & (DOWN_RING - 1);
+}
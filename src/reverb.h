@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+/// Halfword view of the reverb work area: sound RAM from `base`
+/// to its end, used as a ring addressed relative to `current`.
+/// Tap offsets wrap back into the area with a mask instead of a
+/// branch, as the hardware does, offsets past the end included.
+struct ReverbArea {
+    // Halfwords of sound RAM
+    static constexpr uint32_t MASK = 0x3ffff;
+
+    uint8_t *ram;
+    uint32_t base;
+    uint32_t current;
+
+    uint32_t index(uint32_t p_offset) const {
+        uint32_t i = this->current + p_offset;
+        // Past the end of RAM: back to the start of the area
+        i += this->base & (0u - ((i >> 18) & 1));
+        return i & MASK;
+    }
+    int16_t read(uint32_t p_offset) const {
+        int16_t val;
+        memcpy(&val, this->ram + this->index(p_offset) * 2, 2);
+        return val;
+    }
+    void write(uint32_t p_offset, int16_t p_val) {
+        memcpy(this->ram + this->index(p_offset) * 2, &p_val, 2);
+    }
+};
+
+/// SPU reverb: the hardware's network of IIR, comb and all-pass
+/// filters, run at 22.05kHz over the work area in sound RAM.
+/// Input and output go through a 39 tap half-band FIR from and
+/// back to 44.1kHz.
+///
+/// The SPU hands it blocks of up to BLOCK samples. The FIRs are
+/// most of the work and have no feedback: each output is a
+/// vector dot product (AVX2 when the build targets it) over a
+/// window of its ring, and the rings keep every sample twice, at
+/// i and i + size, so a window is always contiguous. The filter
+/// network reads back what it wrote a tick earlier, and the right
+/// channel what the left one just wrote when the taps coincide
+/// (as in most presets), so it stays a sequential loop over the
+/// block's ticks. Every path gives the same samples.
+struct Reverb {
+    // Most samples per run()
+    static constexpr uint32_t BLOCK = 32;
+    // Resampling rings, in 44.1kHz and 22.05kHz samples: a block
+    // and a filter window fit without wrapping onto each other
+    static constexpr uint32_t DOWN_RING = 128;
+    static constexpr uint32_t UP_RING = 64;
+
+    // Input at 44.1kHz and output at 22.05kHz, by channel
+    alignas(32) int16_t down[2][2 * DOWN_RING];
+    alignas(32) int16_t up[2][2 * UP_RING];
+    // 44.1kHz samples so far, mod DOWN_RING. Odd ones run the
+    // network.
+    uint32_t position;
+    // Work area start (mBASE) and position, in halfwords
+    uint32_t base;
+    uint32_t current;
+
+    // Set by the frontend, not part of save states. Off, the
+    // output is dry and the work area is left alone: for runs
+    // nobody listens to.
+    bool enabled;
+
+    Reverb();
+    ~Reverb() = default;
+
+    // mBASE write, restarting at the top of the area
+    void set_base(uint16_t p_val);
+
+    // p_frames (at most BLOCK) stereo frames: p_in the sum of the
+    // voices with reverb on, p_out the reverb after its output
+    // volume. p_regs are the SPU registers, by halfword.
+    void run(uint8_t *p_ram, const uint16_t *p_regs,
+             const int16_t *p_in, int32_t *p_out,
+             uint32_t p_frames);
+
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("RVB ");
+        p_v.value(this->down);
+        p_v.value(this->up);
+        p_v.value(this->position);
+        p_v.value(this->base);
+        p_v.value(this->current);
+    }
+
+  private:
+    // Registers of a block, offsets in halfwords from `current`
+    struct Params {
+        bool write;
+        int32_t v_iir;
+        int32_t v_wall;
+        int32_t v_apf[2];
+        int32_t v_comb[4];
+        int32_t v_in[2];
+        int32_t v_out[2];
+        // By channel
+        uint32_t same[2];
+        uint32_t same_prev[2];
+        uint32_t diff[2];
+        uint32_t diff_prev[2];
+        uint32_t same_src[2];
+        uint32_t diff_src[2];
+        uint32_t comb[4][2];
+        uint32_t apf[2][2];
+        uint32_t apf_src[2][2];
+    };
+
+    void load_params(const uint16_t *p_regs, Params &p_params);
+    // One 22.05kHz tick of the network: p_in downsampled, the
+    // result goes to the up ring at p_tick
+    void tick(ReverbArea &p_area, const Params &p_params,
+              const int32_t p_in[2], uint32_t p_tick);
+    // 44.1kHz to 22.05kHz, for the odd p_position
+    int32_t downsample(uint32_t p_channel, uint32_t p_position);
+    // 22.05kHz back to 44.1kHz at p_position
+    int32_t upsample(uint32_t p_channel, uint32_t p_position);
+};
@@ -0,0 +1,277 @@
+#include "rewind.h"
+#include "lz.h"
+#include "system.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+/// Offset in a state of the memory at `memory`, found by walking
+/// the fields like StateSizer
+struct StateLocator {
+    static constexpr bool LOADING = false;
+
+    const void *memory;
+    size_t size = sizeof(StateHeader);
+    size_t found = SIZE_MAX;
+
+    void section(const char (&p_tag)[5]) { this->size += 4; }
+
+    template <class T> void value(T &p_val) {
+        this->size += sizeof(T);
+    }
+
+    void bytes(void *p_data, size_t p_size) {
+        if (p_data == this->memory)
+            this->found = this->size;
+        this->size += p_size;
+    }
+};
+
+/// Walks the fields like StateWriter, but compares them with
+/// the previous state instead, adding the changed ones to the
+/// delta. RAM and VRAM are skipped.
+struct Rewind::DeltaWriter {
+    static constexpr bool LOADING = false;
+
+    Rewind *rewind;
+    const void *ram;
+    const void *vram;
+    size_t offset = sizeof(StateHeader);
+
+    // Tags never change
+    void section(const char (&p_tag)[5]) { this->offset += 4; }
+
+    template <class T> void value(T &p_val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->bytes(&p_val, sizeof(T));
+    }
+
+    void bytes(void *p_data, size_t p_size) {
+        if (p_data != this->ram && p_data != this->vram) {
+            const uint8_t *data = (const uint8_t *)p_data;
+            for (size_t at = 0; at < p_size; at += BLOCK) {
+                size_t len = std::min(BLOCK, p_size - at);
+                this->rewind->compare(this->offset + at,
+                                      data + at, len);
+            }
+        }
+        this->offset += p_size;
+    }
+};
+
+Rewind::Rewind(size_t p_capacity, uint32_t p_key_interval) {
+    this->capacity = p_capacity;
+    this->key_interval = p_key_interval != 0 ? p_key_interval : 1;
+    this->since_key = 0;
+    this->used = 0;
+    this->system = nullptr;
+    this->ram_client = 0;
+    this->vram_client = 0;
+    this->ram_at = 0;
+    this->vram_at = 0;
+}
+
+void Rewind::capture(System &p_system) {
+    RAM &ram = p_system.ram;
+    VRam &vram = p_system.gpu.vram;
+    if (this->system == nullptr) {
+        this->system = &p_system;
+        this->ram_client = ram.dirty.acquire_client();
+        this->vram_client = vram.dirty.acquire_client();
+    }
+
+    bool key = this->ring.empty() ||
+               this->since_key + 1 >= this->key_interval ||
+               p_system.state_size() != this->current.data.size();
+    if (key) {
+        p_system.save_state(this->current);
+        ram.dirty.clear_all(this->ram_client);
+        vram.dirty.clear_all(this->vram_client);
+        this->locate(p_system);
+
+        const std::vector<uint8_t> &state = this->current.data;
+        this->packed.resize(lz_bound(state.size()));
+        this->push(true, lz_compress(state.data(), state.size(),
+                                     this->packed.data()));
+        this->trim();
+        return;
+    }
+
+    // Everything but RAM and VRAM, compared whole
+    this->changed.clear();
+    this->blocks.clear();
+    p_system.gpu.sync_vram(vram.stale);
+    DeltaWriter writer{this, ram.data, vram.data};
+    p_system.serialize(writer);
+
+    constexpr uint32_t PAGE = 1 << RAM::PAGE_SHIFT;
+    ram.dirty.for_each_dirty(
+        this->ram_client, [&](uint32_t p_page) {
+            size_t offset = size_t(p_page) * PAGE;
+            this->compare(this->ram_at + offset,
+                          ram.data + offset, PAGE);
+        });
+    ram.dirty.clear_all(this->ram_client);
+
+    // Row by row, so that the rows of neighbouring dirty tiles
+    // make one span
+    constexpr uint32_t TILE_WIDTH = 1 << VRam::TILE_SHIFT_X;
+    constexpr uint32_t TILE_HEIGHT = 1 << VRam::TILE_SHIFT_Y;
+    for (uint32_t ty = 0; ty < VRam::TILES_Y; ty++) {
+        for (uint32_t y = 0; y < TILE_HEIGHT; y++) {
+            for (uint32_t tx = 0; tx < VRam::TILES_X; tx++) {
+                uint32_t tile = VRam::tile_index(tx, ty);
+                if (!vram.dirty.is_dirty(tile, this->vram_client))
+                    continue;
+                uint32_t i = VRam::index(tx * TILE_WIDTH,
+                                         ty * TILE_HEIGHT + y);
+                this->compare(this->vram_at + size_t(i) * 2,
+                              (const uint8_t *)(vram.data + i),
+                              TILE_WIDTH * 2);
+            }
+        }
+    }
+    vram.dirty.clear_all(this->vram_client);
+
+    uint32_t count = uint32_t(this->changed.size());
+    size_t head = 4 + size_t(count) * sizeof(Span);
+    this->packed.resize(head + lz_bound(this->blocks.size()));
+    memcpy(this->packed.data(), &count, 4);
+    memcpy(this->packed.data() + 4, this->changed.data(),
+           size_t(count) * sizeof(Span));
+    size_t size = lz_compress(this->blocks.data(),
+                              this->blocks.size(),
+                              this->packed.data() + head);
+    this->push(false, head + size);
+    this->trim();
+}
+
+bool Rewind::step_back(System &p_system) {
+    if (this->ring.size() < 2)
+        return false;
+
+    if (this->ring.back().key)
+        this->rebuild(this->ring.size() - 2, this->current.data);
+    else
+        this->apply_delta(this->ring.back(), this->current.data);
+
+    this->used -= this->ring.back().data.size();
+    this->ring.pop_back();
+    this->since_key = 0;
+    for (size_t i = this->ring.size(); i-- > 0;) {
+        if (this->ring[i].key)
+            break;
+        this->since_key += 1;
+    }
+
+    p_system.load_state(this->current);
+    // The next delta starts from `current`, whatever the dirty
+    // maps held
+    p_system.ram.dirty.mark_all(this->ram_client);
+    p_system.gpu.vram.dirty.mark_all(this->vram_client);
+    return true;
+}
+
+void Rewind::push(bool p_key, size_t p_size) {
+    Snapshot snapshot;
+    snapshot.key = p_key;
+    snapshot.data.assign(this->packed.begin(),
+                         this->packed.begin() + p_size);
+
+    this->used += p_size;
+    this->since_key = p_key ? 0 : this->since_key + 1;
+    this->ring.push_back(std::move(snapshot));
+}
+
+void Rewind::locate(System &p_system) {
+    StateLocator ram{p_system.ram.data};
+    p_system.serialize(ram);
+    StateLocator vram{p_system.gpu.vram.data};
+    p_system.serialize(vram);
+    this->ram_at = ram.found;
+    this->vram_at = vram.found;
+}
+
+void Rewind::compare(size_t p_offset, const uint8_t *p_now,
+                     size_t p_size) {
+    uint8_t *before = this->current.data.data() + p_offset;
+    if (memcmp(p_now, before, p_size) == 0)
+        return;
+
+    size_t at = this->blocks.size();
+    this->blocks.resize(at + p_size);
+    for (size_t i = 0; i < p_size; i++)
+        this->blocks[at + i] = p_now[i] ^ before[i];
+    memcpy(before, p_now, p_size);
+
+    if (!this->changed.empty()) {
+        Span &span = this->changed.back();
+        if (span.offset + span.size == p_offset) {
+            span.size += uint32_t(p_size);
+            return;
+        }
+    }
+    this->changed.push_back(
+        {uint32_t(p_offset), uint32_t(p_size)});
+}
+
+void Rewind::apply_delta(const Snapshot &p_delta,
+                         std::vector<uint8_t> &p_state) {
+    const uint8_t *data = p_delta.data.data();
+    uint32_t count;
+    memcpy(&count, data, 4);
+    size_t head = 4 + size_t(count) * sizeof(Span);
+    this->changed.resize(count);
+    memcpy(this->changed.data(), data + 4,
+           size_t(count) * sizeof(Span));
+
+    size_t size = 0;
+    for (const Span &span : this->changed)
+        size += span.size;
+
+    this->blocks.resize(size);
+    if (!lz_decompress(data + head, p_delta.data.size() - head,
+                       this->blocks.data(), size))
+        throw std::runtime_error("Damaged rewind snapshot");
+
+    const uint8_t *src = this->blocks.data();
+    for (const Span &span : this->changed) {
+        uint8_t *dst = p_state.data() + span.offset;
+        for (size_t j = 0; j < span.size; j++)
+            dst[j] ^= src[j];
+        src += span.size;
+    }
+}
+
+void Rewind::rebuild(size_t p_index,
+                     std::vector<uint8_t> &p_state) {
+    // trim() keeps a keyframe at the front
+    size_t key = p_index;
+    while (!this->ring[key].key)
+        key -= 1;
+
+    const Snapshot &keyframe = this->ring[key];
+    if (!lz_decompress(keyframe.data.data(), keyframe.data.size(),
+                       p_state.data(), p_state.size()))
+        throw std::runtime_error("Damaged rewind keyframe");
+    for (size_t i = key + 1; i <= p_index; i++)
+        this->apply_delta(this->ring[i], p_state);
+}
+
+void Rewind::trim() {
+    while (this->used > this->capacity) {
+        size_t next = 1;
+        while (next < this->ring.size() && !this->ring[next].key)
+            next += 1;
+        // The newest group stays
+        if (next == this->ring.size())
+            break;
+
+        for (size_t i = 0; i < next; i++) {
+            this->used -= this->ring.front().data.size();
+            this->ring.pop_front();
+        }
+    }
+}
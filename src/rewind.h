@@ -0,0 +1,106 @@
+#pragma once
+#include "savestate.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+struct System;
+
+/// Rewind history: the machine states of the last frames, kept
+/// compressed in memory.
+///
+/// Every key_interval captures a full state is stored, LZ
+/// compressed. The captures in between are deltas: the spans of
+/// the state that changed since the previous capture, XORed with
+/// their previous contents (mostly zero bytes) and LZ
+/// compressed. RAM and VRAM, most of a state, are never compared
+/// whole: only the RAM pages and VRAM tiles their dirty maps flag
+/// since the last capture are. The other devices are small and
+/// compared in full, field by field and their memories BLOCK by
+/// BLOCK.
+///
+/// XOR works both ways, so stepping back from the newest state
+/// only undoes one delta. Keyframes bound the work of rebuilding
+/// a state behind them, and when the history grows past its
+/// memory cap the oldest keyframe and its deltas are dropped
+/// together.
+///
+/// A Rewind belongs to the System it first captures, where it
+/// holds a client of both dirty maps.
+struct Rewind {
+    static constexpr size_t BLOCK = 4096;
+
+    // p_capacity: bytes of compressed history to keep, at least
+    // one keyframe group is kept whatever its size
+    Rewind(size_t p_capacity, uint32_t p_key_interval);
+    ~Rewind() = default;
+
+    // Add the current machine state, called once per frame
+    void capture(System &p_system);
+    // Go back to the state captured before the newest one, which
+    // is forgotten. Returns false when there is none left.
+    bool step_back(System &p_system);
+
+    size_t snapshots() const { return this->ring.size(); }
+    // Compressed bytes held
+    size_t memory() const { return this->used; }
+
+  private:
+    struct Snapshot {
+        bool key;
+        // Keyframes: the LZ compressed state. Deltas: the count
+        // of changed spans, the spans, then the LZ compressed XOR
+        // of their contents.
+        std::vector<uint8_t> data;
+    };
+
+    // Bytes [offset, offset + size) of the state
+    struct Span {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // Compares the state but RAM and VRAM
+    struct DeltaWriter;
+
+    void push(bool p_key, size_t p_size);
+    // Find RAM and VRAM in a state of p_system
+    void locate(System &p_system);
+    // Add the bytes of the state at p_offset to the delta if
+    // p_now differs from them, and update them. Contiguous
+    // changes make one span.
+    void compare(size_t p_offset, const uint8_t *p_now,
+                 size_t p_size);
+    // XOR the changed spans of p_delta into p_state
+    void apply_delta(const Snapshot &p_delta,
+                     std::vector<uint8_t> &p_state);
+    // Rebuild the state of ring[p_index] into p_state
+    void rebuild(size_t p_index, std::vector<uint8_t> &p_state);
+    // Drop the oldest keyframe groups beyond the memory cap
+    void trim();
+
+    size_t capacity;
+    uint32_t key_interval;
+    // Deltas since the newest keyframe
+    uint32_t since_key;
+    size_t used;
+
+    // Set by the first capture
+    System *system;
+    uint8_t ram_client;
+    uint8_t vram_client;
+    // Offsets of RAM and VRAM in a state
+    size_t ram_at;
+    size_t vram_at;
+
+    std::deque<Snapshot> ring;
+    // State of ring.back(), uncompressed
+    SaveState current;
+    // Changed spans and contents of the delta being built
+    std::vector<Span> changed;
+    std::vector<uint8_t> blocks;
+    // Compression output, copied to the snapshot once its size is
+    // known
+    std::vector<uint8_t> packed;
+};
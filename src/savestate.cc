@@ -0,0 +1,44 @@
+#include "savestate.h"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+void SaveState::write_file(const char *p_path) const {
+    FILE *file = fopen(p_path, "wb");
+    if (!file)
+        throw std::runtime_error(
+            std::string("Can't create save state: ") + p_path);
+
+    size_t written =
+        fwrite(this->data.data(), 1, this->data.size(), file);
+    if (fclose(file) != 0 || written != this->data.size())
+        throw std::runtime_error(
+            std::string("Can't write save state: ") + p_path);
+}
+
+void SaveState::read_file(const char *p_path) {
+    FILE *file = fopen(p_path, "rb");
+    if (!file)
+        throw std::runtime_error(
+            std::string("Can't open save state: ") + p_path);
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    this->data.resize(size > 0 ? size_t(size) : 0);
+    size_t read = fread(this->data.data(), 1, this->data.size(),
+                        file);
+    fclose(file);
+    if (size < 0 || read != this->data.size())
+        throw std::runtime_error(
+            std::string("Can't read save state: ") + p_path);
+}
+
+void StateChecker::section(const char (&p_tag)[5]) {
+    if (memcmp(this->cursor, p_tag, 4) != 0)
+        throw std::runtime_error(
+            std::string("Damaged save state, expected section ") +
+            p_tag);
+    this->cursor += 4;
+}
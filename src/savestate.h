@@ -0,0 +1,126 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Bump on any change to a serialize() method
+constexpr uint32_t STATE_VERSION = 4;
+
+/// Start of every save state
+struct StateHeader {
+    static constexpr char MAGIC[8] = {'P', 'S', 'X', 'S',
+                                      'T', 'A', 'T', 'E'};
+
+    char magic[8];
+    uint32_t version;
+    // Whole state, header included
+    uint32_t size;
+};
+
+/// A serialised machine, see System::save_state.
+///
+/// Every device lists its state once, in a
+///     template <class V> void serialize(V &p_v);
+/// method calling p_v.value() on its fields and p_v.bytes() on
+/// its memories, each device starting with a p_v.section() tag.
+/// Visitors walk these lists: StateSizer measures the state,
+/// StateWriter copies it out, StateChecker validates a state
+/// before StateReader copies it back in.
+///
+/// Fields are stored in their host layout: a state is only meant
+/// to be loaded by the build that wrote it.
+struct SaveState {
+    // Sized once, saving again into the same SaveState doesn't
+    // allocate
+    std::vector<uint8_t> data;
+
+    // Throw std::runtime_error on I/O errors
+    void write_file(const char *p_path) const;
+    void read_file(const char *p_path);
+};
+
+struct StateSizer {
+    static constexpr bool LOADING = false;
+
+    size_t size = 0;
+
+    void section(const char (&p_tag)[5]) { this->size += 4; }
+
+    template <class T> void value(T &p_val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->size += sizeof(T);
+    }
+
+    void bytes(void *p_data, size_t p_size) {
+        this->size += p_size;
+    }
+};
+
+/// Writes into a buffer already sized by StateSizer
+struct StateWriter {
+    static constexpr bool LOADING = false;
+
+    uint8_t *cursor;
+
+    void section(const char (&p_tag)[5]) {
+        memcpy(this->cursor, p_tag, 4);
+        this->cursor += 4;
+    }
+
+    template <class T> void value(T &p_val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->bytes(&p_val, sizeof(T));
+    }
+
+    void bytes(void *p_data, size_t p_size) {
+        memcpy(this->cursor, p_data, p_size);
+        this->cursor += p_size;
+    }
+};
+
+/// Walks a state without touching the machine. A section tag out
+/// of place means a damaged state, reported by throwing
+/// std::runtime_error.
+struct StateChecker {
+    static constexpr bool LOADING = false;
+
+    const uint8_t *cursor;
+
+    void section(const char (&p_tag)[5]);
+
+    template <class T> void value(T &p_val) {
+        this->cursor += sizeof(T);
+    }
+
+    void bytes(void *p_data, size_t p_size) {
+        this->cursor += p_size;
+    }
+};
+
+/// Reads a state that went through StateChecker
+struct StateReader {
+    static constexpr bool LOADING = true;
+
+    const uint8_t *cursor;
+
+    void section(const char (&p_tag)[5]) { this->cursor += 4; }
+
+    template <class T> void value(T &p_val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        this->bytes(&p_val, sizeof(T));
+    }
+
+    void bytes(void *p_data, size_t p_size) {
+        memcpy(p_data, this->cursor, p_size);
+        this->cursor += p_size;
+    }
+
+    // The next p_size bytes, for memories loaded by hand
+    const uint8_t *take(size_t p_size) {
+        const uint8_t *data = this->cursor;
+        this->cursor += p_size;
+        return data;
+    }
+};
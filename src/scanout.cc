@@ -0,0 +1,157 @@
+#include "scanout.h"
+#include <cstdio>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+Scanout::Scanout() {
+    this->width = 0;
+    this->height = 0;
+}
+
+// 5 to 8 bits, replicating the top bits so that 0x1f maps to 0xff
+static inline uint32_t expand_5(uint32_t p_val) {
+    return (p_val << 3) | (p_val >> 2);
+}
+
+void Scanout::convert_15(const uint16_t *p_src, uint32_t *p_dst,
+                         uint32_t p_count) {
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i mask = _mm256_set1_epi32(0x1f);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+    for (; i + 8 <= p_count; i += 8) {
+        __m256i p = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128((const __m128i *)(p_src + i)));
+
+        __m256i r = _mm256_and_si256(p, mask);
+        __m256i g =
+            _mm256_and_si256(_mm256_srli_epi32(p, 5), mask);
+        __m256i b =
+            _mm256_and_si256(_mm256_srli_epi32(p, 10), mask);
+        r = _mm256_or_si256(_mm256_slli_epi32(r, 3),
+                            _mm256_srli_epi32(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi32(g, 3),
+                            _mm256_srli_epi32(g, 2));
+        b = _mm256_or_si256(_mm256_slli_epi32(b, 3),
+                            _mm256_srli_epi32(b, 2));
+
+        __m256i out = _mm256_or_si256(
+            _mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+            _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha));
+        _mm256_storeu_si256((__m256i *)(p_dst + i), out);
+    }
+#endif
+
+    for (; i < p_count; i++) {
+        uint32_t p = p_src[i];
+        p_dst[i] = expand_5(p & 0x1f) |
+                   expand_5((p >> 5) & 0x1f) << 8 |
+                   expand_5((p >> 10) & 0x1f) << 16 | 0xff000000;
+    }
+}
+
+void Scanout::convert_24(const uint8_t *p_src, uint32_t *p_dst,
+                         uint32_t p_count) {
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    // Each 128bit lane gets 12 bytes, spread to 4 pixels
+    const __m256i spread = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, //
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+    for (; i + 8 <= p_count; i += 8) {
+        const uint8_t *s = p_src + i * 3;
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *)s)),
+            _mm_loadu_si128((const __m128i *)(s + 12)), 1);
+        __m256i out = _mm256_or_si256(
+            _mm256_shuffle_epi8(in, spread), alpha);
+        _mm256_storeu_si256((__m256i *)(p_dst + i), out);
+    }
+#endif
+
+    for (; i < p_count; i++) {
+        const uint8_t *s = p_src + i * 3;
+        p_dst[i] = uint32_t(s[0]) | uint32_t(s[1]) << 8 |
+                   uint32_t(s[2]) << 16 | 0xff000000;
+    }
+}
+
+void Scanout::convert(const VRam &p_vram,
+                      const DisplayArea &p_area) {
+    uint32_t w = p_area.width;
+    uint32_t h = p_area.height;
+    if (w > VRam::WIDTH)
+        w = VRam::WIDTH;
+    if (h > VRam::HEIGHT)
+        h = VRam::HEIGHT;
+
+    this->width = w;
+    this->height = h;
+    this->pixels.resize(size_t(w) * h);
+
+    // VRAM pixels making up an output row, plus the slack read
+    // by the 24bit kernel
+    uint32_t halfwords = p_area.depth24 ? (w * 3 + 1) / 2 : w;
+    uint32_t slack = p_area.depth24 ? 2 : 0;
+    uint32_t x = p_area.x % VRam::WIDTH;
+    bool contiguous = x + halfwords + slack <= VRam::WIDTH;
+
+    // Bounce buffer for rows wrapping around the right edge
+    uint16_t row[VRam::WIDTH * 3 / 2 + 4];
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint16_t *src =
+            p_vram.data + VRam::index(x, p_area.y + y);
+        if (!contiguous) {
+            for (uint32_t i = 0; i < halfwords; i++)
+                row[i] = p_vram.load(x + i, p_area.y + y);
+            src = row;
+        }
+
+        uint32_t *dst = this->pixels.data() + size_t(y) * w;
+        if (p_area.depth24)
+            convert_24((const uint8_t *)src, dst, w);
+        else
+            convert_15(src, dst, w);
+    }
+}
+
+uint64_t Scanout::hash() const {
+    uint64_t h = 0xcbf29ce484222325;
+    auto feed = [&h](uint32_t p_word) {
+        for (uint32_t i = 0; i < 4; i++) {
+            h ^= (p_word >> (i * 8)) & 0xff;
+            h *= 0x100000001b3;
+        }
+    };
+
+    feed(this->width);
+    feed(this->height);
+    for (uint32_t p : this->pixels)
+        feed(p);
+    return h;
+}
+
+bool Scanout::write_ppm(const char *p_path) const {
+    FILE *f = fopen(p_path, "wb");
+    if (!f)
+        return false;
+
+    fprintf(f, "P6\n%u %u\n255\n", this->width, this->height);
+    std::vector<uint8_t> rgb(size_t(this->width) * 3);
+    const uint32_t *src = this->pixels.data();
+    for (uint32_t y = 0; y < this->height; y++) {
+        for (uint32_t x = 0; x < this->width; x++, src++) {
+            rgb[x * 3 + 0] = uint8_t(*src);
+            rgb[x * 3 + 1] = uint8_t(*src >> 8);
+            rgb[x * 3 + 2] = uint8_t(*src >> 16);
+        }
+        fwrite(rgb.data(), 1, rgb.size(), f);
+    }
+    return fclose(f) == 0;
+}
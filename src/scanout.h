@@ -0,0 +1,36 @@
+#pragma once
+#include "structs.h"
+#include "vram.h"
+#include <cstdint>
+#include <vector>
+
+/// Video output stage: converts the displayed VRAM rectangle into
+/// an RGBA8 frame for the consumers that need the picture on the
+/// CPU (24bit video, frame dumps, headless hashes).
+///
+/// Runs over up to 640x480 pixels every frame, the row kernels
+/// use AVX2 when the build targets it.
+struct Scanout {
+    // Converted frame, row after row, R in the lowest byte
+    std::vector<uint32_t> pixels;
+    uint32_t width;
+    uint32_t height;
+
+    Scanout();
+    ~Scanout() = default;
+
+    void convert(const VRam &p_vram, const DisplayArea &p_area);
+
+    // FNV-1a over the pixels, stable across runs and hosts
+    uint64_t hash() const;
+    // Binary PPM, returns false if the file can't be written
+    bool write_ppm(const char *p_path) const;
+
+    // 1555 VRAM pixels to opaque RGBA8
+    static void convert_15(const uint16_t *p_src, uint32_t *p_dst,
+                           uint32_t p_count);
+    // Packed RGB888 to opaque RGBA8. p_src must be readable 4
+    // bytes past the last pixel.
+    static void convert_24(const uint8_t *p_src, uint32_t *p_dst,
+                           uint32_t p_count);
+};
@@ -0,0 +1,52 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() {
+    this->now = 0;
+    for (uint32_t i = 0; i < EVENT_COUNT; i++)
+        this->deadlines[i] = NEVER;
+    this->slice_end = NEVER;
+}
+
+void Scheduler::schedule(Event p_event, uint64_t p_delay) {
+    uint64_t deadline = this->now + p_delay;
+    this->deadlines[(uint32_t)p_event] = deadline;
+
+    // Only ever shorten the slice here: an early exit is
+    // harmless, pop_due() recomputes the real end
+    if (deadline < this->slice_end)
+        this->slice_end = deadline;
+}
+
+void Scheduler::cancel(Event p_event) {
+    this->deadlines[(uint32_t)p_event] = NEVER;
+}
+
+bool Scheduler::pop_due(Event &p_event) {
+    uint32_t best = EVENT_COUNT;
+
+    for (uint32_t i = 0; i < EVENT_COUNT; i++) {
+        if (this->deadlines[i] > this->now)
+            continue;
+        if (best == EVENT_COUNT ||
+            this->deadlines[i] < this->deadlines[best])
+            best = i;
+    }
+
+    if (best == EVENT_COUNT) {
+        this->update_slice_end();
+        return false;
+    }
+
+    this->deadlines[best] = NEVER;
+    p_event = (Event)best;
+    return true;
+}
+
+void Scheduler::update_slice_end() {
+    uint64_t end = NEVER;
+    for (uint32_t i = 0; i < EVENT_COUNT; i++) {
+        if (this->deadlines[i] < end)
+            end = this->deadlines[i];
+    }
+    this->slice_end = end;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+
+/// Timed events raised by the devices
+enum class Event : uint32_t {
+    /// GPU video timing: start or end of vertical blanking
+    Gpu = 0,
+    /// CD-ROM command answer
+    CdRom,
+    /// CD-ROM second answer of a slow command
+    CdRomAsync,
+    /// CD-ROM drive: seek done or sector read
+    CdRomDrive,
+    /// SPU: hand the samples made so far to the AudioSink
+    Spu,
+    Count,
+};
+
+/// Keeps emulated time in CPU cycles. The CPU runs uninterrupted
+/// slices up to the earliest pending deadline, so devices are
+/// only looked at when one of them actually has work to do.
+struct Scheduler {
+    static constexpr uint32_t EVENT_COUNT = (uint32_t)Event::Count;
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    // Current CPU cycle
+    uint64_t now;
+    // Absolute deadline of each event, NEVER when idle
+    uint64_t deadlines[EVENT_COUNT];
+    // The CPU slice ends at this cycle
+    uint64_t slice_end;
+
+    Scheduler();
+    ~Scheduler() = default;
+
+    // Fire p_event p_delay cycles from now
+    void schedule(Event p_event, uint64_t p_delay);
+    void cancel(Event p_event);
+
+    // Leave the current CPU slice after the current instruction
+    void end_slice() { this->slice_end = this->now; }
+
+    // Pop the earliest event whose deadline has passed. Returns
+    // false when none is due.
+    bool pop_due(Event &p_event);
+
+    void update_slice_end();
+
+    // Save state fields, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("SCHD");
+        p_v.value(this->now);
+        p_v.value(this->deadlines);
+        p_v.value(this->slice_end);
+    }
+};
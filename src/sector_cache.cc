@@ -0,0 +1,83 @@
+#include "sector_cache.h"
+#include <cstring>
+
+static constexpr uint32_t NO_SECTOR = UINT32_MAX;
+
+SectorCache::SectorCache(const Disc *p_disc) : disc(p_disc) {
+    for (Slot &slot : this->slots) {
+        slot.seq.store(0, std::memory_order_relaxed);
+        slot.lba.store(NO_SECTOR, std::memory_order_relaxed);
+    }
+    this->window.store(0, std::memory_order_relaxed);
+    this->requests.store(0, std::memory_order_relaxed);
+    this->stopping.store(false, std::memory_order_relaxed);
+    this->thread = std::thread(&SectorCache::run, this);
+}
+
+SectorCache::~SectorCache() {
+    this->stopping.store(true, std::memory_order_relaxed);
+    this->requests.fetch_add(1, std::memory_order_release);
+    this->requests.notify_one();
+    this->thread.join();
+}
+
+void SectorCache::prefetch(uint32_t p_lba) {
+    if (this->window.load(std::memory_order_relaxed) == p_lba)
+        return;
+    this->window.store(p_lba, std::memory_order_relaxed);
+    this->requests.fetch_add(1, std::memory_order_release);
+    this->requests.notify_one();
+}
+
+bool SectorCache::fetch(uint32_t p_lba, uint8_t *p_dst) {
+    Slot &slot = this->slots[p_lba % SLOTS];
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if ((seq & 1) != 0 ||
+        slot.lba.load(std::memory_order_relaxed) != p_lba)
+        return false;
+
+    memcpy(p_dst, slot.data, Disc::SECTOR_SIZE);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+void SectorCache::run() {
+    uint8_t scratch[Disc::SECTOR_SIZE];
+
+    while (!this->stopping.load(std::memory_order_relaxed)) {
+        uint32_t seen =
+            this->requests.load(std::memory_order_acquire);
+        uint32_t start =
+            this->window.load(std::memory_order_relaxed);
+
+        uint32_t end = start + AHEAD;
+        if (end > this->disc->sectors() || end < start)
+            end = this->disc->sectors();
+        // Get the kernel reading the window and the next one
+        this->disc->will_need(start, 2 * AHEAD);
+        for (uint32_t lba = start; lba < end; lba++) {
+            // Follow seeks right away
+            if (this->requests.load(std::memory_order_relaxed) !=
+                seen)
+                break;
+
+            Slot &slot = this->slots[lba % SLOTS];
+            if (slot.lba.load(std::memory_order_relaxed) == lba)
+                continue;
+            std::span<const uint8_t> sector =
+                this->disc->sector(lba, scratch);
+
+            // A page fault while copying only makes a concurrent
+            // fetch() miss
+            uint32_t seq =
+                slot.seq.load(std::memory_order_relaxed);
+            slot.seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.lba.store(lba, std::memory_order_relaxed);
+            memcpy(slot.data, sector.data(), Disc::SECTOR_SIZE);
+            slot.seq.store(seq + 2, std::memory_order_release);
+        }
+
+        this->requests.wait(seen, std::memory_order_acquire);
+    }
+}
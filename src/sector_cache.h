@@ -0,0 +1,60 @@
+#pragma once
+#include "disc.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+/// Sectors of a Disc read ahead of the drive by a background I/O
+/// thread, so the emulation thread never waits on the host (page
+/// faults in the image mapping included).
+///
+/// The CD-ROM controller moves the read-ahead window with
+/// prefetch() and picks sectors up with fetch(). Both are lock
+/// free: the window is an atomic the I/O thread waits on, and
+/// every slot is a seqlock, so a sector being replaced while it
+/// is copied out reads as a miss instead of torn data. A miss
+/// means the drive is late, the controller tries again a little
+/// later in emulated time.
+struct SectorCache {
+    static constexpr uint32_t SLOTS = 64;
+    // Sectors read from the window start on, at most half the
+    // slots so the ones just delivered stay cached a while
+    static constexpr uint32_t AHEAD = 32;
+
+    // p_disc is owned by the caller and outlives the cache, any
+    // number of caches can share it
+    SectorCache(const Disc *p_disc);
+    ~SectorCache();
+
+    SectorCache(const SectorCache &) = delete;
+    SectorCache &operator=(const SectorCache &) = delete;
+
+    const Disc &image() const { return *this->disc; }
+    uint32_t sectors() const { return this->disc->sectors(); }
+
+    // Read ahead from p_lba on
+    void prefetch(uint32_t p_lba);
+    // Copy raw sector p_lba (Disc::SECTOR_SIZE bytes) to p_dst if
+    // it has been read, false otherwise
+    bool fetch(uint32_t p_lba, uint8_t *p_dst);
+
+  private:
+    struct Slot {
+        // Odd while the I/O thread rewrites the slot
+        std::atomic<uint32_t> seq;
+        std::atomic<uint32_t> lba;
+        uint8_t data[Disc::SECTOR_SIZE];
+    };
+
+    const Disc *disc;
+    Slot slots[SLOTS];
+    // Start of the read-ahead window
+    std::atomic<uint32_t> window;
+    // Bumped by every prefetch() and by shutdown, the I/O thread
+    // sleeps on it
+    std::atomic<uint32_t> requests;
+    std::atomic<bool> stopping;
+    std::thread thread;
+
+    void run();
+};
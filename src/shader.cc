@@ -82,6 +82,14 @@ void Shader::set_mat4(const std::string &name,
     glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1,
                        GL_FALSE, &mat[0][0]);
 }
+void Shader::set_vec2(const std::string &name, float x,
+                      float y) const {
+    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+}
+void Shader::set_ivec2(const std::string &name, int x,
+                       int y) const {
+    glUniform2i(glGetUniformLocation(ID, name.c_str()), x, y);
+}
 void Shader::set_vec3(const std::string &name,
                       const glm::vec3 &value) const {
     glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1,
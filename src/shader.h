@@ -18,6 +18,8 @@ class Shader {
     void set_int(const std::string &name, int value) const;
     void set_float(const std::string &name, float value) const;
     void set_mat4(const std::string &name, const glm::mat4 &mat) const;
+    void set_vec2(const std::string &name, float x, float y) const;
+    void set_ivec2(const std::string &name, int x, int y) const;
     void set_vec3(const std::string &name, const glm::vec3 &value) const;
     void set_int_array(const std::string &name,
                        const std::vector<int> &values) const;
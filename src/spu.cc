@@ -0,0 +1,755 @@
+#include "spu.h"
+#include <algorithm>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Register offsets from 0x1f801c00. Voice v has 16 bytes at
+// v * 16, the VOICE_ ones are from there.
+static constexpr uint32_t VOICE_VOLUME = 0x0;
+static constexpr uint32_t VOICE_PITCH = 0x4;
+static constexpr uint32_t VOICE_START = 0x6;
+static constexpr uint32_t VOICE_ADSR = 0x8;
+static constexpr uint32_t VOICE_ADSR_HIGH = 0xa;
+static constexpr uint32_t VOICE_LEVEL = 0xc;
+static constexpr uint32_t VOICE_REPEAT = 0xe;
+static constexpr uint32_t MAIN_VOLUME = 0x180;
+static constexpr uint32_t KEY_ON = 0x188;
+static constexpr uint32_t KEY_OFF = 0x18c;
+static constexpr uint32_t PITCH_MOD = 0x190;
+static constexpr uint32_t NOISE_ON = 0x194;
+static constexpr uint32_t REVERB_ON = 0x198;
+static constexpr uint32_t VOICE_END = 0x19c;
+static constexpr uint32_t REVERB_BASE = 0x1a2;
+static constexpr uint32_t IRQ_ADDRESS = 0x1a4;
+static constexpr uint32_t TRANSFER_ADDRESS = 0x1a6;
+static constexpr uint32_t TRANSFER_FIFO = 0x1a8;
+static constexpr uint32_t CONTROL = 0x1aa;
+static constexpr uint32_t STATUS = 0x1ae;
+static constexpr uint32_t CURRENT_MAIN_VOLUME = 0x1b8;
+// Left and right of voice v at v * 4
+static constexpr uint32_t CURRENT_VOLUME = 0x200;
+
+// SPUCNT bits
+static constexpr uint16_t CONTROL_ENABLE = 0x8000;
+static constexpr uint16_t CONTROL_UNMUTE = 0x4000;
+static constexpr uint16_t CONTROL_IRQ = 0x0040;
+
+// Capture buffers in sound RAM, 1KB each
+static constexpr uint32_t CAPTURE_CD_LEFT = 0x000;
+static constexpr uint32_t CAPTURE_CD_RIGHT = 0x400;
+static constexpr uint32_t CAPTURE_VOICE_1 = 0x800;
+static constexpr uint32_t CAPTURE_VOICE_3 = 0xc00;
+
+// Pitch counter at the end of a block
+static constexpr int32_t BLOCK_END = SPU::BLOCK_SAMPLES << 12;
+
+// Interpolation weights, entry i for the newest sample and
+// 0xff - i, 0x1ff - i and 0x100 + i for the older ones, i being
+// the top 8 bits of the pitch counter fraction. The four sum to
+// about 0x7f80. int32_t for the AVX2 gathers.
+alignas(32) static const int32_t GAUSS[512] = {
+       -1,    -1,    -1,    -1,    -1,    -1,    -1,    -1,
+       -1,    -1,    -1,    -1,    -1,    -1,    -1,    -1,
+        0,     0,     0,     0,     0,     0,     0,     1,
+        1,     1,     1,     2,     2,     2,     3,     3,
+        3,     4,     4,     5,     5,     6,     7,     7,
+        8,     9,     9,    10,    11,    12,    13,    14,
+       15,    16,    17,    18,    19,    21,    22,    24,
+       25,    27,    28,    30,    32,    33,    35,    37,
+       39,    41,    44,    46,    48,    51,    53,    56,
+       58,    61,    64,    67,    70,    73,    77,    80,
+       84,    87,    91,    95,    99,   103,   107,   111,
+      116,   120,   125,   130,   135,   140,   145,   150,
+      156,   161,   167,   173,   179,   186,   192,   199,
+      205,   212,   219,   227,   234,   242,   250,   257,
+      266,   274,   283,   291,   300,   309,   319,   328,
+      338,   348,   358,   369,   379,   390,   401,   412,
+      424,   436,   448,   460,   473,   485,   498,   512,
+      525,   539,   553,   567,   582,   597,   612,   627,
+      643,   659,   675,   692,   708,   726,   743,   761,
+      779,   797,   816,   835,   854,   874,   894,   914,
+      935,   956,   977,   999,  1020,  1043,  1066,  1089,
+     1112,  1136,  1160,  1184,  1209,  1234,  1260,  1286,
+     1312,  1339,  1366,  1394,  1422,  1450,  1479,  1508,
+     1537,  1567,  1598,  1628,  1660,  1691,  1723,  1756,
+     1789,  1822,  1856,  1890,  1924,  1959,  1995,  2031,
+     2067,  2104,  2141,  2179,  2217,  2256,  2295,  2334,
+     2374,  2415,  2456,  2497,  2539,  2582,  2624,  2668,
+     2712,  2756,  2801,  2846,  2892,  2938,  2985,  3032,
+     3079,  3128,  3176,  3225,  3275,  3325,  3376,  3427,
+     3479,  3531,  3584,  3637,  3691,  3745,  3799,  3855,
+     3910,  3967,  4023,  4081,  4138,  4197,  4255,  4315,
+     4374,  4435,  4495,  4557,  4619,  4681,  4744,  4807,
+     4871,  4935,  5000,  5065,  5131,  5197,  5264,  5332,
+     5399,  5468,  5536,  5606,  5676,  5746,  5817,  5888,
+     5959,  6032,  6104,  6177,  6251,  6325,  6400,  6475,
+     6550,  6626,  6702,  6779,  6856,  6934,  7012,  7091,
+     7170,  7249,  7329,  7409,  7490,  7571,  7653,  7735,
+     7817,  7900,  7983,  8066,  8150,  8234,  8319,  8404,
+     8489,  8575,  8661,  8748,  8834,  8922,  9009,  9097,
+     9185,  9273,  9362,  9451,  9541,  9630,  9720,  9811,
+     9901,  9992, 10083, 10174, 10266, 10358, 10450, 10542,
+    10635, 10727, 10820, 10913, 11007, 11100, 11194, 11288,
+    11382, 11476, 11571, 11665, 11760, 11855, 11950, 12045,
+    12140, 12236, 12331, 12427, 12522, 12618, 12714, 12809,
+    12905, 13001, 13097, 13193, 13289, 13385, 13481, 13577,
+    13673, 13769, 13865, 13961, 14056, 14152, 14248, 14343,
+    14439, 14534, 14630, 14725, 14820, 14915, 15010, 15104,
+    15199, 15293, 15387, 15481, 15575, 15669, 15762, 15855,
+    15948, 16041, 16133, 16226, 16317, 16409, 16500, 16592,
+    16682, 16773, 16863, 16953, 17042, 17131, 17220, 17308,
+    17396, 17484, 17571, 17658, 17744, 17830, 17916, 18001,
+    18086, 18170, 18254, 18337, 18420, 18502, 18584, 18665,
+    18746, 18826, 18905, 18985, 19063, 19141, 19219, 19295,
+    19372, 19447, 19522, 19597, 19671, 19744, 19816, 19888,
+    19959, 20030, 20100, 20169, 20238, 20306, 20373, 20439,
+    20505, 20570, 20634, 20698, 20760, 20822, 20884, 20944,
+    21004, 21063, 21121, 21178, 21235, 21290, 21345, 21399,
+    21452, 21505, 21556, 21607, 21657, 21706, 21754, 21801,
+    21848, 21893, 21938, 21982, 22025, 22066, 22107, 22148,
+    22187, 22225, 22262, 22299, 22334, 22369, 22402, 22435,
+    22467, 22498, 22527, 22556, 22584, 22611, 22637, 22662,
+    22686, 22709, 22731, 22752, 22772, 22791, 22809, 22826,
+    22842, 22857, 22872, 22885, 22897, 22908, 22918, 22927,
+    22935, 22942, 22948, 22953, 22957, 22960, 22962, 22963,
+};
+
+static inline int32_t clamp16(int32_t p_val) {
+    return std::clamp(p_val, -0x8000, 0x7fff);
+}
+
+// One sample of an ADSR phase or volume sweep: p_level moves by
+// p_step (+7..+4 or -8..-5) every 1 << (p_shift - 11) samples,
+// or by p_step << (11 - p_shift) every sample for the fast
+// rates. Exponential increases slow down 4 times above 0x6000,
+// exponential decreases are in proportion to the level.
+static int32_t envelope(int32_t p_level, int32_t &p_wait,
+                        uint32_t p_shift, int32_t p_step,
+                        bool p_exponential) {
+    if (p_wait > 0) {
+        p_wait--;
+        return p_level;
+    }
+    int32_t shift = int32_t(p_shift);
+    int32_t cycles = 1 << std::max(0, shift - 11);
+    int32_t step = p_step * (1 << std::max(0, 11 - shift));
+    if (p_exponential) {
+        if (p_step > 0 && p_level > 0x6000)
+            cycles *= 4;
+        if (p_step < 0)
+            step = step * p_level >> 15;
+    }
+    p_wait = cycles - 1;
+    return std::clamp(p_level + step, 0, 0x7fff);
+}
+
+// One sample of the volume sweep set by register p_reg
+static int32_t sweep(uint16_t p_reg, int32_t p_volume,
+                     int32_t &p_wait) {
+    int32_t step = p_reg & 3;
+    step = p_reg & 0x2000 ? step - 8 : 7 - step;
+    // Negative phase: the magnitude is swept, below 0
+    bool negative = p_reg & 0x1000;
+    int32_t level = envelope(negative ? -p_volume : p_volume,
+                             p_wait, (p_reg >> 2) & 0x1f, step,
+                             p_reg & 0x4000);
+    return negative ? -level : level;
+}
+
+SPU::SPU() {
+    this->scheduler = nullptr;
+    memset(this->ram, 0, sizeof(this->ram));
+    memset(this->regs, 0, sizeof(this->regs));
+    memset(this->counter, 0, sizeof(this->counter));
+    memset(this->pitch, 0, sizeof(this->pitch));
+    memset(this->env_level, 0, sizeof(this->env_level));
+    memset(this->volume_left, 0, sizeof(this->volume_left));
+    memset(this->volume_right, 0, sizeof(this->volume_right));
+    memset(this->outx, 0, sizeof(this->outx));
+    memset(this->decoded, 0, sizeof(this->decoded));
+    memset(this->address, 0, sizeof(this->address));
+    memset(this->repeat, 0, sizeof(this->repeat));
+    memset(this->block_flags, 0, sizeof(this->block_flags));
+    memset(this->adpcm_prev, 0, sizeof(this->adpcm_prev));
+    std::fill_n(this->phase, VOICES, AdsrPhase::Off);
+    memset(this->env_wait, 0, sizeof(this->env_wait));
+    memset(this->sweep_wait, 0, sizeof(this->sweep_wait));
+    this->endx = 0;
+    this->main_volume[0] = 0;
+    this->main_volume[1] = 0;
+    this->main_wait[0] = 0;
+    this->main_wait[1] = 0;
+    this->noise_level = 0;
+    this->noise_timer = 0;
+    this->transfer_address = 0;
+    this->capture_index = 0;
+    this->irq_flag = false;
+    this->clock = SAMPLE_CYCLES;
+    this->out_frames = 0;
+}
+
+uint16_t SPU::status() const {
+    uint16_t control = this->reg(CONTROL);
+    // Mode, DMA request and the CD/external audio enables
+    // mirror SPUCNT at once
+    uint16_t val = control & 0x3f;
+    if (this->irq_flag)
+        val |= 0x40;
+    if (control & 0x20)
+        val |= 0x80;
+    uint32_t mode = (control >> 4) & 3;
+    if (mode == 2)
+        val |= 0x100;
+    else if (mode == 3)
+        val |= 0x200;
+    if (this->capture_index >= 0x100)
+        val |= 0x800;
+    return val;
+}
+
+uint16_t SPU::load(uint32_t p_offset) {
+    if (p_offset < MAIN_VOLUME) {
+        uint32_t voice = p_offset / 16;
+        switch (p_offset % 16) {
+        case VOICE_LEVEL:
+            return uint16_t(this->env_level[voice]);
+        case VOICE_REPEAT:
+            return uint16_t(this->repeat[voice] / 8);
+        default:
+            return this->reg(p_offset);
+        }
+    }
+    if (p_offset >= CURRENT_VOLUME) {
+        uint32_t voice = (p_offset - CURRENT_VOLUME) / 4;
+        if (voice >= VOICES)
+            return this->reg(p_offset);
+        return uint16_t(p_offset & 2 ? this->volume_right[voice]
+                                     : this->volume_left[voice]);
+    }
+
+    switch (p_offset) {
+    case VOICE_END:
+        return uint16_t(this->endx);
+    case VOICE_END + 2:
+        return uint16_t(this->endx >> 16);
+    case TRANSFER_FIFO:
+        return 0;
+    case STATUS:
+        return this->status();
+    case CURRENT_MAIN_VOLUME:
+        return uint16_t(this->main_volume[0]);
+    case CURRENT_MAIN_VOLUME + 2:
+        return uint16_t(this->main_volume[1]);
+    default:
+        return this->reg(p_offset);
+    }
+}
+
+void SPU::store(uint32_t p_offset, uint16_t p_val) {
+    this->regs[p_offset / 2] = p_val;
+
+    if (p_offset < MAIN_VOLUME) {
+        uint32_t voice = p_offset / 16;
+        switch (p_offset % 16) {
+        case VOICE_VOLUME:
+        case VOICE_VOLUME + 2: {
+            // Fixed volume, halved. Sweeps start from the current
+            // volume on the next sample.
+            int32_t *volume = p_offset & 2 ? this->volume_right
+                                           : this->volume_left;
+            if (!(p_val & 0x8000))
+                volume[voice] = int16_t(p_val << 1);
+            break;
+        }
+        case VOICE_PITCH:
+            this->pitch[voice] = p_val;
+            break;
+        case VOICE_LEVEL:
+            this->env_level[voice] = p_val & 0x7fff;
+            break;
+        case VOICE_REPEAT:
+            this->repeat[voice] = uint32_t(p_val) * 8;
+            break;
+        }
+        return;
+    }
+
+    switch (p_offset) {
+    case MAIN_VOLUME:
+    case MAIN_VOLUME + 2:
+        if (!(p_val & 0x8000))
+            this->main_volume[(p_offset / 2) & 1] =
+                int16_t(p_val << 1);
+        break;
+    case KEY_ON:
+    case KEY_ON + 2:
+    case KEY_OFF:
+    case KEY_OFF + 2: {
+        uint32_t first = p_offset & 2 ? 16 : 0;
+        for (uint32_t bit = 0; bit < 16; bit++) {
+            uint32_t voice = first + bit;
+            if (voice >= VOICES || !(p_val & (1 << bit)))
+                continue;
+            if (p_offset < KEY_OFF)
+                this->key_on(voice);
+            else
+                this->key_off(voice);
+        }
+        break;
+    }
+    case REVERB_BASE:
+        this->reverb.set_base(p_val);
+        break;
+    case TRANSFER_ADDRESS:
+        this->transfer_address = uint32_t(p_val) * 8;
+        break;
+    case TRANSFER_FIFO:
+        this->write_ram(p_val);
+        break;
+    case CONTROL:
+        if (!(p_val & CONTROL_IRQ))
+            this->irq_flag = false;
+        break;
+    }
+}
+
+void SPU::write_ram(uint16_t p_val) {
+    uint32_t at = this->transfer_address;
+    this->ram[at] = uint8_t(p_val);
+    this->ram[at + 1] = uint8_t(p_val >> 8);
+    this->check_irq(at, 2);
+    this->transfer_address = (at + 2) & (RAM_SIZE - 1);
+}
+
+uint16_t SPU::read_ram() {
+    uint32_t at = this->transfer_address;
+    uint16_t val = this->ram[at] | (this->ram[at + 1] << 8);
+    this->check_irq(at, 2);
+    this->transfer_address = (at + 2) & (RAM_SIZE - 1);
+    return val;
+}
+
+uint32_t SPU::dma_read() {
+    uint32_t low = this->read_ram();
+    return low | uint32_t(this->read_ram()) << 16;
+}
+
+void SPU::dma_write(uint32_t p_word) {
+    this->write_ram(uint16_t(p_word));
+    this->write_ram(uint16_t(p_word >> 16));
+}
+
+void SPU::check_irq(uint32_t p_address, uint32_t p_size) {
+    if (!(this->reg(CONTROL) & CONTROL_IRQ))
+        return;
+    uint32_t at = uint32_t(this->reg(IRQ_ADDRESS)) * 8;
+    if (at - p_address < p_size)
+        this->irq_flag = true;
+}
+
+void SPU::key_on(uint32_t p_voice) {
+    this->address[p_voice] =
+        uint32_t(this->reg(p_voice * 16 + VOICE_START)) * 8;
+    this->counter[p_voice] = 0;
+    this->phase[p_voice] = AdsrPhase::Attack;
+    this->env_level[p_voice] = 0;
+    this->env_wait[p_voice] = 0;
+    this->adpcm_prev[p_voice][0] = 0;
+    this->adpcm_prev[p_voice][1] = 0;
+    // Nothing to interpolate from before the first block
+    int32_t *row = this->decoded[p_voice];
+    std::fill_n(row + BLOCK_SAMPLES, HISTORY, 0);
+    this->endx &= ~(1u << p_voice);
+    this->decode_block(p_voice);
+}
+
+void SPU::key_off(uint32_t p_voice) {
+    if (this->phase[p_voice] == AdsrPhase::Off)
+        return;
+    this->phase[p_voice] = AdsrPhase::Release;
+    this->env_wait[p_voice] = 0;
+}
+
+void SPU::decode_block(uint32_t p_voice) {
+    static const int32_t POSITIVE[5] = {0, 60, 115, 98, 122};
+    static const int32_t NEGATIVE[5] = {0, 0, -52, -55, -60};
+
+    uint32_t at = this->address[p_voice] & (RAM_SIZE - 16);
+    this->check_irq(at, 16);
+    const uint8_t *block = this->ram + at;
+    uint8_t flags = block[1];
+    this->block_flags[p_voice] = flags;
+    // Loop start
+    if (flags & 4)
+        this->repeat[p_voice] = at;
+
+    uint32_t shift = block[0] & 0xf;
+    if (shift > 12)
+        shift = 9;
+    uint32_t filter = std::min(uint32_t(block[0] >> 4) & 7, 4u);
+    int32_t positive = POSITIVE[filter];
+    int32_t negative = NEGATIVE[filter];
+
+    int32_t *row = this->decoded[p_voice];
+    for (uint32_t i = 0; i < HISTORY; i++)
+        row[i] = row[BLOCK_SAMPLES + i];
+    int32_t old = this->adpcm_prev[p_voice][0];
+    int32_t older = this->adpcm_prev[p_voice][1];
+    for (uint32_t i = 0; i < BLOCK_SAMPLES; i++) {
+        uint32_t nibble = (block[2 + i / 2] >> (i & 1) * 4) & 0xf;
+        int32_t s = int16_t(nibble << 12) >> shift;
+        s += (old * positive + older * negative + 32) >> 6;
+        s = clamp16(s);
+        row[HISTORY + i] = s;
+        older = old;
+        old = s;
+    }
+    this->adpcm_prev[p_voice][0] = int16_t(old);
+    this->adpcm_prev[p_voice][1] = int16_t(older);
+}
+
+void SPU::next_block(uint32_t p_voice) {
+    this->counter[p_voice] -= BLOCK_END;
+    uint8_t flags = this->block_flags[p_voice];
+    if (flags & 1) {
+        // Loop end: back to the loop start, silenced unless the
+        // repeat flag is set too
+        this->endx |= 1u << p_voice;
+        this->address[p_voice] = this->repeat[p_voice];
+        if (!(flags & 2)) {
+            this->phase[p_voice] = AdsrPhase::Off;
+            this->env_level[p_voice] = 0;
+        }
+    } else {
+        this->address[p_voice] =
+            (this->address[p_voice] + 16) & (RAM_SIZE - 1);
+    }
+    this->decode_block(p_voice);
+}
+
+void SPU::step_envelope(uint32_t p_voice) {
+    uint16_t low = this->reg(p_voice * 16 + VOICE_ADSR);
+    uint16_t high = this->reg(p_voice * 16 + VOICE_ADSR_HIGH);
+    int32_t &level = this->env_level[p_voice];
+    int32_t &wait = this->env_wait[p_voice];
+    AdsrPhase &phase = this->phase[p_voice];
+
+    switch (phase) {
+    case AdsrPhase::Attack:
+        level = envelope(level, wait, (low >> 10) & 0x1f,
+                         7 - ((low >> 8) & 3), low & 0x8000);
+        if (level == 0x7fff) {
+            phase = AdsrPhase::Decay;
+            wait = 0;
+        }
+        break;
+    case AdsrPhase::Decay:
+        level = envelope(level, wait, ((low >> 4) & 0xf) << 2, -8,
+                         true);
+        if (level <= ((low & 0xf) + 1) * 0x800) {
+            phase = AdsrPhase::Sustain;
+            wait = 0;
+        }
+        break;
+    case AdsrPhase::Sustain: {
+        int32_t step = (high >> 6) & 3;
+        step = high & 0x4000 ? step - 8 : 7 - step;
+        level = envelope(level, wait, (high >> 8) & 0x1f, step,
+                         high & 0x8000);
+        break;
+    }
+    case AdsrPhase::Release:
+        level = envelope(level, wait, (high & 0x1f) << 2, -8,
+                         high & 0x20);
+        if (level == 0)
+            phase = AdsrPhase::Off;
+        break;
+    case AdsrPhase::Off:
+        break;
+    }
+}
+
+void SPU::step_sweeps(uint32_t p_voice) {
+    uint16_t left = this->reg(p_voice * 16 + VOICE_VOLUME);
+    uint16_t right = this->reg(p_voice * 16 + VOICE_VOLUME + 2);
+    if (left & 0x8000)
+        this->volume_left[p_voice] =
+            sweep(left, this->volume_left[p_voice],
+                  this->sweep_wait[p_voice][0]);
+    if (right & 0x8000)
+        this->volume_right[p_voice] =
+            sweep(right, this->volume_right[p_voice],
+                  this->sweep_wait[p_voice][1]);
+}
+
+void SPU::step_noise() {
+    uint16_t control = this->reg(CONTROL);
+    uint32_t shift = (control >> 10) & 0xf;
+    int32_t step = ((control >> 8) & 3) + 4;
+    this->noise_timer -= step;
+    if (this->noise_timer >= 0)
+        return;
+
+    uint16_t level = this->noise_level;
+    uint32_t parity =
+        ((level >> 15) ^ (level >> 12) ^ (level >> 11) ^
+         (level >> 10) ^ 1) &
+        1;
+    this->noise_level = uint16_t(level << 1 | parity);
+    this->noise_timer += 0x20000 >> shift;
+    if (this->noise_timer < 0)
+        this->noise_timer += 0x20000 >> shift;
+}
+
+#ifdef __AVX2__
+// (p_a * p_b) >> 15 in every lane
+static inline __m256i mul_15(__m256i p_a, __m256i p_b) {
+    return _mm256_srai_epi32(_mm256_mullo_epi32(p_a, p_b), 15);
+}
+
+static inline __m256i load_8(const int32_t *p_src) {
+    return _mm256_loadu_si256((const __m256i *)p_src);
+}
+
+static inline int32_t sum_lanes(__m256i p_val) {
+    __m128i high = _mm256_extracti128_si256(p_val, 1);
+    __m128i sum =
+        _mm_add_epi32(_mm256_castsi256_si128(p_val), high);
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// All ones in lane i when bit i of p_bits is set
+static inline __m256i lane_mask(uint32_t p_bits) {
+    const __m256i lanes =
+        _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i bits = _mm256_set1_epi32(int32_t(p_bits));
+    return _mm256_cmpeq_epi32(_mm256_and_si256(bits, lanes),
+                              lanes);
+}
+#endif
+
+void SPU::mix_voices(int32_t p_dry[2], int16_t p_reverb[2]) {
+    uint32_t noise_on = this->voice_bits(NOISE_ON);
+    uint32_t reverb_on = this->voice_bits(REVERB_ON);
+    int32_t noise = int16_t(this->noise_level);
+    int32_t left = 0;
+    int32_t right = 0;
+    int32_t reverb_left = 0;
+    int32_t reverb_right = 0;
+    uint32_t v = 0;
+
+#ifdef __AVX2__
+    const __m256i rows = _mm256_setr_epi32(
+        0, ROW, 2 * ROW, 3 * ROW, 4 * ROW, 5 * ROW, 6 * ROW,
+        7 * ROW);
+    const __m256i fraction = _mm256_set1_epi32(0xff);
+    __m256i sum_left = _mm256_setzero_si256();
+    __m256i sum_right = _mm256_setzero_si256();
+    __m256i sum_reverb_left = _mm256_setzero_si256();
+    __m256i sum_reverb_right = _mm256_setzero_si256();
+    for (; v + 8 <= VOICES; v += 8) {
+        __m256i c = load_8(this->counter + v);
+        // Oldest of the 4 samples, in the voices' rows
+        __m256i at =
+            _mm256_add_epi32(_mm256_srli_epi32(c, 12), rows);
+        const int *row = this->decoded[v];
+        __m256i s0 = _mm256_i32gather_epi32(row, at, 4);
+        __m256i s1 = _mm256_i32gather_epi32(row + 1, at, 4);
+        __m256i s2 = _mm256_i32gather_epi32(row + 2, at, 4);
+        __m256i s3 = _mm256_i32gather_epi32(row + 3, at, 4);
+
+        __m256i i = _mm256_and_si256(_mm256_srli_epi32(c, 4),
+                                     fraction);
+        __m256i back = _mm256_sub_epi32(fraction, i);
+        const int *high = GAUSS + 0x100;
+        __m256i g0 = _mm256_i32gather_epi32(GAUSS, back, 4);
+        __m256i g1 = _mm256_i32gather_epi32(high, back, 4);
+        __m256i g2 = _mm256_i32gather_epi32(high, i, 4);
+        __m256i g3 = _mm256_i32gather_epi32(GAUSS, i, 4);
+
+        __m256i sample = _mm256_add_epi32(
+            _mm256_add_epi32(mul_15(g0, s0), mul_15(g1, s1)),
+            _mm256_add_epi32(mul_15(g2, s2), mul_15(g3, s3)));
+        sample = _mm256_blendv_epi8(sample,
+                                    _mm256_set1_epi32(noise),
+                                    lane_mask(noise_on >> v));
+
+        __m256i x = mul_15(sample, load_8(this->env_level + v));
+        _mm256_storeu_si256((__m256i *)(this->outx + v + 1), x);
+
+        __m256i l = mul_15(x, load_8(this->volume_left + v));
+        __m256i r = mul_15(x, load_8(this->volume_right + v));
+        sum_left = _mm256_add_epi32(sum_left, l);
+        sum_right = _mm256_add_epi32(sum_right, r);
+        __m256i reverb = lane_mask(reverb_on >> v);
+        sum_reverb_left = _mm256_add_epi32(
+            sum_reverb_left, _mm256_and_si256(l, reverb));
+        sum_reverb_right = _mm256_add_epi32(
+            sum_reverb_right, _mm256_and_si256(r, reverb));
+    }
+    left = sum_lanes(sum_left);
+    right = sum_lanes(sum_right);
+    reverb_left = sum_lanes(sum_reverb_left);
+    reverb_right = sum_lanes(sum_reverb_right);
+#endif
+
+    for (; v < VOICES; v++) {
+        int32_t c = this->counter[v];
+        const int32_t *s = this->decoded[v] + (c >> 12);
+        int32_t i = (c >> 4) & 0xff;
+        int32_t sample = (GAUSS[0xff - i] * s[0] >> 15) +
+                         (GAUSS[0x1ff - i] * s[1] >> 15) +
+                         (GAUSS[0x100 + i] * s[2] >> 15) +
+                         (GAUSS[i] * s[3] >> 15);
+        if (noise_on & (1u << v))
+            sample = noise;
+
+        int32_t x = sample * this->env_level[v] >> 15;
+        this->outx[v + 1] = x;
+        int32_t l = x * this->volume_left[v] >> 15;
+        int32_t r = x * this->volume_right[v] >> 15;
+        left += l;
+        right += r;
+        if (reverb_on & (1u << v)) {
+            reverb_left += l;
+            reverb_right += r;
+        }
+    }
+    p_dry[0] = left;
+    p_dry[1] = right;
+    p_reverb[0] = int16_t(clamp16(reverb_left));
+    p_reverb[1] = int16_t(clamp16(reverb_right));
+}
+
+void SPU::step_counters() {
+    // Voice 0 has nothing to be modulated by
+    uint32_t modulated = this->voice_bits(PITCH_MOD) & ~1u;
+    uint32_t ended = 0;
+    uint32_t v = 0;
+
+#ifdef __AVX2__
+    const __m256i low = _mm256_set1_epi32(0xffff);
+    const __m256i bias = _mm256_set1_epi32(0x8000);
+    const __m256i max_step = _mm256_set1_epi32(0x4000);
+    const __m256i last = _mm256_set1_epi32(BLOCK_END - 1);
+    for (; v + 8 <= VOICES; v += 8) {
+        __m256i p = load_8(this->pitch + v);
+        // Previous voice's output, see outx
+        __m256i prev = load_8(this->outx + v);
+        __m256i signed_p =
+            _mm256_srai_epi32(_mm256_slli_epi32(p, 16), 16);
+        __m256i mod = _mm256_and_si256(
+            mul_15(signed_p, _mm256_add_epi32(prev, bias)), low);
+        __m256i step = _mm256_min_epi32(
+            _mm256_blendv_epi8(p, mod, lane_mask(modulated >> v)),
+            max_step);
+
+        __m256i c =
+            _mm256_add_epi32(load_8(this->counter + v), step);
+        _mm256_store_si256((__m256i *)(this->counter + v), c);
+        __m256i over = _mm256_cmpgt_epi32(c, last);
+        ended |= uint32_t(_mm256_movemask_ps(
+                     _mm256_castsi256_ps(over)))
+                 << v;
+    }
+#endif
+
+    for (; v < VOICES; v++) {
+        int32_t step = this->pitch[v];
+        if (modulated & (1u << v)) {
+            int32_t factor = this->outx[v] + 0x8000;
+            step = (int16_t(step) * factor >> 15) & 0xffff;
+        }
+        this->counter[v] += std::min(step, 0x4000);
+        if (this->counter[v] >= BLOCK_END)
+            ended |= 1u << v;
+    }
+
+    // Rare: once every 28 samples at the normal rate
+    while (ended != 0) {
+        this->next_block(__builtin_ctz(ended));
+        ended &= ended - 1;
+    }
+}
+
+void SPU::write_capture(uint32_t p_base, int16_t p_val) {
+    uint32_t at = p_base + this->capture_index * 2;
+    this->ram[at] = uint8_t(p_val);
+    this->ram[at + 1] = uint8_t(uint16_t(p_val) >> 8);
+    this->check_irq(at, 2);
+}
+
+void SPU::run_sample(int32_t p_dry[2], int16_t p_reverb[2]) {
+    this->step_noise();
+    this->mix_voices(p_dry, p_reverb);
+
+    // No CD audio yet: its buffers record silence
+    this->write_capture(CAPTURE_CD_LEFT, 0);
+    this->write_capture(CAPTURE_CD_RIGHT, 0);
+    this->write_capture(CAPTURE_VOICE_1, int16_t(this->outx[2]));
+    this->write_capture(CAPTURE_VOICE_3, int16_t(this->outx[4]));
+    this->capture_index = (this->capture_index + 1) & 0x1ff;
+
+    this->step_counters();
+    for (uint32_t v = 0; v < VOICES; v++) {
+        this->step_envelope(v);
+        this->step_sweeps(v);
+    }
+}
+
+void SPU::output(const int32_t *p_dry, const int32_t *p_wet,
+                 uint32_t p_frames) {
+    uint16_t control = this->reg(CONTROL);
+    uint16_t on = CONTROL_ENABLE | CONTROL_UNMUTE;
+    for (uint32_t i = 0; i < p_frames; i++) {
+        for (uint32_t side = 0; side < 2; side++) {
+            uint16_t reg = this->reg(MAIN_VOLUME + side * 2);
+            if (reg & 0x8000)
+                this->main_volume[side] =
+                    sweep(reg, this->main_volume[side],
+                          this->main_wait[side]);
+        }
+        int32_t left = 0;
+        int32_t right = 0;
+        if ((control & on) == on) {
+            left = clamp16(p_dry[i * 2] + p_wet[i * 2]) *
+                       this->main_volume[0] >>
+                   15;
+            right = clamp16(p_dry[i * 2 + 1] + p_wet[i * 2 + 1]) *
+                        this->main_volume[1] >>
+                    15;
+        }
+        // Dropped when nobody took the last ones
+        if (this->out_frames < OUT_FRAMES) {
+            this->out[this->out_frames * 2] = int16_t(left);
+            this->out[this->out_frames * 2 + 1] = int16_t(right);
+            this->out_frames++;
+        }
+    }
+}
+
+void SPU::sync() {
+    uint64_t now = this->scheduler->now;
+    while (this->clock <= now) {
+        // A block at a time for the reverb, registers can't
+        // change in between
+        int32_t dry[Reverb::BLOCK * 2];
+        int16_t reverb_in[Reverb::BLOCK * 2];
+        int32_t wet[Reverb::BLOCK * 2];
+        uint32_t n = 0;
+        for (; n < Reverb::BLOCK && this->clock <= now; n++) {
+            this->run_sample(dry + n * 2, reverb_in + n * 2);
+            this->clock += SAMPLE_CYCLES;
+        }
+        if (this->reverb.enabled)
+            this->reverb.run(this->ram, this->regs, reverb_in,
+                             wet, n);
+        else
+            memset(wet, 0, sizeof(wet));
+        this->output(dry, wet, n);
+    }
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include "reverb.h"
+#include "scheduler.h"
+#include <cstdint>
+
+/// Stage of a voice's ADSR envelope
+enum class AdsrPhase : uint8_t {
+    Attack,
+    Decay,
+    Sustain,
+    Release,
+    // Released down to silence
+    Off,
+};
+
+/// Sound Processing Unit: 512KB of sound RAM, 24 ADPCM voices
+/// with ADSR envelopes, pitch modulation and noise, mixed to
+/// 44.1kHz stereo. Registers at 0x1f801c00.
+///
+/// The SPU runs behind the CPU: every register access and
+/// Event::Spu first catch it up to the current cycle (sync()),
+/// one sample per SAMPLE_CYCLES. Finished samples wait in `out`
+/// until the Interconnect hands them to the AudioSink.
+///
+/// Every sample goes through all 24 voices, so their state is
+/// kept as arrays indexed by voice and 8 voices are interpolated,
+/// enveloped, mixed and stepped at once (AVX2 when the build
+/// targets it). A voice decodes each ADPCM block once, into
+/// `decoded`, when its pitch counter enters it; the per-sample
+/// work only reads that cache. Block ends and envelope steps are
+/// handled a voice at a time, off the vector path.
+///
+/// The voices with reverb on also go to `reverb`, a block of
+/// samples at a time. Not emulated yet: the CD audio input,
+/// which reads as silence.
+struct SPU {
+    static constexpr uint32_t RAM_SIZE = 512 * 1024;
+    static constexpr uint32_t VOICES = 24;
+    // CPU cycles per 44.1kHz sample
+    static constexpr uint64_t SAMPLE_CYCLES = 768;
+    // Samples per Event::Spu
+    static constexpr uint32_t BATCH = 32;
+    // Room in `out`, in stereo frames
+    static constexpr uint32_t OUT_FRAMES = 2 * BATCH;
+
+    // Samples per ADPCM block, and the decoded ones kept before
+    // them for the interpolation
+    static constexpr uint32_t BLOCK_SAMPLES = 28;
+    static constexpr uint32_t HISTORY = 3;
+    // Row of `decoded`, padded to a power of two
+    static constexpr uint32_t ROW = 32;
+
+    // Set by the Interconnect
+    Scheduler *scheduler;
+
+    uint8_t ram[RAM_SIZE];
+    // Every register as last written, 16bit each
+    uint16_t regs[0x140];
+
+    // Vector state, by voice. Pitch counter: sample index in
+    // the block in the top bits, 12 bit fraction.
+    alignas(32) int32_t counter[VOICES];
+    // Sample rate registers, 0x1000 being 44.1kHz
+    alignas(32) int32_t pitch[VOICES];
+    alignas(32) int32_t env_level[VOICES];
+    alignas(32) int32_t volume_left[VOICES];
+    alignas(32) int32_t volume_right[VOICES];
+    // Last output of each voice, after the envelope and before
+    // the volume, one slot late: voice v is at v + 1 and slot 0
+    // stays 0, so pitch modulation reads voice v - 1 at v
+    alignas(32) int32_t outx[VOICES + 1];
+    // HISTORY samples of the previous block, then this one
+    alignas(32) int32_t decoded[VOICES][ROW];
+
+    // Scalar state, by voice
+    // Address of the block being played and of the loop start
+    uint32_t address[VOICES];
+    uint32_t repeat[VOICES];
+    // Flags of the block being played
+    uint8_t block_flags[VOICES];
+    // ADPCM filter history
+    int16_t adpcm_prev[VOICES][2];
+    AdsrPhase phase[VOICES];
+    // Samples to the next envelope step
+    int32_t env_wait[VOICES];
+    // Samples to the next volume sweep step, left and right
+    int32_t sweep_wait[VOICES][2];
+
+    // Voices that passed a block with the loop end flag
+    uint32_t endx;
+    // Main volume after sweeps, and its sweep counters
+    int32_t main_volume[2];
+    int32_t main_wait[2];
+
+    // Noise generator
+    uint16_t noise_level;
+    int32_t noise_timer;
+
+    // Transfer address for the FIFO and DMA, in bytes
+    uint32_t transfer_address;
+    // Capture buffers position, in halfwords
+    uint32_t capture_index;
+    // SPUSTAT bit 6, up until SPUCNT clears the enable
+    bool irq_flag;
+
+    // Cycle of the next sample
+    uint64_t clock;
+
+    Reverb reverb;
+
+    // Samples made since the Interconnect last took them,
+    // interleaved left/right
+    int16_t out[OUT_FRAMES * 2];
+    uint32_t out_frames;
+
+    SPU();
+    ~SPU() = default;
+
+    // Registers, p_offset from 0x1f801c00. Call sync() first.
+    uint16_t load(uint32_t p_offset);
+    void store(uint32_t p_offset, uint16_t p_val);
+    // DMA channel 4
+    uint32_t dma_read();
+    void dma_write(uint32_t p_word);
+
+    // Produce the samples due by the current cycle
+    void sync();
+
+    bool irq_line() const { return this->irq_flag; }
+
+    // Save state fields, see SaveState. The samples not handed
+    // out yet are output, not state.
+    template <class V> void serialize(V &p_v) {
+        p_v.section("SPU ");
+        p_v.bytes(this->ram, RAM_SIZE);
+        p_v.value(this->regs);
+        p_v.value(this->counter);
+        p_v.value(this->pitch);
+        p_v.value(this->env_level);
+        p_v.value(this->volume_left);
+        p_v.value(this->volume_right);
+        p_v.value(this->outx);
+        p_v.value(this->decoded);
+        p_v.value(this->address);
+        p_v.value(this->repeat);
+        p_v.value(this->block_flags);
+        p_v.value(this->adpcm_prev);
+        p_v.value(this->phase);
+        p_v.value(this->env_wait);
+        p_v.value(this->sweep_wait);
+        p_v.value(this->endx);
+        p_v.value(this->main_volume);
+        p_v.value(this->main_wait);
+        p_v.value(this->noise_level);
+        p_v.value(this->noise_timer);
+        p_v.value(this->transfer_address);
+        p_v.value(this->capture_index);
+        p_v.value(this->irq_flag);
+        p_v.value(this->clock);
+        this->reverb.serialize(p_v);
+    }
+
+  private:
+    uint16_t reg(uint32_t p_offset) const {
+        return this->regs[p_offset / 2];
+    }
+    // 24 voice bits from a register pair
+    uint32_t voice_bits(uint32_t p_offset) const {
+        return this->reg(p_offset) |
+               uint32_t(this->reg(p_offset + 2)) << 16;
+    }
+    uint16_t status() const;
+
+    void key_on(uint32_t p_voice);
+    void key_off(uint32_t p_voice);
+    // Decode the block at address[p_voice] into its row, keeping
+    // the end of the previous one as history
+    void decode_block(uint32_t p_voice);
+    // The pitch counter left the block: follow the flags to the
+    // next one
+    void next_block(uint32_t p_voice);
+    void step_envelope(uint32_t p_voice);
+    void step_sweeps(uint32_t p_voice);
+    void step_noise();
+    // One 44.1kHz sample of every voice: the dry mix and the
+    // reverb input
+    void run_sample(int32_t p_dry[2], int16_t p_reverb[2]);
+    // Interpolate, envelope and mix every voice for one sample
+    void mix_voices(int32_t p_dry[2], int16_t p_reverb[2]);
+    // Main volume and mute over p_frames frames of dry and
+    // reverb samples, into `out`
+    void output(const int32_t *p_dry, const int32_t *p_wet,
+                uint32_t p_frames);
+    // Advance every pitch counter by one sample
+    void step_counters();
+    void write_capture(uint32_t p_base, int16_t p_val);
+    // Halfword at transfer_address, moving it on
+    void write_ram(uint16_t p_val);
+    uint16_t read_ram();
+
+    // Raise the SPU interrupt if enabled and its address falls
+    // in the p_size bytes at p_address
+    void check_irq(uint32_t p_address, uint32_t p_size);
+};
@@ -1,5 +1,5 @@
 #pragma once
-#include "GLFW/glfw3.h"
+#include <cstdint>
 
 struct Position {
   int16_t x;
@@ -25,3 +25,56 @@ struct Color {
     return Color{r, g, b};
   };
 };
+
+// Vertex::flags bits
+enum VertexFlag : uint8_t {
+  // Sample the texture page
+  Textured = 1 << 0,
+  // Use the texel as is instead of blending with the color
+  RawTexture = 1 << 1,
+  // Blend with the framebuffer using the draw mode equation
+  SemiTransparent = 1 << 2,
+};
+
+// Interleaved vertex, streamed as is to the renderer
+struct Vertex {
+  Position position;
+  Color color;
+  // VertexFlag bits
+  uint8_t flags;
+  // Texture coordinates inside the texture page
+  uint8_t u;
+  uint8_t v;
+  // CLUT location in the GP0 encoding: x / 16 in bits [5:0], y in
+  // bits [14:6]
+  uint16_t clut;
+  // Texture page in the GP0 encoding (draw mode bits)
+  uint16_t texpage;
+  // Texture cache slot holding the decoded page
+  uint16_t page;
+
+  static Vertex from_gp0(uint32_t p_pos, uint32_t p_color) {
+    return Vertex{Position::from_gp0(p_pos),
+                  Color::from_gp0(p_color), 0, 0, 0, 0, 0, 0};
+  }
+
+  // Texture coordinates from the low half of a GP0 texture word
+  void set_uv(uint32_t p_val) {
+    this->u = uint8_t(p_val);
+    this->v = uint8_t(p_val >> 8);
+  }
+};
+
+static_assert(sizeof(Vertex) == 16, "Vertex must stay packed");
+
+// Visible part of VRAM, derived from the GP1 display registers
+struct DisplayArea {
+  // Top-left corner in VRAM
+  uint16_t x;
+  uint16_t y;
+  // Size of the output picture in pixels
+  uint16_t width;
+  uint16_t height;
+  // 24bit output: VRAM holds packed RGB888 from byte x * 2 on
+  bool depth24;
+};
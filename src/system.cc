@@ -0,0 +1,184 @@
+#include "system.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+System::System(Bios *p_bios, Renderer *p_renderer)
+    : bios(p_bios), gpu(&this->commands, p_renderer),
+      inter(p_bios, &this->ram, &this->dma, &this->gpu,
+            &this->cdrom, &this->spu),
+      cpu(&this->inter) {
+    this->frames = 0;
+    this->rewind = nullptr;
+    this->run_ahead = 0;
+    this->hidden_client = this->gpu.vram.dirty.acquire_client();
+    this->perf = nullptr;
+    this->frame_opcodes = 0;
+}
+
+void System::set_perf(Perf *p_perf) {
+    this->perf = p_perf;
+    this->gpu.perf = p_perf;
+    this->inter.perf = p_perf;
+    this->gpu.renderer->perf = p_perf;
+}
+
+bool System::emulate_frame() {
+    while (!this->gpu.frame_done) {
+        if (this->inter.watch.halted)
+            return false;
+        this->cpu.run();
+    }
+    this->gpu.frame_done = false;
+    this->frames += 1;
+    return true;
+}
+
+void System::show_frame() {
+    // Watchpoints must see the real execution only
+    if (this->run_ahead == 0 || this->inter.watch.armed()) {
+        this->gpu.present();
+        return;
+    }
+
+    {
+        PerfScope scope(this->perf, PerfSection::State);
+        this->save_state(this->ahead_state);
+    }
+    // The frames ahead are heard when they're really emulated.
+    // Samples not handed out yet aren't state, keep them aside.
+    AudioSink *audio = this->inter.audio;
+    this->inter.audio = nullptr;
+    int16_t pending[SPU::OUT_FRAMES * 2];
+    uint32_t pending_frames = this->spu.out_frames;
+    memcpy(pending, this->spu.out, sizeof(pending));
+
+    // Only the last frame is drawn. The ones before it would
+    // only matter to games drawing over their previous frame.
+    VRam &vram = this->gpu.vram;
+    Renderer *renderer = this->gpu.renderer;
+    bool shown = true;
+    for (uint32_t i = 0; i < this->run_ahead && shown; i++) {
+        bool last = i + 1 == this->run_ahead;
+        if (i == 0 && !last) {
+            this->gpu.renderer = &this->hidden;
+            vram.dirty.clear_all(this->hidden_client);
+        }
+        if (i != 0 && last) {
+            // Hand the renderer what the hidden frames wrote,
+            // minus their drawing, and the texture pages they
+            // decoded
+            VRam::TileSet written;
+            vram.dirty.for_each_dirty(
+                this->hidden_client,
+                [&](uint32_t p_tile) { written.set(p_tile); });
+            this->gpu.renderer = renderer;
+            this->gpu.refresh_renderer(written);
+            vram.dirty.mark_all();
+        }
+        shown = this->emulate_frame();
+    }
+    this->gpu.renderer = renderer;
+    if (shown)
+        this->gpu.present();
+
+    PerfScope scope(this->perf, PerfSection::State);
+    this->load_state(this->ahead_state);
+    this->inter.audio = audio;
+    memcpy(this->spu.out, pending, sizeof(pending));
+    this->spu.out_frames = pending_frames;
+}
+
+void System::end_frame() {
+    // Before the capture, the state must hold it
+    uint64_t opcodes =
+        this->cpu.opcode_count - this->frame_opcodes;
+    this->frame_opcodes = this->cpu.opcode_count;
+
+    if (this->rewind) {
+        PerfScope scope(this->perf, PerfSection::State);
+        this->rewind->capture(*this);
+    }
+
+    if (this->perf) {
+        this->perf->count(PerfCounter::Instructions, opcodes);
+        this->perf->end_frame();
+    }
+}
+
+bool System::run_frame() {
+    if (!this->emulate_frame())
+        return false;
+    this->show_frame();
+    this->end_frame();
+    return true;
+}
+
+void System::run_until(uint64_t p_cycle) {
+    Scheduler &scheduler = this->inter.scheduler;
+
+    while (scheduler.now < p_cycle && !this->inter.watch.halted) {
+        // Stop on the exact cycle, ending a slice early is
+        // harmless
+        scheduler.slice_end =
+            std::min(scheduler.slice_end, p_cycle);
+        this->cpu.run();
+        if (this->gpu.frame_done) {
+            this->gpu.frame_done = false;
+            this->frames += 1;
+            this->show_frame();
+            this->end_frame();
+        }
+    }
+}
+
+size_t System::state_size() {
+    StateSizer sizer;
+    sizer.size = sizeof(StateHeader);
+    this->serialize(sizer);
+    return sizer.size;
+}
+
+void System::save_state(SaveState &p_state) {
+    this->gpu.sync_vram(this->gpu.vram.stale);
+
+    size_t size = this->state_size();
+    p_state.data.resize(size);
+
+    StateHeader header;
+    memcpy(header.magic, StateHeader::MAGIC,
+           sizeof(header.magic));
+    header.version = STATE_VERSION;
+    header.size = uint32_t(size);
+    memcpy(p_state.data.data(), &header, sizeof(header));
+
+    StateWriter writer{p_state.data.data() + sizeof(header)};
+    this->serialize(writer);
+}
+
+void System::load_state(const SaveState &p_state) {
+    StateHeader header;
+    if (p_state.data.size() < sizeof(header))
+        throw std::runtime_error("Save state too short");
+    memcpy(&header, p_state.data.data(), sizeof(header));
+
+    if (memcmp(header.magic, StateHeader::MAGIC,
+               sizeof(header.magic)) != 0)
+        throw std::runtime_error("Not a save state");
+    if (header.version != STATE_VERSION)
+        throw std::runtime_error(
+            "Save state version " +
+            std::to_string(header.version) + ", expected " +
+            std::to_string(STATE_VERSION));
+    if (header.size != p_state.data.size() ||
+        header.size != this->state_size())
+        throw std::runtime_error("Save state size mismatch");
+
+    const uint8_t *body = p_state.data.data() + sizeof(header);
+    StateChecker checker{body};
+    this->serialize(checker);
+
+    StateReader reader{body};
+    this->serialize(reader);
+}
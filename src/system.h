@@ -0,0 +1,110 @@
+#pragma once
+#include "bios.h"
+#include "cdrom.h"
+#include "commandbuffer.h"
+#include "cpu.h"
+#include "dma.h"
+#include "gpu.h"
+#include "interconnect.h"
+#include "null_renderer.h"
+#include "perf.h"
+#include "ram.h"
+#include "renderer.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "spu.h"
+#include <cstdint>
+
+/// One emulated console: every device and the wiring between
+/// them. Instances share nothing mutable, so a process can run
+/// any number of them, e.g. one per ThreadPool job. The BIOS
+/// image is read only and can be loaded once for all of them.
+///
+/// Big (the RAM and VRAM live inline), allocate it with new.
+struct System {
+    // Shared, owned by the caller
+    Bios *bios;
+    // Devices, in construction order
+    RAM ram;
+    Dma dma;
+    CommmandBuffer commands;
+    GPU gpu;
+    Cdrom cdrom;
+    SPU spu;
+    Interconnect inter;
+    CPU cpu;
+
+    // Presented frames
+    uint64_t frames;
+    // Captures the machine after every frame when set, owned by
+    // the caller
+    Rewind *rewind;
+    // Frames emulated ahead of the real one to show, hiding the
+    // input lag built into games. Each frame the machine is
+    // saved, run that far (only drawing the last frame) with the
+    // current input, and restored. 0 shows the real frames.
+    uint32_t run_ahead;
+
+    System(Bios *p_bios, Renderer *p_renderer);
+    ~System() = default;
+
+    System(const System &) = delete;
+    System &operator=(const System &) = delete;
+
+    // Hand the optional timing collector to every device, nullptr
+    // detaches it. Owned by the caller.
+    void set_perf(Perf *p_perf);
+
+    // Emulate up to the next vertical blanking and present the
+    // frame (or the run_ahead one). Returns false, without a
+    // frame, if a watchpoint halted the CPU.
+    bool run_frame();
+    // Emulate until the CPU clock reaches p_cycle, presenting the
+    // frames met on the way. Stops early if a watchpoint halts
+    // the CPU.
+    void run_until(uint64_t p_cycle);
+
+    // Bytes taken by a save state of the machine
+    size_t state_size();
+    // Capture the whole machine between two frames (or run_until
+    // calls). Renderer-only VRAM contents are read back first.
+    void save_state(SaveState &p_state);
+    // Restore a state from save_state. Throws std::runtime_error,
+    // leaving the machine untouched, if it comes from another
+    // version or is damaged.
+    void load_state(const SaveState &p_state);
+
+    // Save state fields of every device, see SaveState
+    template <class V> void serialize(V &p_v) {
+        p_v.section("SYS ");
+        p_v.value(this->frames);
+        p_v.value(this->frame_opcodes);
+        this->cpu.serialize(p_v);
+        this->ram.serialize(p_v);
+        this->dma.serialize(p_v);
+        this->commands.serialize(p_v);
+        this->gpu.serialize(p_v);
+        this->cdrom.serialize(p_v);
+        this->spu.serialize(p_v);
+        this->inter.serialize(p_v);
+    }
+
+  private:
+    Perf *perf;
+    // Instruction count at the end of the last frame
+    uint64_t frame_opcodes;
+    // The real frame while running ahead
+    SaveState ahead_state;
+    // Takes the primitives of the run-ahead frames not shown
+    NullRenderer hidden;
+    // VRAM written by those frames
+    uint8_t hidden_client;
+
+    // Run to the next vertical blanking, false if halted
+    bool emulate_frame();
+    // Present the finished frame, or the one run_ahead frames
+    // later
+    void show_frame();
+    // Bookkeeping of a real frame: rewind capture, perf frame
+    void end_frame();
+};
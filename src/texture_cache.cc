@@ -0,0 +1,172 @@
+#include "texture_cache.h"
+#include <cstring>
+
+// Depth field of a texture page attribute, the reserved value 3
+// behaves like 15 bits
+static uint32_t depth_of(uint16_t p_texpage) {
+    uint32_t depth = (p_texpage >> 7) & 3;
+    return depth > 2 ? 2 : depth;
+}
+
+// Top-left corner of the page in VRAM
+static uint32_t page_x(uint16_t p_texpage) {
+    return (p_texpage & 0xf) * 64;
+}
+static uint32_t page_y(uint16_t p_texpage) {
+    return ((p_texpage >> 4) & 1) * 256;
+}
+
+// CLUT position: x in 16 pixel steps, y in lines
+static uint32_t clut_x(uint16_t p_clut) {
+    return (p_clut & 0x3f) * 16;
+}
+static uint32_t clut_y(uint16_t p_clut) {
+    return (p_clut >> 6) & 0x1ff;
+}
+
+TextureCache::TextureCache(VRam *p_vram) {
+    this->vram = p_vram;
+    this->client = p_vram->dirty.acquire_client();
+    this->clock = 0;
+    this->last_slot = 0;
+    this->entries = new Entry[SLOTS];
+    for (uint32_t i = 0; i < SLOTS; i++) {
+        this->entries[i].valid = false;
+        this->entries[i].last_use = 0;
+    }
+}
+
+TextureCache::~TextureCache() { delete[] this->entries; }
+
+VRam::TileSet TextureCache::footprint(uint16_t p_texpage,
+                                      uint16_t p_clut) {
+    uint32_t depth = depth_of(p_texpage);
+
+    // A page row is 64, 128 or 256 VRAM pixels wide
+    VRam::TileSet tiles =
+        VRam::tiles_of(page_x(p_texpage), page_y(p_texpage),
+                       64 << depth, PAGE_SIZE);
+    if (depth < 2)
+        tiles |= VRam::tiles_of(clut_x(p_clut), clut_y(p_clut),
+                                depth == 0 ? 16 : 256, 1);
+    return tiles;
+}
+
+void TextureCache::invalidate() {
+    bool dropped = false;
+
+    this->vram->dirty.for_each_dirty(
+        this->client, [&](uint32_t p_tile) {
+            if (!this->used[p_tile])
+                return;
+            for (uint32_t i = 0; i < SLOTS; i++) {
+                Entry &e = this->entries[i];
+                if (e.valid && e.tiles[p_tile]) {
+                    e.valid = false;
+                    dropped = true;
+                }
+            }
+        });
+    this->vram->dirty.clear_all(this->client);
+
+    if (!dropped)
+        return;
+    this->used.reset();
+    for (uint32_t i = 0; i < SLOTS; i++)
+        if (this->entries[i].valid)
+            this->used |= this->entries[i].tiles;
+}
+
+uint32_t TextureCache::lookup(uint16_t p_texpage, uint16_t p_clut,
+                              bool &p_miss) {
+    this->invalidate();
+    this->clock += 1;
+
+    // The semi-transparency and texture disable bits don't change
+    // the texels, and 15bit pages ignore the CLUT
+    uint32_t depth = depth_of(p_texpage);
+    uint16_t texpage = uint16_t((p_texpage & 0x1f) | depth << 7);
+    uint16_t clut = depth == 2 ? 0 : uint16_t(p_clut & 0x7fff);
+
+    Entry *last = &this->entries[this->last_slot];
+    if (last->valid && last->texpage == texpage &&
+        last->clut == clut) {
+        last->last_use = this->clock;
+        p_miss = false;
+        return this->last_slot;
+    }
+
+    // Hit anywhere else, or the least recently used victim
+    uint32_t victim = 0;
+    for (uint32_t i = 0; i < SLOTS; i++) {
+        Entry &e = this->entries[i];
+        if (e.valid && e.texpage == texpage && e.clut == clut) {
+            e.last_use = this->clock;
+            this->last_slot = i;
+            p_miss = false;
+            return i;
+        }
+
+        const Entry &v = this->entries[victim];
+        if (v.valid && (!e.valid || e.last_use < v.last_use))
+            victim = i;
+    }
+
+    Entry &e = this->entries[victim];
+    e.texpage = texpage;
+    e.clut = clut;
+    e.valid = true;
+    e.last_use = this->clock;
+    e.tiles = footprint(texpage, clut);
+    this->used |= e.tiles;
+    this->last_slot = victim;
+    p_miss = true;
+    return victim;
+}
+
+void TextureCache::decode(uint32_t p_slot) {
+    Entry &e = this->entries[p_slot];
+    const VRam &vram = *this->vram;
+    uint32_t x = page_x(e.texpage);
+    uint32_t y = page_y(e.texpage);
+    uint32_t depth = depth_of(e.texpage);
+    uint16_t *out = e.texels;
+
+    if (depth == 2) {
+        for (uint32_t v = 0; v < PAGE_SIZE; v++) {
+            // Pages starting past x = 768 wrap around
+            if (x + PAGE_SIZE <= VRam::WIDTH) {
+                memcpy(out, vram.data + VRam::index(x, y + v),
+                       PAGE_SIZE * sizeof(uint16_t));
+            } else {
+                for (uint32_t u = 0; u < PAGE_SIZE; u++)
+                    out[u] = vram.load(x + u, y + v);
+            }
+            out += PAGE_SIZE;
+        }
+        return;
+    }
+
+    // Fetch the palette once, the texels then index it directly
+    uint16_t palette[256];
+    uint32_t colors = depth == 0 ? 16 : 256;
+    uint32_t cx = clut_x(e.clut);
+    uint32_t cy = clut_y(e.clut);
+    for (uint32_t i = 0; i < colors; i++)
+        palette[i] = vram.load(cx + i, cy);
+
+    // 4 or 2 indices per VRAM pixel
+    uint32_t per_pixel = depth == 0 ? 4 : 2;
+    uint32_t bits = 16 / per_pixel;
+    uint16_t index_mask = uint16_t(colors - 1);
+
+    for (uint32_t v = 0; v < PAGE_SIZE; v++) {
+        for (uint32_t i = 0; i < PAGE_SIZE / per_pixel; i++) {
+            uint16_t indices = vram.load(x + i, y + v);
+            for (uint32_t k = 0; k < per_pixel; k++) {
+                *out++ = palette[indices & index_mask];
+                indices >>= bits;
+            }
+        }
+    }
+}
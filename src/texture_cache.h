@@ -0,0 +1,67 @@
+#pragma once
+#include "vram.h"
+#include <cstdint>
+
+/// Texture pages decoded to 256x256 16bit texels, one entry per
+/// (texture page, depth, CLUT) combination in use.
+///
+/// 4bpp and 8bpp pages hold indices into a CLUT, expanding them
+/// once lets repeated draws from the same page skip the palette
+/// lookups entirely. An entry stays valid until VRAM under the
+/// page or its CLUT is written (image loads, fills, copies,
+/// draws), which the cache learns from its own VRam::dirty
+/// client.
+struct TextureCache {
+    // Entries resident at once, renderers keep one texture layer
+    // per slot
+    static constexpr uint32_t SLOTS = 64;
+    static constexpr uint32_t PAGE_SIZE = 256;
+
+    struct Entry {
+        // Texture page attribute reduced to the base and depth
+        uint16_t texpage;
+        // CLUT attribute, 0 for 15bit pages
+        uint16_t clut;
+        bool valid;
+        // Lookup count at the last use, the oldest entry is
+        // evicted first
+        uint64_t last_use;
+        // VRAM tiles the texels are decoded from
+        VRam::TileSet tiles;
+        // Final 1555 texel values, row after row
+        uint16_t texels[PAGE_SIZE * PAGE_SIZE];
+    };
+
+    TextureCache(VRam *p_vram);
+    ~TextureCache();
+
+    // Slot holding the page for a texture page and CLUT
+    // attribute pair. On a miss a slot is claimed and p_miss set:
+    // the caller brings the entry's tiles up to date, then calls
+    // decode().
+    uint32_t lookup(uint16_t p_texpage, uint16_t p_clut,
+                    bool &p_miss);
+    // Expand the VRAM contents of a claimed slot
+    void decode(uint32_t p_slot);
+
+    const Entry &entry(uint32_t p_slot) const {
+        return this->entries[p_slot];
+    }
+
+    // VRAM tiles read by a page, CLUT included
+    static VRam::TileSet footprint(uint16_t p_texpage,
+                                   uint16_t p_clut);
+
+  private:
+    // Drop the entries overlapping VRAM written since last time
+    void invalidate();
+
+    VRam *vram;
+    uint8_t client;
+    uint64_t clock;
+    // Slot of the previous hit, usually the next one too
+    uint32_t last_slot;
+    // Union of the tiles of the valid entries
+    VRam::TileSet used;
+    Entry *entries;
+};
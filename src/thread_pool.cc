@@ -0,0 +1,64 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t p_threads) {
+    this->running = 0;
+    this->stopping = false;
+
+    if (p_threads == 0)
+        p_threads =
+            std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 0; i < p_threads; i++)
+        this->threads.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (std::thread &t : this->threads)
+        t.join();
+}
+
+void ThreadPool::submit(std::function<void()> p_job) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->jobs.push_back(std::move(p_job));
+    }
+    this->wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->idle.wait(lock, [this] {
+        return this->jobs.empty() && this->running == 0;
+    });
+}
+
+void ThreadPool::worker() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    for (;;) {
+        this->wake.wait(lock, [this] {
+            return this->stopping || !this->jobs.empty();
+        });
+        // Queued jobs still run on shutdown
+        if (this->jobs.empty())
+            return;
+
+        std::function<void()> job =
+            std::move(this->jobs.front());
+        this->jobs.pop_front();
+        this->running += 1;
+
+        lock.unlock();
+        job();
+        lock.lock();
+
+        this->running -= 1;
+        if (this->jobs.empty() && this->running == 0)
+            this->idle.notify_all();
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of worker threads running queued jobs in submission
+/// order, typically one emulator session (a System and its
+/// frontend objects) per job.
+struct ThreadPool {
+    // 0 uses one thread per hardware thread
+    ThreadPool(uint32_t p_threads);
+    // Finishes the queued jobs first
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    uint32_t size() const {
+        return uint32_t(this->threads.size());
+    }
+
+    void submit(std::function<void()> p_job);
+    // Block until every submitted job has returned
+    void wait();
+
+  private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    // New job or shutdown
+    std::condition_variable wake;
+    // Queue drained and no job running
+    std::condition_variable idle;
+    uint32_t running;
+    bool stopping;
+
+    void worker();
+};
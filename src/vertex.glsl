@@ -2,13 +2,28 @@
 
 layout(location = 0) in ivec2 vertex_position;
 layout(location = 1) in uvec3 vertex_color;
+layout(location = 2) in uvec2 vertex_uv;
+layout(location = 3) in uint vertex_texpage;
+layout(location = 4) in uint vertex_clut;
+layout(location = 5) in uint vertex_flags;
+layout(location = 6) in uint vertex_page;
+
+// GP0(E5) drawing offset
+uniform ivec2 draw_offset;
 
 out vec3 color;
+out vec2 uv;
+flat out uint flags;
+flat out uint page;
 
 void main() {
-    float xpos = ((vertex_position.x) / 320.0) - 1;
-     
-    float ypos = 1 - (float(vertex_position.y) / 240.0);
+    ivec2 position = vertex_position + draw_offset;
+
+    // Map VRAM coordinates [0;1023]x[0;511] to [-1;1], VRAM line 0
+    // ends up in the first row of the VRAM texture
+    float xpos = (float(position.x) / 512.0) - 1.0;
+
+    float ypos = (float(position.y) / 256.0) - 1.0;
 
     gl_Position = vec4(xpos, ypos, 0.0, 1.0);
 
@@ -16,4 +31,8 @@ void main() {
     color = vec3(float(vertex_color.r) / 255.0,
                  float(vertex_color.g) / 255.0,
                  float(vertex_color.b) / 255.0);
+
+    uv = vec2(vertex_uv);
+    flags = vertex_flags;
+    page = vertex_page;
 }
@@ -0,0 +1,91 @@
+#include "vram.h"
+#include <cstring>
+
+VRam::VRam() { memset(this->data, 0, sizeof(this->data)); }
+
+void VRam::mark_rect(uint32_t p_x, uint32_t p_y, uint32_t p_width,
+                     uint32_t p_height) {
+    for_each_tile(
+        p_x, p_y, p_width, p_height,
+        [this](uint32_t p_tile) { this->dirty.mark(p_tile); });
+}
+
+void VRam::mark_drawn(uint32_t p_x, uint32_t p_y,
+                      uint32_t p_width, uint32_t p_height) {
+    for_each_tile(p_x, p_y, p_width, p_height,
+                  [this](uint32_t p_tile) {
+                      this->dirty.mark(p_tile);
+                      this->stale.set(p_tile);
+                  });
+}
+
+VRam::TileSet VRam::tiles_of(uint32_t p_x, uint32_t p_y,
+                             uint32_t p_width,
+                             uint32_t p_height) {
+    TileSet tiles;
+    for_each_tile(p_x, p_y, p_width, p_height,
+                  [&](uint32_t p_tile) { tiles.set(p_tile); });
+    return tiles;
+}
+
+void VRam::write_span(uint32_t p_x, uint32_t p_y,
+                      const uint8_t *p_src, uint32_t p_count,
+                      uint16_t p_set_mask, bool p_check_mask) {
+    uint16_t *dst = this->data + index(p_x, p_y);
+
+    // Common case: straight row copy
+    if (p_set_mask == 0 && !p_check_mask) {
+        memcpy(dst, p_src, p_count * sizeof(uint16_t));
+        return;
+    }
+
+    for (uint32_t i = 0; i < p_count; i++) {
+        uint16_t pixel;
+        memcpy(&pixel, p_src + i * sizeof(pixel), sizeof(pixel));
+        if (p_check_mask && (dst[i] & 0x8000) != 0)
+            continue;
+        dst[i] = pixel | p_set_mask;
+    }
+}
+
+void VRam::read_span(uint32_t p_x, uint32_t p_y, uint8_t *p_dst,
+                     uint32_t p_count) const {
+    memcpy(p_dst, this->data + index(p_x, p_y),
+           p_count * sizeof(uint16_t));
+}
+
+void VRam::copy_rect(uint32_t p_src_x, uint32_t p_src_y,
+                     uint32_t p_dst_x, uint32_t p_dst_y,
+                     uint32_t p_width, uint32_t p_height,
+                     uint16_t p_set_mask, bool p_check_mask) {
+    // Rows go through a bounce buffer so that overlapping and
+    // wrapping rectangles copy like the hardware, one line after
+    // the other
+    uint16_t row[WIDTH];
+
+    for (uint32_t y = 0; y < p_height; y++) {
+        uint32_t sy = p_src_y + y;
+        uint32_t dy = p_dst_y + y;
+
+        for (uint32_t x = 0; x < p_width;) {
+            uint32_t sx = (p_src_x + x) % WIDTH;
+            uint32_t n = p_width - x;
+            if (n > WIDTH - sx)
+                n = WIDTH - sx;
+            this->read_span(sx, sy, (uint8_t *)(row + x), n);
+            x += n;
+        }
+
+        for (uint32_t x = 0; x < p_width;) {
+            uint32_t dx = (p_dst_x + x) % WIDTH;
+            uint32_t n = p_width - x;
+            if (n > WIDTH - dx)
+                n = WIDTH - dx;
+            this->write_span(dx, dy, (const uint8_t *)(row + x),
+                             n, p_set_mask, p_check_mask);
+            x += n;
+        }
+    }
+
+    this->mark_rect(p_dst_x, p_dst_y, p_width, p_height);
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "dirty.h"
+#include <bitset>
+#include <cstdint>
+
+/// 1MB of GPU video memory, addressed as 1024x512 16bit pixels
+struct VRam {
+    static constexpr uint32_t WIDTH = 1024;
+    static constexpr uint32_t HEIGHT = 512;
+
+    // Write tracking granularity: 64x16 pixel tiles. Short
+    // enough that a CLUT row below a 240 or 480 line framebuffer
+    // doesn't share its tiles.
+    static constexpr uint32_t TILE_SHIFT_X = 6;
+    static constexpr uint32_t TILE_SHIFT_Y = 4;
+    static constexpr uint32_t TILES_X = WIDTH >> TILE_SHIFT_X;
+    static constexpr uint32_t TILES_Y = HEIGHT >> TILE_SHIFT_Y;
+    static constexpr uint32_t TILE_COUNT = TILES_X * TILES_Y;
+
+    uint16_t data[WIDTH * HEIGHT];
+
+    using TileSet = std::bitset<TILE_COUNT>;
+
+    // Tiles written since each client last cleared them
+    DirtyMap<TILE_COUNT> dirty;
+    // Tiles the renderer drew to since data was last read back
+    // from it: their pixels in data are out of date
+    TileSet stale;
+
+    VRam();
+    ~VRam() = default;
+
+    // Coordinates wrap around like on the real hardware
+    uint16_t load(uint32_t p_x, uint32_t p_y) const {
+        return this->data[index(p_x, p_y)];
+    }
+    // Raw pixel write, the caller marks the covered area dirty
+    void store(uint32_t p_x, uint32_t p_y, uint16_t p_val) {
+        this->data[index(p_x, p_y)] = p_val;
+    }
+
+    // Mask bit handling shared by every write path: p_set_mask is
+    // ORed into each pixel (0 or 0x8000), and pixels already
+    // carrying the mask bit are skipped when p_check_mask is set
+    //
+    // Write p_count pixels from p_src (little endian halfwords,
+    // any alignment) at (p_x, p_y). The span must not cross the
+    // right edge of VRAM.
+    void write_span(uint32_t p_x, uint32_t p_y,
+                    const uint8_t *p_src, uint32_t p_count,
+                    uint16_t p_set_mask, bool p_check_mask);
+    // Copy p_count pixels at (p_x, p_y) to p_dst, same layout
+    // and constraints as write_span
+    void read_span(uint32_t p_x, uint32_t p_y, uint8_t *p_dst,
+                   uint32_t p_count) const;
+    // VRAM to VRAM copy, both rectangles wrap around
+    void copy_rect(uint32_t p_src_x, uint32_t p_src_y,
+                   uint32_t p_dst_x, uint32_t p_dst_y,
+                   uint32_t p_width, uint32_t p_height,
+                   uint16_t p_set_mask, bool p_check_mask);
+
+    // Flag every tile touched by the (wrapping) rectangle
+    void mark_rect(uint32_t p_x, uint32_t p_y, uint32_t p_width,
+                   uint32_t p_height);
+    // Same for a rectangle only drawn by the renderer, which also
+    // leaves its tiles stale
+    void mark_drawn(uint32_t p_x, uint32_t p_y, uint32_t p_width,
+                    uint32_t p_height);
+    // Tiles touched by the (wrapping) rectangle
+    static TileSet tiles_of(uint32_t p_x, uint32_t p_y,
+                            uint32_t p_width, uint32_t p_height);
+
+    // Call p_fn(x, y, width, height) for each of the (up to four)
+    // pieces of a rectangle wrapping around the VRAM edges
+    template <class F>
+    static void split_rect(uint32_t p_x, uint32_t p_y,
+                           uint32_t p_width, uint32_t p_height,
+                           F &&p_fn) {
+        p_x %= WIDTH;
+        p_y %= HEIGHT;
+        uint32_t w0 =
+            p_width < WIDTH - p_x ? p_width : WIDTH - p_x;
+        uint32_t h0 =
+            p_height < HEIGHT - p_y ? p_height : HEIGHT - p_y;
+        uint32_t w1 = p_width - w0;
+        uint32_t h1 = p_height - h0;
+
+        p_fn(p_x, p_y, w0, h0);
+        if (w1 != 0)
+            p_fn(0, p_y, w1, h0);
+        if (h1 != 0)
+            p_fn(p_x, 0, w0, h1);
+        if (w1 != 0 && h1 != 0)
+            p_fn(0, 0, w1, h1);
+    }
+
+    static uint32_t index(uint32_t p_x, uint32_t p_y) {
+        return (p_y % HEIGHT) * WIDTH + (p_x % WIDTH);
+    }
+
+    static uint32_t tile_index(uint32_t p_tx, uint32_t p_ty) {
+        return p_ty * TILES_X + p_tx;
+    }
+
+    // Call p_fn(tile) for each tile of a (wrapping) rectangle
+    template <class F>
+    static void for_each_tile(uint32_t p_x, uint32_t p_y,
+                              uint32_t p_width, uint32_t p_height,
+                              F &&p_fn) {
+        if (p_width == 0 || p_height == 0)
+            return;
+
+        // Number of tiles covered on each axis, capped to the
+        // full surface when the rectangle wraps all the way
+        // around
+        uint32_t x0 = (p_x % WIDTH) >> TILE_SHIFT_X;
+        uint32_t y0 = (p_y % HEIGHT) >> TILE_SHIFT_Y;
+        uint32_t x1 =
+            ((p_x % WIDTH) + p_width - 1) >> TILE_SHIFT_X;
+        uint32_t y1 =
+            ((p_y % HEIGHT) + p_height - 1) >> TILE_SHIFT_Y;
+
+        uint32_t nx = x1 - x0 + 1;
+        uint32_t ny = y1 - y0 + 1;
+        if (nx > TILES_X)
+            nx = TILES_X;
+        if (ny > TILES_Y)
+            ny = TILES_Y;
+
+        for (uint32_t j = 0; j < ny; j++) {
+            uint32_t ty = (y0 + j) % TILES_Y;
+            for (uint32_t i = 0; i < nx; i++)
+                p_fn(tile_index((x0 + i) % TILES_X, ty));
+        }
+    }
+};
@@ -0,0 +1,46 @@
+#include "watchpoint.h"
+
+Watchpoints::Watchpoints() {
+    this->hit_count = 0;
+    this->pc = nullptr;
+    this->halted = false;
+    this->halt_addr = NO_ADDR;
+    this->resume_addr = NO_ADDR;
+}
+
+bool Watchpoints::covers(WatchAccess p_access, uint32_t p_start,
+                         uint32_t p_length) const {
+    for (const Watchpoint &w : this->points) {
+        if (w.matches(p_access, p_start, p_length))
+            return true;
+    }
+    return false;
+}
+
+bool Watchpoints::check(WatchAccess p_access, uint32_t p_addr,
+                        uint32_t p_value, uint32_t p_size) {
+    bool halt = false;
+
+    for (const Watchpoint &w : this->points) {
+        if (!w.matches(p_access, p_addr, p_size))
+            continue;
+
+        WatchHit &hit = this->hits[this->hit_count % HIT_RING_LEN];
+        hit.pc = p_access == WatchAccess::Exec || !this->pc
+                     ? p_addr
+                     : *this->pc;
+        hit.addr = p_addr;
+        hit.value = p_value;
+        hit.size = (uint8_t)p_size;
+        hit.access = p_access;
+        this->hit_count += 1;
+
+        halt |= w.halt;
+    }
+    return halt;
+}
+
+const WatchHit &Watchpoints::recent(uint32_t p_index) const {
+    return this->hits[(this->hit_count - 1 - p_index) %
+                      HIT_RING_LEN];
+}
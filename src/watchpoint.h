@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/// Access types a watchpoint can trigger on (bit mask)
+enum class WatchAccess : uint8_t {
+    Read = 1 << 0,
+    Write = 1 << 1,
+    /// Instruction fetch, i.e. a PC breakpoint
+    Exec = 1 << 2,
+};
+
+struct Watchpoint {
+    // Physical address range [start, start + length)
+    uint32_t start;
+    uint32_t length;
+    // Mask of WatchAccess bits
+    uint8_t access;
+    // Stop the CPU on hit instead of only recording it
+    bool halt;
+
+    bool matches(WatchAccess p_access, uint32_t p_addr,
+                 uint32_t p_size) const {
+        return (this->access & (uint8_t)p_access) != 0 &&
+               p_addr < this->start + this->length &&
+               p_addr + p_size > this->start;
+    }
+};
+
+struct WatchHit {
+    // Instruction performing the access
+    uint32_t pc;
+    // Physical address accessed
+    uint32_t addr;
+    // Value loaded, stored or fetched
+    uint32_t value;
+    uint8_t size;
+    WatchAccess access;
+};
+
+struct Watchpoints {
+    static constexpr uint32_t HIT_RING_LEN = 256;
+    static constexpr uint32_t NO_ADDR = 0xffffffff;
+
+    std::vector<Watchpoint> points;
+
+    // Last HIT_RING_LEN hits, oldest entries get overwritten
+    WatchHit hits[HIT_RING_LEN];
+    // Total number of hits, next slot is hit_count % HIT_RING_LEN
+    uint64_t hit_count;
+
+    // Address of the instruction being executed, provided by the
+    // CPU so that data hits can be attributed
+    const uint32_t *pc;
+
+    // CPU stopped by a halting watchpoint
+    bool halted;
+    // Fetch address the CPU stopped on, skipped once on resume so
+    // that execution can step past its own breakpoint
+    uint32_t halt_addr;
+    uint32_t resume_addr;
+
+    Watchpoints();
+    ~Watchpoints() = default;
+
+    bool armed() const { return !this->points.empty(); }
+
+    // True if an armed point of type p_access overlaps the page
+    bool covers(WatchAccess p_access, uint32_t p_start,
+                uint32_t p_length) const;
+
+    // Record every point hit by the access. Returns true when one
+    // of them asks for the CPU to halt.
+    bool check(WatchAccess p_access, uint32_t p_addr,
+               uint32_t p_value, uint32_t p_size);
+
+    // Hit `p_index` places back from the most recent one
+    const WatchHit &recent(uint32_t p_index) const;
+};
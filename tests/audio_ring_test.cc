@@ -0,0 +1,104 @@
+// AudioRing: frames come out in order across the wrap around,
+// a full ring takes only what fits, an empty one gives only what
+// it has, and a producer and a consumer thread agree on every
+// frame.
+#include "audio_ring.h"
+#include "check.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static constexpr uint32_t FRAMES = AudioRing::FRAMES;
+
+// p_frames stereo frames numbered from p_first, the left sample
+// the low half of the number and the right one the high half
+static std::vector<int16_t> frames_from(uint32_t p_first,
+                                        uint32_t p_frames) {
+    std::vector<int16_t> out(size_t(p_frames) * 2);
+    for (uint32_t i = 0; i < p_frames; i++) {
+        out[i * 2] = int16_t(p_first + i);
+        out[i * 2 + 1] = int16_t((p_first + i) >> 16);
+    }
+    return out;
+}
+
+static bool numbered_from(const int16_t *p_samples,
+                          uint32_t p_first, uint32_t p_frames) {
+    std::vector<int16_t> expected =
+        frames_from(p_first, p_frames);
+    return memcmp(p_samples, expected.data(),
+                  expected.size() * 2) == 0;
+}
+
+int main() {
+    AudioRing ring;
+    std::vector<int16_t> out(FRAMES * 2);
+
+    CHECK(ring.size() == 0);
+    CHECK(ring.pop(out.data(), 10) == 0);
+
+    // Fill up to 100 before the end and drain, then wrap around
+    std::vector<int16_t> in = frames_from(0, FRAMES - 100);
+    CHECK(ring.push(in.data(), FRAMES - 100) == FRAMES - 100);
+    CHECK(ring.size() == FRAMES - 100);
+    CHECK(ring.pop(out.data(), FRAMES) == FRAMES - 100);
+    CHECK(numbered_from(out.data(), 0, FRAMES - 100));
+    CHECK(ring.size() == 0);
+
+    in = frames_from(1000, 300);
+    CHECK(ring.push(in.data(), 300) == 300);
+    CHECK(ring.size() == 300);
+    // Both pops straddle the end of the buffer
+    CHECK(ring.pop(out.data(), 150) == 150);
+    CHECK(numbered_from(out.data(), 1000, 150));
+    CHECK(ring.pop(out.data(), 1000) == 150);
+    CHECK(numbered_from(out.data(), 1150, 150));
+
+    // A full ring takes what fits and nothing more
+    in = frames_from(5000, FRAMES + 50);
+    CHECK(ring.push(in.data(), FRAMES + 50) == FRAMES);
+    CHECK(ring.size() == FRAMES);
+    CHECK(ring.push(in.data(), 1) == 0);
+    CHECK(ring.pop(out.data(), 10) == 10);
+    CHECK(numbered_from(out.data(), 5000, 10));
+    in = frames_from(5000 + FRAMES, 50);
+    CHECK(ring.push(in.data(), 50) == 10);
+    CHECK(ring.pop(out.data(), FRAMES) == FRAMES);
+    CHECK(numbered_from(out.data(), 5010, FRAMES));
+    CHECK(ring.size() == 0);
+
+    // Uneven blocks from two threads, neither waiting for the
+    // other: every frame once, in order
+    static constexpr uint32_t TOTAL = 1 << 21;
+    std::thread producer([&] {
+        std::vector<int16_t> block;
+        uint32_t sent = 0;
+        uint32_t size = 1;
+        while (sent < TOTAL) {
+            size = size * 7 % 997 + 1;
+            uint32_t n = std::min(size, TOTAL - sent);
+            block = frames_from(sent, n);
+            sent += ring.push(block.data(), n);
+            std::this_thread::yield();
+        }
+    });
+    uint32_t received = 0;
+    uint32_t size = 1;
+    bool in_order = true;
+    while (received < TOTAL) {
+        size = size * 5 % 1499 + 1;
+        uint32_t n = ring.pop(out.data(), size);
+        in_order =
+            in_order && numbered_from(out.data(), received, n);
+        received += n;
+        std::this_thread::yield();
+    }
+    producer.join();
+    CHECK(in_order);
+    CHECK(received == TOTAL);
+    CHECK(ring.size() == 0);
+
+    return test_result();
+}
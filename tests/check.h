@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal checks for the unit tests, one executable per test
+// file run by ctest. A failed CHECK prints where and carries on,
+// the test then exits with a failure from test_result().
+
+inline int test_failures = 0;
+
+#define CHECK(cond)                                                \
+    do {                                                           \
+        if (!(cond)) {                                             \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__,          \
+                   __LINE__, #cond);                               \
+            test_failures++;                                       \
+        }                                                          \
+    } while (0)
+
+// Evaluating expr must throw type
+#define CHECK_THROWS(expr, type)                                   \
+    do {                                                           \
+        bool thrown = false;                                       \
+        try {                                                      \
+            (void)(expr);                                          \
+        } catch (const type &) {                                   \
+            thrown = true;                                         \
+        }                                                          \
+        if (!thrown) {                                             \
+            printf("%s:%d: %s didn't throw %s\n", __FILE__,        \
+                   __LINE__, #expr, #type);                        \
+            test_failures++;                                       \
+        }                                                          \
+    } while (0)
+
+// Exit code of the test
+inline int test_result() {
+    if (test_failures != 0)
+        printf("%d checks failed\n", test_failures);
+    return test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
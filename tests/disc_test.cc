@@ -0,0 +1,134 @@
+// CUE sheets: tracks laid out from their INDEX 00/01 times, a
+// pregap stored in the BIN (INDEX 00) read from it, one that
+// isn't (PREGAP) read as zeros, and bad sheets refused.
+#include "check.h"
+#include "disc.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Every byte of sector p_index of file p_file
+static uint8_t fill_byte(uint32_t p_file, uint32_t p_index) {
+    return uint8_t(p_file * 0x80 + p_index % 0x7f + 1);
+}
+
+static void write_bin(const fs::path &p_path, uint32_t p_file,
+                      uint32_t p_sectors) {
+    std::vector<uint8_t> data(size_t(p_sectors) *
+                              Disc::SECTOR_SIZE);
+    for (uint32_t i = 0; i < p_sectors; i++)
+        memset(data.data() + size_t(i) * Disc::SECTOR_SIZE,
+               fill_byte(p_file, i), Disc::SECTOR_SIZE);
+    FILE *f = fopen(p_path.string().c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+static void write_text(const fs::path &p_path,
+                       const char *p_text) {
+    FILE *f = fopen(p_path.string().c_str(), "w");
+    fputs(p_text, f);
+    fclose(f);
+}
+
+// Sector p_lba holds p_byte all over
+static bool sector_is(const Disc &p_disc, uint32_t p_lba,
+                      uint8_t p_byte) {
+    uint8_t scratch[Disc::SECTOR_SIZE];
+    std::span<const uint8_t> s = p_disc.sector(p_lba, scratch);
+    if (s.size() != Disc::SECTOR_SIZE)
+        return false;
+    for (uint8_t b : s)
+        if (b != p_byte)
+            return false;
+    return true;
+}
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / "psx_disc_test";
+    fs::create_directories(dir);
+
+    // a.bin: track 1 (100 sectors), then track 2 with a 30
+    // sector pregap stored before its 50 sectors. b.bin: track
+    // 3, 40 sectors after a 2 second pregap that isn't stored.
+    write_bin(dir / "a.bin", 0, 180);
+    write_bin(dir / "b.bin", 1, 40);
+    write_text(dir / "disc.cue",
+               "FILE \"a.bin\" BINARY\n"
+               "  TRACK 01 MODE2/2352\n"
+               "    INDEX 01 00:00:00\n"
+               "  TRACK 02 AUDIO\n"
+               "    INDEX 00 00:01:25\n"
+               "    INDEX 01 00:01:55\n"
+               "FILE \"b.bin\" BINARY\n"
+               "  TRACK 03 AUDIO\n"
+               "    PREGAP 00:02:00\n"
+               "    INDEX 01 00:00:00\n");
+
+    Disc disc((dir / "disc.cue").string().c_str());
+    CHECK(disc.tracks.size() == 3);
+    if (disc.tracks.size() == 3) {
+        const DiscTrack &t1 = disc.tracks[0];
+        CHECK(t1.number == 1 && t1.type == TrackType::Mode2);
+        CHECK(t1.pregap == 0 && t1.start == 0 && t1.end == 100);
+
+        const DiscTrack &t2 = disc.tracks[1];
+        CHECK(t2.number == 2 && t2.type == TrackType::Audio);
+        CHECK(t2.pregap == 100 && t2.stored == 100);
+        CHECK(t2.start == 130 && t2.end == 180);
+
+        const DiscTrack &t3 = disc.tracks[2];
+        CHECK(t3.number == 3 && t3.type == TrackType::Audio);
+        CHECK(t3.pregap == 180 && t3.stored == 330);
+        CHECK(t3.start == 330 && t3.end == 370);
+    }
+    CHECK(disc.sectors() == 370);
+
+    CHECK(disc.track_at(99) == &disc.tracks[0]);
+    CHECK(disc.track_at(100) == &disc.tracks[1]);
+    CHECK(disc.track_at(369) == &disc.tracks[2]);
+    CHECK(disc.track_at(370) == nullptr);
+
+    CHECK(sector_is(disc, 0, fill_byte(0, 0)));
+    CHECK(sector_is(disc, 99, fill_byte(0, 99)));
+    // Stored pregap, then the track proper
+    CHECK(sector_is(disc, 100, fill_byte(0, 100)));
+    CHECK(sector_is(disc, 130, fill_byte(0, 130)));
+    CHECK(sector_is(disc, 179, fill_byte(0, 179)));
+    // Pregap missing from b.bin: audio silence
+    CHECK(sector_is(disc, 180, 0));
+    CHECK(sector_is(disc, 329, 0));
+    CHECK(sector_is(disc, 330, fill_byte(1, 0)));
+    CHECK(sector_is(disc, 369, fill_byte(1, 39)));
+    uint8_t scratch[Disc::SECTOR_SIZE];
+    CHECK(disc.sector(370, scratch).empty());
+
+    // Bad sheets
+    write_text(dir / "no_index.cue", "FILE \"a.bin\" BINARY\n"
+                                     "  TRACK 01 MODE2/2352\n");
+    CHECK_THROWS(Disc((dir / "no_index.cue").string().c_str()),
+                 std::runtime_error);
+    write_text(dir / "bad_time.cue", "FILE \"a.bin\" BINARY\n"
+                                     "  TRACK 01 MODE2/2352\n"
+                                     "    INDEX 01 00:00:75\n");
+    CHECK_THROWS(Disc((dir / "bad_time.cue").string().c_str()),
+                 std::runtime_error);
+    write_text(dir / "past_end.cue", "FILE \"b.bin\" BINARY\n"
+                                     "  TRACK 01 AUDIO\n"
+                                     "    INDEX 01 00:01:00\n");
+    CHECK_THROWS(Disc((dir / "past_end.cue").string().c_str()),
+                 std::runtime_error);
+    write_text(dir / "missing.cue", "FILE \"none.bin\" BINARY\n"
+                                    "  TRACK 01 AUDIO\n"
+                                    "    INDEX 01 00:00:00\n");
+    CHECK_THROWS(Disc((dir / "missing.cue").string().c_str()),
+                 std::runtime_error);
+
+    fs::remove_all(dir);
+    return test_result();
+}
@@ -0,0 +1,198 @@
+// Compressed disc images: a disc packed by write_hunk_image()
+// reads back sector for sector with the same track table, in
+// order, backwards and after prefetch(), and damaged images are
+// refused.
+#include "check.h"
+#include "disc.h"
+#include "hunk_image.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/// xorshift32, the same sequence on every run
+struct Random {
+    uint32_t state = 0x9e3779b9;
+
+    uint8_t next() {
+        this->state ^= this->state << 13;
+        this->state ^= this->state >> 17;
+        this->state ^= this->state << 5;
+        return uint8_t(this->state);
+    }
+};
+
+static void write_file(const fs::path &p_path,
+                       const std::vector<uint8_t> &p_data) {
+    FILE *f = fopen(p_path.string().c_str(), "wb");
+    fwrite(p_data.data(), 1, p_data.size(), f);
+    fclose(f);
+}
+
+static std::vector<uint8_t> read_file(const fs::path &p_path) {
+    std::vector<uint8_t> data(fs::file_size(p_path));
+    FILE *f = fopen(p_path.string().c_str(), "rb");
+    size_t n = fread(data.data(), 1, data.size(), f);
+    fclose(f);
+    data.resize(n);
+    return data;
+}
+
+// p_sectors of p_stride bytes: runs of one byte that compress
+// well, alternating with noise that doesn't
+static std::vector<uint8_t> make_track(uint32_t p_sectors,
+                                       uint32_t p_stride,
+                                       Random &p_random) {
+    std::vector<uint8_t> data(size_t(p_sectors) * p_stride);
+    for (uint32_t i = 0; i < p_sectors; i++) {
+        uint8_t *s = data.data() + size_t(i) * p_stride;
+        if (i / 5 % 2 == 0) {
+            memset(s, i, p_stride);
+        } else {
+            for (uint32_t j = 0; j < p_stride; j++)
+                s[j] = p_random.next();
+        }
+    }
+    return data;
+}
+
+static bool same_sector(const Disc &p_a, const Disc &p_b,
+                        uint32_t p_lba) {
+    uint8_t a_scratch[Disc::SECTOR_SIZE];
+    uint8_t b_scratch[Disc::SECTOR_SIZE];
+    std::span<const uint8_t> a = p_a.sector(p_lba, a_scratch);
+    std::span<const uint8_t> b = p_b.sector(p_lba, b_scratch);
+    return a.size() == Disc::SECTOR_SIZE &&
+           b.size() == Disc::SECTOR_SIZE &&
+           memcmp(a.data(), b.data(), Disc::SECTOR_SIZE) == 0;
+}
+
+static void open_image(std::span<const uint8_t> p_file) {
+    HunkImage image(p_file);
+}
+
+// p_image with p_size bytes of p_byte at p_at, opened as a
+// HunkImage
+static void open_damaged(std::vector<uint8_t> p_image,
+                         size_t p_at, uint8_t p_byte,
+                         size_t p_size) {
+    memset(p_image.data() + p_at, p_byte, p_size);
+    open_image(p_image);
+}
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / "psx_hunk_test";
+    fs::create_directories(dir);
+
+    // A 2048 byte data track (headers rebuilt on read) and an
+    // audio track behind an unstored pregap: 203 sectors, the
+    // last hunk short
+    Random random;
+    write_file(dir / "data.bin", make_track(120, 2048, random));
+    write_file(dir / "audio.bin",
+               make_track(8, Disc::SECTOR_SIZE, random));
+    FILE *f = fopen((dir / "disc.cue").string().c_str(), "w");
+    fputs("FILE \"data.bin\" BINARY\n"
+          "  TRACK 01 MODE1/2048\n"
+          "    INDEX 01 00:00:00\n"
+          "FILE \"audio.bin\" BINARY\n"
+          "  TRACK 02 AUDIO\n"
+          "    PREGAP 00:01:00\n"
+          "    INDEX 01 00:00:00\n",
+          f);
+    fclose(f);
+
+    Disc source((dir / "disc.cue").string().c_str());
+    CHECK(source.sectors() == 203);
+    fs::path packed = dir / "disc.cdz";
+    {
+        ThreadPool pool(4);
+        write_hunk_image(source, packed.string().c_str(), pool);
+    }
+    CHECK(fs::file_size(packed) <
+          size_t(source.sectors()) * Disc::SECTOR_SIZE);
+
+    Disc disc(packed.string().c_str());
+    CHECK(disc.sectors() == source.sectors());
+    CHECK(disc.tracks.size() == source.tracks.size());
+    for (size_t i = 0;
+         i < disc.tracks.size() && i < source.tracks.size();
+         i++) {
+        const DiscTrack &a = disc.tracks[i];
+        const DiscTrack &b = source.tracks[i];
+        CHECK(a.number == b.number && a.type == b.type);
+        CHECK(a.pregap == b.pregap && a.start == b.start &&
+              a.end == b.end);
+    }
+    bool same = true;
+    for (uint32_t lba = 0; lba < source.sectors(); lba++)
+        same = same && same_sector(disc, source, lba);
+    CHECK(same);
+    same = true;
+    for (uint32_t lba = source.sectors(); lba-- > 0;)
+        same = same && same_sector(disc, source, lba);
+    CHECK(same);
+    uint8_t scratch[Disc::SECTOR_SIZE];
+    CHECK(disc.sector(source.sectors(), scratch).empty());
+
+    // Straight through HunkImage, reading ahead of the cache
+    std::vector<uint8_t> file = read_file(packed);
+    {
+        HunkImage image(file);
+        CHECK(image.header().sectors == source.sectors());
+        CHECK(image.header().hunk_sectors ==
+              HunkImage::HUNK_SECTORS);
+        same = true;
+        for (uint32_t lba = 0; lba < source.sectors(); lba++) {
+            if (lba % 16 == 0)
+                image.prefetch(lba, 64);
+            uint8_t sector[Disc::SECTOR_SIZE];
+            image.read(lba, sector);
+            std::span<const uint8_t> s =
+                source.sector(lba, scratch);
+            same = same && memcmp(sector, s.data(),
+                                  Disc::SECTOR_SIZE) == 0;
+        }
+        CHECK(same);
+    }
+
+    // Damaged images
+    size_t tracks_at = sizeof(HunkHeader);
+    size_t index_at =
+        tracks_at + source.tracks.size() * sizeof(HunkTrack);
+    CHECK_THROWS(open_damaged(file, 0, 'X', 1),
+                 std::runtime_error);
+    CHECK_THROWS(open_damaged(file, offsetof(HunkHeader, version),
+                              0x7f, 1),
+                 std::runtime_error);
+    CHECK_THROWS(open_damaged(file,
+                              offsetof(HunkHeader, hunk_sectors),
+                              0, 4),
+                 std::runtime_error);
+    // Track 1 no longer starting at LBA 0
+    CHECK_THROWS(open_damaged(file,
+                              tracks_at +
+                                  offsetof(HunkTrack, pregap),
+                              1, 1),
+                 std::runtime_error);
+    // A hunk past the end of the file
+    CHECK_THROWS(open_damaged(file, index_at + 8 + 7, 0x7f, 1),
+                 std::runtime_error);
+    CHECK_THROWS(open_image({file.data(), index_at}),
+                 std::runtime_error);
+    CHECK_THROWS(open_image({file.data(), 10}),
+                 std::runtime_error);
+    write_file(dir / "garbage.cdz",
+               make_track(4, Disc::SECTOR_SIZE, random));
+    CHECK_THROWS(Disc((dir / "garbage.cdz").string().c_str()),
+                 std::runtime_error);
+
+    fs::remove_all(dir);
+    return test_result();
+}
@@ -0,0 +1,117 @@
+// lz_compress/lz_decompress: every kind of input comes back
+// byte for byte within lz_bound(), and bad input is refused
+// without writing out of bounds.
+#include "check.h"
+#include "lz.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Deterministic xorshift, the tests don't depend on the host
+struct Random {
+    uint32_t state = 0x12345678;
+
+    uint32_t next() {
+        this->state ^= this->state << 13;
+        this->state ^= this->state >> 17;
+        this->state ^= this->state << 5;
+        return this->state;
+    }
+};
+
+static std::vector<uint8_t>
+compress(const std::vector<uint8_t> &p_data) {
+    std::vector<uint8_t> packed(lz_bound(p_data.size()));
+    size_t size = lz_compress(p_data.data(), p_data.size(),
+                              packed.data());
+    CHECK(size <= packed.size());
+    packed.resize(size);
+    return packed;
+}
+
+static void round_trip(const std::vector<uint8_t> &p_data) {
+    std::vector<uint8_t> packed = compress(p_data);
+    std::vector<uint8_t> out(p_data.size());
+    CHECK(lz_decompress(packed.data(), packed.size(), out.data(),
+                        out.size()));
+    CHECK(out == p_data);
+}
+
+int main() {
+    Random random;
+
+    // Sizes around the minimum match and the token limits
+    for (size_t size = 0; size < 300; size++) {
+        std::vector<uint8_t> zeros(size, 0);
+        round_trip(zeros);
+        std::vector<uint8_t> noise(size);
+        for (uint8_t &b : noise)
+            b = uint8_t(random.next());
+        round_trip(noise);
+    }
+
+    // Long runs: match lengths over many extra bytes, offset 1
+    std::vector<uint8_t> zeros(1 << 20, 0);
+    round_trip(zeros);
+    CHECK(compress(zeros).size() < zeros.size() / 200);
+
+    // Incompressible: long literal runs, within the bound
+    std::vector<uint8_t> noise(1 << 18);
+    for (uint8_t &b : noise)
+        b = uint8_t(random.next());
+    round_trip(noise);
+
+    // Repeats at every distance, some past the 64KB window
+    std::vector<uint8_t> mixed;
+    std::vector<uint8_t> block(4096);
+    for (uint8_t &b : block)
+        b = uint8_t(random.next());
+    while (mixed.size() < (1 << 19)) {
+        uint32_t kind = random.next() % 4;
+        uint32_t len = 1 + random.next() % 600;
+        if (kind == 0) {
+            for (uint32_t i = 0; i < len; i++)
+                mixed.push_back(uint8_t(random.next()));
+        } else if (kind == 1) {
+            uint8_t b = uint8_t(random.next());
+            mixed.insert(mixed.end(), len, b);
+        } else if (kind == 2 && mixed.size() > len) {
+            size_t from = random.next() % (mixed.size() - len);
+            for (uint32_t i = 0; i < len; i++)
+                mixed.push_back(mixed[from + i]);
+        } else {
+            size_t from = random.next() % (block.size() - 64);
+            mixed.insert(mixed.end(), block.begin() + from,
+                         block.begin() + from + 64);
+        }
+    }
+    round_trip(mixed);
+
+    // Bad input
+    std::vector<uint8_t> packed = compress(mixed);
+    std::vector<uint8_t> out(mixed.size() + 64, 0xaa);
+    // Output too small
+    CHECK(!lz_decompress(packed.data(), packed.size(), out.data(),
+                         mixed.size() - 1));
+    for (size_t i = mixed.size() - 1; i < out.size(); i++)
+        CHECK(out[i] == 0xaa);
+    // Cut short
+    CHECK(!lz_decompress(packed.data(), packed.size() / 2,
+                         out.data(), mixed.size()));
+    // A match before the start of the output
+    const uint8_t far_match[] = {0x10, 'a', 0x05, 0x00};
+    CHECK(!lz_decompress(far_match, sizeof(far_match), out.data(),
+                         16));
+    // Garbage is either refused or stays in bounds
+    for (uint32_t i = 0; i < 1000; i++) {
+        std::vector<uint8_t> garbage(1 + random.next() % 64);
+        for (uint8_t &b : garbage)
+            b = uint8_t(random.next());
+        std::fill(out.begin(), out.end(), 0xaa);
+        lz_decompress(garbage.data(), garbage.size(), out.data(),
+                      256);
+        CHECK(out[256] == 0xaa);
+    }
+
+    return test_result();
+}
@@ -0,0 +1,102 @@
+// Rewind: stepping back through the history gives back the exact
+// state of every frame captured, across keyframes, after running
+// forward again from a rewound frame, and with run-ahead.
+//
+//   rewind_test BIOS
+#include "bios.h"
+#include "check.h"
+#include "null_renderer.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "system.h"
+#include <cstdint>
+#include <vector>
+
+// FNV-1a of the machine's save state
+static uint64_t state_hash(System &p_system) {
+    static SaveState state;
+    p_system.save_state(state);
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint8_t b : state.data)
+        hash = (hash ^ b) * 0x100000001b3;
+    return hash;
+}
+
+// Run p_frames, adding the hash of each to p_hashes
+static void record(System &p_system, uint32_t p_frames,
+                   std::vector<uint64_t> &p_hashes) {
+    for (uint32_t i = 0; i < p_frames; i++) {
+        p_system.run_frame();
+        p_hashes.push_back(state_hash(p_system));
+    }
+}
+
+// Step back p_steps frames, checking each against p_hashes
+static bool unwind(System &p_system, Rewind &p_rewind,
+                   uint32_t p_steps,
+                   std::vector<uint64_t> &p_hashes) {
+    bool same = true;
+    for (uint32_t i = 0; i < p_steps; i++) {
+        if (!p_rewind.step_back(p_system))
+            return false;
+        p_hashes.pop_back();
+        same = same && state_hash(p_system) == p_hashes.back();
+    }
+    return same;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: rewind_test BIOS\n");
+        return EXIT_FAILURE;
+    }
+    Bios bios(argv[1]);
+    NullRenderer renderer;
+
+    // Just before the boot logo, which writes VRAM from frame 83
+    // on
+    System *a = new System(&bios, &renderer);
+    for (uint32_t i = 0; i < 75; i++)
+        a->run_frame();
+    // Keyframes every 8 captures, the history spans several
+    Rewind rewind(64 << 20, 8);
+    a->rewind = &rewind;
+    std::vector<uint64_t> hashes;
+    record(*a, 40, hashes);
+    CHECK(rewind.snapshots() == 40);
+
+    CHECK(unwind(*a, rewind, 13, hashes));
+    // Forward again: the same frames, captured from the rewound
+    // state
+    std::vector<uint64_t> again = hashes;
+    record(*a, 10, again);
+    CHECK(unwind(*a, rewind, 10, again));
+    CHECK(again == hashes);
+    CHECK(unwind(*a, rewind, 26, hashes));
+    CHECK(rewind.snapshots() == 1);
+    CHECK(!rewind.step_back(*a));
+    delete a;
+
+    // Run-ahead reloads the machine every frame
+    System *b = new System(&bios, &renderer);
+    for (uint32_t i = 0; i < 80; i++)
+        b->run_frame();
+    Rewind ahead(64 << 20, 8);
+    b->rewind = &ahead;
+    b->run_ahead = 2;
+    hashes.clear();
+    record(*b, 20, hashes);
+    CHECK(unwind(*b, ahead, 19, hashes));
+    delete b;
+
+    // A small cap drops whole keyframe groups, oldest first
+    System *c = new System(&bios, &renderer);
+    Rewind small(1, 8);
+    c->rewind = &small;
+    for (uint32_t i = 0; i < 20; i++)
+        c->run_frame();
+    CHECK(small.snapshots() == 4);
+    delete c;
+
+    return test_result();
+}
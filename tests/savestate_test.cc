@@ -0,0 +1,90 @@
+// Save states: a state written, saved to a file and loaded into
+// another machine reproduces the machine exactly, and states from
+// another version or damaged ones are turned down without
+// touching it.
+//
+//   savestate_test BIOS
+#include "bios.h"
+#include "check.h"
+#include "null_renderer.h"
+#include "savestate.h"
+#include "system.h"
+#include <filesystem>
+#include <stdexcept>
+
+static void run_frames(System &p_system, uint32_t p_frames) {
+    for (uint32_t i = 0; i < p_frames; i++)
+        p_system.run_frame();
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: savestate_test BIOS\n");
+        return EXIT_FAILURE;
+    }
+    Bios bios(argv[1]);
+    NullRenderer renderer;
+    System *a = new System(&bios, &renderer);
+    System *b = new System(&bios, &renderer);
+
+    run_frames(*a, 30);
+    SaveState saved;
+    a->save_state(saved);
+
+    // Through a file
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "psx_savestate_test.state")
+                           .string();
+    saved.write_file(path.c_str());
+    SaveState read;
+    read.read_file(path.c_str());
+    std::filesystem::remove(path);
+    CHECK(read.data == saved.data);
+
+    // Loading and saving again gives the same bytes
+    b->load_state(read);
+    SaveState again;
+    b->save_state(again);
+    CHECK(again.data == saved.data);
+
+    // Both machines go on the same way
+    run_frames(*a, 10);
+    run_frames(*b, 10);
+    SaveState after_a;
+    SaveState after_b;
+    a->save_state(after_a);
+    b->save_state(after_b);
+    CHECK(after_a.data == after_b.data);
+
+    // Refused states leave the machine alone
+    StateHeader header;
+    SaveState other_version = saved;
+    memcpy(&header, other_version.data.data(), sizeof(header));
+    header.version = STATE_VERSION + 1;
+    memcpy(other_version.data.data(), &header, sizeof(header));
+    CHECK_THROWS(b->load_state(other_version),
+                 std::runtime_error);
+
+    SaveState damaged = saved;
+    damaged.data[sizeof(StateHeader)] ^= 0xff;
+    CHECK_THROWS(b->load_state(damaged), std::runtime_error);
+
+    SaveState truncated = saved;
+    truncated.data.resize(saved.data.size() - 1);
+    CHECK_THROWS(b->load_state(truncated), std::runtime_error);
+
+    SaveState not_a_state;
+    not_a_state.data.assign(64, 0);
+    CHECK_THROWS(b->load_state(not_a_state), std::runtime_error);
+
+    SaveState unchanged;
+    b->save_state(unchanged);
+    CHECK(unchanged.data == after_b.data);
+
+    CHECK_THROWS(read.read_file("/nonexistent/psx.state"),
+                 std::runtime_error);
+
+    delete b;
+    delete a;
+    return test_result();
+}